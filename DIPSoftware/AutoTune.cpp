@@ -0,0 +1,294 @@
+#include "AutoTune.h"
+#include "CpuDispatch.h"
+#include "ImageWriter.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+const char *KERNEL_NAMES[] = { "median", "gaussian", "rotate", "histogram" };
+const int BAND_CANDIDATES[] = { 4, 8, 16, 32, 64, 128, 256 };
+const int CALIBRATION_ROUNDS = 3;
+// Calibrating takes seconds; a lock this old was left behind by a crash.
+const int STALE_LOCK_SECONDS = 600;
+
+mutex paramsMutex;
+// The tuning file initFromEnvironment() could not load, empty when it
+// loaded one or tuning is off.
+string untunedFile;
+AutoTune::Params current[AutoTune::KERNEL_COUNT] = {
+	AutoTune::defaultParams(), AutoTune::defaultParams(), AutoTune::defaultParams(), AutoTune::defaultParams()
+};
+
+// Created exclusively next to the tuning file while a process calibrates.
+class TuningLock {
+public:
+	explicit TuningLock(const string& fileName) : path(fileName + ".lock") {
+		held = create() || (stale() && remove(path.c_str()) == 0 && create());
+	}
+	~TuningLock() {
+		if (held) {
+			remove(path.c_str());
+		}
+	}
+	TuningLock(const TuningLock&) = delete;
+	TuningLock& operator=(const TuningLock&) = delete;
+
+	string path;
+	bool held;
+
+private:
+	bool create() {
+#ifdef _WIN32
+		int fd = _open(path.c_str(), _O_CREAT | _O_EXCL | _O_WRONLY, _S_IREAD | _S_IWRITE);
+		return fd >= 0 && _close(fd) == 0;
+#else
+		int fd = open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+		return fd >= 0 && close(fd) == 0;
+#endif
+	}
+
+	bool stale() {
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 && time(nullptr) - st.st_mtime > STALE_LOCK_SECONDS;
+	}
+};
+
+int hardwareThreads() {
+	return max(1, (int) thread::hardware_concurrency());
+}
+
+// Powers of two up to the hardware thread count, plus the count itself.
+vector<int> threadCandidates() {
+	vector<int> res;
+	for (int n = 1; n < hardwareThreads(); n *= 2) {
+		res.push_back(n);
+	}
+	res.push_back(hardwareThreads());
+	return res;
+}
+
+void runKernel(AutoTune::Kernel kernel, const Mat& mat, Mat& res) {
+	switch (kernel) {
+	case AutoTune::KERNEL_MEDIAN:
+		Utils::medianFilterImageMat(mat, res, 5);
+		break;
+	case AutoTune::KERNEL_GAUSSIAN:
+		Utils::gaussianFilterImageMat(mat, res, 7, 1.5f);
+		break;
+	case AutoTune::KERNEL_ROTATE:
+		Utils::rotateImageMat(mat, res, 0.3f);
+		break;
+	default:
+		Utils::getHistogram3Channel(mat);
+		break;
+	}
+}
+
+// Best of a few runs, after a warm-up that also sizes res.
+double measure(AutoTune::Kernel kernel, const AutoTune::Params& params, const Mat& mat, Mat& res) {
+	AutoTune::setParams(kernel, params);
+	runKernel(kernel, mat, res);
+	double best = 1e30;
+	for (int i = 0; i < CALIBRATION_ROUNDS; ++i) {
+		int64_t begin = Trace::now();
+		runKernel(kernel, mat, res);
+		updateMin(best, (Trace::now() - begin) * 1e-6);
+	}
+	return best;
+}
+
+}
+
+AutoTune::Params AutoTune::defaultParams() {
+	return { hardwareThreads(), 32 };
+}
+
+AutoTune::Params AutoTune::params(Kernel kernel) {
+	lock_guard<mutex> lock(paramsMutex);
+	return current[kernel];
+}
+
+void AutoTune::setParams(Kernel kernel, const Params& value) {
+	lock_guard<mutex> lock(paramsMutex);
+	current[kernel] = { max(1, value.threads), max(1, value.bandRows) };
+}
+
+const char* AutoTune::kernelName(Kernel kernel) {
+	return betw(kernel, KERNEL_MEDIAN, KERNEL_COUNT) ? KERNEL_NAMES[kernel] : "unknown";
+}
+
+string AutoTune::defaultFileName() {
+#ifdef _WIN32
+	const char *dir = getenv("LOCALAPPDATA");
+	return dir ? string(dir) + "\\dipsoftware-tuning.cfg" : "dipsoftware-tuning.cfg";
+#else
+	const char *dir = getenv("HOME");
+	return dir ? string(dir) + "/.dipsoftware-tuning" : ".dipsoftware-tuning";
+#endif
+}
+
+// "cpu=<model>" followed by one "<kernel>=<threads>,<bandRows>" per line.
+bool AutoTune::load(const string& fileName) {
+	ifstream fin(fileName);
+	string line;
+	if (!getline(fin, line) || line != "cpu=" + CpuDispatch::cpuModel()) {
+		return false;
+	}
+	Params loaded[KERNEL_COUNT];
+	bool found[KERNEL_COUNT] = {};
+	while (getline(fin, line)) {
+		auto eq = line.find('=');
+		Params value;
+		if (eq == string::npos || sscanf(line.c_str() + eq + 1, "%d,%d", &value.threads, &value.bandRows) != 2) {
+			return false;
+		}
+		rep(k, (int) KERNEL_COUNT) {
+			if (line.compare(0, eq, KERNEL_NAMES[k]) == 0) {
+				loaded[k] = value;
+				found[k] = true;
+			}
+		}
+	}
+	rep(k, (int) KERNEL_COUNT) {
+		if (!found[k]) {
+			return false;
+		}
+	}
+	rep(k, (int) KERNEL_COUNT) {
+		setParams((Kernel) k, loaded[k]);
+	}
+	return true;
+}
+
+// Replaces the file atomically, so a process loading it at the same time
+// sees the old or the new tuning.
+bool AutoTune::save(const string& fileName) {
+	return ImageWriter::writeAtomically(fileName, [](FILE *fp) {
+		fprintf(fp, "cpu=%s\n", CpuDispatch::cpuModel().c_str());
+		rep(k, (int) KERNEL_COUNT) {
+			Params value = params((Kernel) k);
+			fprintf(fp, "%s=%d,%d\n", KERNEL_NAMES[k], value.threads, value.bandRows);
+		}
+		return !ferror(fp);
+	});
+}
+
+// The band height is chosen with every thread busy, then the thread count
+// with that band height; a full grid would take too long.
+void AutoTune::calibrate(FILE *log) {
+	TRACE_SCOPE("AutoTune::calibrate");
+	Mat mat(768, 1024, CV_8UC3), res;
+	randu(mat, Scalar::all(0), Scalar::all(256));
+
+	rep(k, (int) KERNEL_COUNT) {
+		Kernel kernel = (Kernel) k;
+		Params best = defaultParams();
+		double bestMs = 1e30;
+		for (int bandRows : BAND_CANDIDATES) {
+			Params candidate = { hardwareThreads(), bandRows };
+			double ms = measure(kernel, candidate, mat, res);
+			if (ms < bestMs) {
+				bestMs = ms;
+				best = candidate;
+			}
+		}
+		for (int threads : threadCandidates()) {
+			Params candidate = { threads, best.bandRows };
+			double ms = measure(kernel, candidate, mat, res);
+			// More threads have to win by 5%, while fewer threads are taken
+			// even when up to 2% slower, which leaves cores free for the
+			// rest of the application.
+			if (ms < bestMs * 0.95 || (threads < best.threads && ms < bestMs * 1.02)) {
+				bestMs = min(bestMs, ms);
+				best = candidate;
+			}
+		}
+		setParams(kernel, best);
+		if (log) {
+			fprintf(log, "%-12s %3d threads, %3d rows per band, %8.3f ms\n", KERNEL_NAMES[k], best.threads, best.bandRows, bestMs);
+		}
+	}
+}
+
+void AutoTune::printParams(FILE *fp) {
+	fprintf(fp, "%-12s %8s %10s\n", "kernel", "threads", "bandRows");
+	rep(k, (int) KERNEL_COUNT) {
+		Params value = params((Kernel) k);
+		fprintf(fp, "%-12s %8d %10d\n", KERNEL_NAMES[k], value.threads, value.bandRows);
+	}
+}
+
+bool AutoTune::calibrateAndSave(const string& fileName, FILE *log, string& error) {
+	TuningLock lock(fileName);
+	if (!lock.held) {
+		error = "another process is calibrating (" + lock.path + ")";
+		return false;
+	}
+	calibrate(log);
+	if (!save(fileName)) {
+		error = "cannot write tuning to " + fileName;
+		return false;
+	}
+	return true;
+}
+
+// Another process may have written the file since startup; if it is still
+// calibrating, the defaults are kept rather than calibrating alongside it.
+void AutoTune::calibrateIfUntuned() {
+	if (untunedFile.empty()) {
+		return;
+	}
+	string fileName = untunedFile;
+	untunedFile.clear();
+	TuningLock lock(fileName);
+	if (!lock.held) {
+		Utils::c_fprintf(COLOR_YELLOW, stderr, "another process is calibrating, using the default tuning\n");
+		return;
+	}
+	if (load(fileName)) {
+		Trace::setMetadata("tuning", fileName);
+		return;
+	}
+	Utils::c_fprintf(COLOR_YELLOW, stderr, "calibrating kernels for %s\n", CpuDispatch::cpuModel().c_str());
+	calibrate();
+	if (!save(fileName)) {
+		Utils::c_fprintf(COLOR_YELLOW, stderr, "cannot write tuning to %s\n", fileName.c_str());
+	}
+	Trace::setMetadata("tuning", "calibrated");
+}
+
+void AutoTune::initFromEnvironment() {
+	untunedFile.clear();
+	const char *env = getenv("DIP_TUNE");
+	if (env && string(env) == "off") {
+		Trace::setMetadata("tuning", "defaults");
+		return;
+	}
+	const char *fileEnv = getenv("DIP_TUNE_FILE");
+	string fileName = fileEnv && *fileEnv ? fileEnv : defaultFileName();
+	if (load(fileName)) {
+		Trace::setMetadata("tuning", fileName);
+		return;
+	}
+	untunedFile = fileName;
+	Trace::setMetadata("tuning", "defaults");
+}
\ No newline at end of file
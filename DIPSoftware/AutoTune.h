@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+// Band height and thread count for the kernels that Utils splits into
+// horizontal bands. The best values depend on the cache sizes and core count,
+// so they are measured on the machine by calibrate() and kept in a file keyed
+// by the CPU model. initFromEnvironment() only loads that file. The
+// long-lived entry points, the GUI and the daemon, then call
+// calibrateIfUntuned(), which calibrates when the file is missing or was
+// written on another CPU. Short-lived clients (workers, --submit, the C API)
+// keep the built-in defaults instead, since calibrating there would stall
+// every client and skew the numbers of workers started together.
+// DIP_TUNE_FILE=<file> overrides the default location, DIP_TUNE=off keeps
+// the built-in defaults and never calibrates.
+class AutoTune {
+public:
+	enum Kernel {
+		KERNEL_MEDIAN,
+		KERNEL_GAUSSIAN,
+		KERNEL_ROTATE,
+		KERNEL_HISTOGRAM,
+		KERNEL_COUNT
+	};
+
+	struct Params {
+		int threads, bandRows;
+	};
+
+	static void initFromEnvironment();
+
+	static Params params(Kernel kernel);
+	static void setParams(Kernel kernel, const Params& value);
+	static Params defaultParams();
+	static const char* kernelName(Kernel kernel);
+
+	static std::string defaultFileName();
+	static bool load(const std::string& fileName);
+	static bool save(const std::string& fileName);
+
+	// Times each kernel over candidate band heights and thread counts and
+	// keeps the fastest. Progress goes to log when it is not null.
+	static void calibrate(FILE *log = nullptr);
+	// Calibrates and saves while holding <fileName>.lock, so processes never
+	// calibrate against each other. On failure error says whether another
+	// process holds the lock or the save failed.
+	static bool calibrateAndSave(const std::string& fileName, FILE *log, std::string& error);
+	static void calibrateIfUntuned();
+	static void printParams(FILE *fp);
+};
\ No newline at end of file
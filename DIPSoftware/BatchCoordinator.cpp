@@ -0,0 +1,427 @@
+#include "BatchCoordinator.h"
+#include "ImageWriter.h"
+#include "KernelVerifier.h"
+#include "ResultCache.h"
+#include "SocketIO.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+const double SHARD_SECONDS = 2.0;
+const double RATE_SMOOTHING = 0.5;
+// A worker is taken for stuck once it is silent this many times longer than
+// its shard should take, and never before the floor, which also covers the
+// first shard, whose duration is unknown.
+const double SHARD_TIMEOUT_FACTOR = 10.0;
+const double MIN_SHARD_TIMEOUT_SECONDS = 120.0;
+// Local workers are started again this many times over when all are gone.
+const int RESPAWNS_PER_WORKER = 3;
+// How long the batch waits for a remote worker once the last one has left.
+const double WORKER_GRACE_SECONDS = 60.0;
+const int SUPERVISE_INTERVAL_MS = 1000;
+// Shard and result lines list image paths, so they may outgrow the default
+// line limit.
+const size_t MAX_MESSAGE_BYTES = 16 << 20;
+
+vector<string> splitFields(const string& line) {
+	vector<string> res;
+	string field;
+	istringstream in(line);
+	while (getline(in, field, '\t')) {
+		res.push_back(field);
+	}
+	return res;
+}
+
+string joinFields(const vector<string>& fields) {
+	string res;
+	for (const auto& field : fields) {
+		res += (res.size() ? "\t" : "") + field;
+	}
+	return res;
+}
+
+string workerName() {
+	char host[256] = "localhost";
+#ifndef _WIN32
+	gethostname(host, sizeof(host) - 1);
+	return string(host) + ":" + to_string(getpid());
+#else
+	return host;
+#endif
+}
+
+#ifndef _WIN32
+pid_t spawnWorker(const string& programPath, const string& address) {
+	vector<string> args = { programPath, "--worker", "--connect", address };
+	vector<char*> argv;
+	for (auto& arg : args) {
+		argv.push_back(&arg[0]);
+	}
+	argv.push_back(nullptr);
+	pid_t pid;
+	return posix_spawnp(&pid, programPath.c_str(), nullptr, nullptr, argv.data(), environ) ? -1 : pid;
+}
+#endif
+
+}
+
+BatchCoordinator::Options BatchCoordinator::defaultOptions() {
+	return { "127.0.0.1", 0, {}, ".", "", 4, 256, 3, 0, "" };
+}
+
+BatchCoordinator::BatchCoordinator(const Options& options, const vector<string>& images) : options(options), images(images), nextImage(0), outstanding(0), nextShardId(0), listenFd(-1), wakeRead(-1), wakeWrite(-1), liveWorkers(0), hadWorkers(false), report() {
+	string ops;
+	for (const auto& op : options.ops) {
+		ops += (ops.size() ? "," : "") + op;
+	}
+	opsField = ops.size() ? ops : "-";
+	report.images = (int) images.size();
+}
+
+bool BatchCoordinator::run(const Options& options, const vector<string>& images, Report& report) {
+	TRACE_SCOPE("BatchCoordinator::run");
+	BatchCoordinator coordinator(options, images);
+	coordinator.listenFd = SocketIO::listenTcp(options.host, options.port);
+	if (coordinator.listenFd < 0) {
+		Utils::c_fprintf(COLOR_RED, stderr, "cannot listen on %s:%d\n", options.host.c_str(), options.port);
+		return false;
+	}
+	if (!SocketIO::openWakePipe(coordinator.wakeRead, coordinator.wakeWrite)) {
+		SocketIO::close(coordinator.listenFd);
+		Utils::c_fprintf(COLOR_RED, stderr, "cannot create a pipe\n");
+		return false;
+	}
+	int port = SocketIO::boundPort(coordinator.listenFd);
+	printf("coordinating %d images on %s:%d\n", (int) images.size(), options.host.c_str(), port);
+	fflush(stdout);
+
+	auto begin = clock::now();
+	coordinator.idleSince = begin;
+#ifndef _WIN32
+	// Local workers reach a wildcard address through the loopback.
+	bool wildcard = options.host.empty() || options.host == "0.0.0.0" || options.host == "::";
+	string address = (wildcard ? string("127.0.0.1") : options.host) + ":" + to_string(port);
+	vector<pid_t> children, exited;
+	int respawnsLeft = options.localWorkers * RESPAWNS_PER_WORKER;
+	auto spawn = [&]() {
+		rep(i, options.localWorkers) {
+			pid_t pid = spawnWorker(options.programPath, address);
+			if (pid < 0) {
+				Utils::c_fprintf(COLOR_YELLOW, stderr, "cannot start a worker from %s\n", options.programPath.c_str());
+				break;
+			}
+			children.push_back(pid);
+		}
+	};
+	spawn();
+#endif
+
+	// Nothing wakes the loop when workers die, so it looks every second
+	// whether anyone is left to take the remaining shards.
+	auto supervise = [&]() {
+#ifndef _WIN32
+		for (auto it = children.begin(); it != children.end(); ) {
+			if (waitpid(*it, nullptr, WNOHANG) == *it) {
+				it = children.erase(it);
+			} else {
+				++it;
+			}
+		}
+		bool running = !children.empty();
+#else
+		bool running = false;
+#endif
+		lock_guard<mutex> lock(coordinator.mtx);
+		if (coordinator.finished() || coordinator.liveWorkers || running) {
+			return;
+		}
+		if (options.localWorkers) {
+#ifndef _WIN32
+			if (respawnsLeft > 0) {
+				Utils::c_fprintf(COLOR_YELLOW, stderr, "all workers are gone, starting %d more\n", options.localWorkers);
+				respawnsLeft -= options.localWorkers;
+				spawn();
+				return;
+			}
+#endif
+		} else if (!coordinator.hadWorkers || chrono::duration<double>(clock::now() - coordinator.idleSince).count() < WORKER_GRACE_SECONDS) {
+			return;
+		}
+		Utils::c_fprintf(COLOR_RED, stderr, "no workers left, giving up on the remaining images\n");
+		coordinator.failRemaining();
+	};
+
+	if (coordinator.finished()) {
+		SocketIO::wake(coordinator.wakeWrite);
+	}
+	vector<thread> connections;
+	while (true) {
+		int fd = SocketIO::accept(coordinator.listenFd, coordinator.wakeRead, SUPERVISE_INTERVAL_MS);
+		if (fd >= 0) {
+			connections.emplace_back(&BatchCoordinator::serve, &coordinator, fd);
+		} else if (errno == ETIMEDOUT) {
+			supervise();
+		} else if (errno != EINTR) {
+			break;
+		}
+	}
+	for (auto& connection : connections) {
+		connection.join();
+	}
+	SocketIO::close(coordinator.listenFd);
+	SocketIO::close(coordinator.wakeRead);
+	SocketIO::close(coordinator.wakeWrite);
+#ifndef _WIN32
+	for (pid_t pid : children) {
+		waitpid(pid, nullptr, 0);
+	}
+#endif
+
+	report = coordinator.report;
+	report.wallMs = chrono::duration<double, milli>(clock::now() - begin).count();
+	for (const auto& worker : coordinator.workers) {
+		report.workers.push_back(*worker);
+	}
+	return true;
+}
+
+void BatchCoordinator::serve(int fd) {
+	string line, buffer;
+	vector<string> fields;
+	SocketIO::setReadTimeout(fd, MIN_SHARD_TIMEOUT_SECONDS);
+	if (!SocketIO::readLine(fd, line, buffer, MAX_MESSAGE_BYTES) || (fields = splitFields(line)).size() != 2 || fields[0] != "ready") {
+		SocketIO::close(fd);
+		return;
+	}
+	WorkerStats *worker;
+	{
+		lock_guard<mutex> lock(mtx);
+		workers.emplace_back(new WorkerStats{ fields[1], 0, 0, 0, 0, 0 });
+		worker = workers.back().get();
+		++liveWorkers;
+		hadWorkers = true;
+	}
+
+	Shard shard;
+	double timeoutSeconds;
+	while (takeShard(*worker, shard, timeoutSeconds)) {
+		SocketIO::setReadTimeout(fd, timeoutSeconds);
+		vector<string> message = { "shard", to_string(shard.id), opsField, options.outDir, options.format.size() ? options.format : "-" };
+		message.insert(message.end(), shard.images.begin(), shard.images.end());
+		auto begin = clock::now();
+		if (!SocketIO::writeLine(fd, joinFields(message)) || !SocketIO::readLine(fd, line, buffer, MAX_MESSAGE_BYTES) ||
+			(fields = splitFields(line)).size() < 5 || fields[0] != "result" || fields[1] != message[1]) {
+			abandonShard(shard);
+			leave();
+			SocketIO::close(fd);
+			return;
+		}
+		double ms = chrono::duration<double, milli>(clock::now() - begin).count();
+		finishShard(*worker, fields, ms);
+	}
+	leave();
+	SocketIO::writeLine(fd, "done");
+	SocketIO::close(fd);
+}
+
+void BatchCoordinator::leave() {
+	lock_guard<mutex> lock(mtx);
+	if (!--liveWorkers) {
+		idleSince = clock::now();
+	}
+}
+
+// Retried shards go first. New shards are sized to the worker's throughput
+// and also capped to half of an even split of what is left, so the tail of
+// the batch stays spread over every worker instead of sitting in one big
+// shard. With nothing left to hand out but shards still out at other
+// workers, waits: one of them may fail and need a new home.
+bool BatchCoordinator::takeShard(const WorkerStats& worker, Shard& shard, double& timeoutSeconds) {
+	unique_lock<mutex> lock(mtx);
+	changed.wait(lock, [this]() { return finished() || !retries.empty() || nextImage < images.size(); });
+	int shardSize = worker.shards ? max(1, min(options.maxShardSize, (int) (worker.imagesPerSecond * SHARD_SECONDS + 0.5))) : options.firstShardSize;
+	if (!retries.empty()) {
+		shard = retries.front();
+		retries.pop_front();
+		++report.retries;
+	} else if (nextImage < images.size()) {
+		size_t left = images.size() - nextImage;
+		size_t count = min<size_t>(shardSize, max<size_t>(1, left / (2 * workers.size())));
+		shard = { nextShardId++, 0, vector<string>(images.begin() + nextImage, images.begin() + nextImage + count) };
+		nextImage += count;
+	} else {
+		return false;
+	}
+	++shard.attempts;
+	++outstanding;
+	double expectedSeconds = worker.shards && worker.imagesPerSecond > 0 ? shard.images.size() / worker.imagesPerSecond : 0;
+	timeoutSeconds = max(MIN_SHARD_TIMEOUT_SECONDS, SHARD_TIMEOUT_FACTOR * expectedSeconds);
+	return true;
+}
+
+void BatchCoordinator::finishShard(WorkerStats& worker, const vector<string>& fields, double ms) {
+	int processed = atoi(fields[2].c_str()), failed = atoi(fields[3].c_str());
+	double workerMs = max(1.0, atof(fields[4].c_str()));
+	lock_guard<mutex> lock(mtx);
+	++worker.shards;
+	worker.images += processed;
+	worker.failed += failed;
+	worker.busyMs += ms;
+	double rate = (processed + failed) * 1000.0 / workerMs;
+	worker.imagesPerSecond = worker.shards == 1 ? rate : RATE_SMOOTHING * rate + (1 - RATE_SMOOTHING) * worker.imagesPerSecond;
+
+	++report.shards;
+	report.failed += failed;
+	report.failedImages.insert(report.failedImages.end(), fields.begin() + 5, fields.end());
+	--outstanding;
+	if (finished()) {
+		SocketIO::wake(wakeWrite);
+	}
+	changed.notify_all();
+}
+
+// A failed shard comes back as two halves with fresh attempts, so an image
+// that kills workers is narrowed down to a shard of its own instead of
+// taking its whole shard with it. Only a single image runs out of attempts;
+// splits are bounded by the image count, so nothing cycles forever.
+void BatchCoordinator::abandonShard(const Shard& shard) {
+	lock_guard<mutex> lock(mtx);
+	--outstanding;
+	if (shard.images.size() > 1) {
+		auto middle = shard.images.begin() + shard.images.size() / 2;
+		retries.push_back({ nextShardId++, 0, vector<string>(shard.images.begin(), middle) });
+		retries.push_back({ nextShardId++, 0, vector<string>(middle, shard.images.end()) });
+	} else if (shard.attempts < options.maxAttempts) {
+		retries.push_back(shard);
+	} else {
+		report.failed += (int) shard.images.size();
+		report.failedImages.insert(report.failedImages.end(), shard.images.begin(), shard.images.end());
+	}
+	if (finished()) {
+		SocketIO::wake(wakeWrite);
+	}
+	changed.notify_all();
+}
+
+// Called with mtx held once no worker is left to take what remains.
+void BatchCoordinator::failRemaining() {
+	for (const auto& shard : retries) {
+		report.failed += (int) shard.images.size();
+		report.failedImages.insert(report.failedImages.end(), shard.images.begin(), shard.images.end());
+	}
+	retries.clear();
+	report.failed += (int) (images.size() - nextImage);
+	report.failedImages.insert(report.failedImages.end(), images.begin() + nextImage, images.end());
+	nextImage = images.size();
+	if (finished()) {
+		SocketIO::wake(wakeWrite);
+	}
+	changed.notify_all();
+}
+
+bool BatchCoordinator::finished() const {
+	return nextImage >= images.size() && retries.empty() && !outstanding;
+}
+
+void BatchCoordinator::printReport(const Report& report, FILE *fp) {
+	double seconds = report.wallMs / 1000;
+	fprintf(fp, "%d images, %d failed, %.2f s, %.2f images/s\n", report.images, report.failed, seconds, seconds > 0 ? report.images / seconds : 0.0);
+	fprintf(fp, "%d shards, %d retried\n", report.shards, report.retries);
+	fprintf(fp, "%-32s %8s %8s %8s %10s %10s\n", "worker", "shards", "images", "failed", "busy(s)", "images/s");
+	for (const auto& worker : report.workers) {
+		fprintf(fp, "%-32s %8d %8d %8d %10.2f %10.2f\n", worker.name.c_str(), worker.shards, worker.images, worker.failed, worker.busyMs / 1000, worker.imagesPerSecond);
+	}
+	for (const auto& image : report.failedImages) {
+		fprintf(fp, "failed: %s\n", image.c_str());
+	}
+}
+
+int BatchWorker::run(const string& host, int port) {
+	int fd = SocketIO::connectTcp(host, port);
+	if (fd < 0) {
+		Utils::c_fprintf(COLOR_RED, stderr, "cannot connect to %s:%d\n", host.c_str(), port);
+		return 1;
+	}
+	KernelVerifier verifier;
+	string line, buffer;
+	bool ok = SocketIO::writeLine(fd, joinFields({ "ready", workerName() }));
+	while (ok && SocketIO::readLine(fd, line, buffer, MAX_MESSAGE_BYTES)) {
+		vector<string> fields = splitFields(line);
+		if (fields.size() == 1 && fields[0] == "done") {
+			break;
+		}
+		if (fields.size() < 5 || fields[0] != "shard") {
+			ok = false;
+			break;
+		}
+
+		vector<string> ops;
+		istringstream opsList(fields[2] == "-" ? string() : fields[2]);
+		string op, unknown;
+		while (getline(opsList, op, ',')) {
+			ops.push_back(op);
+		}
+		vector<KernelVerifier::opFuncType> chain;
+		if (!verifier.buildChain(ops, chain, unknown)) {
+			Utils::c_fprintf(COLOR_RED, stderr, "unknown op %s\n", unknown.c_str());
+			SocketIO::close(fd);
+			return 2;
+		}
+
+		TRACE_SCOPE("BatchWorker::shard");
+		auto begin = chrono::steady_clock::now();
+		int processed = 0;
+		vector<string> failed;
+		for (size_t i = 5; i < fields.size(); ++i) {
+			const string& input = fields[i];
+			string name = input.substr(input.find_last_of("/\\") + 1);
+			if (fields[4] != "-") {
+				name = name.substr(0, name.find_last_of('.')) + "." + fields[4];
+			}
+			Mat mat = Utils::readImageMat(input);
+			bool written = false;
+			if (!mat.empty()) {
+				try {
+					mat = ResultCache::instance().apply(mat, fields[2], [&](Mat mat) {
+						for (const auto& f : chain) {
+							mat = f(mat);
+						}
+						return mat;
+					});
+					written = ImageWriter::write(fields[3] + "/" + name, mat);
+				} catch (const cv::Exception&) {
+				}
+			}
+			if (written) {
+				++processed;
+			} else {
+				failed.push_back(input);
+			}
+		}
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+		vector<string> result = { "result", fields[1], to_string(processed), to_string(failed.size()), to_string(ms) };
+		result.insert(result.end(), failed.begin(), failed.end());
+		ok = SocketIO::writeLine(fd, joinFields(result));
+	}
+	SocketIO::close(fd);
+	return ok ? 0 : 1;
+}
\ No newline at end of file
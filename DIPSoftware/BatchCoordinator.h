@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Spreads a batch over worker processes on this and other machines. Workers
+// connect over TCP and pull one shard (a run of images) at a time, so faster
+// workers naturally take more, and each worker's next shard is sized to
+// about SHARD_SECONDS of its measured throughput. A shard whose worker
+// disconnects, or stays silent far longer than the shard should take, is
+// handed out again in two halves, so an image that takes workers down ends
+// up alone; a single image is tried up to maxAttempts times. When the last
+// worker is gone, the local workers are started again a few times, after
+// which, or after a grace period without remote workers, the remaining
+// images are reported as failed. The coordinator listens on 127.0.0.1 unless
+// given another address for remote workers. One line per
+// message, fields separated by tabs:
+//   worker:      ready <name>
+//   coordinator: shard <id> <ops> <outDir> <format> <image>...   or   done
+//   worker:      result <id> <processed> <failed> <ms> [<failed image>...]
+// <ops> is a comma separated list of --bench operation names, or "-".
+class BatchCoordinator {
+public:
+	struct Options {
+		// Where workers connect; "0.0.0.0" accepts them from anywhere.
+		std::string host;
+		int port;
+		std::vector<std::string> ops;
+		std::string outDir, format;
+		int firstShardSize, maxShardSize, maxAttempts;
+		// Worker processes to start on this machine, running programPath.
+		int localWorkers;
+		std::string programPath;
+	};
+
+	struct WorkerStats {
+		std::string name;
+		int shards, images, failed;
+		double busyMs, imagesPerSecond;
+	};
+
+	struct Report {
+		int images, failed, shards, retries;
+		double wallMs;
+		std::vector<WorkerStats> workers;
+		std::vector<std::string> failedImages;
+	};
+
+	static Options defaultOptions();
+	// Blocks until every image is processed or given up on.
+	static bool run(const Options& options, const std::vector<std::string>& images, Report& report);
+	static void printReport(const Report& report, FILE *fp);
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct Shard {
+		int id, attempts;
+		std::vector<std::string> images;
+	};
+
+	BatchCoordinator(const Options& options, const std::vector<std::string>& images);
+
+	void serve(int fd);
+	bool takeShard(const WorkerStats& worker, Shard& shard, double& timeoutSeconds);
+	void finishShard(WorkerStats& worker, const std::vector<std::string>& fields, double ms);
+	void abandonShard(const Shard& shard);
+	void failRemaining();
+	void leave();
+	bool finished() const;
+
+	const Options options;
+	const std::vector<std::string>& images;
+	std::string opsField;
+
+	std::mutex mtx;
+	std::condition_variable changed;
+	size_t nextImage;
+	std::deque<Shard> retries;
+	int outstanding, nextShardId, listenFd, wakeRead, wakeWrite;
+	int liveWorkers;
+	bool hadWorkers;
+	clock::time_point idleSince;
+	Report report;
+	std::vector<std::unique_ptr<WorkerStats>> workers;
+};
+
+// The worker side: connects to a coordinator and processes shards with the
+// Utils pipeline until it is told that the batch is done.
+class BatchWorker {
+public:
+	static int run(const std::string& host, int port);
+};
\ No newline at end of file
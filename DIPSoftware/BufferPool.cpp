@@ -0,0 +1,216 @@
+#include "BufferPool.h"
+#include "MemoryTracker.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+const size_t POOL_MIN_SIZE = 64 << 10;
+const size_t PAGE_SIZE = 4 << 10;
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+}
+
+// Never destroyed: Mats held by statics of other files are released after
+// any function-local static of this one would be gone.
+BufferPool& BufferPool::instance() {
+	static BufferPool *pool = new BufferPool;
+	return *pool;
+}
+
+void BufferPool::install() {
+	const char *env = getenv("DIP_BUFFER_POOL");
+	if (env && string(env) == "off") {
+		return;
+	}
+	Mat::setDefaultAllocator(&instance());
+}
+
+// Geometric classes with eight steps per power of two, so a recycled buffer
+// wastes at most 12.5% and same-shaped Mats always land in the same class.
+size_t BufferPool::sizeClass(size_t size) {
+	if (size < POOL_MIN_SIZE) {
+		return size;
+	}
+	size_t power = POOL_MIN_SIZE;
+	while (power * 2 <= size) {
+		power *= 2;
+	}
+	size_t step = power / 8;
+	return (size + step - 1) / step * step;
+}
+
+void* BufferPool::alignedAlloc(size_t size) {
+	size_t alignment = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : PAGE_SIZE;
+#ifdef _WIN32
+	void *ptr = _aligned_malloc(size, alignment);
+#else
+	void *ptr = nullptr;
+	if (posix_memalign(&ptr, alignment, size)) {
+		ptr = nullptr;
+	}
+#ifdef MADV_HUGEPAGE
+	if (ptr && alignment == HUGE_PAGE_SIZE) {
+		madvise(ptr, size, MADV_HUGEPAGE);
+	}
+#endif
+#endif
+	if (!ptr) {
+		throw bad_alloc();
+	}
+	return ptr;
+}
+
+void BufferPool::alignedFree(void *ptr) {
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+UMatData* BufferPool::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, int /*flags*/, UMatUsageFlags /*usageFlags*/) const {
+	size_t total = CV_ELEM_SIZE(type);
+	for (int i = dims - 1; i >= 0; --i) {
+		if (step) {
+			if (data0 && step[i] != CV_AUTOSTEP) {
+				CV_Assert(total <= step[i]);
+				total = step[i];
+			} else {
+				step[i] = total;
+			}
+		}
+		total *= sizes[i];
+	}
+
+	uchar *data;
+	if (data0) {
+		data = (uchar*) data0;
+	} else if (total < POOL_MIN_SIZE) {
+		data = (uchar*) fastMalloc(total);
+	} else {
+		size_t capacity = sizeClass(total);
+		data = nullptr;
+		{
+			lock_guard<mutex> lock(mtx);
+			auto it = freeBlocks.find(capacity);
+			if (it != freeBlocks.end() && !it->second.empty()) {
+				data = (uchar*) it->second.back().ptr;
+				it->second.pop_back();
+				counters.cachedBytes -= capacity;
+				++counters.hits;
+			} else {
+				++counters.misses;
+			}
+			counters.liveBytes += capacity;
+			updatePeak();
+		}
+		if (!data) {
+			try {
+				data = (uchar*) alignedAlloc(capacity);
+			} catch (...) {
+				lock_guard<mutex> lock(mtx);
+				counters.liveBytes -= capacity;
+				throw;
+			}
+		}
+	}
+
+	UMatData *u = new UMatData(this);
+	u->data = u->origdata = data;
+	u->size = total;
+	if (data0) {
+		u->flags |= UMatData::USER_ALLOCATED;
+	} else {
+		MemoryTracker::onAllocate(u);
+	}
+	return u;
+}
+
+bool BufferPool::allocate(UMatData* u, int /*accessflags*/, UMatUsageFlags /*usageFlags*/) const {
+	return u != nullptr;
+}
+
+void BufferPool::deallocate(UMatData* u) const {
+	if (!u) {
+		return;
+	}
+	CV_Assert(u->urefcount == 0);
+	CV_Assert(u->refcount == 0);
+
+	if (!(u->flags & UMatData::USER_ALLOCATED)) {
+		MemoryTracker::onRelease(u);
+		if (u->size < POOL_MIN_SIZE) {
+			fastFree(u->origdata);
+		} else {
+			size_t capacity = sizeClass(u->size);
+			lock_guard<mutex> lock(mtx);
+			freeBlocks[capacity].push_back({ u->origdata, clock::now() });
+			counters.liveBytes -= capacity;
+			counters.cachedBytes += capacity;
+			while (counters.cachedBytes > cacheLimit) {
+				evictOldest();
+			}
+		}
+		u->origdata = 0;
+	}
+	delete u;
+}
+
+void BufferPool::updatePeak() const {
+	updateMax(counters.peakBytes, counters.liveBytes + counters.cachedBytes);
+}
+
+void BufferPool::evictOldest() const {
+	auto oldest = freeBlocks.end();
+	for (auto it = freeBlocks.begin(); it != freeBlocks.end(); ++it) {
+		if (!it->second.empty() && (oldest == freeBlocks.end() || it->second.front().released < oldest->second.front().released)) {
+			oldest = it;
+		}
+	}
+	if (oldest == freeBlocks.end()) {
+		return;
+	}
+	alignedFree(oldest->second.front().ptr);
+	oldest->second.erase(oldest->second.begin());
+	counters.cachedBytes -= oldest->first;
+}
+
+void BufferPool::trim(double idleSeconds) {
+	auto deadline = clock::now() - chrono::duration_cast<clock::duration>(chrono::duration<double>(idleSeconds));
+
+	lock_guard<mutex> lock(mtx);
+	for (auto& entry : freeBlocks) {
+		auto& blocks = entry.second;
+		auto keep = stable_partition(blocks.begin(), blocks.end(), [&](const Block& block) { return block.released > deadline; });
+		for (auto it = keep; it != blocks.end(); ++it) {
+			alignedFree(it->ptr);
+			counters.cachedBytes -= entry.first;
+		}
+		blocks.erase(keep, blocks.end());
+	}
+}
+
+void BufferPool::setCacheLimit(size_t bytes) {
+	lock_guard<mutex> lock(mtx);
+	cacheLimit = bytes;
+	while (counters.cachedBytes > cacheLimit) {
+		evictOldest();
+	}
+}
+
+BufferPool::Stats BufferPool::stats() const {
+	lock_guard<mutex> lock(mtx);
+	return counters;
+}
\ No newline at end of file
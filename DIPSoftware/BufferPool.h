@@ -0,0 +1,55 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// cv::MatAllocator that recycles large buffers by size class, so repeated
+// same-shaped allocations (preview ticks, display conversion, chained ops)
+// reuse memory that is already faulted in instead of hitting the OS again.
+// Buffers of 2MB and above are huge-page aligned. Idle buffers are returned
+// to the system by trim().
+class BufferPool : public cv::MatAllocator {
+public:
+	struct Stats {
+		size_t cachedBytes, liveBytes, peakBytes;
+		uint64_t hits, misses;
+	};
+
+	static BufferPool& instance();
+	static void install();
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags, cv::UMatUsageFlags usageFlags) const override;
+	bool allocate(cv::UMatData* data, int accessflags, cv::UMatUsageFlags usageFlags) const override;
+	void deallocate(cv::UMatData* data) const override;
+
+	void trim(double idleSeconds);
+	void setCacheLimit(size_t bytes);
+	Stats stats() const;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct Block {
+		void *ptr;
+		clock::time_point released;
+	};
+
+	BufferPool() : cacheLimit(size_t(1) << 30) {}
+
+	static size_t sizeClass(size_t size);
+	static void* alignedAlloc(size_t size);
+	static void alignedFree(void *ptr);
+
+	void updatePeak() const;
+	void evictOldest() const;
+
+	mutable std::mutex mtx;
+	mutable std::map<size_t, std::vector<Block>> freeBlocks;
+	mutable Stats counters = {};
+	size_t cacheLimit;
+};
\ No newline at end of file
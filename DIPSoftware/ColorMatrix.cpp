@@ -0,0 +1,176 @@
+#include "ColorMatrix.h"
+#include "CpuDispatch.h"
+#include "MemoryTracker.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#define PI 3.141592653589793
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+// Rec. 709 luma, as used by the SVG/CSS saturate and hue-rotate filters.
+const float LUMA_R = 0.213f, LUMA_G = 0.715f, LUMA_B = 0.072f;
+const int FIXED_SHIFT = 12;
+const char *MATRIX_PREFIX = "matrix";
+
+int toFixed(double value) {
+	return (int) lround(value * (1 << FIXED_SHIFT));
+}
+
+// NaN maps to 0.
+float clampCoefficient(float value) {
+	const float bound = (float) ColorMatrix::MAX_COEFFICIENT;
+	return value > bound ? bound : value < -bound ? -bound : value == value ? value : 0.0f;
+}
+
+}
+
+ColorMatrix::ColorMatrix() {
+	rep(i, 3) rep(j, 4) {
+		m[i][j] = i == j ? 1.0f : 0.0f;
+	}
+}
+
+ColorMatrix ColorMatrix::saturation(float s) {
+	const float rows[3][4] = {
+		{ LUMA_R + (1 - LUMA_R) * s, LUMA_G - LUMA_G * s, LUMA_B - LUMA_B * s, 0 },
+		{ LUMA_R - LUMA_R * s, LUMA_G + (1 - LUMA_G) * s, LUMA_B - LUMA_B * s, 0 },
+		{ LUMA_R - LUMA_R * s, LUMA_G - LUMA_G * s, LUMA_B + (1 - LUMA_B) * s, 0 }
+	};
+	return channelMix(rows);
+}
+
+// Rotates the chroma plane about the grey axis, keeping luma.
+ColorMatrix ColorMatrix::hueRotation(float degrees) {
+	float c = (float) cos(degrees * PI / 180), s = (float) sin(degrees * PI / 180);
+	const float rows[3][4] = {
+		{ LUMA_R + c * (1 - LUMA_R) - s * LUMA_R, LUMA_G - c * LUMA_G - s * LUMA_G, LUMA_B - c * LUMA_B + s * (1 - LUMA_B), 0 },
+		{ LUMA_R - c * LUMA_R + s * 0.143f, LUMA_G + c * (1 - LUMA_G) + s * 0.140f, LUMA_B - c * LUMA_B - s * 0.283f, 0 },
+		{ LUMA_R - c * LUMA_R - s * (1 - LUMA_R), LUMA_G - c * LUMA_G + s * LUMA_G, LUMA_B + c * (1 - LUMA_B) + s * LUMA_B, 0 }
+	};
+	return channelMix(rows);
+}
+
+ColorMatrix ColorMatrix::channelMix(const float (&rows)[3][4]) {
+	ColorMatrix res;
+	rep(i, 3) rep(j, 4) {
+		res.m[i][j] = rows[i][j];
+	}
+	return res;
+}
+
+ColorMatrix ColorMatrix::operator*(const ColorMatrix& other) const {
+	ColorMatrix res;
+	rep(i, 3) rep(j, 4) {
+		float v = j == 3 ? m[i][3] : 0.0f;
+		rep(k, 3) {
+			v += m[i][k] * other.m[k][j];
+		}
+		res.m[i][j] = v;
+	}
+	return res;
+}
+
+bool ColorMatrix::isBounded() const {
+	rep(i, 3) rep(j, 4) {
+		if (!(fabs(m[i][j]) <= MAX_COEFFICIENT)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ColorMatrix::isIdentity() const {
+	rep(i, 3) rep(j, 4) {
+		if (toFixed(m[i][j]) != (i == j ? 1 << FIXED_SHIFT : 0)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+Mat ColorMatrix::apply(const Mat& mat) const {
+	Mat res;
+	apply(mat, res);
+	return res;
+}
+
+void ColorMatrix::apply(const Mat& mat, Mat& res) const {
+	TRACE_SCOPE("ColorMatrix::apply");
+	MEMORY_TAG("ColorMatrix::apply");
+	if (isIdentity()) {
+		if (res.data != mat.data) {
+			mat.copyTo(res);
+		}
+		return;
+	}
+	res.create(mat.rows, mat.cols, mat.type());
+
+	// Rows and columns reordered for BGR memory order; the offset includes
+	// the rounding term. With entries clamped to MAX_COEFFICIENT a sum peaks
+	// near 2^28, well inside an int.
+	int coeffs[12];
+	rep(c, 3) {
+		int i = 2 - c;
+		rep(k, 3) {
+			coeffs[c * 4 + k] = toFixed(clampCoefficient(m[i][2 - k]));
+		}
+		coeffs[c * 4 + 3] = toFixed(clampCoefficient(m[i][3]) * 255) + (1 << (FIXED_SHIFT - 1));
+	}
+	if (mat.channels() == 1) {
+		uchar map[1][256];
+		rep(v, 256) {
+			int sum = 0;
+			rep(c, 3) {
+				int value = ((coeffs[c * 4] + coeffs[c * 4 + 1] + coeffs[c * 4 + 2]) * v + coeffs[c * 4 + 3]) >> FIXED_SHIFT;
+				sum += min(255, max(0, value));
+			}
+			map[0][v] = (uchar) ((sum + 1) / 3);
+		}
+		CpuDispatch::kernels().applyLUT(mat.data, mat.step, res.data, res.step, mat.cols, mat.rows, 1, map);
+		return;
+	}
+	CpuDispatch::kernels().colorMatrix(mat.data, mat.step, res.data, res.step, mat.cols, mat.rows, mat.channels(), coeffs);
+}
+
+bool ColorMatrix::isMatrixOp(const string& op) {
+	return !op.compare(0, strlen(MATRIX_PREFIX), MATRIX_PREFIX);
+}
+
+bool ColorMatrix::parse(const string& op, ColorMatrix& matrix) {
+	size_t colon = op.find(':');
+	if (colon == string::npos) {
+		return false;
+	}
+	string name = op.substr(0, colon);
+	const char *value = op.c_str() + colon + 1;
+	char *end;
+	if (name == "matrixSaturation" || name == "matrixHue") {
+		float v = strtof(value, &end);
+		if (end == value || *end) {
+			return false;
+		}
+		matrix = name == "matrixSaturation" ? saturation(v) : hueRotation(v);
+		return matrix.isBounded();
+	}
+	if (name == "matrixMix") {
+		float rows[3][4];
+		rep(i, 12) {
+			rows[i / 4][i % 4] = strtof(value, &end);
+			if (end == value || *end != (i < 11 ? '/' : '\0')) {
+				return false;
+			}
+			value = end + 1;
+		}
+		matrix = channelMix(rows);
+		return matrix.isBounded();
+	}
+	return false;
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+
+// An affine colour transform on RGB values in [0, 1]:
+//   (r', g', b') = m[0..2][0..2] * (r, g, b) + m[0..2][3]
+// Saturation, hue rotation about the grey axis and channel mixing are all of
+// this form, so a run of them multiplies into one matrix and costs a single
+// pass over the pixels (an integer kernel, see CpuKernels::colorMatrix).
+// hueRotation() and saturation() approximate the exact HSL adjustments in
+// Utils with luma-weighted matrices: much cheaper, but not identical.
+class ColorMatrix {
+public:
+	ColorMatrix();
+
+	static ColorMatrix saturation(float s);
+	static ColorMatrix hueRotation(float degrees);
+	static ColorMatrix channelMix(const float (&rows)[3][4]);
+
+	// The transform applying other first, then this.
+	ColorMatrix operator*(const ColorMatrix& other) const;
+	bool isIdentity() const;
+	// Every entry finite and within +-MAX_COEFFICIENT, the range the 32-bit
+	// fixed point kernel accumulates without overflow. apply() clamps
+	// entries outside it, so callers fusing matrices check the product.
+	bool isBounded() const;
+	static const int MAX_COEFFICIENT = 64;
+
+	cv::Mat apply(const cv::Mat& mat) const;
+	// res may be mat itself. Alpha is passed through; a grey image gets the
+	// grey value of the transformed (v, v, v).
+	void apply(const cv::Mat& mat, cv::Mat& res) const;
+
+	// Op names for chains: "matrixSaturation:<s>" (1 keeps the image),
+	// "matrixHue:<degrees>" and "matrixMix:<12 numbers separated by '/'>",
+	// the rows of m. Ops whose matrix is not bounded are rejected.
+	static bool isMatrixOp(const std::string& op);
+	static bool parse(const std::string& op, ColorMatrix& matrix);
+
+	float m[3][4];
+};
\ No newline at end of file
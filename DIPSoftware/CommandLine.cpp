@@ -0,0 +1,767 @@
+#include "CommandLine.h"
+#include "AutoTune.h"
+#include "BatchCoordinator.h"
+#include "CpuDispatch.h"
+#include "Daemon.h"
+#include "FramePipeline.h"
+#include "ImageWriter.h"
+#include "IntegralHistogram.h"
+#include "KernelVerifier.h"
+#include "MemoryTracker.h"
+#include "ResultCache.h"
+#include "SocketIO.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+bool buildChain(const KernelVerifier& verifier, const vector<string>& ops, vector<KernelVerifier::opFuncType>& chain,
+	const function<KernelVerifier::opFuncType(const string&)>& resolve = nullptr) {
+	string unknown;
+	if (!verifier.buildChain(ops, chain, unknown, resolve)) {
+		Utils::c_fprintf(COLOR_RED, stderr, "unknown op %s, see --bench for the list\n", unknown.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool hasExtension(const string& fileName, initializer_list<const char*> extensions) {
+	string extension = ImageWriter::extensionOf(fileName);
+	return any_of(extensions.begin(), extensions.end(), [&](const char *e) { return extension == e; });
+}
+
+bool isVideo(const string& fileName) {
+	return hasExtension(fileName, { "avi", "mp4", "mov", "mkv", "m4v", "wmv" });
+}
+
+string baseName(const string& fileName) {
+	return fileName.substr(fileName.find_last_of("/\\") + 1);
+}
+
+double meanOf(const array<int, 256>& hist) {
+	double sum = 0, count = 0;
+	rep(v, 256) {
+		sum += (double) v * hist[v];
+		count += hist[v];
+	}
+	return count ? sum / count : 0;
+}
+
+// Grey value statistics of one region, from its histogram.
+void printRegionStats(const Rect& rect, const array<int, 256>& hist) {
+	int64_t pixels = 0;
+	double sum = 0, squares = 0;
+	int lowest = -1, highest = -1, median = -1;
+	rep(v, 256) {
+		if (hist[v]) {
+			if (lowest < 0) {
+				lowest = v;
+			}
+			highest = v;
+		}
+		pixels += hist[v];
+		sum += (double) v * hist[v];
+		squares += (double) v * v * hist[v];
+	}
+	if (!pixels) {
+		printf("%5d %5d %5d %5d %10d\n", rect.x, rect.y, rect.width, rect.height, 0);
+		return;
+	}
+	int64_t seen = 0;
+	rep(v, 256) {
+		seen += hist[v];
+		if (median < 0 && 2 * seen >= pixels) {
+			median = v;
+		}
+	}
+	double mean = sum / pixels;
+	printf("%5d %5d %5d %5d %10lld %8.2f %8.2f %4d %6d %4d\n", rect.x, rect.y, rect.width, rect.height, (long long) pixels,
+		mean, sqrt(max(0.0, squares / pixels - mean * mean)), lowest, median, highest);
+}
+
+}
+
+string CommandLine::programPath;
+
+bool CommandLine::isCommandLine(int argc, char *argv[]) {
+	return argc > 1 && !strncmp(argv[1], "--", 2);
+}
+
+int CommandLine::run(int argc, char *argv[]) {
+	programPath = argv[0];
+	argsType args;
+	string traceFile, memoryReport;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--trace" && i + 1 < argc) {
+			traceFile = argv[++i];
+		} else if (arg == "--memory-report" && i + 1 < argc) {
+			memoryReport = argv[++i];
+		} else if (arg == "--tier" && i + 1 < argc) {
+			CpuDispatch::Tier tier;
+			if (!CpuDispatch::parseTier(argv[++i], tier)) {
+				Utils::c_fprintf(COLOR_RED, stderr, "unknown tier %s, expected scalar|sse2|avx2|avx512\n", argv[i]);
+				return 2;
+			}
+			if (CpuDispatch::setTier(tier) != tier) {
+				Utils::c_fprintf(COLOR_YELLOW, stderr, "tier %s is not supported here, using %s\n", argv[i], CpuDispatch::tierName(CpuDispatch::tier()));
+			}
+		} else {
+			args.push_back(arg);
+		}
+	}
+	if (args.empty()) {
+		return usage();
+	}
+	if (traceFile.size()) {
+		Trace::setEnabled(true);
+	}
+
+	string command = args.front();
+	args.erase(args.begin());
+	int res;
+	if (command == "--verify") {
+		res = verify(args);
+	} else if (command == "--bench") {
+		res = bench(args);
+	} else if (command == "--tune") {
+		res = tune(args);
+	} else if (command == "--batch") {
+		res = batch(args);
+	} else if (command == "--sequence") {
+		res = sequence(args);
+	} else if (command == "--daemon") {
+		res = daemon(args);
+	} else if (command == "--submit") {
+		res = submit(args);
+	} else if (command == "--coordinate") {
+		res = coordinate(args);
+	} else if (command == "--worker") {
+		res = worker(args);
+	} else if (command == "--regions") {
+		res = regions(args);
+	} else if (command == "--solve") {
+		res = solve(args);
+	} else {
+		res = usage();
+	}
+
+	if (traceFile.size()) {
+		Trace::printSummary(stderr);
+		if (!Trace::dumpChromeTrace(traceFile)) {
+			Utils::c_fprintf(COLOR_RED, stderr, "cannot write trace to %s\n", traceFile.c_str());
+		}
+	}
+	if (memoryReport == "-") {
+		MemoryTracker::dump(stderr);
+	} else if (memoryReport.size()) {
+		FILE *fp = fopen(memoryReport.c_str(), "w");
+		if (fp) {
+			MemoryTracker::dump(fp);
+			fclose(fp);
+		}
+	}
+	return res;
+}
+
+int CommandLine::verify(const argsType& args) {
+	KernelVerifier verifier;
+	string filter;
+	bool synthetic = true;
+	for (size_t i = 0; i < args.size(); ++i) {
+		const string& arg = args[i];
+		bool hasValue = i + 1 < args.size();
+		if (arg == "--images" && hasValue) {
+			const string& dir = args[++i];
+			if (!verifier.addImageDirectory(dir)) {
+				Utils::c_fprintf(COLOR_RED, stderr, "no usable images in %s\n", dir.c_str());
+				return 2;
+			}
+		} else if (arg == "--tolerance" && hasValue) {
+			if (!verifier.parseTolerance(args[++i])) {
+				Utils::c_fprintf(COLOR_RED, stderr, "bad tolerance %s, expected op=maxAbs[,minPSNR]\n", args[i].c_str());
+				return 2;
+			}
+		} else if (arg == "--filter" && hasValue) {
+			filter = args[++i];
+		} else if (arg == "--no-synthetic") {
+			synthetic = false;
+		} else {
+			return usage();
+		}
+	}
+	if (synthetic) {
+		verifier.addSyntheticCorpus();
+	}
+	return KernelVerifier::printReport(stdout, verifier.run(filter)) ? 0 : 1;
+}
+
+// Times every verifier operation on one synthetic image with the active tier.
+int CommandLine::bench(const argsType& args) {
+	int width = 1920, height = 1080, iterations = 10;
+	string filter;
+	for (size_t i = 0; i < args.size(); ++i) {
+		const string& arg = args[i];
+		bool hasValue = i + 1 < args.size();
+		if (arg == "--size" && hasValue) {
+			if (sscanf(args[++i].c_str(), "%dx%d", &width, &height) != 2 || width < 16 || height < 16) {
+				Utils::c_fprintf(COLOR_RED, stderr, "bad size %s, expected WxH\n", args[i].c_str());
+				return 2;
+			}
+		} else if (arg == "--iterations" && hasValue) {
+			iterations = max(1, atoi(args[++i].c_str()));
+		} else if (arg == "--filter" && hasValue) {
+			filter = args[++i];
+		} else {
+			return usage();
+		}
+	}
+
+	Mat mat(height, width, CV_8UC3);
+	randu(mat, Scalar::all(0), Scalar::all(256));
+
+	printf("tier: %s (detected %s)\n", CpuDispatch::tierName(CpuDispatch::tier()), CpuDispatch::tierName(CpuDispatch::detectedTier()));
+	printf("image: %dx%d, %d iterations\n", width, height, iterations);
+	printf("%-28s %12s %12s\n", "op", "mean(ms)", "min(ms)");
+	KernelVerifier verifier;
+	for (const auto& c : verifier.operations()) {
+		if (!KernelVerifier::matches(c.op, filter)) {
+			continue;
+		}
+		c.optimized(mat);
+		double total = 0, best = 1e30;
+		rep(i, iterations) {
+			int64_t begin = Trace::now();
+			c.optimized(mat);
+			double ms = (Trace::now() - begin) * 1e-6;
+			total += ms;
+			updateMin(best, ms);
+		}
+		printf("%-28s %12.3f %12.3f\n", c.op.c_str(), total / iterations, best);
+	}
+	return 0;
+}
+
+// Recalibrates even when the tuning file matches this CPU.
+int CommandLine::tune(const argsType& args) {
+	string fileName = AutoTune::defaultFileName();
+	const char *env = getenv("DIP_TUNE_FILE");
+	if (env && *env) {
+		fileName = env;
+	}
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (args[i] == "--file" && i + 1 < args.size()) {
+			fileName = args[++i];
+		} else {
+			return usage();
+		}
+	}
+
+	printf("cpu: %s, tier %s\n", CpuDispatch::cpuModel().c_str(), CpuDispatch::tierName(CpuDispatch::tier()));
+	string error;
+	if (!AutoTune::calibrateAndSave(fileName, stdout, error)) {
+		Utils::c_fprintf(COLOR_RED, stderr, "%s\n", error.c_str());
+		return 1;
+	}
+	printf("written to %s\n", fileName.c_str());
+	return 0;
+}
+
+// Applies the named verifier operations in order to every image and saves
+// the results through the same encoder and atomic write as the GUI.
+int CommandLine::batch(const argsType& args) {
+	KernelVerifier verifier;
+	argsType ops, inputs;
+	string outDir = ".", format, opsKey;
+	for (size_t i = 0; i < args.size(); ++i) {
+		const string& arg = args[i];
+		bool hasValue = i + 1 < args.size();
+		if (arg == "--op" && hasValue) {
+			ops.push_back(args[++i]);
+			opsKey += (opsKey.size() ? "," : "") + ops.back();
+		} else if (arg == "--out" && hasValue) {
+			outDir = args[++i];
+		} else if (arg == "--format" && hasValue) {
+			format = args[++i];
+		} else if (arg.compare(0, 2, "--") == 0) {
+			return usage();
+		} else {
+			inputs.push_back(arg);
+		}
+	}
+	if (inputs.empty()) {
+		return usage();
+	}
+	vector<KernelVerifier::opFuncType> chain;
+	if (!buildChain(verifier, ops, chain)) {
+		return 2;
+	}
+
+	int failed = 0;
+	for (const auto& input : inputs) {
+		string name = baseName(input);
+		if (format.size()) {
+			name = name.substr(0, name.find_last_of('.')) + "." + format;
+		}
+		string output = outDir + "/" + name;
+
+		Mat mat = Utils::readImageMat(input);
+		if (mat.empty()) {
+			Utils::c_fprintf(COLOR_RED, stderr, "cannot read %s\n", input.c_str());
+			++failed;
+			continue;
+		}
+		mat = ResultCache::instance().apply(mat, opsKey, [&](Mat mat) {
+			for (const auto& f : chain) {
+				mat = f(mat);
+			}
+			return mat;
+		});
+		if (!ImageWriter::write(output, mat)) {
+			Utils::c_fprintf(COLOR_RED, stderr, "cannot write %s\n", output.c_str());
+			++failed;
+			continue;
+		}
+		printf("%s -> %s\n", input.c_str(), output.c_str());
+	}
+	return failed ? 1 : 0;
+}
+
+// Applies the ops to every frame of an image folder (in name order) or a
+// video through the three-stage FramePipeline, writing an image folder or a
+// video. Transfer functions are cached across frames by Utils; --reference
+// makes the histogram specification ops match every frame to that image,
+// whose histograms are computed once.
+int CommandLine::sequence(const argsType& args) {
+	KernelVerifier verifier;
+	argsType ops;
+	string input, output, format, reference;
+	size_t capacity = 4;
+	for (size_t i = 0; i < args.size(); ++i) {
+		const string& arg = args[i];
+		bool hasValue = i + 1 < args.size();
+		if (arg == "--op" && hasValue) {
+			ops.push_back(args[++i]);
+		} else if (arg == "--out" && hasValue) {
+			output = args[++i];
+		} else if (arg == "--format" && hasValue) {
+			format = args[++i];
+		} else if (arg == "--reference" && hasValue) {
+			reference = args[++i];
+		} else if (arg == "--queue" && hasValue) {
+			capacity = max(1, atoi(args[++i].c_str()));
+		} else if (arg.compare(0, 2, "--") == 0 || input.size()) {
+			return usage();
+		} else {
+			input = arg;
+		}
+	}
+	if (input.empty() || output.empty()) {
+		return usage();
+	}
+
+	shared_ptr<Utils::HistogramReference> histogramReference;
+	if (reference.size()) {
+		Mat pattern = Utils::readImageMat(reference);
+		if (pattern.empty()) {
+			Utils::c_fprintf(COLOR_RED, stderr, "cannot read %s\n", reference.c_str());
+			return 1;
+		}
+		histogramReference = make_shared<Utils::HistogramReference>(Utils::getHistogramReference(pattern));
+	}
+	vector<KernelVerifier::opFuncType> chain;
+	auto resolve = [histogramReference](const string& op) -> KernelVerifier::opFuncType {
+		if (histogramReference && op == "histogramSpecificationSML") {
+			return [histogramReference](const Mat& m) { Mat res; Utils::histogramSpecificationSML(m, res, *histogramReference); return res; };
+		} else if (histogramReference && op == "histogramSpecificationGML") {
+			return [histogramReference](const Mat& m) { Mat res; Utils::histogramSpecificationGML(m, res, *histogramReference); return res; };
+		} else if (histogramReference && op == "histogramSpecificationExact") {
+			return [histogramReference](const Mat& m) { Mat res; Utils::histogramSpecificationExact(m, res, *histogramReference); return res; };
+		}
+		return nullptr;
+	};
+	if (!buildChain(verifier, ops, chain, resolve)) {
+		return 2;
+	}
+
+	FramePipeline::sourceType source;
+	VideoCapture capture;
+	vector<String> files;
+	double fps = 25;
+	if (isVideo(input)) {
+		if (!capture.open(input)) {
+			Utils::c_fprintf(COLOR_RED, stderr, "cannot open %s\n", input.c_str());
+			return 1;
+		}
+		if (capture.get(CAP_PROP_FPS) > 0) {
+			fps = capture.get(CAP_PROP_FPS);
+		}
+		source = [&](FramePipeline::Frame& frame) {
+			char name[32];
+			snprintf(name, sizeof(name), "frame_%06d", frame.index);
+			frame.name = name;
+			return capture.read(frame.mat);
+		};
+	} else {
+		vector<String> entries;
+		glob(input + "/*", entries, false);
+		copy_if(entries.begin(), entries.end(), back_inserter(files), [](const String& file) { return hasExtension(file, { "bmp", "png", "jpg", "jpeg", "tif", "tiff", "dipraw" }); });
+		sort(files.begin(), files.end());
+		if (files.empty()) {
+			Utils::c_fprintf(COLOR_RED, stderr, "no frames in %s\n", input.c_str());
+			return 1;
+		}
+		source = [&](FramePipeline::Frame& frame) {
+			if (frame.index >= (int) files.size()) {
+				return false;
+			}
+			frame.name = baseName(files[frame.index]);
+			frame.mat = Utils::readImageMat(files[frame.index]);
+			if (frame.mat.empty()) {
+				Utils::c_fprintf(COLOR_RED, stderr, "cannot read %s\n", files[frame.index].c_str());
+			}
+			return true;
+		};
+	}
+
+	auto process = [&](FramePipeline::Frame& frame) {
+		for (const auto& op : chain) {
+			frame.mat = op(frame.mat);
+		}
+	};
+
+	FramePipeline::sinkType sink;
+	VideoWriter writer;
+	if (isVideo(output)) {
+		int fourcc = hasExtension(output, { "avi" }) ? VideoWriter::fourcc('M', 'J', 'P', 'G') : VideoWriter::fourcc('m', 'p', '4', 'v');
+		sink = [&](const FramePipeline::Frame& frame) {
+			Mat bgr = frame.mat;
+			if (bgr.channels() != 3) {
+				cvtColor(bgr, bgr, bgr.channels() == 1 ? COLOR_GRAY2BGR : COLOR_BGRA2BGR);
+			}
+			if (!writer.isOpened() && !writer.open(output, fourcc, fps, bgr.size())) {
+				return false;
+			}
+			writer.write(bgr);
+			return true;
+		};
+	} else {
+		sink = [&](const FramePipeline::Frame& frame) {
+			string name = frame.name;
+			if (format.size() || name.find('.') == string::npos) {
+				name = name.substr(0, name.find_last_of('.')) + "." + (format.size() ? format : "png");
+			}
+			return ImageWriter::write(output + "/" + name, frame.mat);
+		};
+	}
+
+	FramePipeline::Stats stats;
+	try {
+		stats = FramePipeline::run(source, process, sink, capacity);
+	} catch (const exception& e) {
+		Utils::c_fprintf(COLOR_RED, stderr, "sequence stopped: %s\n", e.what());
+		return 1;
+	}
+	FramePipeline::printStats(stats, stdout);
+	return stats.failed ? 1 : 0;
+}
+
+int CommandLine::daemon(const argsType& args) {
+	Daemon::Options options = Daemon::defaultOptions();
+	for (size_t i = 0; i < args.size(); ++i) {
+		const string& arg = args[i];
+		bool hasValue = i + 1 < args.size();
+		if (arg == "--socket" && hasValue) {
+			options.socketPath = args[++i];
+		} else if (arg == "--workers" && hasValue) {
+			options.workers = max(1, atoi(args[++i].c_str()));
+		} else if (arg == "--batch" && hasValue) {
+			options.batchLimit = max(1, atoi(args[++i].c_str()));
+		} else {
+			return usage();
+		}
+	}
+	AutoTune::calibrateIfUntuned();
+	return Daemon::run(options);
+}
+
+// Sends one request to a running daemon and prints its reply. A single
+// argument is the request line as is; several are its words, quoted where
+// they hold spaces.
+int CommandLine::submit(const argsType& args) {
+	string socketPath = Daemon::defaultSocketPath(), request;
+	vector<string> words;
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (args[i] == "--socket" && i + 1 < args.size() && words.empty()) {
+			socketPath = args[++i];
+		} else {
+			words.push_back(args[i]);
+		}
+	}
+	if (words.empty()) {
+		return usage();
+	}
+	if (words.size() == 1) {
+		request = words[0];
+	} else {
+		for (const auto& word : words) {
+			request += (request.size() ? " " : "") + SocketIO::quoteWord(word);
+		}
+	}
+	int fd = SocketIO::connectUnix(socketPath);
+	if (fd < 0) {
+		Utils::c_fprintf(COLOR_RED, stderr, "cannot connect to %s\n", socketPath.c_str());
+		return 1;
+	}
+	string reply, buffer;
+	bool ok = SocketIO::writeLine(fd, request) && SocketIO::readLine(fd, reply, buffer);
+	SocketIO::close(fd);
+	if (!ok) {
+		Utils::c_fprintf(COLOR_RED, stderr, "no reply from %s\n", socketPath.c_str());
+		return 1;
+	}
+	printf("%s\n", reply.c_str());
+	return reply.compare(0, 2, "ok") ? 1 : 0;
+}
+
+// Shards the images over worker processes; --spawn starts that many workers
+// on this machine, others can join with --worker on the --listen address.
+int CommandLine::coordinate(const argsType& args) {
+	KernelVerifier verifier;
+	BatchCoordinator::Options options = BatchCoordinator::defaultOptions();
+	options.programPath = programPath;
+	bool listening = false;
+	string reportFile;
+	argsType inputs;
+	for (size_t i = 0; i < args.size(); ++i) {
+		const string& arg = args[i];
+		bool hasValue = i + 1 < args.size();
+		if (arg == "--op" && hasValue) {
+			options.ops.push_back(args[++i]);
+		} else if (arg == "--listen" && hasValue) {
+			const string& address = args[++i];
+			size_t colon = address.find_last_of(':');
+			if (colon == string::npos || !colon) {
+				return usage();
+			}
+			options.host = address.substr(0, colon);
+			options.port = atoi(address.substr(colon + 1).c_str());
+			listening = true;
+		} else if (arg == "--spawn" && hasValue) {
+			options.localWorkers = max(0, atoi(args[++i].c_str()));
+		} else if (arg == "--out" && hasValue) {
+			options.outDir = args[++i];
+		} else if (arg == "--format" && hasValue) {
+			options.format = args[++i];
+		} else if (arg == "--report" && hasValue) {
+			reportFile = args[++i];
+		} else if (arg.compare(0, 2, "--") == 0) {
+			return usage();
+		} else {
+			inputs.push_back(arg);
+		}
+	}
+	if (inputs.empty() || (!listening && !options.localWorkers)) {
+		return usage();
+	}
+	vector<KernelVerifier::opFuncType> chain;
+	if (!buildChain(verifier, options.ops, chain)) {
+		return 2;
+	}
+
+	BatchCoordinator::Report report;
+	if (!BatchCoordinator::run(options, inputs, report)) {
+		return 1;
+	}
+	BatchCoordinator::printReport(report, stdout);
+	if (reportFile.size()) {
+		FILE *fp = fopen(reportFile.c_str(), "w");
+		if (!fp) {
+			Utils::c_fprintf(COLOR_RED, stderr, "cannot write report to %s\n", reportFile.c_str());
+			return 1;
+		}
+		BatchCoordinator::printReport(report, fp);
+		fclose(fp);
+	}
+	return report.failed ? 1 : 0;
+}
+
+int CommandLine::worker(const argsType& args) {
+	if (args.size() != 2 || args[0] != "--connect") {
+		return usage();
+	}
+	size_t colon = args[1].find_last_of(':');
+	if (colon == string::npos) {
+		return usage();
+	}
+	return BatchWorker::run(args[1].substr(0, colon), atoi(args[1].substr(colon + 1).c_str()));
+}
+
+// Grey value statistics of rectangles of one image; each region costs
+// O(256 + perimeter) through an IntegralHistogram instead of a pass over it.
+int CommandLine::regions(const argsType& args) {
+	vector<Rect> rects;
+	int gridCols = 0, gridRows = 0;
+	string input;
+	for (size_t i = 0; i < args.size(); ++i) {
+		const string& arg = args[i];
+		bool hasValue = i + 1 < args.size();
+		if (arg == "--rect" && hasValue) {
+			Rect rect;
+			if (sscanf(args[++i].c_str(), "%d,%d,%d,%d", &rect.x, &rect.y, &rect.width, &rect.height) != 4) {
+				return usage();
+			}
+			rects.push_back(rect);
+		} else if (arg == "--grid" && hasValue) {
+			if (sscanf(args[++i].c_str(), "%dx%d", &gridCols, &gridRows) != 2 || gridCols <= 0 || gridRows <= 0) {
+				return usage();
+			}
+		} else if (arg.compare(0, 2, "--") == 0 || input.size()) {
+			return usage();
+		} else {
+			input = arg;
+		}
+	}
+	if (input.empty()) {
+		return usage();
+	}
+
+	Mat mat = Utils::readImageMat(input);
+	if (mat.empty()) {
+		Utils::c_fprintf(COLOR_RED, stderr, "cannot read %s\n", input.c_str());
+		return 1;
+	}
+	rep(i, gridRows) {
+		rep(j, gridCols) {
+			int x0 = mat.cols * j / gridCols, y0 = mat.rows * i / gridRows;
+			rects.push_back(Rect(x0, y0, mat.cols * (j + 1) / gridCols - x0, mat.rows * (i + 1) / gridRows - y0));
+		}
+	}
+	if (rects.empty()) {
+		rects.push_back(Rect(0, 0, mat.cols, mat.rows));
+	}
+
+	IntegralHistogram integral;
+	integral.build(mat);
+	printf("%5s %5s %5s %5s %10s %8s %8s %4s %6s %4s\n", "x", "y", "w", "h", "pixels", "mean", "stddev", "min", "median", "max");
+	for (const auto& rect : rects) {
+		printRegionStats(rect, integral.histogram(rect));
+	}
+	return 0;
+}
+
+// Searches the gamma (with a fixed c) whose result has the requested mean
+// colour value. A point operation only moves histogram bins, so every step
+// of the bisection maps the 256-bin histogram through the candidate table
+// instead of touching the pixels; the image is read once and, with --out,
+// written once.
+int CommandLine::solve(const argsType& args) {
+	string input, output;
+	double target = -1, c = 1;
+	if (args.empty() || args[0] != "gamma") {
+		return usage();
+	}
+	for (size_t i = 1; i < args.size(); ++i) {
+		const string& arg = args[i];
+		bool hasValue = i + 1 < args.size();
+		if (arg == "--mean" && hasValue) {
+			target = atof(args[++i].c_str());
+		} else if (arg == "--c" && hasValue) {
+			c = atof(args[++i].c_str());
+		} else if (arg == "--out" && hasValue) {
+			output = args[++i];
+		} else if (arg.compare(0, 2, "--") == 0 || input.size()) {
+			return usage();
+		} else {
+			input = arg;
+		}
+	}
+	if (input.empty() || target < 0 || target > 255 || c <= 0) {
+		return usage();
+	}
+
+	Mat mat = Utils::readImageMat(input);
+	if (mat.empty()) {
+		Utils::c_fprintf(COLOR_RED, stderr, "cannot read %s\n", input.c_str());
+		return 1;
+	}
+	array<int, 256> hist = Utils::getHistogram3Channel(mat);
+	auto predict = [&](double exponent) {
+		return meanOf(Utils::mapHistogram(hist, Utils::gammaTable({ (float) pow(10, exponent), (float) c })));
+	};
+
+	// The mean falls as gamma grows; the range is that of the gamma dialog.
+	double low = -1.4, high = 1.4;
+	if (predict(low) < target || predict(high) > target) {
+		Utils::c_fprintf(COLOR_YELLOW, stderr, "mean %.2f is out of reach, using the closest gamma\n", target);
+	}
+	rep(iteration, 40) {
+		double middle = (low + high) / 2;
+		if (predict(middle) > target) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+	double exponent = fabs(predict(low) - target) <= fabs(predict(high) - target) ? low : high;
+	float gamma = (float) pow(10, exponent);
+	printf("gamma %.4f, c %.3f: predicted mean %.3f (target %.3f)\n", gamma, c, predict(exponent), target);
+
+	if (output.size()) {
+		Mat res;
+		Utils::changePartialImageMatGamma(mat, res, { gamma, (float) c });
+		if (!ImageWriter::write(output, res)) {
+			Utils::c_fprintf(COLOR_RED, stderr, "cannot write %s\n", output.c_str());
+			return 1;
+		}
+		printf("written to %s, measured mean %.3f\n", output.c_str(), meanOf(Utils::getHistogram3Channel(res)));
+	}
+	return 0;
+}
+
+int CommandLine::usage() {
+	fprintf(stderr,
+		"usage: DIPSoftware [--trace <file>] [--memory-report <file|->] [--tier scalar|sse2|avx2|avx512] <command>\n"
+		"commands:\n"
+		"  --verify [--images <dir>] [--tolerance <op>=<maxAbs>[,<minPSNR>]]... [--filter <op>] [--no-synthetic]\n"
+		"      compare every optimized kernel against its reference implementation\n"
+		"  --bench [--size <W>x<H>] [--iterations <n>] [--filter <op>]\n"
+		"      time every optimized kernel with the selected CPU tier\n"
+		"  --batch [--op <op>]... [--out <dir>] [--format <ext>] <image>...\n"
+		"      apply the ops (as listed by --bench) in order and save each result\n"
+		"      (--format dipraw keeps intermediate results mappable without decoding)\n"
+		"      besides those ops, matrixSaturation:<s>, matrixHue:<degrees> and matrixMix:<12 numbers separated by '/'>\n"
+		"      are colour matrices; consecutive ones are multiplied and applied in a single pass\n"
+		"      histogramSpecificationExact:uniform and :gaussian give every channel exactly that histogram\n"
+		"  --sequence [--op <op>]... [--reference <image>] [--queue <n>] --out <dir|video> [--format <ext>] <dir|video>\n"
+		"      apply the ops to every frame, decoding, processing and encoding on separate threads\n"
+		"  --daemon [--socket <path>] [--workers <n>] [--batch <n>]\n"
+		"      serve file and shared memory jobs on a Unix domain socket (see Daemon.h)\n"
+		"  --submit [--socket <path>] <request>\n"
+		"      send one request line to the daemon, e.g. \"file in.png out.png median:3,gaussian:5\" or \"stats\";\n"
+		"      given as separate arguments, words with spaces are quoted for the daemon\n"
+		"  --coordinate [--listen <host>:<port>] [--spawn <n>] [--op <op>]... [--out <dir>] [--format <ext>] [--report <file>] <image>...\n"
+		"      shard the images over worker processes, retrying failed shards, and report the throughput;\n"
+		"      only --spawn workers on 127.0.0.1 unless --listen gives an address for remote ones (0.0.0.0 for any)\n"
+		"  --worker --connect <host>:<port>\n"
+		"      process shards for a coordinator until its batch is done\n"
+		"  --regions [--rect <x>,<y>,<w>,<h>]... [--grid <cols>x<rows>] <image>\n"
+		"      print grey value statistics of each rectangle (the whole image by default)\n"
+		"  --solve gamma --mean <value> [--c <c>] [--out <file>] <image>\n"
+		"      find the gamma whose result has the given mean colour value, from the histogram alone\n"
+		"  --tune [--file <file>]\n"
+		"      measure the fastest band height and thread count per kernel and save them;\n"
+		"      without a saved tuning the GUI and --daemon calibrate on start, other commands use the defaults\n");
+	return 2;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Headless entry point: "DIPSoftware --<command> [options]" runs without
+// creating the Qt application. Global options --trace <file>,
+// --memory-report <file|-> and --tier <name> apply to every command.
+class CommandLine {
+public:
+	static bool isCommandLine(int argc, char *argv[]);
+	static int run(int argc, char *argv[]);
+
+private:
+	using argsType = std::vector<std::string>;
+
+	static int verify(const argsType& args);
+	static int bench(const argsType& args);
+	static int tune(const argsType& args);
+	static int batch(const argsType& args);
+	static int sequence(const argsType& args);
+	static int daemon(const argsType& args);
+	static int submit(const argsType& args);
+	static int coordinate(const argsType& args);
+	static int worker(const argsType& args);
+	static int regions(const argsType& args);
+	static int solve(const argsType& args);
+	static int usage();
+
+	static std::string programPath;
+};
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include "CpuDispatch.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const char *TIER_NAMES[] = { "scalar", "sse2", "avx2", "avx512" };
+const CpuKernels *TIER_TABLES[] = { &scalarKernels, &sse2Kernels, &avx2Kernels, &avx512Kernels };
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define DIP_X86 1
+
+void cpuid(int leaf, int subleaf, uint32_t regs[4]) {
+	int tmp[4];
+	__cpuidex(tmp, leaf, subleaf);
+	rep(i, 4) {
+		regs[i] = (uint32_t) tmp[i];
+	}
+}
+
+uint64_t xgetbv() {
+	return _xgetbv(0);
+}
+
+#elif defined(__x86_64__) || defined(__i386__)
+#define DIP_X86 1
+
+void cpuid(int leaf, int subleaf, uint32_t regs[4]) {
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+}
+
+uint64_t xgetbv() {
+	uint32_t lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+#endif
+
+// The OS must also save the wider registers on context switch, which XCR0
+// reports: bits 1-2 for SSE/AVX state, 5-7 for the AVX-512 opmask and ZMM.
+CpuDispatch::Tier detect() {
+#ifdef DIP_X86
+	uint32_t regs[4];
+	cpuid(0, 0, regs);
+	uint32_t maxLeaf = regs[0];
+
+	cpuid(1, 0, regs);
+	if (!(regs[3] & (1u << 26))) {
+		return CpuDispatch::TIER_SCALAR;
+	}
+	bool osxsave = (regs[2] & (1u << 27)) != 0;
+	bool avx = (regs[2] & (1u << 28)) != 0;
+	if (!osxsave || !avx || maxLeaf < 7) {
+		return CpuDispatch::TIER_SSE2;
+	}
+	uint64_t xcr0 = xgetbv();
+	if ((xcr0 & 0x6) != 0x6) {
+		return CpuDispatch::TIER_SSE2;
+	}
+
+	cpuid(7, 0, regs);
+	bool avx2 = (regs[1] & (1u << 5)) != 0;
+	bool avx512f = (regs[1] & (1u << 16)) != 0;
+	bool avx512bw = (regs[1] & (1u << 30)) != 0;
+	if (!avx2) {
+		return CpuDispatch::TIER_SSE2;
+	}
+	if (avx512f && avx512bw && (xcr0 & 0xe6) == 0xe6) {
+		return CpuDispatch::TIER_AVX512;
+	}
+	return CpuDispatch::TIER_AVX2;
+#else
+	return CpuDispatch::TIER_SCALAR;
+#endif
+}
+
+string brand() {
+#ifdef DIP_X86
+	uint32_t regs[4];
+	cpuid(0x80000000, 0, regs);
+	if (regs[0] >= 0x80000004) {
+		char res[49] = {};
+		rep(i, 3) {
+			cpuid(0x80000002 + i, 0, regs);
+			memcpy(res + 16 * i, regs, 16);
+		}
+		string trimmed(res);
+		trimmed.erase(0, trimmed.find_first_not_of(' '));
+		return trimmed;
+	}
+#endif
+	return "unknown cpu";
+}
+
+// Until initFromEnvironment() runs, the portable kernels are used.
+CpuDispatch::Tier current = CpuDispatch::TIER_SCALAR;
+
+}
+
+const CpuKernels* CpuDispatch::table = &scalarKernels;
+
+CpuDispatch::Tier CpuDispatch::detectedTier() {
+	static const Tier detected = detect();
+	return detected;
+}
+
+// The brand string and the number of hardware threads, e.g. to key settings
+// that depend on the machine.
+string CpuDispatch::cpuModel() {
+	static const string model = brand() + " / " + to_string(thread::hardware_concurrency()) + " threads";
+	return model;
+}
+
+CpuDispatch::Tier CpuDispatch::tier() {
+	return current;
+}
+
+CpuDispatch::Tier CpuDispatch::setTier(Tier value) {
+	if (value > detectedTier()) {
+		value = detectedTier();
+	}
+	current = value;
+	table = TIER_TABLES[value];
+	return value;
+}
+
+const char* CpuDispatch::tierName(Tier value) {
+	return betw(value, TIER_SCALAR, TIER_COUNT) ? TIER_NAMES[value] : "unknown";
+}
+
+bool CpuDispatch::parseTier(const string& name, Tier& value) {
+	rep(i, (int) TIER_COUNT) {
+		if (name == TIER_NAMES[i]) {
+			value = (Tier) i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void CpuDispatch::initFromEnvironment() {
+	const char *env = getenv("DIP_CPU_TIER");
+	Tier value = detectedTier();
+	if (env && *env && !parseTier(env, value)) {
+		Utils::c_fprintf(COLOR_YELLOW, stderr, "unknown DIP_CPU_TIER %s\n", env);
+		value = detectedTier();
+	}
+	if (setTier(value) != value) {
+		Utils::c_fprintf(COLOR_YELLOW, stderr, "DIP_CPU_TIER %s is not supported here, using %s\n", env, tierName(tier()));
+	}
+	Trace::setMetadata("cpu tier", tierName(tier()));
+	Trace::setMetadata("cpu tier detected", tierName(detectedTier()));
+	Trace::setMetadata("cpu model", cpuModel());
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "CpuKernels.h"
+
+#include <string>
+
+// Selects the kernel table for the widest instruction set the CPU and OS
+// support. DIP_CPU_TIER=scalar|sse2|avx2|avx512 forces a tier for testing;
+// a tier above what the hardware supports is clamped to the detected one.
+class CpuDispatch {
+public:
+	enum Tier {
+		TIER_SCALAR,
+		TIER_SSE2,
+		TIER_AVX2,
+		TIER_AVX512,
+		TIER_COUNT
+	};
+
+	static void initFromEnvironment();
+
+	static Tier detectedTier();
+	static std::string cpuModel();
+	static Tier tier();
+	static Tier setTier(Tier value);
+	static const char* tierName(Tier value);
+	static bool parseTier(const std::string& name, Tier& value);
+
+	static inline const CpuKernels& kernels() {
+		return *table;
+	}
+
+private:
+	static const CpuKernels *table;
+};
\ No newline at end of file
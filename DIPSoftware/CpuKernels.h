@@ -0,0 +1,45 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <cstddef>
+
+// Raw-pointer kernels behind the hot Utils operations. The same source
+// (CpuKernels.inl) is compiled once per instruction set tier and CpuDispatch
+// picks a table at startup. Steps are in bytes, sizes in pixels, cn is the
+// channel count (1, 3 or 4) and alpha, when present, is passed through.
+// Every tier produces bit-identical results.
+struct CpuKernels {
+	// hist[256] is accumulated into, not cleared.
+	void (*histogram)(const uchar *src, size_t step, int width, int height, int cn, int channel, int *hist);
+	void (*greyHistogram)(const uchar *src, size_t step, int width, int height, int cn, int *hist);
+	// Grey and per-channel histograms of a colour image in one pass; bgr
+	// holds three 256 entry histograms in memory channel order.
+	void (*colorHistograms)(const uchar *src, size_t step, int width, int height, int cn, int *grey, int *bgr);
+	// maps holds one 256 entry table per colour channel.
+	void (*applyLUT)(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, const uchar (*maps)[256]);
+
+	void (*lightness)(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, float delta);
+	void (*saturation)(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, float delta);
+	// Shifts the hue of the HSL planes h, s and l (CV_32F, all with step
+	// planeStep) by delta degrees; src only supplies alpha and may be dst.
+	void (*hue)(const float *h, const float *s, const float *l, size_t planeStep, const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, float delta);
+	// coeffs holds three rows of four Q12 integers in memory channel order,
+	// the last one the offset including the rounding term.
+	void (*colorMatrix)(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, const int *coeffs);
+
+	// type: 0 Robert, 1 Prewitt, 2 Sobel, 3 Laplace. The one pixel border is zero.
+	void (*gradient)(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, int type);
+	void (*sharpenBlend)(const uchar *src, size_t srcStep, const uchar *grad, size_t gradStep, uchar *dst, size_t dstStep, int width, int height, int cn, float t);
+
+	// Separable gaussian: tmp has the colour channels of src only. height and
+	// width are those of the output of each pass.
+	void (*gaussianVertical)(const uchar *src, size_t srcStep, float *tmp, size_t tmpStep, int width, int height, int cn, const float *kernel, int size);
+	void (*gaussianHorizontal)(const float *tmp, size_t tmpStep, uchar *dst, size_t dstStep, int width, int height, int cn, const float *kernel, int size);
+
+	// Inverse-maps every output pixel by the rotation and interpolates
+	// bilinearly. Only dst rows [rowBegin, rowEnd) are written.
+	void (*rotate)(const uchar *src, size_t srcStep, int srcRows, int srcCols, uchar *dst, size_t dstStep, int rowBegin, int rowEnd, int dstCols, int cn, float cosTheta, float sinTheta, float cx, float cy, float dx, float dy);
+};
+
+extern const CpuKernels scalarKernels, sse2Kernels, avx2Kernels, avx512Kernels;
\ No newline at end of file
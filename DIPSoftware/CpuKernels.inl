@@ -0,0 +1,584 @@
+// Kernel bodies shared by the CpuKernels*.cpp tier files. Each includer
+// defines CPU_KERNELS to the name of its table and sets the target options
+// before including this file. Everything here has internal linkage and the
+// only library functions called are the C library's (roundf, abs), built
+// once outside the tiers. The <cmath> overloads, std::round and the touc
+// macro on top of it, are inline: every tier would emit its own copy and the
+// linker could keep any one of them for all tiers. Loops are left to the
+// auto-vectorizer except where it cannot help (table lookups); for those an
+// x86 tier may define CPU_KERNELS_GATHER_AVX2 or CPU_KERNELS_GATHER_AVX512
+// after including <immintrin.h>.
+//
+// The arithmetic is copied expression for expression from the scalar
+// originals so that every tier stays bit-identical to ReferenceUtils; keep
+// it that way when editing (and keep FP contraction off in the tier files).
+
+#ifndef CPU_KERNELS
+#error "define CPU_KERNELS before including CpuKernels.inl"
+#endif
+
+#define KERNEL_EPSILON 1e-3
+
+namespace {
+
+inline uchar maxOf(uchar a, uchar b) {
+	return a > b ? a : b;
+}
+
+inline uchar minOf(uchar a, uchar b) {
+	return a < b ? a : b;
+}
+
+// touc with the C library's roundf.
+inline uchar roundToByte(float v) {
+	return (uchar) roundf(v);
+}
+
+inline uchar clampToByte(int v) {
+	return (uchar) (v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+inline const uchar* row(const uchar *data, size_t step, int i) {
+	return data + step * i;
+}
+
+inline uchar* row(uchar *data, size_t step, int i) {
+	return data + step * i;
+}
+
+void copyAlphaLanes(const uchar *src, uchar *dst, int width) {
+	for (int j = 3; j < width * 4; j += 4) {
+		dst[j] = src[j];
+	}
+}
+
+void histogram(const uchar *src, size_t step, int width, int height, int cn, int channel, int *hist) {
+	// Four partial histograms break the store-to-load dependency on runs of
+	// equal pixels.
+	int partial[4][256] = {};
+	for (int i = 0; i < height; ++i) {
+		const uchar *p = row(src, step, i) + channel;
+		int j = 0;
+		for (; j + 4 <= width; j += 4) {
+			++partial[0][p[0]];
+			++partial[1][p[cn]];
+			++partial[2][p[2 * cn]];
+			++partial[3][p[3 * cn]];
+			p += 4 * cn;
+		}
+		for (; j < width; ++j) {
+			++partial[0][*p];
+			p += cn;
+		}
+	}
+	for (int v = 0; v < 256; ++v) {
+		hist[v] += partial[0][v] + partial[1][v] + partial[2][v] + partial[3][v];
+	}
+}
+
+// round((b + g + r) / 3.0) without the division: a third is never a half.
+void greyHistogram(const uchar *src, size_t step, int width, int height, int cn, int *hist) {
+	int partial[2][256] = {};
+	for (int i = 0; i < height; ++i) {
+		const uchar *p = row(src, step, i);
+		int j = 0;
+		for (; j + 2 <= width; j += 2) {
+			++partial[0][(p[0] + p[1] + p[2] + 1) / 3];
+			++partial[1][(p[cn] + p[cn + 1] + p[cn + 2] + 1) / 3];
+			p += 2 * cn;
+		}
+		for (; j < width; ++j) {
+			++partial[0][(p[0] + p[1] + p[2] + 1) / 3];
+			p += cn;
+		}
+	}
+	for (int v = 0; v < 256; ++v) {
+		hist[v] += partial[0][v] + partial[1][v];
+	}
+}
+
+void colorHistograms(const uchar *src, size_t step, int width, int height, int cn, int *grey, int *bgr) {
+	int partial[4][256] = {};
+	for (int i = 0; i < height; ++i) {
+		const uchar *p = row(src, step, i);
+		for (int j = 0; j < width; ++j) {
+			++partial[0][p[0]];
+			++partial[1][p[1]];
+			++partial[2][p[2]];
+			++partial[3][(p[0] + p[1] + p[2] + 1) / 3];
+			p += cn;
+		}
+	}
+	for (int v = 0; v < 256; ++v) {
+		bgr[v] += partial[0][v];
+		bgr[256 + v] += partial[1][v];
+		bgr[512 + v] += partial[2][v];
+		grey[v] += partial[3][v];
+	}
+}
+
+// Table lookups over a flat run of n interleaved bytes: byte k goes through
+// tables[k % cn], 256 ints each; for BGRA the fourth table is the identity,
+// so alpha passes through the same path. The gather tiers look up a whole
+// vector of bytes at once.
+void lutPixels(const uchar *s, uchar *d, int n, int cn, const int *tables) {
+	const int *t0 = tables, *t1 = tables + 256, *t2 = tables + 512;
+	if (cn == 1) {
+		for (int k = 0; k < n; ++k) {
+			d[k] = (uchar) t0[s[k]];
+		}
+		return;
+	}
+	for (int k = 0; k < n; k += cn) {
+		d[k] = (uchar) t0[s[k]];
+		d[k + 1] = (uchar) t1[s[k + 1]];
+		d[k + 2] = (uchar) t2[s[k + 2]];
+		if (cn == 4) {
+			d[k + 3] = s[k + 3];
+		}
+	}
+}
+
+#if defined(CPU_KERNELS_GATHER_AVX512)
+void lutRun(const uchar *s, uchar *d, int n, int cn, const int *tables) {
+	__m512i offsets[3];
+	for (int r = 0; r < 3; ++r) {
+		int lanes[16];
+		for (int l = 0; l < 16; ++l) {
+			lanes[l] = (r * 16 + l) % cn * 256;
+		}
+		offsets[r] = _mm512_loadu_si512(lanes);
+	}
+	int k = 0;
+	for (; k + 48 <= n; k += 48) {
+		for (int r = 0; r < 3; ++r) {
+			__m512i index = _mm512_add_epi32(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*) (s + k + r * 16))), offsets[r]);
+			_mm_storeu_si128((__m128i*) (d + k + r * 16), _mm512_cvtepi32_epi8(_mm512_i32gather_epi32(index, tables, 4)));
+		}
+	}
+	lutPixels(s + k, d + k, n - k, cn, tables);
+}
+#elif defined(CPU_KERNELS_GATHER_AVX2)
+void lutRun(const uchar *s, uchar *d, int n, int cn, const int *tables) {
+	__m256i offsets[3];
+	for (int r = 0; r < 3; ++r) {
+		int lanes[8];
+		for (int l = 0; l < 8; ++l) {
+			lanes[l] = (r * 8 + l) % cn * 256;
+		}
+		offsets[r] = _mm256_loadu_si256((const __m256i*) lanes);
+	}
+	// Low byte of every lane to the bottom of each 128-bit half, then both
+	// halves next to each other.
+	const __m256i packBytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i packLanes = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+	int k = 0;
+	for (; k + 24 <= n; k += 24) {
+		for (int r = 0; r < 3; ++r) {
+			__m256i index = _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (s + k + r * 8))), offsets[r]);
+			__m256i v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_i32gather_epi32(tables, index, 4), packBytes), packLanes);
+			_mm_storel_epi64((__m128i*) (d + k + r * 8), _mm256_castsi256_si128(v));
+		}
+	}
+	lutPixels(s + k, d + k, n - k, cn, tables);
+}
+#else
+void lutRun(const uchar *s, uchar *d, int n, int cn, const int *tables) {
+	lutPixels(s, d, n, cn, tables);
+}
+#endif
+
+// Contiguous images are cut into runs that ignore row boundaries, so narrow
+// images still go through the vector loop in long stretches.
+void applyLUT(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, const uchar (*maps)[256]) {
+	const int RUN_PIXELS = 1 << 14;
+	int tables[4 * 256];
+	for (int c = 0; c < cn; ++c) {
+		for (int v = 0; v < 256; ++v) {
+			tables[c * 256 + v] = c < 3 ? maps[c][v] : v;
+		}
+	}
+	bool flat = srcStep == (size_t) width * cn && dstStep == srcStep;
+	long long pixels = (long long) width * height;
+	int runs = flat ? (int) ((pixels + RUN_PIXELS - 1) / RUN_PIXELS) : height;
+	#pragma omp parallel for if(runs > 1)
+	for (int i = 0; i < runs; ++i) {
+		if (flat) {
+			long long first = (long long) i * RUN_PIXELS;
+			int n = (int) (first + RUN_PIXELS < pixels ? RUN_PIXELS : pixels - first);
+			lutRun(src + first * cn, dst + first * cn, n * cn, cn, tables);
+		} else {
+			lutRun(row(src, srcStep, i), row(dst, dstStep, i), width * cn, cn, tables);
+		}
+	}
+}
+
+inline void lightnessPixel(const uchar *rgb, uchar *out, float delta) {
+	float maxValue, minValue;
+	maxValue = maxOf(rgb[0], maxOf(rgb[1], rgb[2]));
+	minValue = minOf(rgb[0], minOf(rgb[1], rgb[2]));
+	float L = (maxValue + minValue) * 1.0 / 510;
+	if (delta < 1) {
+		float alpha = L * (1 - delta) / (L * (1 - delta) + delta);
+		out[0] = roundToByte((1 - alpha) * rgb[0] + alpha * 255);
+		out[1] = roundToByte((1 - alpha) * rgb[1] + alpha * 255);
+		out[2] = roundToByte((1 - alpha) * rgb[2] + alpha * 255);
+	} else {
+		out[0] = roundToByte(rgb[0] / (L * (1 - delta) + delta));
+		out[1] = roundToByte(rgb[1] / (L * (1 - delta) + delta));
+		out[2] = roundToByte(rgb[2] / (L * (1 - delta) + delta));
+	}
+}
+
+inline void saturationPixel(const uchar *rgb, uchar *out, float delta) {
+	float maxValue, minValue;
+	maxValue = maxOf(rgb[0], maxOf(rgb[1], rgb[2]));
+	minValue = minOf(rgb[0], minOf(rgb[1], rgb[2]));
+	float L, S;
+	L = (maxValue + minValue) * 1.0 / 510;
+	if (maxValue + minValue < 255) {
+		S = (maxValue - minValue) * 1.0 / (maxValue + minValue);
+	} else {
+		S = (maxValue - minValue) * 1.0 / (510 - maxValue - minValue);
+	}
+
+	float alpha;
+	if (delta > 0) {
+		float keep = 1 - delta;
+		alpha = 1.0f / (S > keep ? S : keep) - 1;
+		out[0] = roundToByte(rgb[0] + (rgb[0] - L * 255) * alpha);
+		out[1] = roundToByte(rgb[1] + (rgb[1] - L * 255) * alpha);
+		out[2] = roundToByte(rgb[2] + (rgb[2] - L * 255) * alpha);
+	} else {
+		alpha = delta;
+		out[0] = roundToByte(L * 255 + (rgb[0] - L * 255) * (1 + alpha));
+		out[1] = roundToByte(L * 255 + (rgb[1] - L * 255) * (1 + alpha));
+		out[2] = roundToByte(L * 255 + (rgb[2] - L * 255) * (1 + alpha));
+	}
+}
+
+// A grey image has 256 distinct pixels, so the adjustment is tabulated.
+template<void (*pixel)(const uchar *, uchar *, float)>
+void adjustPixels(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, float delta) {
+	if (cn == 1) {
+		uchar map[1][256];
+		for (int v = 0; v < 256; ++v) {
+			uchar in[3] = { (uchar) v, (uchar) v, (uchar) v }, out[3];
+			pixel(in, out, delta);
+			map[0][v] = out[0];
+		}
+		applyLUT(src, srcStep, dst, dstStep, width, height, 1, map);
+		return;
+	}
+	#pragma omp parallel for
+	for (int i = 0; i < height; ++i) {
+		const uchar *s = row(src, srcStep, i);
+		uchar *d = row(dst, dstStep, i);
+		for (int j = 0; j < width; ++j, s += cn, d += cn) {
+			uchar out[3];
+			pixel(s, out, delta);
+			d[0] = out[0];
+			d[1] = out[1];
+			d[2] = out[2];
+			if (cn == 4) {
+				d[3] = s[3];
+			}
+		}
+	}
+}
+
+void lightness(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, float delta) {
+	adjustPixels<lightnessPixel>(src, srcStep, dst, dstStep, width, height, cn, delta);
+}
+
+void saturation(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, float delta) {
+	adjustPixels<saturationPixel>(src, srcStep, dst, dstStep, width, height, cn, delta);
+}
+
+// Utils::HSL2RGB after the hue shift of changeHSLPlanesHue.
+inline void huePixel(float h, float s, float l, float delta, uchar *out) {
+	h += delta;
+	if (h < 0) {
+		h += 360.0;
+	} else if (h > 360.0) {
+		h -= 360.0;
+	}
+
+	if (s < 1e-3) {
+		out[0] = out[1] = out[2] = roundToByte(l);
+		return;
+	}
+
+	float rgb[3];
+	float p, q;
+	if (l < 0.5) {
+		q = l * (1 + s);
+	} else {
+		q = l + s - (l * s);
+	}
+	p = 2 * l - q;
+
+	rgb[1] = h / 360.0;
+	rgb[0] = rgb[1] + 1.0 / 3;
+	rgb[2] = rgb[1] - 1.0 / 3;
+
+	for (int i = 0; i < 3; ++i) {
+		if (rgb[i] < 0) {
+			rgb[i] += 1.0;
+		} else if (rgb[i] >= 1.0) {
+			rgb[i] -= 1.0;
+		}
+
+		if (rgb[i] < 1.0 / 6) {
+			rgb[i] = p + ((q - p) * 6 * rgb[i]);
+		} else if (rgb[i] < 0.5) {
+			rgb[i] = q;
+		} else if (rgb[i] < 2.0 / 3) {
+			rgb[i] = p + ((q - p) * 6 * (2.0 / 3 - rgb[i]));
+		} else {
+			rgb[i] = p;
+		}
+	}
+
+	out[0] = roundToByte(rgb[2] * 255);
+	out[1] = roundToByte(rgb[1] * 255);
+	out[2] = roundToByte(rgb[0] * 255);
+}
+
+void hue(const float *h, const float *s, const float *l, size_t planeStep, const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, float delta) {
+	#pragma omp parallel for
+	for (int i = 0; i < height; ++i) {
+		const float *hr = (const float*) row((const uchar*) h, planeStep, i);
+		const float *sr = (const float*) row((const uchar*) s, planeStep, i);
+		const float *lr = (const float*) row((const uchar*) l, planeStep, i);
+		const uchar *a = row(src, srcStep, i);
+		uchar *d = row(dst, dstStep, i);
+		for (int j = 0; j < width; ++j, a += cn, d += cn) {
+			// Read before the write, dst may be src.
+			uchar alpha = cn == 4 ? a[3] : 0;
+			huePixel(hr[j], sr[j], lr[j], delta, d);
+			if (cn == 4) {
+				d[3] = alpha;
+			}
+		}
+	}
+}
+
+// Integer only, so every tier gives the same bytes. The channel count is a
+// template argument so that the loop has a constant stride the compiler can
+// vectorize; grey images go through a table built by ColorMatrix.
+template<int cn>
+void colorMatrixRows(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, const int *coeffs) {
+	const int c0 = coeffs[0], c1 = coeffs[1], c2 = coeffs[2], c3 = coeffs[3];
+	const int c4 = coeffs[4], c5 = coeffs[5], c6 = coeffs[6], c7 = coeffs[7];
+	const int c8 = coeffs[8], c9 = coeffs[9], c10 = coeffs[10], c11 = coeffs[11];
+	#pragma omp parallel for
+	for (int i = 0; i < height; ++i) {
+		const uchar *s = row(src, srcStep, i);
+		uchar *d = row(dst, dstStep, i);
+		for (int j = 0; j < width; ++j) {
+			int b = s[j * cn], g = s[j * cn + 1], r = s[j * cn + 2];
+			int v0 = (c0 * b + c1 * g + c2 * r + c3) >> 12;
+			int v1 = (c4 * b + c5 * g + c6 * r + c7) >> 12;
+			int v2 = (c8 * b + c9 * g + c10 * r + c11) >> 12;
+			d[j * cn] = (uchar) (v0 < 0 ? 0 : v0 > 255 ? 255 : v0);
+			d[j * cn + 1] = (uchar) (v1 < 0 ? 0 : v1 > 255 ? 255 : v1);
+			d[j * cn + 2] = (uchar) (v2 < 0 ? 0 : v2 > 255 ? 255 : v2);
+			if (cn == 4) {
+				d[j * cn + 3] = s[j * cn + 3];
+			}
+		}
+	}
+}
+
+void colorMatrix(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, const int *coeffs) {
+	if (cn == 4) {
+		colorMatrixRows<4>(src, srcStep, dst, dstStep, width, height, coeffs);
+	} else {
+		colorMatrixRows<3>(src, srcStep, dst, dstStep, width, height, coeffs);
+	}
+}
+
+// Rows are processed as flat interleaved arrays so that every channel of a
+// run of pixels goes through the same vector lanes.
+void gradient(const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, int height, int cn, int type) {
+	int begin = cn, end = (width - 1) * cn;
+	for (int i = 0; i < height; ++i) {
+		uchar *d = row(dst, dstStep, i);
+		if (i == 0 || i == height - 1 || width < 3) {
+			for (int x = 0; x < width * cn; ++x) {
+				d[x] = 0;
+			}
+			continue;
+		}
+		const uchar *r0 = row(src, srcStep, i - 1), *r1 = row(src, srcStep, i), *r2 = row(src, srcStep, i + 1);
+		for (int x = 0; x < begin; ++x) {
+			d[x] = 0;
+			d[end + x] = 0;
+		}
+		if (type == 0) {
+			for (int x = begin; x < end; ++x) {
+				int tmp = abs(r1[x] - r2[x + cn]) + abs(r1[x + cn] - r2[x]);
+				d[x] = (uchar) (tmp > 255 ? 255 : tmp);
+			}
+		} else if (type == 1) {
+			for (int x = begin; x < end; ++x) {
+				int tmp = abs(r0[x + cn] + r1[x + cn] + r2[x + cn] - r0[x - cn] - r1[x - cn] - r2[x - cn]) +
+					abs(r2[x - cn] + r2[x] + r2[x + cn] - r0[x - cn] - r0[x] - r0[x + cn]);
+				d[x] = (uchar) (tmp > 255 ? 255 : tmp);
+			}
+		} else if (type == 2) {
+			for (int x = begin; x < end; ++x) {
+				int tmp = abs(r0[x + cn] + 2 * r1[x + cn] + r2[x + cn] - r0[x - cn] - 2 * r1[x - cn] - r2[x - cn]) +
+					abs(r2[x - cn] + 2 * r2[x] + r2[x + cn] - r0[x - cn] - 2 * r0[x] - r0[x + cn]);
+				d[x] = (uchar) (tmp > 255 ? 255 : tmp);
+			}
+		} else {
+			for (int x = begin; x < end; ++x) {
+				int tmp = abs(r1[x] * 8 - r0[x - cn] - r0[x] - r0[x + cn] - r1[x - cn] - r1[x + cn] - r2[x - cn] - r2[x] - r2[x + cn]);
+				d[x] = (uchar) (tmp > 255 ? 255 : tmp);
+			}
+		}
+		if (cn == 4) {
+			for (int x = 3; x < width * 4; x += 4) {
+				d[x] = 0;
+			}
+		}
+	}
+}
+
+void sharpenBlend(const uchar *src, size_t srcStep, const uchar *grad, size_t gradStep, uchar *dst, size_t dstStep, int width, int height, int cn, float t) {
+	for (int i = 0; i < height; ++i) {
+		const uchar *s = row(src, srcStep, i), *g = row(grad, gradStep, i);
+		uchar *d = row(dst, dstStep, i);
+		for (int x = 0; x < width * cn; ++x) {
+			int tmp = (int) roundf(s[x] + t * g[x]);
+			d[x] = clampToByte(tmp);
+		}
+		if (cn == 4) {
+			copyAlphaLanes(s, d, width);
+		}
+	}
+}
+
+// Each output element sums kernel[k] * input[k] in k order from zero, the
+// same sequence as the per-pixel original; only the loop nesting differs.
+void gaussianVertical(const uchar *src, size_t srcStep, float *tmp, size_t tmpStep, int width, int height, int cn, const float *kernel, int size) {
+	int ccn = cn == 4 ? 3 : cn;
+	for (int i = 0; i < height; ++i) {
+		float *t = (float*) ((uchar*) tmp + tmpStep * i);
+		for (int x = 0; x < width * ccn; ++x) {
+			t[x] = 0;
+		}
+		for (int k = 0; k < size; ++k) {
+			const uchar *s = row(src, srcStep, i + k);
+			float w = kernel[k];
+			if (cn == ccn) {
+				for (int x = 0; x < width * cn; ++x) {
+					t[x] += w * s[x];
+				}
+			} else {
+				for (int j = 0; j < width; ++j) {
+					t[j * 3] += w * s[j * 4];
+					t[j * 3 + 1] += w * s[j * 4 + 1];
+					t[j * 3 + 2] += w * s[j * 4 + 2];
+				}
+			}
+		}
+	}
+}
+
+void gaussianHorizontal(const float *tmp, size_t tmpStep, uchar *dst, size_t dstStep, int width, int height, int cn, const float *kernel, int size) {
+	int ccn = cn == 4 ? 3 : cn;
+	float *acc = new float[width * ccn];
+	for (int i = 0; i < height; ++i) {
+		const float *t = (const float*) ((const uchar*) tmp + tmpStep * i);
+		uchar *d = row(dst, dstStep, i);
+		for (int x = 0; x < width * ccn; ++x) {
+			acc[x] = 0;
+		}
+		for (int k = 0; k < size; ++k) {
+			const float *tk = t + k * ccn;
+			float w = kernel[k];
+			for (int x = 0; x < width * ccn; ++x) {
+				acc[x] += w * tk[x];
+			}
+		}
+		if (cn == ccn) {
+			for (int x = 0; x < width * cn; ++x) {
+				d[x] = roundToByte(acc[x]);
+			}
+		} else {
+			for (int j = 0; j < width; ++j) {
+				d[j * 4] = roundToByte(acc[j * 3]);
+				d[j * 4 + 1] = roundToByte(acc[j * 3 + 1]);
+				d[j * 4 + 2] = roundToByte(acc[j * 3 + 2]);
+			}
+		}
+	}
+	delete[] acc;
+}
+
+void rotate(const uchar *src, size_t srcStep, int srcRows, int srcCols, uchar *dst, size_t dstStep, int rowBegin, int rowEnd, int dstCols, int cn, float cosTheta, float sinTheta, float cx, float cy, float dx, float dy) {
+	int w = srcRows, h = srcCols;
+	for (int i = rowBegin; i < rowEnd; ++i) {
+		uchar *d = row(dst, dstStep, i);
+		for (int j = 0; j < dstCols; ++j, d += cn) {
+			float x, y;
+			x = cosTheta * (i - cx - dx) - sinTheta * (j - cy - dy) + cx;
+			y = sinTheta * (i - cx - dx) + cosTheta * (j - cy - dy) + cy;
+			if (!(betw(x, -KERNEL_EPSILON, w + KERNEL_EPSILON) && betw(y, -KERNEL_EPSILON, h + KERNEL_EPSILON))) {
+				for (int k = 0; k < cn; ++k) {
+					d[k] = k < 3 ? 255 : 0;
+				}
+				continue;
+			}
+
+			int x1, x2, y1, y2;
+			x1 = (int) x;
+			y1 = (int) y;
+			x2 = x1 + 1;
+			y2 = y1 + 1;
+			const uchar *p11 = row(src, srcStep, x1) + y1 * cn;
+			const uchar *p21 = x2 < srcRows ? row(src, srcStep, x2) + y1 * cn : p11;
+			const uchar *p12 = p11 + cn, *p22 = p21 + cn;
+			for (int k = 0; k < cn; ++k) {
+				float v;
+				if (x < srcRows - 1 && y < srcCols - 1) {
+					v = p11[k] * (x2 - x) * (y2 - y) +
+						p21[k] * (x - x1) * (y2 - y) +
+						p12[k] * (x2 - x) * (y - y1) +
+						p22[k] * (x - x1) * (y - y1);
+				} else if (x == srcRows - 1 && y < srcCols - 1) {
+					v = p11[k] * (y2 - y) + p12[k] * (y - y1);
+				} else if (x < srcRows - 1 && y == srcCols - 1) {
+					v = p11[k] * (x2 - x) + p21[k] * (x - x1);
+				} else {
+					v = p11[k];
+				}
+				d[k] = roundToByte(v);
+			}
+		}
+	}
+}
+
+}
+
+const CpuKernels CPU_KERNELS = {
+	histogram,
+	greyHistogram,
+	colorHistograms,
+	applyLUT,
+	lightness,
+	saturation,
+	hue,
+	colorMatrix,
+	gradient,
+	sharpenBlend,
+	gaussianVertical,
+	gaussianHorizontal,
+	rotate,
+};
+
+#undef KERNEL_EPSILON
\ No newline at end of file
@@ -0,0 +1,33 @@
+// AVX2 tier. MSVC has no per-function targets; build this file with /arch:AVX2.
+#include "CpuKernels.h"
+#include "Utils.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define CPU_KERNELS_GATHER_AVX2
+#endif
+
+using namespace cv;
+using namespace std;
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#pragma GCC optimize("fp-contract=off")
+#endif
+#endif
+
+#define CPU_KERNELS avx2Kernels
+#include "CpuKernels.inl"
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+#endif
\ No newline at end of file
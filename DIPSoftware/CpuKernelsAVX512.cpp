@@ -0,0 +1,33 @@
+// AVX-512 (F + BW) tier. MSVC has no per-function targets; build this file with /arch:AVX512.
+#include "CpuKernels.h"
+#include "Utils.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define CPU_KERNELS_GATHER_AVX512
+#endif
+
+using namespace cv;
+using namespace std;
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#pragma clang attribute push (__attribute__((target("avx512f,avx512bw"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+#pragma GCC optimize("fp-contract=off")
+#endif
+#endif
+
+#define CPU_KERNELS avx512Kernels
+#include "CpuKernels.inl"
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+#endif
\ No newline at end of file
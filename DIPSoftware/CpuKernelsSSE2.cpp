@@ -0,0 +1,28 @@
+// SSE2 tier, the x86-64 baseline. MSVC builds it with the project's default /arch.
+#include "CpuKernels.h"
+#include "Utils.h"
+
+using namespace cv;
+using namespace std;
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#pragma clang attribute push (__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#pragma GCC optimize("fp-contract=off")
+#endif
+#endif
+
+#define CPU_KERNELS sse2Kernels
+#include "CpuKernels.inl"
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+#endif
\ No newline at end of file
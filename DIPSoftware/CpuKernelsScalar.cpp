@@ -0,0 +1,19 @@
+// Scalar tier: the baseline build with auto-vectorization off, so that every
+// other tier can be compared against plain code on the same machine.
+#include "CpuKernels.h"
+#include "Utils.h"
+
+using namespace cv;
+using namespace std;
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize("no-tree-vectorize", "fp-contract=off")
+#endif
+
+#define CPU_KERNELS scalarKernels
+#include "CpuKernels.inl"
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
\ No newline at end of file
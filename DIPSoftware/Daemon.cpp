@@ -0,0 +1,375 @@
+#include "Daemon.h"
+#include "BufferPool.h"
+#include "ImageWriter.h"
+#include "ResultCache.h"
+#include "SocketIO.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+const size_t LATENCY_SAMPLES = 4096;
+
+vector<string> split(const string& text, char separator) {
+	vector<string> res;
+	string word;
+	istringstream in(text);
+	while (getline(in, word, separator)) {
+		if (word.size()) {
+			res.push_back(word);
+		}
+	}
+	return res;
+}
+
+double percentile(vector<double> values, double fraction) {
+	if (values.empty()) {
+		return 0;
+	}
+	size_t k = min(values.size() - 1, (size_t) (fraction * values.size()));
+	nth_element(values.begin(), values.begin() + k, values.end());
+	return values[k];
+}
+
+#ifndef _WIN32
+// Wraps a read-only mapping of the shared memory object as mat; the caller
+// unmaps data once done with it. Returns the error reply, empty on success.
+// An object shorter than the image is refused, as reading past its end would
+// raise SIGBUS and take the daemon down.
+string mapSharedImage(const string& name, int rows, int cols, int channels, Mat& mat, void *&data, size_t& size) {
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0) {
+		return "error cannot map " + name;
+	}
+	size = (size_t) rows * cols * channels;
+	struct stat st;
+	if (fstat(fd, &st) || (size_t) st.st_size < size) {
+		::close(fd);
+		return "error " + name + " is smaller than " + to_string(cols) + "x" + to_string(rows) + "x" + to_string(channels);
+	}
+	data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		return "error cannot map " + name;
+	}
+	mat = Mat(rows, cols, CV_8UC(channels), data);
+	return "";
+}
+
+bool writeSharedImage(const string& name, const Mat& mat) {
+	int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+	if (fd < 0) {
+		return false;
+	}
+	size_t rowBytes = (size_t) mat.cols * mat.elemSize(), size = rowBytes * mat.rows;
+	void *data = ftruncate(fd, size) ? MAP_FAILED : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	rep(i, mat.rows) {
+		memcpy((uchar*) data + i * rowBytes, mat.ptr(i), rowBytes);
+	}
+	munmap(data, size);
+	return true;
+}
+#endif
+
+}
+
+string Daemon::defaultSocketPath() {
+	const char *env = getenv("DIP_SOCKET");
+	if (env && *env) {
+		return env;
+	}
+	const char *runtime = getenv("XDG_RUNTIME_DIR");
+	return string(runtime && *runtime ? runtime : "/tmp") + "/dipsoftware.sock";
+}
+
+Daemon::Options Daemon::defaultOptions() {
+	return { defaultSocketPath(), 2, 16 };
+}
+
+int Daemon::run(const Options& options) {
+	Daemon daemon(options);
+	daemon.listenFd = SocketIO::listenUnix(options.socketPath);
+	if (daemon.listenFd < 0) {
+		if (errno == EADDRINUSE) {
+			Utils::c_fprintf(COLOR_RED, stderr, "a daemon is already listening on %s\n", options.socketPath.c_str());
+		} else {
+			Utils::c_fprintf(COLOR_RED, stderr, "cannot listen on %s: %s\n", options.socketPath.c_str(), strerror(errno));
+		}
+		return 1;
+	}
+	if (!SocketIO::openWakePipe(daemon.wakeRead, daemon.wakeWrite)) {
+		SocketIO::close(daemon.listenFd);
+		Utils::c_fprintf(COLOR_RED, stderr, "cannot create a pipe: %s\n", strerror(errno));
+		return 1;
+	}
+	daemon.started = clock::now();
+	printf("listening on %s with %d workers\n", options.socketPath.c_str(), options.workers);
+	fflush(stdout);
+
+	vector<thread> workers;
+	rep(i, options.workers) {
+		workers.emplace_back(&Daemon::work, &daemon);
+	}
+	while (true) {
+		int fd = SocketIO::accept(daemon.listenFd, daemon.wakeRead);
+		if (fd < 0) {
+			break;
+		}
+		lock_guard<mutex> lock(daemon.mtx);
+		if (daemon.stopping) {
+			SocketIO::close(fd);
+			break;
+		}
+		daemon.clients.insert(fd);
+		++daemon.connections;
+		thread(&Daemon::serve, &daemon, fd).detach();
+	}
+
+	{
+		lock_guard<mutex> lock(daemon.mtx);
+		daemon.stopping = true;
+	}
+	daemon.wake.notify_all();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	// Every job is answered by now; drop the clients that are still
+	// connected and wait for their threads.
+	unique_lock<mutex> lock(daemon.mtx);
+	for (int fd : daemon.clients) {
+		SocketIO::shutdown(fd);
+	}
+	daemon.drained.wait(lock, [&]() { return !daemon.connections; });
+	SocketIO::close(daemon.listenFd);
+	SocketIO::close(daemon.wakeRead);
+	SocketIO::close(daemon.wakeWrite);
+#ifndef _WIN32
+	unlink(options.socketPath.c_str());
+#endif
+	return 0;
+}
+
+void Daemon::serve(int fd) {
+	string line, buffer;
+	while (SocketIO::readLine(fd, line, buffer)) {
+		if (!SocketIO::writeLine(fd, handle(line))) {
+			break;
+		}
+	}
+	SocketIO::close(fd);
+	lock_guard<mutex> lock(mtx);
+	clients.erase(fd);
+	if (!--connections) {
+		drained.notify_all();
+	}
+}
+
+string Daemon::handle(const string& line) {
+	vector<string> words;
+	if (!SocketIO::splitWords(line, words)) {
+		return "error unterminated quote";
+	}
+	if (words.empty()) {
+		return "error empty request";
+	}
+	const string& command = words[0];
+	if (command == "stats" && words.size() == 1) {
+		return stats();
+	}
+	if (command == "shutdown" && words.size() == 1) {
+		{
+			lock_guard<mutex> lock(mtx);
+			stopping = true;
+		}
+		SocketIO::wake(wakeWrite);
+		return "ok";
+	}
+	if ((command == "file" && words.size() == 4) || (command == "shm" && words.size() == 5)) {
+		return submit(words, words.back());
+	}
+	return "error bad request: " + line;
+}
+
+// Queues the job and blocks this connection until a worker answers it.
+string Daemon::submit(const vector<string>& words, const string& opsKey) {
+	unique_ptr<Job> job(new Job);
+	string error;
+	job->chain = chainOf(opsKey, error);
+	if (!job->chain) {
+		return "error " + error;
+	}
+	job->words = words;
+	job->opsKey = opsKey;
+	job->queued = clock::now();
+	future<string> reply = job->reply.get_future();
+	{
+		lock_guard<mutex> lock(mtx);
+		if (stopping) {
+			return "error shutting down";
+		}
+		queue.push_back(move(job));
+	}
+	wake.notify_one();
+	return reply.get();
+}
+
+// Chains are built once per distinct ops list and shared by every job that
+// uses it.
+shared_ptr<const Daemon::chainType> Daemon::chainOf(const string& opsKey, string& error) {
+	lock_guard<mutex> lock(mtx);
+	auto& res = chains[opsKey];
+	if (res) {
+		return res;
+	}
+	auto chain = make_shared<chainType>();
+	string unknown;
+	if (!verifier.buildChain(split(opsKey == "-" ? string() : opsKey, ','), *chain, unknown)) {
+		chains.erase(opsKey);
+		error = "unknown op " + unknown;
+		return nullptr;
+	}
+	res = chain;
+	return res;
+}
+
+// Takes the oldest job and up to batchLimit - 1 queued jobs with the same
+// ops, so a batch runs back to back on warm state.
+void Daemon::work() {
+	while (true) {
+		vector<unique_ptr<Job>> batch;
+		{
+			unique_lock<mutex> lock(mtx);
+			wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty()) {
+				return;
+			}
+			batch.push_back(move(queue.front()));
+			queue.pop_front();
+			for (auto it = queue.begin(); it != queue.end() && (int) batch.size() < options.batchLimit; ) {
+				if ((*it)->opsKey == batch.front()->opsKey) {
+					batch.push_back(move(*it));
+					it = queue.erase(it);
+				} else {
+					++it;
+				}
+			}
+			++batches;
+		}
+
+		TRACE_SCOPE("Daemon::batch");
+		for (auto& job : batch) {
+			string reply = execute(*job);
+			double ms = chrono::duration<double, milli>(clock::now() - job->queued).count();
+			{
+				lock_guard<mutex> lock(mtx);
+				++jobsDone;
+				jobsFailed += reply.compare(0, 2, "ok") != 0;
+				latencies.push_back(ms);
+				if (latencies.size() > LATENCY_SAMPLES) {
+					latencies.pop_front();
+				}
+			}
+			job->reply.set_value(reply);
+		}
+	}
+}
+
+string Daemon::execute(const Job& job) {
+	TRACE_SCOPE("Daemon::execute");
+	auto begin = clock::now();
+	const string& input = job.words[1];
+	const string& output = job.words[2];
+	try {
+		if (job.words[0] == "file") {
+			Mat mat = Utils::readImageMat(input);
+			if (mat.empty()) {
+				return "error cannot read " + input;
+			}
+			mat = runChain(job, mat);
+			if (!ImageWriter::write(output, mat)) {
+				return "error cannot write " + output;
+			}
+			return format("ok %.3f", chrono::duration<double, milli>(clock::now() - begin).count());
+		}
+
+#ifndef _WIN32
+		int cols, rows, channels;
+		if (sscanf(job.words[3].c_str(), "%dx%dx%d", &cols, &rows, &channels) != 3 || cols <= 0 || rows <= 0 || (channels != 1 && channels != 3 && channels != 4)) {
+			return "error bad size " + job.words[3];
+		}
+		Mat mat;
+		void *data;
+		size_t size;
+		string error = mapSharedImage(input, rows, cols, channels, mat, data, size);
+		if (error.size()) {
+			return error;
+		}
+		Mat res = runChain(job, mat);
+		bool ok = writeSharedImage(output, res);
+		string reply = format("ok %dx%dx%d %.3f", res.cols, res.rows, res.channels(), chrono::duration<double, milli>(clock::now() - begin).count());
+		mat.release();
+		res.release();
+		munmap(data, size);
+		return ok ? reply : "error cannot write " + output;
+#else
+		return "error shared memory is not supported here";
+#endif
+	} catch (const cv::Exception& e) {
+		return string("error ") + e.what();
+	} catch (const bad_alloc&) {
+		return "error out of memory";
+	}
+}
+
+Mat Daemon::runChain(const Job& job, const Mat& mat) {
+	return ResultCache::instance().apply(mat, job.opsKey, [&](Mat res) {
+		for (const auto& op : *job.chain) {
+			res = op(res);
+		}
+		return res;
+	});
+}
+
+string Daemon::stats() {
+	vector<double> samples;
+	size_t depth;
+	uint64_t done, failed, batchCount;
+	{
+		lock_guard<mutex> lock(mtx);
+		samples.assign(latencies.begin(), latencies.end());
+		depth = queue.size();
+		done = jobsDone;
+		failed = jobsFailed;
+		batchCount = batches;
+	}
+	double uptime = chrono::duration<double>(clock::now() - started).count();
+	BufferPool::Stats pool = BufferPool::instance().stats();
+	ResultCache::Stats cache = ResultCache::instance().stats();
+	return format("ok queue=%d jobs=%llu failed=%llu batches=%llu p50=%.3f p95=%.3f max=%.3f uptime=%.1f pool_hits=%llu pool_misses=%llu pool_cached_mb=%.1f"
+		" cache_memory_hits=%llu cache_disk_hits=%llu cache_misses=%llu cache_mb=%.1f",
+		(int) depth, (unsigned long long) done, (unsigned long long) failed, (unsigned long long) batchCount,
+		percentile(samples, 0.5), percentile(samples, 0.95), samples.empty() ? 0.0 : *max_element(samples.begin(), samples.end()), uptime,
+		(unsigned long long) pool.hits, (unsigned long long) pool.misses, pool.cachedBytes / (1024.0 * 1024.0),
+		(unsigned long long) cache.memoryHits, (unsigned long long) cache.diskHits, (unsigned long long) cache.misses, cache.memoryBytes / (1024.0 * 1024.0));
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "KernelVerifier.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Long running processing service on a Unix domain socket. One request per
+// line, answered by one line starting with "ok" or "error":
+//   file <input> <output> <ops>          read, process and write image files
+//   shm <input> <output> <W>x<H>x<C> <ops>
+//                                        process a POSIX shared memory image
+//                                        into another one; replies its size
+//   stats                                queue depth, latency and cache use
+//   shutdown                             finish the queued jobs and exit
+// Words are separated by spaces; a path with spaces goes in double quotes,
+// with \" and \\ inside (SocketIO::quoteWord). Lines over
+// SocketIO::MAX_LINE_BYTES drop the connection.
+// <ops> is a comma separated list of the operations listed by --bench, or
+// "-" for none. Queued jobs with the same ops are taken together, and the
+// ops, transfer functions and buffer pool stay warm between requests.
+// Repeated inputs are answered from the ResultCache.
+class Daemon {
+public:
+	struct Options {
+		std::string socketPath;
+		int workers;
+		int batchLimit;
+	};
+
+	static std::string defaultSocketPath();
+	static Options defaultOptions();
+	static int run(const Options& options);
+
+private:
+	using clock = std::chrono::steady_clock;
+	using chainType = std::vector<KernelVerifier::opFuncType>;
+
+	struct Job {
+		std::vector<std::string> words;
+		std::string opsKey;
+		std::shared_ptr<const chainType> chain;
+		clock::time_point queued;
+		std::promise<std::string> reply;
+	};
+
+	explicit Daemon(const Options& options) : options(options), stopping(false), listenFd(-1), wakeRead(-1), wakeWrite(-1), connections(0), jobsDone(0), jobsFailed(0), batches(0) {}
+
+	void serve(int fd);
+	std::string handle(const std::string& line);
+	std::string submit(const std::vector<std::string>& words, const std::string& opsKey);
+	std::shared_ptr<const chainType> chainOf(const std::string& opsKey, std::string& error);
+	void work();
+	std::string execute(const Job& job);
+	cv::Mat runChain(const Job& job, const cv::Mat& mat);
+	std::string stats();
+
+	Options options;
+	KernelVerifier verifier;
+	clock::time_point started;
+
+	std::mutex mtx;
+	std::condition_variable wake, drained;
+	std::deque<std::unique_ptr<Job>> queue;
+	std::map<std::string, std::shared_ptr<const chainType>> chains;
+	std::set<int> clients;
+	bool stopping;
+	int listenFd, wakeRead, wakeWrite, connections;
+
+	uint64_t jobsDone, jobsFailed, batches;
+	std::deque<double> latencies;
+};
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "DiagramPreviewDialog.h"
-#include "Utils.h"
+#include "QtUtils.h"
+#include "Trace.h"
 
 using namespace cv;
 using namespace std;
@@ -45,9 +46,10 @@ void DiagramPreviewDialog::setPreviewMode(bool mode) {
 	previewFlag = mode;
 
 	if (previewFlag) {
-		imgWidget->setImageMat(matListFunc(diagramWidget->vertices));
+		imgWidget->setPreviewMat(matListFunc(diagramWidget->vertices));
 		QObject::connect(diagramWidget, &DiagramWidget::valueChanged, this, [=](const list<pair<float, float>>& vertices) {
-			imgWidget->setImageMat(matListFunc(vertices));
+			TRACE_SCOPE("DiagramPreviewDialog::preview");
+			imgWidget->setPreviewMat(matListFunc(vertices));
 		});
 	} else {
 		QObject::disconnect(diagramWidget, 0, this, 0);
@@ -17,7 +17,7 @@ class DiagramPreviewDialog : public QDialog {
 	Q_OBJECT
 
 private:
-	using matListType = std::function<cv::Mat(std::list<std::pair<float, float>>)>;
+	using matListType = std::function<cv::Mat(const std::list<std::pair<float, float>>&)>;
 
 	QLabel *title;
 	QCheckBox *previewCheckBox;
@@ -1,13 +1,41 @@
 #include "EditImageCommand.h"
+#include "MemoryTracker.h"
 
-EditImageCommand::EditImageCommand(ImgWidget *_imgWidget, HistogramWidget *_histogramWidget, cv::Mat _originMat, cv::Mat _newMat, QUndoCommand *parent) : QUndoCommand(parent), imgWidget(_imgWidget), histogramWidget(_histogramWidget), originMat(_originMat), newMat(_newMat) {}
+EditImageCommand::EditImageCommand(ImgWidget *_imgWidget, HistogramWidget *_histogramWidget, cv::Mat _originMat, cv::Mat _newMat, QUndoCommand *parent) : QUndoCommand(parent), imgWidget(_imgWidget), histogramWidget(_histogramWidget), originMat(_originMat), newMat(_newMat), restored(false) {
+	MemoryTracker::retag(originMat, "undo history");
+	MemoryTracker::retag(newMat, "undo history");
+}
+
+EditImageCommand::EditImageCommand(ImgWidget *_imgWidget, HistogramWidget *_histogramWidget, loaderType _originLoader, loaderType _newLoader, QUndoCommand *parent) : QUndoCommand(parent), imgWidget(_imgWidget), histogramWidget(_histogramWidget), originLoader(_originLoader), newLoader(_newLoader), restored(true) {
+}
 
 void EditImageCommand::undo() {
-	imgWidget->setImageMat(originMat);
-	histogramWidget->setImageMat(originMat);
+	imgWidget->setImageMat(origin());
+	histogramWidget->setImageMat(origin());
 }
 
 void EditImageCommand::redo() {
-	imgWidget->setImageMat(newMat);
-	histogramWidget->setImageMat(newMat);
+	if (restored) {
+		restored = false;
+		return;
+	}
+	imgWidget->setImageMat(result());
+	histogramWidget->setImageMat(result());
+}
+
+const cv::Mat& EditImageCommand::origin() const {
+	return load(originMat, originLoader);
+}
+
+const cv::Mat& EditImageCommand::result() const {
+	return load(newMat, newLoader);
+}
+
+const cv::Mat& EditImageCommand::load(cv::Mat& mat, loaderType& loader) {
+	if (mat.empty() && loader) {
+		MEMORY_TAG("undo history");
+		mat = loader();
+		loader = nullptr;
+	}
+	return mat;
 }
\ No newline at end of file
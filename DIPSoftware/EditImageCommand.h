@@ -4,20 +4,34 @@
 
 #include <opencv2/opencv.hpp>
 
+#include <functional>
+
 #include "HistogramWidget.h"
 #include "ImgWidget.h"
 
 class EditImageCommand : public QUndoCommand {
 public:
+	using loaderType = std::function<cv::Mat()>;
+
 	explicit EditImageCommand(ImgWidget *_imgWidget = 0, HistogramWidget *_histogramWidget = 0, cv::Mat _originMat = {}, cv::Mat _newMat = {}, QUndoCommand *parent = 0);
+	// Restored from a session: the images are loaded on first use, and the
+	// redo() done by QUndoStack::push leaves the widgets alone.
+	EditImageCommand(ImgWidget *_imgWidget, HistogramWidget *_histogramWidget, loaderType _originLoader, loaderType _newLoader, QUndoCommand *parent = 0);
 	void undo();
 	void redo();
 
+	const cv::Mat& origin() const;
+	const cv::Mat& result() const;
+
 signals:
 	void modifyWidgetStates(const cv::Mat& mat);
 
 private:
-	cv::Mat originMat, newMat;
+	static const cv::Mat& load(cv::Mat& mat, loaderType& loader);
+
+	mutable cv::Mat originMat, newMat;
+	mutable loaderType originLoader, newLoader;
+	bool restored;
 	ImgWidget *imgWidget;
 	HistogramWidget *histogramWidget;
 };
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "FramePipeline.h"
+#include "SpscQueue.h"
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+using clock_type = chrono::steady_clock;
+
+double elapsedMs(clock_type::time_point begin) {
+	return chrono::duration<double, milli>(clock_type::now() - begin).count();
+}
+
+}
+
+// A stage that throws sets stop, which releases the others from their
+// queues; the first exception is rethrown once all three have finished.
+FramePipeline::Stats FramePipeline::run(const sourceType& source, const processType& process, const sinkType& sink, size_t capacity) {
+	TRACE_SCOPE("FramePipeline::run");
+	Stats stats = {};
+	atomic<bool> stop{ false };
+	mutex errorMutex;
+	exception_ptr error;
+	SpscQueue<Frame> decoded(capacity, &stop), processed(capacity, &stop);
+	auto fail = [&]() {
+		lock_guard<mutex> lock(errorMutex);
+		if (!error) {
+			error = current_exception();
+		}
+		stop = true;
+	};
+	auto begin = clock_type::now();
+
+	thread decoder([&]() {
+		try {
+			for (int index = 0; ; ++index) {
+				Frame frame = { index, string(), Mat() };
+				auto start = clock_type::now();
+				bool more;
+				{
+					TRACE_SCOPE("FramePipeline::decode");
+					more = source(frame);
+				}
+				stats.busyMs[STAGE_DECODE] += elapsedMs(start);
+				if (!more || !decoded.push(move(frame))) {
+					break;
+				}
+			}
+		} catch (...) {
+			fail();
+		}
+		decoded.close();
+	});
+
+	// A frame that failed to decode or process travels on empty, so the
+	// encoder still sees every index and can count it.
+	thread processor([&]() {
+		try {
+			Frame frame;
+			while (decoded.pop(frame)) {
+				auto start = clock_type::now();
+				if (!frame.mat.empty()) {
+					TRACE_SCOPE("FramePipeline::process");
+					try {
+						process(frame);
+					} catch (const cv::Exception&) {
+						frame.mat.release();
+					}
+				}
+				stats.busyMs[STAGE_PROCESS] += elapsedMs(start);
+				if (!processed.push(move(frame))) {
+					break;
+				}
+			}
+		} catch (...) {
+			fail();
+		}
+		processed.close();
+	});
+
+	thread encoder([&]() {
+		try {
+			Frame frame;
+			while (processed.pop(frame)) {
+				auto start = clock_type::now();
+				bool ok;
+				{
+					TRACE_SCOPE("FramePipeline::encode");
+					ok = !frame.mat.empty() && sink(frame);
+				}
+				stats.busyMs[STAGE_ENCODE] += elapsedMs(start);
+				++stats.frames;
+				stats.failed += !ok;
+			}
+		} catch (...) {
+			fail();
+		}
+	});
+
+	decoder.join();
+	processor.join();
+	encoder.join();
+	stats.wallMs = elapsedMs(begin);
+	if (error) {
+		rethrow_exception(error);
+	}
+	return stats;
+}
+
+const char* FramePipeline::stageName(Stage stage) {
+	const char *names[] = { "decode", "process", "encode" };
+	return names[stage];
+}
+
+// Busy time per stage next to the wall time: with the stages overlapped the
+// wall time approaches the largest of them rather than their sum.
+void FramePipeline::printStats(const Stats& stats, FILE *fp) {
+	fprintf(fp, "%d frames (%d failed) in %.1f ms, %.2f frames/s\n", stats.frames, stats.failed, stats.wallMs, stats.wallMs > 0 ? stats.frames * 1000 / stats.wallMs : 0.0);
+	int slowest = 0;
+	for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+		if (stats.busyMs[stage] > stats.busyMs[slowest]) {
+			slowest = stage;
+		}
+		fprintf(fp, "%-8s %10.1f ms busy, %8.2f ms/frame\n", stageName((Stage) stage), stats.busyMs[stage], stats.frames ? stats.busyMs[stage] / stats.frames : 0.0);
+	}
+	fprintf(fp, "bottleneck: %s\n", stageName((Stage) slowest));
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+// Runs decode, process and encode on three threads joined by bounded
+// SpscQueues, so frame n + 1 decodes while frame n is processed and frame
+// n - 1 is encoded. A full queue stalls the stage before it, so throughput
+// settles at the slowest stage and at most 2 * capacity frames are in flight.
+class FramePipeline {
+public:
+	struct Frame {
+		int index;
+		std::string name;
+		cv::Mat mat;
+	};
+
+	// Fills the next frame; false at the end of the sequence.
+	using sourceType = std::function<bool(Frame& frame)>;
+	using processType = std::function<void(Frame& frame)>;
+	// false when the frame could not be written.
+	using sinkType = std::function<bool(const Frame& frame)>;
+
+	enum Stage { STAGE_DECODE, STAGE_PROCESS, STAGE_ENCODE, STAGE_COUNT };
+
+	struct Stats {
+		int frames, failed;
+		double wallMs;
+		double busyMs[STAGE_COUNT];
+	};
+
+	// A cv::Exception from process only fails its frame; any other exception
+	// stops the pipeline and is rethrown here.
+	static Stats run(const sourceType& source, const processType& process, const sinkType& sink, size_t capacity = 4);
+	static const char* stageName(Stage stage);
+	static void printStats(const Stats& stats, FILE *fp);
+};
\ No newline at end of file
@@ -1,33 +1,216 @@
 #include "HistogramWidget.h"
 #include "Utils.h"
 #include "DebugUtils.h"
+#include "Trace.h"
 
 #include <QPainter>
+#include <QPolygonF>
+#include <QRunnable>
+#include <QTimer>
+
+#include <functional>
 
 using namespace cv;
 using namespace std;
 
+namespace {
+
+const float PREVIEW_MAX_ERROR = 0.005f;
+const int PREVIEW_SETTLE_MS = 150;
+
+// QThreadPool::start() only takes a QRunnable before Qt 5.15.
+class Task : public QRunnable {
+public:
+	explicit Task(function<void()> body) : body(body) {}
+	void run() {
+		body();
+	}
+
+private:
+	function<void()> body;
+};
+
+}
+
+HistogramWidget::HistogramWidget(QWidget *parent) : QWidget(parent) {
+	previewTimer = new QTimer(this);
+	previewTimer->setSingleShot(true);
+	previewTimer->setInterval(PREVIEW_SETTLE_MS);
+	connect(previewTimer, &QTimer::timeout, this, [this]() { count(previewMat); });
+	// A newer result may already have replaced the one announced, so both
+	// generations are checked.
+	connect(this, &HistogramWidget::histogramsCounted, this, [this](int counted) {
+		Utils::ColorHistograms value;
+		{
+			lock_guard<mutex> lock(resultMutex);
+			if (counted != generation || countedGeneration != counted) {
+				return;
+			}
+			value = countedHistograms;
+		}
+		if (previewMat.empty()) {
+			imageHistograms = value;
+			imageCounted = true;
+			showRegion();
+		} else {
+			showHistograms(value);
+		}
+	}, Qt::QueuedConnection);
+	connect(this, &HistogramWidget::integralHistogramBuilt, this, [this](int built) {
+		{
+			lock_guard<mutex> lock(resultMutex);
+			if (built != imageGeneration || builtGeneration != built) {
+				return;
+			}
+			integralHistogram = builtIntegralHistogram;
+		}
+		if (!region.isEmpty()) {
+			showRegion();
+		}
+	}, Qt::QueuedConnection);
+}
+
+// Queued tasks become stale and return at once; running ones are waited for,
+// as they emit on this widget.
+HistogramWidget::~HistogramWidget() {
+	++generation;
+	++imageGeneration;
+	pool.waitForDone();
+}
+
+// Both the histograms and the integral histogram are computed off the GUI
+// thread; the previous histogram stays up until they arrive. The selection
+// survives an edit, so its histogram follows the new image.
 void HistogramWidget::setImageMat(const Mat& mat) {
-	histogramArr = Utils::getHistogram(mat);
-	repaint();
+	TRACE_SCOPE("HistogramWidget::setImageMat");
+	previewTimer->stop();
+	previewMat.release();
+	imageCounted = false;
+	baseCurrent = false;
+	hasPreviewTable = false;
+	count(mat);
+
+	int current = ++imageGeneration;
+	integralHistogram.reset();
+	pool.start(new Task([this, mat, current]() {
+		if (current != imageGeneration) {
+			return;
+		}
+		auto res = make_shared<IntegralHistogram>();
+		res->build(mat);
+		{
+			lock_guard<mutex> lock(resultMutex);
+			if (current < builtGeneration) {
+				return;
+			}
+			builtIntegralHistogram = res;
+			builtGeneration = current;
+		}
+		emit integralHistogramBuilt(current);
+	}));
+}
+
+// Previews of a point operation announced by setPreviewTable() are predicted
+// from the histograms on display, other previews are shown from a sample (of
+// the selection, if any); the exact histograms of the last one are counted
+// once they pause.
+void HistogramWidget::setPreviewMat(const Mat& mat) {
+	TRACE_SCOPE("HistogramWidget::setPreviewMat");
+	++generation;
+	previewMat = region.isEmpty() ? mat : mat(Rect(region.x(), region.y(), region.width(), region.height()) & Rect(0, 0, mat.cols, mat.rows));
+	if (hasPreviewTable && baseCurrent) {
+		showHistograms(Utils::mapHistograms(baseHistograms, previewTable));
+	} else {
+		showHistograms(Utils::getSampledHistograms(previewMat, PREVIEW_MAX_ERROR));
+	}
+	hasPreviewTable = false;
+	previewTimer->start();
+}
+
+// The table the next preview was computed with, when it is a point operation
+// of the image on display.
+void HistogramWidget::setPreviewTable(const array<uchar, 256>& table) {
+	previewTable = table;
+	hasPreviewTable = true;
+}
+
+void HistogramWidget::count(const Mat& mat) {
+	int current = ++generation;
+	pool.start(new Task([this, mat, current]() {
+		if (current != generation) {
+			return;
+		}
+		Utils::ColorHistograms res = Utils::getColorHistograms(mat);
+		{
+			lock_guard<mutex> lock(resultMutex);
+			if (current < countedGeneration) {
+				return;
+			}
+			countedHistograms = res;
+			countedGeneration = current;
+		}
+		emit histogramsCounted(current);
+	}));
+}
+
+void HistogramWidget::setRegion(const QRect& rect) {
+	region = rect;
+	showRegion();
+}
+
+// The integral histogram is grey only, so a region has no channel overlays.
+void HistogramWidget::showRegion() {
+	if (region.isEmpty()) {
+		baseHistograms = imageHistograms;
+		baseCurrent = imageCounted;
+	} else if (integralHistogram) {
+		baseHistograms = {};
+		baseHistograms.grey = integralHistogram->histogram(Rect(region.x(), region.y(), region.width(), region.height()));
+		baseCurrent = true;
+	} else {
+		baseCurrent = false;
+		return;
+	}
+	showHistograms(baseHistograms);
+}
+
+void HistogramWidget::showHistograms(const Utils::ColorHistograms& value) {
+	shown = value;
+	renderedStale = true;
+	update();
 }
 
 void HistogramWidget::paintEvent(QPaintEvent *event) {
+	if (renderedStale || rendered.size() != size()) {
+		render();
+	}
+	QPainter p(this);
+	p.drawPixmap(0, 0, rendered);
+}
+
+// Grey bars with the B, G and R histograms drawn over them as lines, all on
+// one scale.
+void HistogramWidget::render() {
+	TRACE_SCOPE("HistogramWidget::render");
 	int w, h;
 	w = width();
 	h = height();
+	rendered = QPixmap(size());
+	renderedStale = false;
 
-	QPainter p(this);
+	QPainter p(&rendered);
 	p.setBrush(QBrush(QColor(255, 255, 255)));
 	p.drawRect(0, 0, w - 1, h - 1);
 
-	if (histogramArr == array<int, 256>{}) {
-		return;
-	}
-
 	int maxCount = 0;
-	for (const auto& elem : histogramArr) {
-		updateMax(maxCount, elem);
+	rep(i, 256) {
+		updateMax(maxCount, shown.grey[i]);
+		rep(k, shown.channelCount) {
+			updateMax(maxCount, shown.channels[k][i]);
+		}
+	}
+	if (!maxCount) {
+		return;
 	}
 
 	float xStep, yStep;
@@ -35,6 +218,17 @@ void HistogramWidget::paintEvent(QPaintEvent *event) {
 	yStep = (h - 2) * 1.0f / maxCount;
 
 	rep(i, 256) {
-		p.fillRect(QRectF(1 + i * xStep, 1 + yStep * (maxCount - histogramArr[i]), xStep, yStep * histogramArr[i]), QBrush(QColor(150, 150, 150)));
+		p.fillRect(QRectF(1 + i * xStep, 1 + yStep * (maxCount - shown.grey[i]), xStep, yStep * shown.grey[i]), QBrush(QColor(150, 150, 150)));
+	}
+
+	const QColor colors[3] = { QColor(0, 0, 255, 160), QColor(0, 160, 0, 160), QColor(255, 0, 0, 160) };
+	p.setRenderHint(QPainter::Antialiasing);
+	rep(k, shown.channelCount) {
+		QPolygonF line;
+		rep(i, 256) {
+			line << QPointF(1 + (i + 0.5f) * xStep, 1 + yStep * (maxCount - shown.channels[k][i]));
+		}
+		p.setPen(QPen(colors[k], 1));
+		p.drawPolyline(line);
 	}
 }
\ No newline at end of file
@@ -1,23 +1,76 @@
 #pragma once
 
+#include "IntegralHistogram.h"
+#include "Utils.h"
+
 #include <QPaintEvent>
+#include <QPixmap>
+#include <QRect>
+#include <QThreadPool>
+#include <QTimer>
 #include <QWidget>
 
 #include <opencv2/opencv.hpp>
 
 #include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
+// Shows the grey histogram of the image with B/G/R overlays, or the grey
+// histogram of the selected region once the integral histogram of the image
+// is ready; until then the whole image is shown. Everything is counted on
+// the widget's thread pool and delivered by queued signals, the latest
+// request winning; tasks that are stale by the time they start do nothing,
+// and nothing on the GUI thread waits for one that is already running.
+// Dialog previews get a sampled histogram first and the exact one when they
+// pause. The drawing is cached in a pixmap until the data or size changes.
 class HistogramWidget : public QWidget {
 	Q_OBJECT
 
 public:
-	HistogramWidget(QWidget *parent = 0) : QWidget(parent) {}
-	virtual ~HistogramWidget() {}
+	HistogramWidget(QWidget *parent = 0);
+	virtual ~HistogramWidget();
 
 	void setImageMat(const cv::Mat& mat);
+	void setPreviewMat(const cv::Mat& mat);
+	void setPreviewTable(const std::array<uchar, 256>& table);
+	void setRegion(const QRect& rect);
 
 	void paintEvent(QPaintEvent *);
 
+signals:
+	void histogramsCounted(int generation);
+	void integralHistogramBuilt(int generation);
+
 private:
-	std::array<int, 256> histogramArr = {};
+	void count(const cv::Mat& mat);
+	void showRegion();
+	void showHistograms(const Utils::ColorHistograms& value);
+	void render();
+
+	Utils::ColorHistograms shown = {};
+	Utils::ColorHistograms imageHistograms = {};
+	bool imageCounted = false;
+	// What is on display for the current image, whole or region.
+	Utils::ColorHistograms baseHistograms = {};
+	bool baseCurrent = false;
+	QPixmap rendered;
+	bool renderedStale = true;
+
+	QRect region;
+	// Bumped by every count and every image; read by the tasks.
+	std::atomic<int> generation{ 0 }, imageGeneration{ 0 };
+	std::shared_ptr<const IntegralHistogram> integralHistogram;
+	QThreadPool pool;
+	// Results handed over by the tasks, with the generation they belong to.
+	std::mutex resultMutex;
+	Utils::ColorHistograms countedHistograms = {};
+	int countedGeneration = 0;
+	std::shared_ptr<const IntegralHistogram> builtIntegralHistogram;
+	int builtGeneration = 0;
+	cv::Mat previewMat;
+	std::array<uchar, 256> previewTable;
+	bool hasPreviewTable = false;
+	QTimer *previewTimer;
 };
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "ImageMetrics.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <limits>
+
+using namespace cv;
+using namespace std;
+
+double ImageMetrics::maxAbsError(const Mat& a, const Mat& b) {
+	return norm(a, b, NORM_INF);
+}
+
+size_t ImageMetrics::mismatchCount(const Mat& a, const Mat& b) {
+	Mat diff;
+	absdiff(a, b, diff);
+	return countNonZero(diff.reshape(1));
+}
+
+// Infinity when the images are identical.
+double ImageMetrics::psnr(const Mat& a, const Mat& b) {
+	double l2 = norm(a, b, NORM_L2);
+	if (l2 == 0) {
+		return numeric_limits<double>::infinity();
+	}
+	double mse = l2 * l2 / (a.total() * a.channels());
+	return 10 * log10(255.0 * 255.0 / mse);
+}
+
+// Mean SSIM over all channels with the usual 11x11, sigma 1.5 Gaussian window.
+double ImageMetrics::ssim(const Mat& a, const Mat& b) {
+	TRACE_SCOPE("ImageMetrics::ssim");
+	const double C1 = sqr(0.01 * 255), C2 = sqr(0.03 * 255);
+	const Size window(11, 11);
+
+	Mat x, y;
+	a.convertTo(x, CV_32F);
+	b.convertTo(y, CV_32F);
+
+	Mat xx, yy, xy;
+	multiply(x, x, xx);
+	multiply(y, y, yy);
+	multiply(x, y, xy);
+
+	Mat muX, muY, sigmaXX, sigmaYY, sigmaXY;
+	GaussianBlur(x, muX, window, 1.5);
+	GaussianBlur(y, muY, window, 1.5);
+	GaussianBlur(xx, sigmaXX, window, 1.5);
+	GaussianBlur(yy, sigmaYY, window, 1.5);
+	GaussianBlur(xy, sigmaXY, window, 1.5);
+
+	Mat muXX, muYY, muXY;
+	multiply(muX, muX, muXX);
+	multiply(muY, muY, muYY);
+	multiply(muX, muY, muXY);
+	sigmaXX -= muXX;
+	sigmaYY -= muYY;
+	sigmaXY -= muXY;
+
+	Mat numerator, denominator, t1, t2;
+	t1 = 2 * muXY + C1;
+	t2 = 2 * sigmaXY + C2;
+	multiply(t1, t2, numerator);
+	t1 = muXX + muYY + C1;
+	t2 = sigmaXX + sigmaYY + C2;
+	multiply(t1, t2, denominator);
+
+	Mat ssimMap;
+	divide(numerator, denominator, ssimMap);
+	Scalar channelMeans = mean(ssimMap);
+
+	double res = 0;
+	rep(i, a.channels()) {
+		res += channelMeans[i];
+	}
+	return res / a.channels();
+}
+
+ImageMetrics::Comparison ImageMetrics::compare(const Mat& a, const Mat& b) {
+	Comparison res = {};
+	res.sameShape = a.size() == b.size() && a.type() == b.type();
+	if (!res.sameShape) {
+		res.mismatches = max(a.total(), b.total());
+		res.maxAbsError = 255;
+		return res;
+	}
+	res.mismatches = mismatchCount(a, b);
+	res.maxAbsError = maxAbsError(a, b);
+	res.psnr = psnr(a, b);
+	res.ssim = res.mismatches ? ssim(a, b) : 1.0;
+	return res;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <cstddef>
+
+// Image difference metrics built on OpenCV's vectorized primitives. Both
+// inputs must have the same size and type.
+class ImageMetrics {
+public:
+	struct Comparison {
+		bool sameShape;
+		size_t mismatches;
+		double maxAbsError, psnr, ssim;
+	};
+
+	static double maxAbsError(const cv::Mat& a, const cv::Mat& b);
+	static size_t mismatchCount(const cv::Mat& a, const cv::Mat& b);
+	static double psnr(const cv::Mat& a, const cv::Mat& b);
+	static double ssim(const cv::Mat& a, const cv::Mat& b);
+
+	static Comparison compare(const cv::Mat& a, const cv::Mat& b);
+};
\ No newline at end of file
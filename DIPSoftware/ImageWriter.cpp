@@ -0,0 +1,121 @@
+#include "ImageWriter.h"
+#include "MemoryTracker.h"
+#include "PngEncoder.h"
+#include "RawImage.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <io.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+atomic<unsigned> tempCounter{ 0 };
+
+// Unique per process and call, so concurrent saves of one file never share
+// a temporary.
+string tempFileName(const string& fileName) {
+#ifdef _WIN32
+	unsigned long pid = GetCurrentProcessId();
+#else
+	unsigned long pid = (unsigned long) getpid();
+#endif
+	return fileName + "." + to_string(pid) + "." + to_string(++tempCounter) + ".tmp";
+}
+
+bool syncFile(FILE *fp) {
+	if (fflush(fp)) {
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(fp)) == 0;
+#else
+	return fsync(fileno(fp)) == 0;
+#endif
+}
+
+bool replaceFile(const string& from, const string& to) {
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+}
+
+string ImageWriter::extensionOf(const string& fileName) {
+	auto dot = fileName.find_last_of('.');
+	auto slash = fileName.find_last_of("/\\");
+	if (dot == string::npos || (slash != string::npos && dot < slash)) {
+		return "";
+	}
+	string res = fileName.substr(dot + 1);
+	for (auto& c : res) {
+		c = (char) tolower((unsigned char) c);
+	}
+	return res;
+}
+
+bool ImageWriter::encode(const string& extension, const Mat& mat, vector<uchar>& buffer, const progressType& progress) {
+	TRACE_SCOPE("ImageWriter::encode");
+	MEMORY_TAG("image encode");
+	if (extension == "png") {
+		return PngEncoder::encode(mat, buffer, 6, [&](int done, int total) {
+			if (progress) {
+				progress(done * 1.0 / total);
+			}
+		});
+	}
+	bool res = imencode("." + extension, mat, buffer);
+	if (res && progress) {
+		progress(1.0);
+	}
+	return res;
+}
+
+bool ImageWriter::writeAtomically(const string& fileName, const bodyType& body) {
+	TRACE_SCOPE("ImageWriter::writeAtomically");
+	string temp = tempFileName(fileName);
+	FILE *fp = fopen(temp.c_str(), "wb");
+	if (!fp) {
+		return false;
+	}
+	bool ok = body(fp) && syncFile(fp);
+	ok = fclose(fp) == 0 && ok;
+	if (!ok || !replaceFile(temp, fileName)) {
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool ImageWriter::write(const string& fileName, const Mat& mat, const progressType& progress) {
+	TRACE_SCOPE("ImageWriter::write");
+	if (extensionOf(fileName) == RawImage::EXTENSION) {
+		return RawImage::write(fileName, mat, progress);
+	}
+	vector<uchar> buffer;
+	try {
+		if (!encode(extensionOf(fileName), mat, buffer, progress)) {
+			return false;
+		}
+	} catch (const cv::Exception&) {
+		return false;
+	}
+	return writeAtomically(fileName, [&](FILE *fp) { return fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size(); });
+}
\ No newline at end of file
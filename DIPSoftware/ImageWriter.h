@@ -0,0 +1,26 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Encodes an image in memory and publishes it atomically: the bytes go to a
+// temporary file next to the target, are flushed to disk and then renamed
+// over it, so a crash leaves either the old file or the new one, never a
+// truncated one. PNG goes through the parallel PngEncoder, .dipraw through
+// RawImage, other formats through cv::imencode. Safe to call from any thread.
+class ImageWriter {
+public:
+	// Fraction of the encoding done, in [0, 1]; may be called from workers.
+	using progressType = std::function<void(double fraction)>;
+	// Writes the file content; returns false on any error.
+	using bodyType = std::function<bool(FILE *fp)>;
+
+	static bool write(const std::string& fileName, const cv::Mat& mat, const progressType& progress = nullptr);
+	static bool encode(const std::string& extension, const cv::Mat& mat, std::vector<uchar>& buffer, const progressType& progress = nullptr);
+	static bool writeAtomically(const std::string& fileName, const bodyType& body);
+	static std::string extensionOf(const std::string& fileName);
+};
\ No newline at end of file
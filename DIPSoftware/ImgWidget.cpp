@@ -1,5 +1,7 @@
 #include "ImgWidget.h"
-#include "Utils.h"
+#include "MemoryTracker.h"
+#include "QtUtils.h"
+#include "Trace.h"
 
 #include <QCursor>
 #include <QDebug>
@@ -83,21 +85,46 @@ ImgWidget::~ImgWidget() {
 }
 
 void ImgWidget::setImageMat(const Mat& mat) {
+	TRACE_SCOPE("ImgWidget::setImageMat");
 	imgMat = make_shared<Mat>(mat);
+	showMat(mat, 1.0);
+}
+
+// Shows a reduced decode stretched to the size of the full image until
+// setImageMat() replaces it. Cropping is off meanwhile, since a rectangle
+// drawn on the proxy would not survive the swap.
+void ImgWidget::setProxyMat(const Mat& mat, double scale) {
+	TRACE_SCOPE("ImgWidget::setProxyMat");
+	imgMat = make_shared<Mat>(mat);
+	showMat(mat, scale);
+	pixmapItem->setTransformationMode(Qt::SmoothTransformation);
+	pixmapItem->setAcceptedMouseButtons(Qt::NoButton);
+}
+
+// An intermediate result of a dialog, which the histogram follows through
+// previewChanged.
+void ImgWidget::setPreviewMat(const Mat& mat) {
+	setImageMat(mat);
+	emit(previewChanged(mat));
+}
 
+void ImgWidget::showMat(const Mat& mat, double scale) {
 	if (pixmap) {
+		MemoryTracker::adjust("display pixmap", -(int64_t) pixmap->width() * pixmap->height() * pixmap->depth() / 8);
 		delete pixmap;
 	}
 	pixmap = new QPixmap;
-	pixmap->convertFromImage(Utils::mat2QImage(*imgMat));
+	pixmap->convertFromImage(QtUtils::mat2QImage(mat, displayMat));
+	MemoryTracker::adjust("display pixmap", (int64_t) pixmap->width() * pixmap->height() * pixmap->depth() / 8);
 
 	if (pixmapItem) {
 		delete pixmapItem;
 	}
 	pixmapItem = new EditPixmapItem(*pixmap);
+	pixmapItem->setScale(scale);
 	QObject::connect(pixmapItem, &EditPixmapItem::updateCropRectSignal, this, &ImgWidget::updateRectItem);
 	scene->addItem(pixmapItem);
-	view->setSceneRect(0, 0, pixmap->width(), pixmap->height());
+	view->setSceneRect(0, 0, pixmap->width() * scale, pixmap->height() * scale);
 }
 
 QRect ImgWidget::getCropRect() {
@@ -111,6 +138,7 @@ void ImgWidget::removeLastItem() {
 		rectItem = nullptr;
 		view->viewport()->update();
 		emit(setCropActionEnabled(false));
+		emit(cropRectChanged(QRect()));
 	}
 }
 
@@ -132,4 +160,5 @@ void ImgWidget::updateRectItem() {
 	scene->addItem(rectItem);
 	view->viewport()->update();
 	emit(setCropActionEnabled(true));
+	emit(cropRectChanged(pixmapItem->getCropRect()));
 }
\ No newline at end of file
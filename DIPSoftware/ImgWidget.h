@@ -47,14 +47,19 @@ public:
 	~ImgWidget();
 
 	void setImageMat(const cv::Mat &mat);
+	void setProxyMat(const cv::Mat &mat, double scale);
+	void setPreviewMat(const cv::Mat &mat);
 	QRect getCropRect();
 	void removeLastItem();
 
 signals:
 	void setCropActionEnabled(bool);
+	void cropRectChanged(const QRect&);
+	void previewChanged(const cv::Mat&);
 
 private:
 	void contextMenuEvent(QContextMenuEvent *event);
+	void showMat(const cv::Mat &mat, double scale);
 
 public slots:
 	void updateRectItem();
@@ -68,6 +73,8 @@ private:
 
 	QHBoxLayout *mainLayout;
 
+	cv::Mat displayMat;
+
 	QMenu *popMenu;
 	QAction *cancelCropRectAction;
 
@@ -1,12 +1,13 @@
  #include "InputPreviewDialog.h"
-#include "Utils.h"
+#include "QtUtils.h"
+#include "Trace.h"
 
 #include <QDebug>
 
 using namespace cv;
 using namespace std;
 
-InputPreviewDialog::InputPreviewDialog(ImgWidget *widget, function<Mat(vector<float>)> lambdaFunc, QWidget *parent, Qt::WindowFlags flags) : QDialog(parent, flags), 
+InputPreviewDialog::InputPreviewDialog(ImgWidget *widget, function<Mat(const vector<float>&)> lambdaFunc, QWidget *parent, Qt::WindowFlags flags) : QDialog(parent, flags), 
 	imgWidget(widget), title(nullptr), previewCheckBox(nullptr), buttonBox(nullptr), mainLayout(nullptr), matFloatFunc(lambdaFunc), previewFlag(true), parameterLen(0) {}
 
 InputPreviewDialog::~InputPreviewDialog() {
@@ -107,14 +108,15 @@ void InputPreviewDialog::setPreviewMode(vector<function<float(float)>> deltaFunc
 		rep(i, parameterLen) {
 			values.push_back(deltaFuncs[i](sliders[i]->value()));
 		}
-		imgWidget->setImageMat(matFloatFunc(std::move(values)));
+		imgWidget->setPreviewMat(matFloatFunc(std::move(values)));
 		for (const auto &slider : sliders) {
 			QObject::connect(slider, static_cast<void (QSlider::*)(int)>(&QSlider::valueChanged), this, [=](int d) {
+				TRACE_SCOPE("InputPreviewDialog::preview");
 				vector<float> values;
 				rep(i, parameterLen) {
 					values.push_back(deltaFuncs[i](sliders[i]->value()));
 				}
-				imgWidget->setImageMat(matFloatFunc(std::move(values)));
+				imgWidget->setPreviewMat(matFloatFunc(std::move(values)));
 			});
 			//QObject::connect(slider, static_cast<void (QSlider::*)(int)>(&QSlider::valueChanged), this, bind(&ImgWidget::setImageMat, imgWidget, bind(matFloatFunc, placeholders::_1)));
 		}
@@ -125,7 +127,7 @@ void InputPreviewDialog::setPreviewMode(vector<function<float(float)>> deltaFunc
 	}
 }
 
-vector<float> InputPreviewDialog::changeFloat(QWidget *parent, ImgWidget *widget, const function<Mat(vector<float>)>& lambdaFunc, const QString &title, const vector<ParameterInfo> &infos, bool *ok, Qt::WindowFlags flags) {
+vector<float> InputPreviewDialog::changeFloat(QWidget *parent, ImgWidget *widget, const function<Mat(const vector<float>&)>& lambdaFunc, const QString &title, const vector<ParameterInfo> &infos, bool *ok, Qt::WindowFlags flags) {
 	vector<QString> texts;
 	vector<float> values, minValues, maxValues;
 	vector<function<float(float)>> deltaFuncs, invDeltaFuncs;
@@ -43,13 +43,13 @@ private:
 	QGridLayout *mainLayout;
 
 	ImgWidget *imgWidget;
-	std::function<cv::Mat(std::vector<float>)> matFloatFunc;
+	std::function<cv::Mat(const std::vector<float>&)> matFloatFunc;
 
 	int parameterLen;
 	bool previewFlag;
 
 private:
-	InputPreviewDialog(ImgWidget *widget, std::function<cv::Mat(std::vector<float>)> lambdaFunc, QWidget *parent = 0, Qt::WindowFlags flags = 0);
+	InputPreviewDialog(ImgWidget *widget, std::function<cv::Mat(const std::vector<float>&)> lambdaFunc, QWidget *parent = 0, Qt::WindowFlags flags = 0);
 	~InputPreviewDialog();
 
 	void setParameterLen(int _parameterLen);
@@ -65,5 +65,5 @@ public slots:
 	void setPreviewMode(std::vector<std::function<float(float)>> deltaFuncs, bool mode);
 
 public:
-	static std::vector<float> changeFloat(QWidget *parent, ImgWidget *widget, const std::function<cv::Mat(std::vector<float>)>& lambdaFunc, const QString &title, const std::vector<ParameterInfo>& infos, bool *ok = 0, Qt::WindowFlags flags = 0);
+	static std::vector<float> changeFloat(QWidget *parent, ImgWidget *widget, const std::function<cv::Mat(const std::vector<float>&)>& lambdaFunc, const QString &title, const std::vector<ParameterInfo>& infos, bool *ok = 0, Qt::WindowFlags flags = 0);
 };
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "IntegralHistogram.h"
+#include "CpuDispatch.h"
+#include "MemoryTracker.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <algorithm>
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+size_t tableBytes(const Size& size, int blockSize) {
+	size_t rows = (size.height + blockSize - 1) / blockSize + 1;
+	size_t cols = (size.width + blockSize - 1) / blockSize + 1;
+	return rows * cols * 256 * sizeof(int);
+}
+
+// round((b + g + r) / 3.0), as counted by the grey histogram kernel.
+void greyPlane(const Mat& mat, Mat& res) {
+	if (mat.channels() == 1) {
+		mat.copyTo(res);
+		return;
+	}
+	int cn = mat.channels();
+	res.create(mat.rows, mat.cols, CV_8UC1);
+	#pragma omp parallel for
+	for (int i = 0; i < mat.rows; ++i) {
+		const uchar *p = mat.ptr<uchar>(i);
+		uchar *q = res.ptr<uchar>(i);
+		rep(j, mat.cols) {
+			q[j] = (uchar) ((p[0] + p[1] + p[2] + 1) / 3);
+			p += cn;
+		}
+	}
+}
+
+}
+
+void IntegralHistogram::build(const Mat& mat, size_t budgetBytes) {
+	TRACE_SCOPE("IntegralHistogram::build");
+	MEMORY_TAG("integral histogram");
+	greyPlane(mat, grey);
+
+	blockShift = 3;
+	while (tableBytes(grey.size(), 1 << blockShift) > budgetBytes && (1 << blockShift) < max(grey.rows, grey.cols)) {
+		++blockShift;
+	}
+	int block = 1 << blockShift;
+	gridRows = (grey.rows + block - 1) >> blockShift;
+	gridCols = (grey.cols + block - 1) >> blockShift;
+	table = Mat::zeros(gridRows + 1, (gridCols + 1) * 256, CV_32SC1);
+
+	// Cell histograms of each block row, accumulated along the row.
+	#pragma omp parallel for
+	for (int bi = 0; bi < gridRows; ++bi) {
+		int *cells = table.ptr<int>(bi + 1) + 256;
+		int last = min(grey.rows, (bi + 1) * block);
+		repa(i, bi * block, last) {
+			const uchar *p = grey.ptr<uchar>(i);
+			rep(bj, gridCols) {
+				int *hist = cells + bj * 256;
+				int end = min(grey.cols, (bj + 1) * block);
+				repa(j, bj * block, end) {
+					++hist[p[j]];
+				}
+			}
+		}
+		repa(bj, 1, gridCols) {
+			int *hist = cells + bj * 256;
+			const int *left = hist - 256;
+			rep(v, 256) {
+				hist[v] += left[v];
+			}
+		}
+	}
+
+	// Then down the columns.
+	int width = (gridCols + 1) * 256;
+	repa(i, 2, gridRows + 1) {
+		int *cur = table.ptr<int>(i);
+		const int *up = table.ptr<int>(i - 1);
+		rep(k, width) {
+			cur[k] += up[k];
+		}
+	}
+}
+
+void IntegralHistogram::countPixels(const Rect& rect, int *hist) const {
+	if (rect.width <= 0 || rect.height <= 0) {
+		return;
+	}
+	CpuDispatch::kernels().histogram(grey.ptr<uchar>(rect.y) + rect.x, grey.step, rect.width, rect.height, 1, 0, hist);
+}
+
+array<int, 256> IntegralHistogram::histogram(const Rect& rect) const {
+	array<int, 256> res;
+	fill(res.begin(), res.end(), 0);
+	Rect r = rect & Rect(0, 0, grey.cols, grey.rows);
+	if (r.empty()) {
+		return res;
+	}
+
+	int right = r.x + r.width, bottom = r.y + r.height;
+	int bx0 = (r.x + blockSize() - 1) >> blockShift;
+	int by0 = (r.y + blockSize() - 1) >> blockShift;
+	int bx1 = right == grey.cols ? gridCols : right >> blockShift;
+	int by1 = bottom == grey.rows ? gridRows : bottom >> blockShift;
+	if (bx0 >= bx1 || by0 >= by1) {
+		countPixels(r, res.data());
+		return res;
+	}
+
+	const int *a = corner(by0, bx0), *b = corner(by0, bx1), *c = corner(by1, bx0), *d = corner(by1, bx1);
+	rep(v, 256) {
+		res[v] = d[v] - b[v] - c[v] + a[v];
+	}
+
+	int x0 = bx0 << blockShift, y0 = by0 << blockShift;
+	int x1 = min(grey.cols, bx1 << blockShift), y1 = min(grey.rows, by1 << blockShift);
+	countPixels(Rect(r.x, r.y, r.width, y0 - r.y), res.data());
+	countPixels(Rect(r.x, y1, r.width, bottom - y1), res.data());
+	countPixels(Rect(r.x, y0, x0 - r.x, y1 - y0), res.data());
+	countPixels(Rect(x1, y0, right - x1, y1 - y0), res.data());
+	return res;
+}
\ No newline at end of file
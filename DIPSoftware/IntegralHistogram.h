@@ -0,0 +1,42 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <array>
+#include <cstddef>
+
+// Cumulative grey histograms at the corners of a block grid: corner (i, j)
+// holds the histogram of every pixel above and left of it. The histogram of
+// a rectangle is four corner lookups for its block-aligned interior plus a
+// direct count of the border strips, so any rectangle is answered exactly in
+// O(256 + perimeter * blockSize) instead of O(area). The block size is the
+// smallest power of two (8 or more) that keeps the table within the budget.
+// Grey values are those of Utils::getHistogram.
+class IntegralHistogram {
+public:
+	IntegralHistogram() : blockShift(0), gridRows(0), gridCols(0) {}
+
+	void build(const cv::Mat& mat, size_t budgetBytes = 32 << 20);
+	bool empty() const {
+		return grey.empty();
+	}
+	cv::Size size() const {
+		return grey.size();
+	}
+	int blockSize() const {
+		return 1 << blockShift;
+	}
+
+	// The rectangle is clipped to the image.
+	std::array<int, 256> histogram(const cv::Rect& rect) const;
+
+private:
+	const int* corner(int i, int j) const {
+		return table.ptr<int>(i) + j * 256;
+	}
+	void countPixels(const cv::Rect& rect, int *hist) const;
+
+	cv::Mat grey;
+	cv::Mat table;
+	int blockShift, gridRows, gridCols;
+};
\ No newline at end of file
@@ -0,0 +1,348 @@
+#include "KernelVerifier.h"
+#include "ColorMatrix.h"
+#include "ReferenceUtils.h"
+#include "Utils.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+const int MIN_IMAGE_SIZE = 16;
+
+// Deterministic xorshift so the synthetic corpus is identical on every run.
+struct XorShift {
+	uint32_t state;
+	explicit XorShift(uint32_t seed) : state(seed) {}
+	uchar next() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (uchar) (state >> 24);
+	}
+};
+
+Mat noiseImage(int rows, int cols, uint32_t seed, int lo, int hi) {
+	XorShift rng(seed);
+	Mat res(rows, cols, CV_8UC3);
+	rep(i, rows) rep(j, cols) {
+		Vec3b& pixel = res.at<Vec3b>(i, j);
+		rep(k, 3) {
+			pixel[k] = (uchar) (lo + rng.next() * (hi - lo) / 255);
+		}
+	}
+	return res;
+}
+
+Mat gradientImage(int rows, int cols) {
+	Mat res(rows, cols, CV_8UC3);
+	rep(i, rows) rep(j, cols) {
+		res.at<Vec3b>(i, j) = { (uchar) (j * 255 / (cols - 1)), (uchar) (i * 255 / (rows - 1)), (uchar) ((i + j) * 255 / (rows + cols - 2)) };
+	}
+	return res;
+}
+
+Mat checkerImage(int rows, int cols, int cell) {
+	Mat res(rows, cols, CV_8UC3);
+	rep(i, rows) rep(j, cols) {
+		uchar v = ((i / cell + j / cell) % 2) ? 230 : 20;
+		res.at<Vec3b>(i, j) = { v, (uchar) (255 - v), v };
+	}
+	return res;
+}
+
+Mat greyImage(int rows, int cols, uint32_t seed) {
+	Mat res = noiseImage(rows, cols, seed, 0, 255);
+	rep(i, rows) rep(j, cols) {
+		Vec3b& pixel = res.at<Vec3b>(i, j);
+		pixel[1] = pixel[2] = pixel[0];
+	}
+	return res;
+}
+
+string family(const string& op) {
+	return op.substr(0, op.find(':'));
+}
+
+// The alpha a BGRA result of size result should carry. Kernels that keep or
+// crop the image pass the source alpha through, centred on what is left.
+// Kernels that grow it (rotate) resample alpha like a colour channel and
+// leave the area they did not cover transparent, so the reference is run on
+// alpha in channel 0 with a zero marker in channel 1: the reference fills the
+// uncovered area white, which turns the marker non-zero there.
+Mat expectedAlpha(const Mat& bgra, Size result, const KernelVerifier::opFuncType& reference) {
+	Mat alpha;
+	extractChannel(bgra, alpha, 3);
+	if (result.width <= alpha.cols && result.height <= alpha.rows) {
+		return alpha(Rect((alpha.cols - result.width) / 2, (alpha.rows - result.height) / 2, result.width, result.height)).clone();
+	}
+	Mat zero = Mat::zeros(alpha.size(), CV_8U), marked;
+	merge(vector<Mat>{ alpha, zero, zero }, marked);
+	Mat resampled = reference(marked), res, marker;
+	extractChannel(resampled, res, 0);
+	extractChannel(resampled, marker, 1);
+	res.setTo(0, marker);
+	return res;
+}
+
+}
+
+KernelVerifier::KernelVerifier() {
+	const list<pair<float, float>> vertices{ { 0.0f, 0.0f }, { 0.3f, 0.1f }, { 0.7f, 0.9f }, { 1.0f, 1.0f } };
+	pattern = noiseImage(83, 59, 7, 60, 200);
+	const Mat& pat = pattern;
+
+	addCase("linearConvert", [=](const Mat& m) { return Utils::linearConvert(m, vertices); }, [=](const Mat& m) { return ReferenceUtils::linearConvert(m, vertices); });
+	addCase("histogramEqualization", [](const Mat& m) { return Utils::histogramEqualization(m); }, &ReferenceUtils::histogramEqualization);
+	// A grey image is matched to the grey histogram of the colour pattern,
+	// which has no per-channel reference to compare against.
+	addCase("histogramSpecificationSML", [=](const Mat& m) { return Utils::histogramSpecificationSML(m, pat); }, [=](const Mat& m) { return ReferenceUtils::histogramSpecificationSML(m, pat); }, true);
+	addCase("histogramSpecificationGML", [=](const Mat& m) { return Utils::histogramSpecificationGML(m, pat); }, [=](const Mat& m) { return ReferenceUtils::histogramSpecificationGML(m, pat); }, true);
+	addCase("histogramSpecificationExact", [=](const Mat& m) { return Utils::histogramSpecificationExact(m, pat); }, [=](const Mat& m) { return ReferenceUtils::histogramSpecificationExact(m, pat); }, true);
+	const array<double, 256> uniform = Utils::uniformDistribution(), gaussian = Utils::gaussianDistribution(128, 40);
+	addCase("histogramSpecificationExact:uniform", [=](const Mat& m) { Mat res; Utils::histogramSpecificationExact(m, res, uniform); return res; }, [=](const Mat& m) { return ReferenceUtils::histogramSpecificationExact(m, uniform); }, true);
+	addCase("histogramSpecificationExact:gaussian", [=](const Mat& m) { Mat res; Utils::histogramSpecificationExact(m, res, gaussian); return res; }, [=](const Mat& m) { return ReferenceUtils::histogramSpecificationExact(m, gaussian); }, true);
+
+	for (int size : { 3, 7 }) {
+		addCase("median:" + to_string(size), [=](const Mat& m) { return Utils::medianFilterImageMat(m, size); }, [=](const Mat& m) { return ReferenceUtils::medianFilterImageMat(m, size); });
+	}
+	addCase("gaussian:5", [](const Mat& m) { return Utils::gaussianFilterImageMat(m, 5, 1.0f); }, [](const Mat& m) { return ReferenceUtils::gaussianFilterImageMat(m, 5, 1.0f); });
+	const char *sharpenNames[] = { "robert", "prewitt", "sobel", "laplace" };
+	rep(type, 4) {
+		addCase(string("sharpen:") + sharpenNames[type], [=](const Mat& m) { return Utils::sharpenImageMat(m, type); }, [=](const Mat& m) { return ReferenceUtils::sharpenImageMat(m, type); });
+	}
+	addCase("rotate:0.3", [](const Mat& m) { return Utils::rotateImageMat(m, 0.3f); }, [](const Mat& m) { return ReferenceUtils::rotateImageMat(m, 0.3f); });
+
+	auto addChange = [&](const string& op, vector<float> deltas, Utils::changeFuncType func, ReferenceUtils::changeFuncType reference) {
+		addCase(op, [=](const Mat& m) { return Utils::changeImageMat(m, deltas, func); }, [=](const Mat& m) { return ReferenceUtils::changeImageMat(m, deltas, reference); });
+	};
+	addChange("lightness:0.5", { 0.5f }, &Utils::changePartialImageMatLightness, &ReferenceUtils::changePartialImageMatLightness);
+	addChange("lightness:1.5", { 1.5f }, &Utils::changePartialImageMatLightness, &ReferenceUtils::changePartialImageMatLightness);
+	addChange("saturation:0.5", { 0.5f }, &Utils::changePartialImageMatSaturation, &ReferenceUtils::changePartialImageMatSaturation);
+	addChange("saturation:-0.5", { -0.5f }, &Utils::changePartialImageMatSaturation, &ReferenceUtils::changePartialImageMatSaturation);
+	addChange("hue:90", { 90.0f }, &Utils::changePartialImageMatHue, &ReferenceUtils::changePartialImageMatHue);
+	addChange("hue:-150", { -150.0f }, &Utils::changePartialImageMatHue, &ReferenceUtils::changePartialImageMatHue);
+	addChange("gamma:0.5", { 0.5f, 1.0f }, &Utils::changePartialImageMatGamma, &ReferenceUtils::changePartialImageMatGamma);
+	addChange("log:2", { 0.0f, 1.0f, 2.0f }, &Utils::changePartialImageMatLog, &ReferenceUtils::changePartialImageMatLog);
+	addChange("pow:2.3", { 0.0f, 2.3f, 1.0f }, &Utils::changePartialImageMatPow, &ReferenceUtils::changePartialImageMatPow);
+
+	// The fixed point kernel rounds its coefficients to 1/4096, one level
+	// off the float reference at most. The mix keeps grey grey, since a grey
+	// result is the mean of the three channels and the reference's is one.
+	setTolerance("matrixSaturation", { 1, 48 });
+	setTolerance("matrixHue", { 1, 48 });
+	setTolerance("matrixMix", { 1, 48 });
+	for (const char *op : { "matrixSaturation:0.5", "matrixHue:90", "matrixMix:0.2/0.3/0.5/0.05/0.5/0.2/0.3/0.05/0.3/0.5/0.2/0.05" }) {
+		ColorMatrix matrix;
+		ColorMatrix::parse(op, matrix);
+		addCase(op, [=](const Mat& m) { return matrix.apply(m); }, [=](const Mat& m) { return ReferenceUtils::colorMatrix(m, matrix.m); });
+	}
+
+	// The frequency domain filters go through float DFTs whose rounding
+	// depends on the OpenCV build, so they are only held to a PSNR bound.
+	setTolerance("lowPass", { 2, 40 });
+	setTolerance("highPass", { 2, 40 });
+	addCase("lowPass:gauss", [](const Mat& m) { return Utils::lowPassFiltering(m, Utils::gaussLowPassFilter(m.rows, m.cols, 32)); }, [](const Mat& m) { return ReferenceUtils::lowPassFiltering(m, Utils::gaussLowPassFilter(m.rows, m.cols, 32)); });
+	addCase("highPass:butterWorth", [](const Mat& m) { return Utils::highPassFiltering(m, Utils::butterWorthHighPassFilter(m.rows, m.cols, 16, 2)); }, [](const Mat& m) { return ReferenceUtils::highPassFiltering(m, Utils::butterWorthHighPassFilter(m.rows, m.cols, 16, 2)); });
+}
+
+void KernelVerifier::addCase(const string& op, opFuncType optimized, opFuncType reference, bool colorOnly) {
+	cases.push_back({ op, optimized, reference, colorOnly });
+}
+
+void KernelVerifier::setTolerance(const string& op, const Tolerance& tolerance) {
+	tolerances[op] = tolerance;
+}
+
+// "op=maxAbsError[,minPSNR]"; op may be a full case name ("median:3") or a
+// family ("median").
+bool KernelVerifier::parseTolerance(const string& spec) {
+	auto eq = spec.find('=');
+	if (eq == string::npos || eq == 0) {
+		return false;
+	}
+	Tolerance tolerance = { 0, 0 };
+	string values = spec.substr(eq + 1);
+	char *end;
+	tolerance.maxAbsError = strtod(values.c_str(), &end);
+	if (end == values.c_str()) {
+		return false;
+	}
+	if (*end == ',') {
+		tolerance.minPSNR = strtod(end + 1, &end);
+	}
+	if (*end) {
+		return false;
+	}
+	setTolerance(spec.substr(0, eq), tolerance);
+	return true;
+}
+
+KernelVerifier::Tolerance KernelVerifier::toleranceOf(const string& op) const {
+	auto it = tolerances.find(op);
+	if (it == tolerances.end()) {
+		it = tolerances.find(family(op));
+	}
+	if (it != tolerances.end()) {
+		return it->second;
+	}
+	return { 0, numeric_limits<double>::infinity() };
+}
+
+void KernelVerifier::addImage(const string& name, const Mat& mat) {
+	corpus.push_back({ name, mat });
+}
+
+void KernelVerifier::addSyntheticCorpus() {
+	addImage("noise-200x173", noiseImage(173, 200, 1, 0, 255));
+	addImage("lowcontrast-131x97", noiseImage(97, 131, 2, 90, 140));
+	addImage("gradient-257x129", gradientImage(129, 257));
+	addImage("checker-64x64", checkerImage(64, 64, 5));
+	addImage("grey-97x61", greyImage(61, 97, 3));
+	addImage("flat-50x37", Mat(37, 50, CV_8UC3, Scalar(128, 64, 200)));
+
+	Mat grey, bgra, alpha(97, 131, CV_8U);
+	cvtColor(greyImage(61, 97, 4), grey, COLOR_BGR2GRAY);
+	addImage("grey1-97x61", grey);
+	cvtColor(noiseImage(97, 131, 5, 0, 255), bgra, COLOR_BGR2BGRA);
+	rep(i, alpha.rows) rep(j, alpha.cols) {
+		alpha.at<uchar>(i, j) = (uchar) (j * 255 / (alpha.cols - 1));
+	}
+	insertChannel(alpha, bgra, 3);
+	addImage("bgra-131x97", bgra);
+}
+
+int KernelVerifier::addImageDirectory(const string& dir) {
+	int count = 0;
+	for (const char *ext : { "bmp", "png", "jpg", "jpeg" }) {
+		vector<String> files;
+		glob(dir + "/*." + ext, files, false);
+		for (const auto& file : files) {
+			Mat mat = Utils::readImageMat(file);
+			if (mat.rows < MIN_IMAGE_SIZE || mat.cols < MIN_IMAGE_SIZE) {
+				continue;
+			}
+			addImage(file, mat);
+			++count;
+		}
+	}
+	return count;
+}
+
+// An empty filter matches everything.
+const KernelVerifier::Case* KernelVerifier::find(const string& op) const {
+	for (const auto& c : cases) {
+		if (c.op == op) {
+			return &c;
+		}
+	}
+	return nullptr;
+}
+
+bool KernelVerifier::buildChain(const vector<string>& ops, vector<opFuncType>& chain, string& unknown, const function<opFuncType(const string&)>& resolve) const {
+	chain.clear();
+	bool fusing = false;
+	ColorMatrix fused;
+	auto flush = [&]() {
+		if (fusing) {
+			chain.push_back([fused](const Mat& m) { return fused.apply(m); });
+			fusing = false;
+		}
+	};
+	for (const auto& op : ops) {
+		ColorMatrix matrix;
+		if (ColorMatrix::isMatrixOp(op)) {
+			if (!ColorMatrix::parse(op, matrix)) {
+				unknown = op;
+				return false;
+			}
+			// A product past the fixed point range starts a new pass instead.
+			ColorMatrix product = matrix * fused;
+			if (fusing && !product.isBounded()) {
+				flush();
+			}
+			fused = fusing ? product : matrix;
+			fusing = true;
+			continue;
+		}
+		flush();
+		opFuncType f = resolve ? resolve(op) : nullptr;
+		if (!f) {
+			const Case *c = find(op);
+			if (!c) {
+				unknown = op;
+				return false;
+			}
+			f = c->optimized;
+		}
+		chain.push_back(f);
+	}
+	flush();
+	return true;
+}
+
+bool KernelVerifier::matches(const string& op, const string& filter) {
+	return filter.empty() || op == filter || family(op) == filter;
+}
+
+vector<KernelVerifier::Result> KernelVerifier::run(const string& filter) const {
+	vector<Result> res;
+	for (const auto& c : cases) {
+		if (!matches(c.op, filter)) {
+			continue;
+		}
+		Tolerance tolerance = toleranceOf(c.op);
+		for (const auto& image : corpus) {
+			int cn = image.second.channels();
+			if (c.colorOnly && cn != 3) {
+				continue;
+			}
+			Mat actual = c.optimized(image.second);
+			Mat expected, bgr;
+			if (cn == 1) {
+				cvtColor(image.second, bgr, COLOR_GRAY2BGR);
+				extractChannel(c.reference(bgr), expected, 0);
+			} else if (cn == 4) {
+				cvtColor(image.second, bgr, COLOR_BGRA2BGR);
+				Mat color = c.reference(bgr);
+				cvtColor(color, expected, COLOR_BGR2BGRA);
+				insertChannel(expectedAlpha(image.second, color.size(), c.reference), expected, 3);
+			} else {
+				expected = c.reference(image.second);
+			}
+
+			Result result;
+			result.op = c.op;
+			result.image = image.first;
+			result.comparison = ImageMetrics::compare(actual, expected);
+			result.passed = result.comparison.sameShape &&
+				result.comparison.maxAbsError <= tolerance.maxAbsError &&
+				result.comparison.psnr >= tolerance.minPSNR;
+			res.push_back(result);
+		}
+	}
+	return res;
+}
+
+bool KernelVerifier::printReport(FILE *fp, const vector<Result>& results) {
+	int failed = 0;
+	fprintf(fp, "%-28s %-24s %10s %8s %10s %8s\n", "op", "image", "mismatch", "maxAbs", "PSNR", "SSIM");
+	for (const auto& result : results) {
+		const auto& c = result.comparison;
+		const char *color = result.passed ? COLOR_GREEN : COLOR_RED;
+		if (!c.sameShape) {
+			Utils::c_fprintf(color, fp, "%-28s %-24s shape mismatch\n", result.op.c_str(), result.image.c_str());
+		} else {
+			Utils::c_fprintf(color, fp, "%-28s %-24s %10zu %8.0f %10.2f %8.5f\n", result.op.c_str(), result.image.c_str(), c.mismatches, c.maxAbsError, c.psnr, c.ssim);
+		}
+		if (!result.passed) {
+			++failed;
+		}
+	}
+	fprintf(fp, "%d of %d checks passed\n", (int) results.size() - failed, (int) results.size());
+	return !failed;
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include "ImageMetrics.h"
+
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Runs every Utils operation and its frozen ReferenceUtils counterpart over a
+// corpus of synthetic and user-supplied images and checks the outputs against
+// per-op tolerances. The default tolerance is bit-exact. Grey and BGRA inputs
+// are checked against the reference run on their BGR equivalent; the alpha of
+// a BGRA result is checked too, against the source alpha.
+class KernelVerifier {
+public:
+	struct Tolerance {
+		double maxAbsError, minPSNR;
+	};
+
+	struct Result {
+		std::string op, image;
+		bool passed;
+		ImageMetrics::Comparison comparison;
+	};
+
+	using opFuncType = std::function<cv::Mat(const cv::Mat&)>;
+
+	struct Case {
+		std::string op;
+		opFuncType optimized, reference;
+		bool colorOnly;
+	};
+
+	KernelVerifier();
+
+	void setTolerance(const std::string& op, const Tolerance& tolerance);
+	bool parseTolerance(const std::string& spec);
+
+	void addImage(const std::string& name, const cv::Mat& mat);
+	void addSyntheticCorpus();
+	int addImageDirectory(const std::string& dir);
+
+	std::vector<Result> run(const std::string& filter = "") const;
+	static bool printReport(FILE *fp, const std::vector<Result>& results);
+
+	const std::vector<Case>& operations() const {
+		return cases;
+	}
+	// nullptr for an unknown op name.
+	const Case* find(const std::string& op) const;
+	// Resolves op names, the verified ones and the ColorMatrix ones, into
+	// functions; a run of matrix ops is multiplied into a single pass.
+	// resolve, when set, is asked first and may return an empty function.
+	// On failure unknown names the op that could not be resolved.
+	bool buildChain(const std::vector<std::string>& ops, std::vector<opFuncType>& chain, std::string& unknown,
+		const std::function<opFuncType(const std::string&)>& resolve = nullptr) const;
+	static bool matches(const std::string& op, const std::string& filter);
+
+private:
+	void addCase(const std::string& op, opFuncType optimized, opFuncType reference, bool colorOnly = false);
+	Tolerance toleranceOf(const std::string& op) const;
+
+	std::vector<Case> cases;
+	std::map<std::string, Tolerance> tolerances;
+	std::vector<std::pair<std::string, cv::Mat>> corpus;
+	cv::Mat pattern;
+};
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+// Each view gets its own UMatData whose userdata keeps the mapping alive.
+class MappedAllocator : public MatAllocator {
+public:
+	UMatData* allocate(int, const int*, int, void*, size_t*, int, UMatUsageFlags) const override {
+		return nullptr;
+	}
+	bool allocate(UMatData*, int, UMatUsageFlags) const override {
+		return false;
+	}
+	void deallocate(UMatData *u) const override {
+		if (!u) {
+			return;
+		}
+		delete (shared_ptr<MappedFile>*) u->userdata;
+		delete u;
+	}
+};
+
+MappedAllocator mappedAllocator;
+
+}
+
+shared_ptr<MappedFile> MappedFile::open(const string& fileName) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	}
+	CloseHandle(file);
+	if (!mapping) {
+		return nullptr;
+	}
+	uchar *data = (uchar*) MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!data) {
+		return nullptr;
+	}
+	return shared_ptr<MappedFile>(new MappedFile(data, (size_t) fileSize.QuadPart));
+#else
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	void *ptr = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		ptr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		return nullptr;
+	}
+	return shared_ptr<MappedFile>(new MappedFile((uchar*) ptr, st.st_size));
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+	UnmapViewOfFile(base);
+#else
+	munmap(base, length);
+#endif
+}
+
+Mat MappedFile::view(size_t offset, int rows, int cols, int type, size_t step) {
+	size_t rowBytes = (size_t) cols * CV_ELEM_SIZE(type);
+	if (rows <= 0 || cols <= 0 || step < rowBytes || offset > length || length - offset < rowBytes) {
+		return Mat();
+	}
+	if ((length - offset - rowBytes) / step < (size_t) (rows - 1)) {
+		return Mat();
+	}
+	Mat res(rows, cols, type, base + offset, step);
+	UMatData *u = new UMatData(&mappedAllocator);
+	u->data = u->origdata = base + offset;
+	u->size = step * (rows - 1) + rowBytes;
+	u->userdata = new shared_ptr<MappedFile>(shared_from_this());
+	u->refcount = 1;
+	res.allocator = &mappedAllocator;
+	res.u = u;
+	return res;
+}
\ No newline at end of file
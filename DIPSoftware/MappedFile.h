@@ -0,0 +1,31 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// A whole file mapped copy-on-write: pages are read in on first touch and
+// writes through a view never reach the file. Mats returned by view() hold a
+// reference to the mapping, so it is unmapped once the MappedFile and every
+// view of it are gone.
+class MappedFile : public std::enable_shared_from_this<MappedFile> {
+public:
+	static std::shared_ptr<MappedFile> open(const std::string& fileName);
+	~MappedFile();
+
+	const uchar* data() const { return base; }
+	size_t size() const { return length; }
+	// An empty Mat when the rows do not fit in the file.
+	cv::Mat view(size_t offset, int rows, int cols, int type, size_t step);
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile& operator=(const MappedFile &) = delete;
+
+private:
+	MappedFile(uchar *base, size_t length) : base(base), length(length) {}
+
+	uchar *base;
+	size_t length;
+};
\ No newline at end of file
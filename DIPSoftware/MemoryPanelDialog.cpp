@@ -0,0 +1,52 @@
+#include "MemoryPanelDialog.h"
+#include "BufferPool.h"
+#include "MemoryTracker.h"
+#include "QtUtils.h"
+
+#include <QHeaderView>
+
+using namespace std;
+
+MemoryPanelDialog::MemoryPanelDialog(QWidget *parent, Qt::WindowFlags flags) : QDialog(parent, flags) {
+	setWindowTitle(QSL("ڴͳ"));
+
+	table = new QTableWidget(0, 4, this);
+	table->setHorizontalHeaderLabels({ QSL("ǩ"), QSL("ǰ(MB)"), QSL("ֵ(MB)"), QSL("") });
+	table->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+	table->verticalHeader()->hide();
+	table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+	table->setMinimumSize(480, 300);
+	totalLabel = new QLabel(this);
+	poolLabel = new QLabel(this);
+
+	mainLayout = new QVBoxLayout(this);
+	mainLayout->addWidget(table);
+	mainLayout->addWidget(totalLabel);
+	mainLayout->addWidget(poolLabel);
+
+	refreshTimer = new QTimer(this);
+	connect(refreshTimer, &QTimer::timeout, this, &MemoryPanelDialog::refresh);
+	refreshTimer->start(1000);
+	refresh();
+}
+
+MemoryPanelDialog::~MemoryPanelDialog() {
+
+}
+
+void MemoryPanelDialog::refresh() {
+	const double MB = 1024.0 * 1024.0;
+
+	vector<MemoryTracker::TagStats> stats = MemoryTracker::report();
+	table->setRowCount(stats.size());
+	rep(i, (int) stats.size()) {
+		table->setItem(i, 0, new QTableWidgetItem(QString::fromStdString(stats[i].tag)));
+		table->setItem(i, 1, new QTableWidgetItem(QString::number(stats[i].currentBytes / MB, 'f', 2)));
+		table->setItem(i, 2, new QTableWidgetItem(QString::number(stats[i].peakBytes / MB, 'f', 2)));
+		table->setItem(i, 3, new QTableWidgetItem(QString::number((qulonglong) stats[i].allocations)));
+	}
+
+	totalLabel->setText(QSL("ϼƣǰ %1 MBֵ %2 MB").arg(MemoryTracker::totalBytes() / MB, 0, 'f', 2).arg(MemoryTracker::peakTotalBytes() / MB, 0, 'f', 2));
+	BufferPool::Stats pool = BufferPool::instance().stats();
+	poolLabel->setText(QSL("أʹ %1 MB %2 MB %3δ %4").arg(pool.liveBytes / MB, 0, 'f', 2).arg(pool.cachedBytes / MB, 0, 'f', 2).arg((qulonglong) pool.hits).arg((qulonglong) pool.misses));
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <QDialog>
+#include <QLabel>
+#include <QTableWidget>
+#include <QTimer>
+#include <QVBoxLayout>
+
+class MemoryPanelDialog : public QDialog {
+	Q_OBJECT
+
+public:
+	MemoryPanelDialog(QWidget *parent = 0, Qt::WindowFlags flags = 0);
+	~MemoryPanelDialog();
+
+public slots:
+	void refresh();
+
+private:
+	QTableWidget *table;
+	QLabel *totalLabel;
+	QLabel *poolLabel;
+	QTimer *refreshTimer;
+
+	QVBoxLayout *mainLayout;
+};
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include "MemoryTracker.h"
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+// Never destroyed: Mats released at exit, after this file's statics are
+// gone, still charge their entries.
+mutex& entriesMutex = *new mutex;
+map<string, unique_ptr<MemoryTracker::Entry>>& entries = *new map<string, unique_ptr<MemoryTracker::Entry>>;
+thread_local MemoryTracker::Entry *current = nullptr;
+
+atomic<int64_t> total{ 0 }, peakTotal{ 0 };
+string reportFileName;
+
+void updatePeak(atomic<int64_t>& peak, int64_t value) {
+	int64_t old = peak.load(memory_order_relaxed);
+	while (old < value && !peak.compare_exchange_weak(old, value, memory_order_relaxed));
+}
+
+void dumpAtExit() {
+	if (reportFileName == "-") {
+		MemoryTracker::dump(stderr);
+		return;
+	}
+	FILE *fp = fopen(reportFileName.c_str(), "w");
+	if (fp) {
+		MemoryTracker::dump(fp);
+		fclose(fp);
+	}
+}
+
+}
+
+MemoryTracker::Entry* MemoryTracker::entry(const char *tag) {
+	lock_guard<mutex> lock(entriesMutex);
+	auto& res = entries[tag];
+	if (!res) {
+		res.reset(new Entry);
+		res->tag = tag;
+	}
+	return res.get();
+}
+
+MemoryTracker::Entry* MemoryTracker::currentEntry() {
+	if (!current) {
+		current = entry("untagged");
+	}
+	return current;
+}
+
+void MemoryTracker::setCurrentEntry(Entry *entry) {
+	current = entry;
+}
+
+void MemoryTracker::charge(Entry *entry, int64_t bytes) {
+	int64_t value = entry->currentBytes.fetch_add(bytes, memory_order_relaxed) + bytes;
+	updatePeak(entry->peakBytes, value);
+	value = total.fetch_add(bytes, memory_order_relaxed) + bytes;
+	updatePeak(peakTotal, value);
+}
+
+void MemoryTracker::onAllocate(UMatData *u) {
+	Entry *entry = currentEntry();
+	u->userdata = entry;
+	++entry->allocations;
+	charge(entry, u->size);
+}
+
+void MemoryTracker::onRelease(UMatData *u) {
+	if (u->userdata) {
+		charge((Entry*) u->userdata, -(int64_t) u->size);
+		u->userdata = nullptr;
+	}
+}
+
+void MemoryTracker::retag(const Mat& mat, const char *tag) {
+	UMatData *u = mat.u;
+	if (!u || !u->userdata || u->currAllocator != &BufferPool::instance()) {
+		return;
+	}
+	Entry *to = entry(tag);
+	Entry *from = (Entry*) u->userdata;
+	if (from == to) {
+		return;
+	}
+	charge(from, -(int64_t) u->size);
+	charge(to, u->size);
+	u->userdata = to;
+}
+
+// For memory outside cv::Mat (e.g. QPixmap backing stores) that the caller
+// accounts by hand.
+void MemoryTracker::adjust(const char *tag, int64_t bytes) {
+	Entry *entry = MemoryTracker::entry(tag);
+	if (bytes > 0) {
+		++entry->allocations;
+	}
+	charge(entry, bytes);
+}
+
+vector<MemoryTracker::TagStats> MemoryTracker::report() {
+	vector<TagStats> res;
+	{
+		lock_guard<mutex> lock(entriesMutex);
+		for (const auto& entry : entries) {
+			res.push_back({ entry.first, entry.second->currentBytes.load(), entry.second->peakBytes.load(), entry.second->allocations.load() });
+		}
+	}
+	sort(res.begin(), res.end(), [](const TagStats& a, const TagStats& b) { return a.peakBytes > b.peakBytes; });
+	return res;
+}
+
+int64_t MemoryTracker::totalBytes() {
+	return total.load();
+}
+
+int64_t MemoryTracker::peakTotalBytes() {
+	return peakTotal.load();
+}
+
+void MemoryTracker::dump(FILE *fp) {
+	const double MB = 1024.0 * 1024.0;
+	fprintf(fp, "%-40s %12s %12s %10s\n", "tag", "current(MB)", "peak(MB)", "allocs");
+	for (const auto& stats : report()) {
+		fprintf(fp, "%-40s %12.2f %12.2f %10llu\n", stats.tag.c_str(), stats.currentBytes / MB, stats.peakBytes / MB, (unsigned long long) stats.allocations);
+	}
+	fprintf(fp, "%-40s %12.2f %12.2f\n", "total", totalBytes() / MB, peakTotalBytes() / MB);
+
+	BufferPool::Stats pool = BufferPool::instance().stats();
+	fprintf(fp, "buffer pool: live %.2f MB, cached %.2f MB, peak %.2f MB, %llu hits, %llu misses\n",
+		pool.liveBytes / MB, pool.cachedBytes / MB, pool.peakBytes / MB, (unsigned long long) pool.hits, (unsigned long long) pool.misses);
+}
+
+void MemoryTracker::initFromEnvironment() {
+	const char *fileName = getenv("DIP_MEMORY_REPORT");
+	if (!fileName || !*fileName) {
+		return;
+	}
+	reportFileName = fileName;
+	atexit(dumpAtExit);
+}
\ No newline at end of file
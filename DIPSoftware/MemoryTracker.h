@@ -0,0 +1,67 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Per-tag accounting of the bytes allocated through BufferPool. Allocations
+// are charged to the innermost MEMORY_TAG scope of the allocating thread and
+// credited back to the same tag on release; retag() moves a live buffer to
+// another tag (e.g. when an image enters the undo history).
+// Set DIP_MEMORY_REPORT=<file> (or "-" for stderr) to dump a report on exit.
+class MemoryTracker {
+public:
+	struct Entry {
+		std::string tag;
+		std::atomic<int64_t> currentBytes{ 0 }, peakBytes{ 0 };
+		std::atomic<uint64_t> allocations{ 0 };
+	};
+
+	struct TagStats {
+		std::string tag;
+		int64_t currentBytes, peakBytes;
+		uint64_t allocations;
+	};
+
+	static Entry* entry(const char *tag);
+	static Entry* currentEntry();
+	static void setCurrentEntry(Entry *entry);
+
+	static void onAllocate(cv::UMatData *u);
+	static void onRelease(cv::UMatData *u);
+	static void retag(const cv::Mat& mat, const char *tag);
+	static void adjust(const char *tag, int64_t bytes);
+
+	static std::vector<TagStats> report();
+	static int64_t totalBytes();
+	static int64_t peakTotalBytes();
+	static void dump(FILE *fp);
+	static void initFromEnvironment();
+
+private:
+	static void charge(Entry *entry, int64_t bytes);
+};
+
+class MemoryTag {
+public:
+	explicit MemoryTag(const char *tag) : previous(MemoryTracker::currentEntry()) {
+		MemoryTracker::setCurrentEntry(MemoryTracker::entry(tag));
+	}
+	~MemoryTag() {
+		MemoryTracker::setCurrentEntry(previous);
+	}
+
+	MemoryTag(const MemoryTag &) = delete;
+	MemoryTag& operator=(const MemoryTag &) = delete;
+
+private:
+	MemoryTracker::Entry *previous;
+};
+
+#define __MEMORY_TAG_CONCAT__(x, y) x ## y
+#define __MEMORY_TAG_NAME__(x, y) __MEMORY_TAG_CONCAT__(x, y)
+#define MEMORY_TAG(tag) MemoryTag __MEMORY_TAG_NAME__(__memory_tag__, __LINE__)(tag)
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "PngEncoder.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <zlib.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+// Filtered bytes per band: large enough that the 32KB window lost at each
+// band boundary costs little ratio, small enough to spread over many cores.
+const size_t BAND_BYTES = 512 << 10;
+const size_t IDAT_BYTES = 1 << 20;
+
+void putBE32(vector<uchar>& out, uint32_t value) {
+	out.push_back((uchar) (value >> 24));
+	out.push_back((uchar) (value >> 16));
+	out.push_back((uchar) (value >> 8));
+	out.push_back((uchar) value);
+}
+
+void putChunk(vector<uchar>& out, const char *type, const uchar *data, size_t size) {
+	putBE32(out, (uint32_t) size);
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data, data + size);
+	uLong crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, out.data() + start, (uInt) (out.size() - start));
+	putBE32(out, (uint32_t) crc);
+}
+
+// BGR(A) to RGB(A), the PNG byte order.
+void toPngOrder(const uchar *src, uchar *dst, int width, int cn) {
+	if (cn == 1) {
+		memcpy(dst, src, width);
+		return;
+	}
+	for (int j = 0; j < width; ++j, src += cn, dst += cn) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+		if (cn == 4) {
+			dst[3] = src[3];
+		}
+	}
+}
+
+inline uchar paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc) {
+		return (uchar) a;
+	}
+	return (uchar) (pb <= pc ? b : c);
+}
+
+// Writes the filter byte and the filtered row, choosing the filter with the
+// smallest sum of absolute signed residuals like libpng does.
+void filterRow(const uchar *row, const uchar *prev, int length, int bpp, uchar *out, vector<uchar>& scratch) {
+	scratch.resize(length * 5);
+	long best = -1;
+	int bestFilter = 0;
+	rep(f, 5) {
+		uchar *res = scratch.data() + f * length;
+		long sum = 0;
+		rep(x, length) {
+			int a = x >= bpp ? row[x - bpp] : 0;
+			int b = prev ? prev[x] : 0;
+			int c = prev && x >= bpp ? prev[x - bpp] : 0;
+			uchar predictor = 0;
+			if (f == 1) {
+				predictor = (uchar) a;
+			} else if (f == 2) {
+				predictor = (uchar) b;
+			} else if (f == 3) {
+				predictor = (uchar) ((a + b) / 2);
+			} else if (f == 4) {
+				predictor = paeth(a, b, c);
+			}
+			res[x] = (uchar) (row[x] - predictor);
+			sum += abs((signed char) res[x]);
+		}
+		if (best < 0 || sum < best) {
+			best = sum;
+			bestFilter = f;
+		}
+	}
+	out[0] = (uchar) bestFilter;
+	memcpy(out + 1, scratch.data() + bestFilter * length, length);
+}
+
+struct Band {
+	vector<uchar> deflated;
+	uLong adler;
+	size_t filteredBytes;
+	bool ok;
+};
+
+void deflateBand(const uchar *data, size_t step, int width, int cn, int first, int rows, int height, int level, Band& band) {
+	int length = width * cn;
+	vector<uchar> filtered((size_t) rows * (length + 1)), row(length), prev(length), scratch;
+	if (first > 0) {
+		toPngOrder(data + step * (first - 1), prev.data(), width, cn);
+	}
+	rep(i, rows) {
+		toPngOrder(data + step * (first + i), row.data(), width, cn);
+		filterRow(row.data(), first + i > 0 ? prev.data() : nullptr, length, cn, filtered.data() + (size_t) i * (length + 1), scratch);
+		swap(row, prev);
+	}
+
+	band.filteredBytes = filtered.size();
+	band.adler = adler32(adler32(0L, Z_NULL, 0), filtered.data(), (uInt) filtered.size());
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	band.ok = deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+	if (!band.ok) {
+		return;
+	}
+	bool last = first + rows == height;
+	band.deflated.resize(deflateBound(&zs, (uLong) filtered.size()) + 16);
+	zs.next_in = filtered.data();
+	zs.avail_in = (uInt) filtered.size();
+	zs.next_out = band.deflated.data();
+	zs.avail_out = (uInt) band.deflated.size();
+	int res = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+	band.ok = (last ? res == Z_STREAM_END : res == Z_OK) && zs.avail_in == 0;
+	band.deflated.resize(zs.total_out);
+	deflateEnd(&zs);
+}
+
+}
+
+bool PngEncoder::encode(const Mat& mat, vector<uchar>& out, int level, const progressType& progress) {
+	if (mat.depth() != CV_8U) {
+		return false;
+	}
+	return encode(mat.data, mat.step, mat.cols, mat.rows, mat.channels(), out, level, progress);
+}
+
+bool PngEncoder::encode(const uchar *data, size_t step, int width, int height, int cn, vector<uchar>& out, int level, const progressType& progress) {
+	TRACE_SCOPE("PngEncoder::encode");
+	if (!data || width <= 0 || height <= 0 || (cn != 1 && cn != 3 && cn != 4)) {
+		return false;
+	}
+	updateMinMax(level, 9, 0);
+
+	size_t rowBytes = (size_t) width * cn + 1;
+	int bandRows = (int) max<size_t>(1, BAND_BYTES / rowBytes);
+	int bands = (height + bandRows - 1) / bandRows;
+	vector<Band> results(bands);
+	atomic<int> done{ 0 };
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int b = 0; b < bands; ++b) {
+		int first = b * bandRows;
+		deflateBand(data, step, width, cn, first, min(bandRows, height - first), height, level, results[b]);
+		int finished = ++done;
+		if (progress) {
+			progress(finished, bands);
+		}
+	}
+
+	vector<uchar> stream;
+	// CMF 0x78 is deflate with a 32KB window; FLEVEL records the level and
+	// FCHECK makes the header a multiple of 31.
+	int flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+	int flg = flevel << 6;
+	flg += 31 - (0x78 * 256 + flg) % 31;
+	stream.push_back(0x78);
+	stream.push_back((uchar) flg);
+	uLong adler = 0;
+	rep(b, bands) {
+		const Band& band = results[b];
+		if (!band.ok) {
+			return false;
+		}
+		stream.insert(stream.end(), band.deflated.begin(), band.deflated.end());
+		adler = b ? adler32_combine(adler, band.adler, (z_off_t) band.filteredBytes) : band.adler;
+	}
+	putBE32(stream, (uint32_t) adler);
+
+	static const uchar SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	out.assign(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+	vector<uchar> header;
+	putBE32(header, (uint32_t) width);
+	putBE32(header, (uint32_t) height);
+	const uchar colorType = cn == 1 ? 0 : cn == 3 ? 2 : 6;
+	const uchar rest[] = { 8, colorType, 0, 0, 0 };
+	header.insert(header.end(), rest, rest + sizeof(rest));
+	putChunk(out, "IHDR", header.data(), header.size());
+	for (size_t pos = 0; pos < stream.size(); pos += IDAT_BYTES) {
+		putChunk(out, "IDAT", stream.data() + pos, min(IDAT_BYTES, stream.size() - pos));
+	}
+	putChunk(out, "IEND", nullptr, 0);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <functional>
+#include <vector>
+
+// PNG encoder that deflates bands of rows on all cores, the way pigz does:
+// each band is an independent raw deflate stream ended by a sync flush, so
+// the concatenation is one valid zlib stream whose Adler-32 is combined from
+// the per-band checksums. Accepts 8-bit grey, BGR and BGRA images.
+class PngEncoder {
+public:
+	// Called with the number of bands done so far, possibly from a worker thread.
+	using progressType = std::function<void(int done, int total)>;
+
+	static bool encode(const cv::Mat& mat, std::vector<uchar>& out, int level = 6, const progressType& progress = nullptr);
+	static bool encode(const uchar *data, size_t step, int width, int height, int cn, std::vector<uchar>& out, int level = 6, const progressType& progress = nullptr);
+};
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include "QtUtils.h"
+#include "MemoryTracker.h"
+#include "Trace.h"
+
+using namespace cv;
+using namespace std;
+
+QString QtUtils::getExtension(const String& str) {
+	auto pos = str.find_last_of('.');
+	QString res;
+	repa(i, pos + 1, str.size()) {
+		res.append(str[i]);
+	}
+	return res;
+}
+
+QImage QtUtils::mat2QImage(const Mat& mat) {
+	TRACE_SCOPE("QtUtils::mat2QImage");
+	Mat buffer;
+	return mat2QImage(mat, buffer).copy();
+}
+
+// The returned image references buffer, which must outlive it; reusing the
+// same buffer across calls keeps the display path free of allocations.
+QImage QtUtils::mat2QImage(const Mat& mat, Mat& buffer) {
+	TRACE_SCOPE("QtUtils::mat2QImage");
+	MEMORY_TAG("display pixmap");
+	if (mat.type() == CV_8UC3) {
+		cvtColor(mat, buffer, COLOR_BGR2RGB);
+		return QImage(buffer.data, buffer.cols, buffer.rows, buffer.step, QImage::Format_RGB888);
+	} else if (mat.type() == CV_8UC1) {
+		buffer = mat;
+		return QImage(buffer.data, buffer.cols, buffer.rows, buffer.step, QImage::Format_Grayscale8);
+	} else if (mat.type() == CV_8UC4) {
+		// BGRA bytes are exactly ARGB32 words on a little-endian host.
+		buffer = mat;
+		return QImage(buffer.data, buffer.cols, buffer.rows, buffer.step, QImage::Format_ARGB32);
+	} else {
+		return QImage();
+	}
+}
\ No newline at end of file
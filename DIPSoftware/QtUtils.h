@@ -0,0 +1,19 @@
+#pragma once
+
+#include <QImage>
+#include <QString>
+
+#include <opencv2/opencv.hpp>
+
+#include "Utils.h"
+
+#define QSL(x) QStringLiteral(x)
+
+// The Qt side of Utils, kept apart so the processing core builds without Qt.
+class QtUtils {
+public:
+	static QString getExtension(const cv::String& str);
+
+	static QImage mat2QImage(const cv::Mat& mat);
+	static QImage mat2QImage(const cv::Mat& mat, cv::Mat& buffer);
+};
\ No newline at end of file
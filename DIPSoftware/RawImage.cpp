@@ -0,0 +1,102 @@
+#include "RawImage.h"
+#include "ImageWriter.h"
+#include "MappedFile.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <cstring>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+const char MAGIC[8] = { 'D', 'I', 'P', 'R', 'A', 'W', 0, 0 };
+const uint32_t VERSION = 1;
+const size_t DATA_ALIGNMENT = 4096;
+const size_t STRIDE_ALIGNMENT = 64;
+const size_t TILE_BYTES = 1 << 20;
+
+size_t alignUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+bool validHeader(const RawImage::Header& header, size_t fileSize) {
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION || header.depth != CV_8U) {
+		return false;
+	}
+	if (header.channels != 1 && header.channels != 3 && header.channels != 4) {
+		return false;
+	}
+	if (!header.width || !header.height || header.stride < (uint64_t) header.width * header.channels) {
+		return false;
+	}
+	return header.dataOffset >= sizeof(RawImage::Header) && header.dataOffset <= fileSize &&
+		(fileSize - header.dataOffset) / header.stride >= header.height;
+}
+
+}
+
+const char *RawImage::EXTENSION = "dipraw";
+
+// The header is written field by field in memory order; every target we
+// build for is little-endian.
+static_assert(sizeof(RawImage::Header) == 64, "RawImage::Header must stay 64 bytes");
+
+bool RawImage::write(const string& fileName, const Mat& mat, const function<void(double)>& progress) {
+	TRACE_SCOPE("RawImage::write");
+	if (mat.empty() || mat.depth() != CV_8U || (mat.channels() != 1 && mat.channels() != 3 && mat.channels() != 4)) {
+		return false;
+	}
+	Header header = {};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.width = mat.cols;
+	header.height = mat.rows;
+	header.channels = mat.channels();
+	header.depth = CV_8U;
+	header.stride = alignUp((size_t) mat.cols * mat.channels(), STRIDE_ALIGNMENT);
+	header.tileRows = (uint32_t) max<size_t>(1, TILE_BYTES / header.stride);
+	header.dataOffset = DATA_ALIGNMENT;
+
+	return ImageWriter::writeAtomically(fileName, [&](FILE *fp) {
+		vector<uchar> padding(header.dataOffset - sizeof(header), 0);
+		if (fwrite(&header, sizeof(header), 1, fp) != 1 || fwrite(padding.data(), 1, padding.size(), fp) != padding.size()) {
+			return false;
+		}
+		vector<uchar> band(header.stride * header.tileRows, 0);
+		size_t rowBytes = (size_t) mat.cols * mat.channels();
+		for (int first = 0; first < mat.rows; first += header.tileRows) {
+			int rows = min<int>(header.tileRows, mat.rows - first);
+			rep(i, rows) {
+				memcpy(band.data() + i * header.stride, mat.ptr<uchar>(first + i), rowBytes);
+			}
+			if (fwrite(band.data(), header.stride, rows, fp) != (size_t) rows) {
+				return false;
+			}
+			if (progress) {
+				progress((first + rows) * 1.0 / mat.rows);
+			}
+		}
+		return true;
+	});
+}
+
+Mat RawImage::map(const string& fileName) {
+	TRACE_SCOPE("RawImage::map");
+	auto file = MappedFile::open(fileName);
+	Header header;
+	if (!file || file->size() < sizeof(header)) {
+		return Mat();
+	}
+	memcpy(&header, file->data(), sizeof(header));
+	if (!validHeader(header, file->size())) {
+		return Mat();
+	}
+	return file->view(header.dataOffset, header.height, header.width, CV_8UC(header.channels), header.stride);
+}
+
+bool RawImage::isRawImage(const string& fileName) {
+	return ImageWriter::extensionOf(fileName) == EXTENSION;
+}
\ No newline at end of file
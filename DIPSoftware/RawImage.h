@@ -0,0 +1,36 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// The .dipraw working format: a 64 byte header and uncompressed pixels from
+// a page aligned offset, row-major with a padded stride so that the file
+// maps straight onto a cv::Mat. map() returns such a Mat over a copy-on-write
+// mapping: opening costs nothing up front and only the rows that are read
+// get paged in, while writes to the Mat never reach the file.
+class RawImage {
+public:
+	static const char *EXTENSION;
+
+	// All fields little-endian. The pixel data is written in bands of
+	// tileRows rows, the unit worth prefetching when streaming the file.
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t width, height;
+		uint32_t channels;
+		uint32_t depth;
+		uint32_t tileRows;
+		uint64_t stride;
+		uint64_t dataOffset;
+		uint8_t reserved[16];
+	};
+
+	static bool write(const std::string& fileName, const cv::Mat& mat, const std::function<void(double)>& progress = nullptr);
+	// An empty Mat when the file is missing or is not a valid .dipraw.
+	static cv::Mat map(const std::string& fileName);
+	static bool isRawImage(const std::string& fileName);
+};
\ No newline at end of file
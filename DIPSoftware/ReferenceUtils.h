@@ -0,0 +1,64 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <array>
+#include <functional>
+#include <list>
+#include <vector>
+
+// Frozen copies of the original scalar Utils kernels, kept unchanged as the
+// oracle that optimized rewrites are verified against (see KernelVerifier).
+// Do not optimize or otherwise modify these. Kernels that never had a scalar
+// original get the plainest formulation of their definition instead.
+class ReferenceUtils {
+public:
+	using changeFuncType = std::function<void(const cv::Mat &, cv::Mat &, std::vector<float>)>;
+
+	static cv::Vec3b biLinearInterpolation(const cv::Mat& mat, float x, float y);
+	static cv::Vec3f RGB2HSL(cv::Vec3b rgb);
+	static cv::Vec3b HSL2RGB(cv::Vec3f hsl);
+
+	static cv::Mat rotateImageMat(const cv::Mat& mat, float theta);
+	static cv::Mat changeImageMat(const cv::Mat& mat, std::vector<float> delta, changeFuncType changeFunc);
+
+	static std::array<int, 256> getHistogram(const cv::Mat& mat);
+	static std::array<int, 256> getHistogram1Channel(const cv::Mat& mat, int channel);
+	static std::array<int, 256> getHistogram3Channel(const cv::Mat& mat);
+	static std::array<float, 256> getCDF(const std::array<int, 256>& hist, int pixels);
+
+	static cv::Mat linearConvert(const cv::Mat& mat, const std::list<std::pair<float, float>> &vertices);
+	static cv::Mat histogramEqualization(const cv::Mat& mat);
+	static cv::Mat histogramSpecificationSML(const cv::Mat& orig, const cv::Mat& pattern);
+	static cv::Mat histogramSpecificationGML(const cv::Mat& orig, const cv::Mat& pattern);
+	static cv::Mat histogramSpecificationExact(const cv::Mat& orig, const cv::Mat& pattern);
+	static cv::Mat histogramSpecificationExact(const cv::Mat& orig, const std::array<double, 256>& distribution);
+
+	static cv::Mat medianFilterImageMat(const cv::Mat& mat, int size);
+	static cv::Mat gaussianFilterImageMat(const cv::Mat& mat, int size, float sigma);
+	static cv::Mat sharpenImageMat(const cv::Mat& mat, int type);
+
+	static void changePartialImageMatLightness(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
+	static void changePartialImageMatSaturation(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
+	static void changePartialImageMatHue(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
+	static void changePartialImageMatGamma(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
+	static void changePartialImageMatLog(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
+	static void changePartialImageMatPow(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
+	// m as in ColorMatrix: rows of an affine transform on RGB in [0, 1].
+	static cv::Mat colorMatrix(const cv::Mat& mat, const float (&m)[3][4]);
+
+	static cv::Mat freqFiltering(const cv::Mat &mat, const cv::Mat &filter);
+	static cv::Mat lowPassFiltering(const cv::Mat &res, const cv::Mat &filter);
+	static cv::Mat highPassFiltering(const cv::Mat &res, const cv::Mat &filter);
+
+private:
+	static cv::Mat histogramSpecificationExact(const cv::Mat& orig, const std::array<std::array<double, 256>, 3>& targets);
+	static std::vector<float> getGaussianKernel1D(int size, float sigma);
+
+	static cv::Mat getRobertFilterImageMat(const cv::Mat& mat);
+	static cv::Mat getPrewittFilterImageMat(const cv::Mat& mat);
+	static cv::Mat getSobelFilterImageMat(const cv::Mat& mat);
+	static cv::Mat getLaplaceFilterImageMat(const cv::Mat& mat);
+
+	static void shiftDFT(cv::Mat &fImg);
+};
\ No newline at end of file
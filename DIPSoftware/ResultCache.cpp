@@ -0,0 +1,375 @@
+#include "ResultCache.h"
+#include "MemoryTracker.h"
+#include "RawImage.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+// xxHash64 constants; four independent lanes keep the multiplier busy, so
+// hashing runs at memory speed and costs far less than any op it saves.
+const uint64_t PRIME1 = 11400714785074694791ULL;
+const uint64_t PRIME2 = 14029467366897019727ULL;
+const uint64_t PRIME3 = 1609587929392839161ULL;
+const uint64_t PRIME4 = 9650029242287828579ULL;
+const uint64_t PRIME5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t mixRound(uint64_t acc, uint64_t input) {
+	return rotl(acc + input * PRIME2, 31) * PRIME1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t value) {
+	return (acc ^ mixRound(0, value)) * PRIME1 + PRIME4;
+}
+
+inline uint64_t load64(const uchar *p) {
+	uint64_t res;
+	memcpy(&res, p, sizeof(res));
+	return res;
+}
+
+uint64_t hashBytes(const uchar *data, size_t size, uint64_t seed) {
+	const uchar *p = data, *end = data + size;
+	uint64_t h;
+	if (size >= 32) {
+		uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+		for (; p + 32 <= end; p += 32) {
+			v1 = mixRound(v1, load64(p));
+			v2 = mixRound(v2, load64(p + 8));
+			v3 = mixRound(v3, load64(p + 16));
+			v4 = mixRound(v4, load64(p + 24));
+		}
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = mergeRound(mergeRound(mergeRound(mergeRound(h, v1), v2), v3), v4);
+	} else {
+		h = seed + PRIME5;
+	}
+	h += size;
+	for (; p + 8 <= end; p += 8) {
+		h = rotl(h ^ mixRound(0, load64(p)), 27) * PRIME1 + PRIME4;
+	}
+	for (; p < end; ++p) {
+		h = rotl(h ^ (*p * PRIME5), 11) * PRIME1;
+	}
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	return h ^ (h >> 32);
+}
+
+size_t bytesOf(const Mat& mat) {
+	return mat.total() * mat.elemSize();
+}
+
+bool sameShape(const ResultCache::Shape& a, const ResultCache::Shape& b) {
+	return a.rows == b.rows && a.cols == b.cols && a.type == b.type;
+}
+
+size_t megabytesFromEnvironment(const char *name, size_t fallback) {
+	const char *env = getenv(name);
+	return env && *env ? (size_t) atoll(env) << 20 : fallback;
+}
+
+}
+
+ResultCache::ResultCache() : memoryLimit(size_t(256) << 20), diskLimit(size_t(1) << 30), counters(), pendingBytes(0), stopping(false) {
+}
+
+// Queued writes are finished before the process exits, so the next one
+// still finds them.
+ResultCache::~ResultCache() {
+	{
+		lock_guard<mutex> lock(mtx);
+		stopping = true;
+	}
+	writeWake.notify_all();
+	if (writer.joinable()) {
+		writer.join();
+	}
+}
+
+ResultCache& ResultCache::instance() {
+	static ResultCache cache;
+	return cache;
+}
+
+void ResultCache::initFromEnvironment() {
+	instance().setMemoryLimit(megabytesFromEnvironment("DIP_CACHE_MB", size_t(256) << 20));
+	const char *directory = getenv("DIP_CACHE_DIR");
+	if (directory && *directory) {
+		instance().setDiskCache(directory, megabytesFromEnvironment("DIP_CACHE_DISK_MB", size_t(1) << 30));
+	}
+}
+
+// Rows are hashed one at a time so that ROIs and padded strides hash like
+// the continuous Mat with the same pixels.
+uint64_t ResultCache::hashOf(const Mat& mat) {
+	TRACE_SCOPE("ResultCache::hashOf");
+	int shape[3] = { mat.rows, mat.cols, mat.type() };
+	uint64_t res = hashBytes((const uchar*) shape, sizeof(shape), 0);
+	size_t rowBytes = mat.cols * mat.elemSize();
+	rep(i, mat.rows) {
+		res = hashBytes(mat.ptr(i), rowBytes, res);
+	}
+	return res;
+}
+
+string ResultCache::opKey(const char *name, initializer_list<float> params) {
+	char buffer[32];
+	string res = name;
+	for (float param : params) {
+		snprintf(buffer, sizeof(buffer), ":%.9g", param);
+		res += buffer;
+	}
+	return res;
+}
+
+uint64_t ResultCache::keyOf(uint64_t inputHash, const string& op) {
+	return hashBytes((const uchar*) op.data(), op.size(), inputHash);
+}
+
+Mat ResultCache::apply(const Mat& input, const string& op, const function<Mat(const Mat&)>& compute) {
+	bool enabled;
+	{
+		lock_guard<mutex> lock(mtx);
+		enabled = memoryLimit > 0;
+	}
+	if (!enabled || input.empty() || op.empty() || op == "-") {
+		return compute(input);
+	}
+	uint64_t key = keyOf(hashOf(input), op);
+	Shape shape = { input.rows, input.cols, input.type() };
+	Mat res;
+	if (find(key, shape, res)) {
+		return res;
+	}
+	res = compute(input);
+	// A result that shares the input's buffer (an empty chain, a view) may
+	// point into memory the caller is about to unmap.
+	if (!res.empty() && res.u != input.u) {
+		insert(key, shape, res);
+	}
+	return res;
+}
+
+bool ResultCache::find(uint64_t key, const Shape& input, Mat& result) {
+	string fileName;
+	{
+		lock_guard<mutex> lock(mtx);
+		auto it = memoryIndex.find(key);
+		if (it != memoryIndex.end() && !sameShape(it->second->input, input)) {
+			++counters.misses;
+			return false;
+		}
+		if (it != memoryIndex.end()) {
+			memory.splice(memory.begin(), memory, it->second);
+			result = it->second->mat;
+			++counters.memoryHits;
+			return true;
+		}
+		auto diskIt = diskIndex.find(key);
+		if (diskIt == diskIndex.end() || !sameShape(diskIt->second->input, input)) {
+			++counters.misses;
+			return false;
+		}
+		disk.splice(disk.begin(), disk, diskIt->second);
+		fileName = fileNameOf(key, input);
+	}
+
+	// The mapping is copy-on-write, so the file stays intact whatever the
+	// caller does with the Mat; it is promoted to the memory tier as is and
+	// pages in on first touch.
+	Mat mat = RawImage::map(fileName);
+	lock_guard<mutex> lock(mtx);
+	if (mat.empty()) {
+		auto diskIt = diskIndex.find(key);
+		if (diskIt != diskIndex.end()) {
+			counters.diskBytes -= diskIt->second->bytes;
+			disk.erase(diskIt->second);
+			diskIndex.erase(diskIt);
+		}
+		++counters.misses;
+		return false;
+	}
+	++counters.diskHits;
+	if (!memoryIndex.count(key)) {
+		memory.push_front({ key, input, mat, bytesOf(mat) });
+		memoryIndex[key] = memory.begin();
+		counters.memoryBytes += memory.front().bytes;
+		trimMemory();
+	}
+	result = mat;
+	return true;
+}
+
+// A result headed for disk is queued, not written: the caller (often the
+// GUI thread) returns as soon as the memory tier holds it. The queue is
+// capped like the memory tier; past that, results just stay off disk.
+void ResultCache::insert(uint64_t key, const Shape& input, const Mat& result) {
+	MemoryTracker::retag(result, "result cache");
+	size_t bytes = bytesOf(result);
+	bool queued = false;
+	{
+		lock_guard<mutex> lock(mtx);
+		if (memoryIndex.count(key) || bytes > memoryLimit) {
+			return;
+		}
+		memory.push_front({ key, input, result, bytes });
+		memoryIndex[key] = memory.begin();
+		counters.memoryBytes += bytes;
+		trimMemory();
+		if (directory.size() && !diskIndex.count(key) && bytes <= diskLimit && pendingBytes + bytes <= memoryLimit && !stopping) {
+			pendingWrites.push_back({ key, input, result });
+			pendingBytes += bytes;
+			if (!writer.joinable()) {
+				writer = thread(&ResultCache::writeLoop, this);
+			}
+			queued = true;
+		}
+	}
+	if (queued) {
+		writeWake.notify_one();
+	}
+}
+
+void ResultCache::writeLoop() {
+	unique_lock<mutex> lock(mtx);
+	while (true) {
+		writeWake.wait(lock, [this]() { return stopping || !pendingWrites.empty(); });
+		if (pendingWrites.empty()) {
+			return;
+		}
+		PendingWrite job = move(pendingWrites.front());
+		pendingWrites.pop_front();
+		lock.unlock();
+		storeOnDisk(job);
+		lock.lock();
+		pendingBytes -= bytesOf(job.mat);
+	}
+}
+
+// Written through, so a later process (a batch re-run, a restarted daemon)
+// finds the result even if this one never evicts it.
+void ResultCache::storeOnDisk(const PendingWrite& job) {
+	TRACE_SCOPE("ResultCache::storeOnDisk");
+	string fileName;
+	{
+		lock_guard<mutex> lock(mtx);
+		if (diskIndex.count(job.key)) {
+			return;
+		}
+		fileName = fileNameOf(job.key, job.input);
+	}
+	if (!RawImage::write(fileName, job.mat)) {
+		return;
+	}
+	struct stat info;
+	if (stat(fileName.c_str(), &info)) {
+		return;
+	}
+	lock_guard<mutex> lock(mtx);
+	if (diskIndex.count(job.key)) {
+		return;
+	}
+	disk.push_front({ job.key, job.input, (size_t) info.st_size });
+	diskIndex[job.key] = disk.begin();
+	counters.diskBytes += info.st_size;
+	trimDisk();
+}
+
+// The input shape is part of the name, so it survives restarts with the
+// entry.
+string ResultCache::fileNameOf(uint64_t key, const Shape& input) const {
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "/%016llx-%dx%dx%d.", (unsigned long long) key, input.rows, input.cols, input.type);
+	return directory + buffer + RawImage::EXTENSION;
+}
+
+void ResultCache::trimMemory() {
+	while (counters.memoryBytes > memoryLimit && !memory.empty()) {
+		counters.memoryBytes -= memory.back().bytes;
+		memoryIndex.erase(memory.back().key);
+		memory.pop_back();
+	}
+}
+
+void ResultCache::trimDisk() {
+	while (counters.diskBytes > diskLimit && !disk.empty()) {
+		remove(fileNameOf(disk.back().key, disk.back().input).c_str());
+		counters.diskBytes -= disk.back().bytes;
+		diskIndex.erase(disk.back().key);
+		disk.pop_back();
+	}
+}
+
+void ResultCache::setMemoryLimit(size_t bytes) {
+	lock_guard<mutex> lock(mtx);
+	memoryLimit = bytes;
+	trimMemory();
+}
+
+// Picks up the files left by earlier processes, most recently modified
+// first, so the LRU order roughly survives restarts.
+void ResultCache::setDiskCache(const string& directory, size_t limit) {
+	vector<String> fileNames;
+	if (directory.size()) {
+		glob(directory + "/*." + RawImage::EXTENSION, fileNames, false);
+	}
+	struct Found {
+		uint64_t key;
+		Shape input;
+		size_t bytes;
+		time_t modified;
+	};
+	vector<Found> found;
+	for (const auto& fileName : fileNames) {
+		string name = fileName.substr(fileName.find_last_of("/\\") + 1);
+		struct stat info;
+		unsigned long long key;
+		Shape input;
+		int length = 0;
+		if (sscanf(name.c_str(), "%16llx-%dx%dx%d.%n", &key, &input.rows, &input.cols, &input.type, &length) == 4 && length == (int) name.find('.') + 1 && name.compare(length, string::npos, RawImage::EXTENSION) == 0 && !stat(fileName.c_str(), &info)) {
+			found.push_back({ key, input, (size_t) info.st_size, info.st_mtime });
+		}
+	}
+	sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.modified > b.modified; });
+
+	lock_guard<mutex> lock(mtx);
+	this->directory = directory;
+	diskLimit = limit;
+	disk.clear();
+	diskIndex.clear();
+	counters.diskBytes = 0;
+	for (const auto& entry : found) {
+		disk.push_back({ entry.key, entry.input, entry.bytes });
+		diskIndex[entry.key] = prev(disk.end());
+		counters.diskBytes += entry.bytes;
+	}
+	trimDisk();
+}
+
+void ResultCache::clear() {
+	lock_guard<mutex> lock(mtx);
+	memory.clear();
+	memoryIndex.clear();
+	counters.memoryBytes = 0;
+}
+
+ResultCache::Stats ResultCache::stats() const {
+	lock_guard<mutex> lock(mtx);
+	return counters;
+}
\ No newline at end of file
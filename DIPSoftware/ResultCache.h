@@ -0,0 +1,96 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Memoizes operation results by a 64-bit hash of the input pixels (and
+// shape) combined with a canonical encoding of the operation and its
+// parameters, e.g. "median:3,gaussian:5" or opKey("rotate", { theta }).
+// Results live in an LRU memory tier and, when a directory is set, also in a
+// size-capped disk tier of .dipraw files, which outlives the process and
+// maps back without decoding. Disk writes are queued to a background thread,
+// so a miss costs the caller only the compute. Each entry also keeps the
+// input's shape, and a lookup whose shape differs is a miss. Cached Mats are shared and must be treated as
+// read-only, like the images in the undo history.
+// DIP_CACHE_MB sets the memory tier size (0 turns caching off);
+// DIP_CACHE_DIR=<dir> enables the disk tier, capped by DIP_CACHE_DISK_MB.
+class ResultCache {
+public:
+	struct Stats {
+		uint64_t memoryHits, diskHits, misses;
+		size_t memoryBytes, diskBytes;
+	};
+
+	struct Shape {
+		int rows, cols, type;
+	};
+
+	static ResultCache& instance();
+	static void initFromEnvironment();
+	~ResultCache();
+
+	static uint64_t hashOf(const cv::Mat& mat);
+	static std::string opKey(const char *name, std::initializer_list<float> params);
+
+	// The cached result of op on input, or compute(input), remembered.
+	cv::Mat apply(const cv::Mat& input, const std::string& op, const std::function<cv::Mat(const cv::Mat&)>& compute);
+	bool find(uint64_t key, const Shape& input, cv::Mat& result);
+	void insert(uint64_t key, const Shape& input, const cv::Mat& result);
+	static uint64_t keyOf(uint64_t inputHash, const std::string& op);
+
+	void setMemoryLimit(size_t bytes);
+	void setDiskCache(const std::string& directory, size_t limit);
+	void clear();
+	Stats stats() const;
+
+private:
+	struct Entry {
+		uint64_t key;
+		Shape input;
+		cv::Mat mat;
+		size_t bytes;
+	};
+
+	struct DiskEntry {
+		uint64_t key;
+		Shape input;
+		size_t bytes;
+	};
+
+	struct PendingWrite {
+		uint64_t key;
+		Shape input;
+		cv::Mat mat;
+	};
+
+	ResultCache();
+
+	std::string fileNameOf(uint64_t key, const Shape& input) const;
+	void trimMemory();
+	void trimDisk();
+	void writeLoop();
+	void storeOnDisk(const PendingWrite& job);
+
+	mutable std::mutex mtx;
+	std::list<Entry> memory;
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> memoryIndex;
+	std::list<DiskEntry> disk;
+	std::unordered_map<uint64_t, std::list<DiskEntry>::iterator> diskIndex;
+	std::string directory;
+	size_t memoryLimit, diskLimit;
+	Stats counters;
+	std::deque<PendingWrite> pendingWrites;
+	size_t pendingBytes;
+	bool stopping;
+	std::condition_variable writeWake;
+	std::thread writer;
+};
\ No newline at end of file
@@ -0,0 +1,372 @@
+#include "SessionFile.h"
+#include "ImageWriter.h"
+#include "MappedFile.h"
+#include "Trace.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+const char MAGIC[8] = { 'D', 'I', 'P', 'S', 'E', 'S', 'S', 0 };
+const uint32_t VERSION = 1;
+const uint32_t RECORD_MAGIC = 0x52504944;
+const size_t HEADER_SIZE = 64;
+const size_t DATA_ALIGNMENT = 4096;
+const size_t STRIDE_ALIGNMENT = 64;
+// Rebuilt states are whole images; only the last few used are kept, plus a
+// checkpoint every few states along a rebuild so undo does not start over.
+const size_t MAX_REBUILT_STATES = 8;
+const int CHECKPOINT_INTERVAL = 8;
+
+enum RecordKind {
+	RECORD_STATE = 1,
+	RECORD_CURRENT,
+	RECORD_SOURCE
+};
+
+size_t alignUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+bool sameRow(const Mat& a, const Mat& b, int row) {
+	return !memcmp(a.ptr(row), b.ptr(row), (size_t) a.cols * a.elemSize());
+}
+
+// The rows [first, last) outside of which previous and mat agree.
+void changedRows(const Mat& previous, const Mat& mat, int& first, int& last) {
+	first = 0;
+	last = mat.rows;
+	if (previous.size() != mat.size() || previous.type() != mat.type()) {
+		return;
+	}
+	while (first < last && sameRow(previous, mat, first)) {
+		++first;
+	}
+	while (last > first && sameRow(previous, mat, last - 1)) {
+		--last;
+	}
+}
+
+bool seekFile(FILE *fp, uint64_t offset) {
+#ifdef _WIN32
+	return _fseeki64(fp, offset, SEEK_SET) == 0;
+#else
+	return fseeko(fp, offset, SEEK_SET) == 0;
+#endif
+}
+
+uint64_t fileSize(FILE *fp) {
+#ifdef _WIN32
+	return _fseeki64(fp, 0, SEEK_END) == 0 ? _ftelli64(fp) : 0;
+#else
+	return fseeko(fp, 0, SEEK_END) == 0 ? ftello(fp) : 0;
+#endif
+}
+
+// A mapped file cannot be shrunk on Windows, so SessionReader::open cuts a
+// torn tail off before the writer appends over it.
+bool truncateFile(FILE *fp, uint64_t size) {
+#ifdef _WIN32
+	return _chsize_s(_fileno(fp), size) == 0;
+#else
+	return ftruncate(fileno(fp), size) == 0;
+#endif
+}
+
+bool truncateFile(const string& fileName, uint64_t size) {
+	FILE *fp = fopen(fileName.c_str(), "r+b");
+	if (!fp) {
+		return false;
+	}
+	bool ok = truncateFile(fp, size);
+	return fclose(fp) == 0 && ok;
+}
+
+// Every record is on disk before the next one is written, so a crash loses
+// at most the record being written.
+bool syncFile(FILE *fp) {
+	if (fflush(fp)) {
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(fp)) == 0;
+#else
+	return fsync(fileno(fp)) == 0;
+#endif
+}
+
+}
+
+const char *SessionFile::EXTENSION = "dipsession";
+
+static_assert(sizeof(SessionFile::Record) == 64, "SessionFile::Record must stay 64 bytes");
+
+bool SessionFile::isSessionFile(const string& fileName) {
+	return ImageWriter::extensionOf(fileName) == EXTENSION;
+}
+
+SessionWriter::SessionWriter(const string& fileName, uint64_t appendAt) : name(fileName), fp(nullptr), offset(0), failed(false), stopping(false), pending(0) {
+	if (appendAt) {
+		fp = fopen(fileName.c_str(), "r+b");
+		if (fp && (fileSize(fp) <= appendAt || truncateFile(fp, appendAt)) && seekFile(fp, appendAt)) {
+			offset = appendAt;
+		}
+	} else {
+		fp = fopen(fileName.c_str(), "wb");
+		char header[HEADER_SIZE] = {};
+		memcpy(header, MAGIC, sizeof(MAGIC));
+		memcpy(header + sizeof(MAGIC), &VERSION, sizeof(VERSION));
+		if (fp && fwrite(header, 1, HEADER_SIZE, fp) == HEADER_SIZE) {
+			offset = HEADER_SIZE;
+		}
+	}
+	if (fp && offset < HEADER_SIZE) {
+		fclose(fp);
+		fp = nullptr;
+	}
+	if (fp) {
+		worker = thread(&SessionWriter::run, this);
+	}
+}
+
+SessionWriter::~SessionWriter() {
+	if (!fp) {
+		return;
+	}
+	{
+		lock_guard<mutex> lock(mtx);
+		stopping = true;
+	}
+	wake.notify_one();
+	worker.join();
+	fclose(fp);
+}
+
+void SessionWriter::setSource(const string& sourceFileName) {
+	push({ RECORD_SOURCE, 0, Mat(), Mat(), sourceFileName });
+}
+
+void SessionWriter::append(int index, const Mat& previous, const Mat& mat) {
+	push({ RECORD_STATE, index, previous, mat, string() });
+}
+
+void SessionWriter::setCurrent(int index) {
+	push({ RECORD_CURRENT, index, Mat(), Mat(), string() });
+}
+
+bool SessionWriter::flush() {
+	unique_lock<mutex> lock(mtx);
+	idle.wait(lock, [this]() { return !pending; });
+	return fp && !failed;
+}
+
+void SessionWriter::push(Job job) {
+	if (!fp) {
+		return;
+	}
+	{
+		lock_guard<mutex> lock(mtx);
+		jobs.push_back(move(job));
+		++pending;
+	}
+	wake.notify_one();
+}
+
+void SessionWriter::run() {
+	unique_lock<mutex> lock(mtx);
+	while (true) {
+		wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+		if (jobs.empty()) {
+			return;
+		}
+		Job job = move(jobs.front());
+		jobs.pop_front();
+		bool skip = failed;
+		lock.unlock();
+		bool ok = skip || write(job);
+		lock.lock();
+		failed |= !ok;
+		if (!--pending) {
+			idle.notify_all();
+		}
+	}
+}
+
+// A record header, then its payload: the text, or the changed rows from the
+// next page boundary with a padded stride. A crash mid-record leaves a header
+// whose payload runs past the end of the file, which the reader drops.
+bool SessionWriter::write(const Job& job) {
+	TRACE_SCOPE("SessionWriter::write");
+	SessionFile::Record record = {};
+	record.magic = RECORD_MAGIC;
+	record.kind = job.kind;
+	record.index = job.index;
+	record.dataOffset = offset + sizeof(record);
+
+	int first = 0, last = 0;
+	if (job.kind == RECORD_STATE) {
+		const Mat& mat = job.mat;
+		changedRows(job.previous, mat, first, last);
+		record.width = mat.cols;
+		record.height = mat.rows;
+		record.channels = mat.channels();
+		record.firstRow = first;
+		record.rowCount = last - first;
+		record.stride = alignUp((size_t) mat.cols * mat.elemSize(), STRIDE_ALIGNMENT);
+		record.dataOffset = alignUp(offset + sizeof(record), DATA_ALIGNMENT);
+		record.dataSize = record.stride * record.rowCount;
+	} else if (job.kind == RECORD_SOURCE) {
+		record.dataSize = job.text.size();
+	}
+
+	if (fwrite(&record, sizeof(record), 1, fp) != 1) {
+		return false;
+	}
+	vector<uchar> row(max<size_t>(record.stride, record.dataOffset - offset - sizeof(record)), 0);
+	size_t padding = record.dataOffset - offset - sizeof(record);
+	if (fwrite(row.data(), 1, padding, fp) != padding) {
+		return false;
+	}
+	if (job.kind == RECORD_SOURCE && fwrite(job.text.data(), 1, job.text.size(), fp) != job.text.size()) {
+		return false;
+	}
+	size_t rowBytes = (size_t) job.mat.cols * job.mat.elemSize();
+	for (int i = first; i < last; ++i) {
+		memcpy(row.data(), job.mat.ptr(i), rowBytes);
+		if (fwrite(row.data(), 1, record.stride, fp) != record.stride) {
+			return false;
+		}
+	}
+	offset = record.dataOffset + record.dataSize;
+	return syncFile(fp);
+}
+
+shared_ptr<SessionReader> SessionReader::open(const string& fileName) {
+	TRACE_SCOPE("SessionReader::open");
+	auto file = MappedFile::open(fileName);
+	if (!file || file->size() < HEADER_SIZE || memcmp(file->data(), MAGIC, sizeof(MAGIC))) {
+		return nullptr;
+	}
+	uint32_t version;
+	memcpy(&version, file->data() + sizeof(MAGIC), sizeof(version));
+	if (version != VERSION) {
+		return nullptr;
+	}
+
+	shared_ptr<SessionReader> res(new SessionReader);
+	res->file = file;
+	res->repaired = true;
+	res->currentIndex = -1;
+	res->validEnd = HEADER_SIZE;
+	size_t offset = HEADER_SIZE;
+	SessionFile::Record record;
+	while (file->size() - offset >= sizeof(record)) {
+		memcpy(&record, file->data() + offset, sizeof(record));
+		if (record.magic != RECORD_MAGIC || record.dataOffset < offset + sizeof(record) || record.dataOffset > file->size() || file->size() - record.dataOffset < record.dataSize) {
+			break;
+		}
+		if (record.kind == RECORD_STATE) {
+			bool valid = record.index >= 0 && record.index <= res->count() && record.width && record.height &&
+				(record.channels == 1 || record.channels == 3 || record.channels == 4) && (uint64_t) record.firstRow + record.rowCount <= record.height &&
+				record.stride >= (uint64_t) record.width * record.channels && record.dataSize == record.stride * record.rowCount;
+			// Changed rows only make sense on top of a state of the same size.
+			if (valid && record.rowCount < record.height) {
+				valid = record.index > 0 && res->states[record.index - 1].width == record.width &&
+					res->states[record.index - 1].height == record.height && res->states[record.index - 1].channels == record.channels;
+			}
+			if (!valid) {
+				break;
+			}
+			res->states.resize(record.index);
+			res->states.push_back(record);
+			res->currentIndex = record.index;
+		} else if (record.kind == RECORD_CURRENT) {
+			res->currentIndex = record.index;
+		} else if (record.kind == RECORD_SOURCE) {
+			res->sourceFileName.assign((const char*) file->data() + record.dataOffset, record.dataSize);
+		}
+		offset = record.dataOffset + record.dataSize;
+		res->validEnd = offset;
+	}
+	if (res->states.empty()) {
+		return nullptr;
+	}
+	if (res->validEnd < file->size()) {
+		// The torn tail goes while nothing maps the file, which Windows
+		// requires; the records found so far keep their offsets.
+		res->file.reset();
+		file.reset();
+		res->repaired = truncateFile(fileName, res->validEnd);
+		res->file = MappedFile::open(fileName);
+		if (!res->file || res->file->size() < res->validEnd) {
+			return nullptr;
+		}
+	}
+	res->currentIndex = max(0, min(res->currentIndex, res->count() - 1));
+	res->cache.resize(res->states.size());
+	return res;
+}
+
+Mat SessionReader::state(int index) {
+	TRACE_SCOPE("SessionReader::state");
+	lock_guard<mutex> lock(mtx);
+	if (index < 0 || index >= count()) {
+		return Mat();
+	}
+	// Walk back to the nearest state that is either stored in full or
+	// still cached, then patch forward on a single copy.
+	int base = index;
+	while (cache[base].empty() && states[base].rowCount < states[base].height) {
+		--base;
+	}
+	const SessionFile::Record& first = states[base];
+	if (cache[base].empty()) {
+		cache[base] = file->view(first.dataOffset, first.height, first.width, CV_8UC(first.channels), first.stride);
+	} else if (first.rowCount < first.height) {
+		keepRebuilt(base, cache[base]);
+	}
+	Mat work = cache[base];
+	bool owned = false;
+	for (int i = base + 1; i <= index; ++i) {
+		const SessionFile::Record& record = states[i];
+		if (!owned) {
+			work = work.clone();
+			owned = true;
+		}
+		if (record.rowCount) {
+			Mat rows = file->view(record.dataOffset, record.rowCount, record.width, CV_8UC(record.channels), record.stride);
+			Mat target = work.rowRange(record.firstRow, record.firstRow + record.rowCount);
+			rows.copyTo(target);
+		}
+		if (i == index || (index - i) % CHECKPOINT_INTERVAL == 0) {
+			keepRebuilt(i, work);
+			owned = false;
+		}
+	}
+	return cache[index];
+}
+
+// Most recently used last; the oldest rebuilt states are dropped.
+void SessionReader::keepRebuilt(int index, const Mat& mat) {
+	auto it = find(rebuilt.begin(), rebuilt.end(), index);
+	if (it != rebuilt.end()) {
+		rebuilt.erase(it);
+	}
+	cache[index] = mat;
+	rebuilt.push_back(index);
+	while (rebuilt.size() > MAX_REBUILT_STATES) {
+		cache[rebuilt.front()].release();
+		rebuilt.pop_front();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MappedFile;
+
+// The .dipsession format: an append-only log of the states of the undo
+// history. State 0 is the opened image and state i the result of the i-th
+// edit; a state is stored as the rows that differ from state i - 1 (all of
+// them when the size changed) from a page aligned offset, so full states map
+// straight onto a cv::Mat. Appending state i drops any states after it, as a
+// new edit after undo does, and the last "current" record gives the position
+// in the history. A torn record at the end is ignored on reading.
+namespace SessionFile {
+
+extern const char *EXTENSION;
+
+struct Record {
+	uint32_t magic;
+	uint32_t kind;
+	int32_t index;
+	uint32_t width, height, channels;
+	uint32_t firstRow, rowCount;
+	uint64_t stride;
+	uint64_t dataOffset;
+	uint64_t dataSize;
+	uint8_t reserved[8];
+};
+
+bool isSessionFile(const std::string& fileName);
+
+}
+
+// Appends to a session on a worker thread, so edits never wait for the disk.
+// The Mats handed in must not be modified afterwards, which the undo history
+// already guarantees.
+class SessionWriter {
+public:
+	// Creates the file, or continues an existing session from appendAt (the
+	// end of its last intact record), cutting off anything after it.
+	SessionWriter(const std::string& fileName, uint64_t appendAt = 0);
+	~SessionWriter();
+
+	bool isOpen() const { return fp != nullptr; }
+	const std::string& fileName() const { return name; }
+
+	void setSource(const std::string& sourceFileName);
+	void append(int index, const cv::Mat& previous, const cv::Mat& mat);
+	void setCurrent(int index);
+	// Waits for everything queued so far; false if any write failed.
+	bool flush();
+
+	SessionWriter(const SessionWriter &) = delete;
+	SessionWriter& operator=(const SessionWriter &) = delete;
+
+private:
+	struct Job {
+		uint32_t kind;
+		int index;
+		cv::Mat previous, mat;
+		std::string text;
+	};
+
+	void push(Job job);
+	void run();
+	bool write(const Job& job);
+
+	std::string name;
+	FILE *fp;
+	uint64_t offset;
+	bool failed, stopping;
+	int pending;
+	std::deque<Job> jobs;
+	std::mutex mtx;
+	std::condition_variable wake, idle;
+	std::thread worker;
+};
+
+// Reads a session through a mapping: opening only scans the record headers,
+// full states are views of the file and changed-row states are rebuilt on
+// first use, of which only a few are cached. A torn record at the end is cut
+// off on opening, so that a SessionWriter can continue from end().
+class SessionReader {
+public:
+	static std::shared_ptr<SessionReader> open(const std::string& fileName);
+
+	int count() const { return (int) states.size(); }
+	int current() const { return currentIndex; }
+	const std::string& source() const { return sourceFileName; }
+	uint64_t end() const { return validEnd; }
+	// False when a torn tail could not be cut off; the session reads fine
+	// but cannot be continued.
+	bool isRepaired() const { return repaired; }
+	cv::Mat state(int index);
+
+private:
+	void keepRebuilt(int index, const cv::Mat& mat);
+
+	std::shared_ptr<MappedFile> file;
+	std::vector<SessionFile::Record> states;
+	std::vector<cv::Mat> cache;
+	std::deque<int> rebuilt;
+	bool repaired;
+	int currentIndex;
+	uint64_t validEnd;
+	std::string sourceFileName;
+	std::mutex mtx;
+};
\ No newline at end of file
@@ -0,0 +1,299 @@
+#include "SocketIO.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+using namespace std;
+
+#ifndef _WIN32
+
+namespace {
+
+bool unixAddress(const string& path, sockaddr_un& address) {
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		return false;
+	}
+	memcpy(address.sun_path, path.c_str(), path.size());
+	return true;
+}
+
+// Replies are short lines, so Nagle would only add latency.
+void setNoDelay(int fd) {
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int openTcp(const string& host, int port, bool listening) {
+	addrinfo hints = {}, *addresses;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listening ? AI_PASSIVE : 0;
+	if (getaddrinfo(host.empty() ? nullptr : host.c_str(), to_string(port).c_str(), &hints, &addresses)) {
+		return -1;
+	}
+	int res = -1;
+	for (addrinfo *address = addresses; address && res < 0; address = address->ai_next) {
+		int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		if (listening) {
+			int one = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		}
+		bool ok = listening ? !bind(fd, address->ai_addr, address->ai_addrlen) && !listen(fd, SOMAXCONN) : !connect(fd, address->ai_addr, address->ai_addrlen);
+		if (ok) {
+			setNoDelay(fd);
+			res = fd;
+		} else {
+			::close(fd);
+		}
+	}
+	freeaddrinfo(addresses);
+	return res;
+}
+
+}
+
+int SocketIO::listenUnix(const string& path) {
+	sockaddr_un address;
+	if (!unixAddress(path, address)) {
+		return -1;
+	}
+	// Only a socket nobody accepts on is stale; unlinking a live one would
+	// leave its daemon running but unreachable.
+	int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (probe < 0) {
+		return -1;
+	}
+	int connected = connect(probe, (sockaddr*) &address, sizeof(address));
+	int error = errno;
+	::close(probe);
+	if (!connected) {
+		errno = EADDRINUSE;
+		return -1;
+	}
+	if (error == ECONNREFUSED) {
+		unlink(path.c_str());
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (bind(fd, (sockaddr*) &address, sizeof(address)) || listen(fd, SOMAXCONN)) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int SocketIO::connectUnix(const string& path) {
+	sockaddr_un address;
+	if (!unixAddress(path, address)) {
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, (sockaddr*) &address, sizeof(address))) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int SocketIO::listenTcp(const string& host, int port) {
+	return openTcp(host, port, true);
+}
+
+int SocketIO::connectTcp(const string& host, int port) {
+	return openTcp(host, port, false);
+}
+
+int SocketIO::boundPort(int fd) {
+	sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	if (getsockname(fd, (sockaddr*) &address, &length)) {
+		return -1;
+	}
+	if (address.ss_family == AF_INET6) {
+		return ntohs(((sockaddr_in6*) &address)->sin6_port);
+	}
+	return ntohs(((sockaddr_in*) &address)->sin_port);
+}
+
+int SocketIO::accept(int fd, int wakeFd, int timeoutMs) {
+	if (wakeFd >= 0 || timeoutMs >= 0) {
+		pollfd fds[2] = { { fd, POLLIN, 0 }, { wakeFd, POLLIN, 0 } };
+		int n;
+		do {
+			n = poll(fds, wakeFd >= 0 ? 2 : 1, timeoutMs);
+		} while (n < 0 && errno == EINTR);
+		if (n <= 0) {
+			if (!n) {
+				errno = ETIMEDOUT;
+			}
+			return -1;
+		}
+		if (wakeFd >= 0 && fds[1].revents) {
+			errno = ECANCELED;
+			return -1;
+		}
+	}
+	int res;
+	do {
+		res = ::accept(fd, nullptr, nullptr);
+	} while (res < 0 && errno == EINTR);
+	return res;
+}
+
+void SocketIO::close(int fd) {
+	::close(fd);
+}
+
+void SocketIO::shutdown(int fd) {
+	::shutdown(fd, SHUT_RDWR);
+}
+
+bool SocketIO::openWakePipe(int& readFd, int& writeFd) {
+	int fds[2];
+	if (pipe(fds)) {
+		return false;
+	}
+	readFd = fds[0];
+	writeFd = fds[1];
+	return true;
+}
+
+// The byte is never read, so every later accept() on the pipe fails too.
+void SocketIO::wake(int writeFd) {
+	char byte = 0;
+	ssize_t n = write(writeFd, &byte, 1);
+	(void) n;
+}
+
+bool SocketIO::setReadTimeout(int fd, double seconds) {
+	timeval timeout;
+	timeout.tv_sec = (time_t) seconds;
+	timeout.tv_usec = (suseconds_t) ((seconds - timeout.tv_sec) * 1e6);
+	return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+bool SocketIO::readLine(int fd, string& line, string& buffer, size_t maxBytes) {
+	size_t end;
+	while ((end = buffer.find('\n')) == string::npos) {
+		if (buffer.size() >= maxBytes) {
+			return false;
+		}
+		char chunk[4096];
+		ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		buffer.append(chunk, n);
+	}
+	line = buffer.substr(0, end);
+	buffer.erase(0, end + 1);
+	if (line.size() && line.back() == '\r') {
+		line.pop_back();
+	}
+	return true;
+}
+
+bool SocketIO::writeLine(int fd, const string& line) {
+	string data = line + "\n";
+	for (size_t sent = 0; sent < data.size(); ) {
+		ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		sent += n;
+	}
+	return true;
+}
+
+#else
+
+int SocketIO::listenUnix(const string&) { return -1; }
+int SocketIO::connectUnix(const string&) { return -1; }
+int SocketIO::listenTcp(const string&, int) { return -1; }
+int SocketIO::connectTcp(const string&, int) { return -1; }
+int SocketIO::boundPort(int) { return -1; }
+int SocketIO::accept(int, int, int) { return -1; }
+void SocketIO::close(int) {}
+void SocketIO::shutdown(int) {}
+bool SocketIO::openWakePipe(int&, int&) { return false; }
+void SocketIO::wake(int) {}
+bool SocketIO::setReadTimeout(int, double) { return false; }
+bool SocketIO::readLine(int, string&, string&, size_t) { return false; }
+bool SocketIO::writeLine(int, const string&) { return false; }
+
+#endif
+
+bool SocketIO::splitWords(const string& line, vector<string>& words) {
+	words.clear();
+	size_t i = 0;
+	while (true) {
+		while (i < line.size() && line[i] == ' ') {
+			++i;
+		}
+		if (i == line.size()) {
+			return true;
+		}
+		string word;
+		if (line[i] != '"') {
+			size_t end = line.find(' ', i);
+			end = end == string::npos ? line.size() : end;
+			word = line.substr(i, end - i);
+			i = end;
+		} else {
+			for (++i; i < line.size() && line[i] != '"'; ++i) {
+				if (line[i] == '\\' && i + 1 < line.size()) {
+					++i;
+				}
+				word += line[i];
+			}
+			if (i == line.size()) {
+				return false;
+			}
+			++i;
+		}
+		words.push_back(word);
+	}
+}
+
+string SocketIO::quoteWord(const string& word) {
+	if (word.size() && word[0] != '"' && word.find(' ') == string::npos) {
+		return word;
+	}
+	string res = "\"";
+	for (char c : word) {
+		if (c == '"' || c == '\\') {
+			res += '\\';
+		}
+		res += c;
+	}
+	return res + "\"";
+}
\ No newline at end of file
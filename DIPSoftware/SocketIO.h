@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Blocking stream sockets carrying one request or reply per line, for the
+// processing daemon and the batch coordinator. POSIX only: on Windows every
+// open call fails and returns -1.
+namespace SocketIO {
+
+// Longest line readLine() accepts by default; a peer that sends more is
+// dropped rather than buffered without bound.
+const size_t MAX_LINE_BYTES = 64 * 1024;
+
+// Fails with EADDRINUSE while another process is accepting on path; a socket
+// file left behind by one that died is replaced.
+int listenUnix(const std::string& path);
+int connectUnix(const std::string& path);
+// port 0 picks a free port; boundPort() tells which.
+int listenTcp(const std::string& host, int port);
+int connectTcp(const std::string& host, int port);
+int boundPort(int fd);
+// With wakeFd, fails with ECANCELED once wakeFd is readable; with timeoutMs
+// >= 0, fails with ETIMEDOUT when no connection comes in that long.
+int accept(int fd, int wakeFd = -1, int timeoutMs = -1);
+void close(int fd);
+// Unblocks a thread waiting in readLine() on the connected socket fd.
+void shutdown(int fd);
+// A pipe for stopping an accept() loop from another thread: pass readFd to
+// accept() and call wake(writeFd). Shutting the listening socket down only
+// does that on Linux.
+bool openWakePipe(int& readFd, int& writeFd);
+void wake(int writeFd);
+
+// Makes readLine() on fd fail after seconds without data; 0 waits forever.
+bool setReadTimeout(int fd, double seconds);
+// buffer keeps what was read past the line for the next call. Fails once
+// maxBytes are buffered without a line end.
+bool readLine(int fd, std::string& line, std::string& buffer, size_t maxBytes = MAX_LINE_BYTES);
+bool writeLine(int fd, const std::string& line);
+
+// Splits a line into words separated by spaces. A word in double quotes may
+// hold spaces, with \" and \\ standing for a quote and a backslash. False on
+// an unterminated quote.
+bool splitWords(const std::string& line, std::vector<std::string>& words);
+// word as splitWords() reads it back, quoted only when it has to be.
+std::string quoteWord(const std::string& word);
+
+}
\ No newline at end of file
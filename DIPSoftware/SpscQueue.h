@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// push() waits while the queue is full, which is what throttles a fast
+// producer to the pace of its consumer; pop() waits while it is empty and
+// returns false once the producer has closed it and it is drained. When
+// stop is given and becomes true, both stop waiting and return false, so a
+// failed stage can release the ones blocked on it.
+template<typename T>
+class SpscQueue {
+public:
+	explicit SpscQueue(size_t capacity, const std::atomic<bool> *stop = nullptr) : stop(stop) {
+		size_t size = 2;
+		while (size < capacity) {
+			size *= 2;
+		}
+		slots.resize(size);
+		mask = size - 1;
+	}
+
+	bool tryPush(T& value) {
+		size_t tail = tailIndex.load(std::memory_order_relaxed);
+		if (tail - headIndex.load(std::memory_order_acquire) > mask) {
+			return false;
+		}
+		slots[tail & mask] = std::move(value);
+		tailIndex.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool tryPop(T& value) {
+		size_t head = headIndex.load(std::memory_order_relaxed);
+		if (head == tailIndex.load(std::memory_order_acquire)) {
+			return false;
+		}
+		value = std::move(slots[head & mask]);
+		slots[head & mask] = T();
+		headIndex.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool push(T value) {
+		for (int spins = 0; !tryPush(value); ++spins) {
+			if (stopped()) {
+				return false;
+			}
+			backOff(spins);
+		}
+		return true;
+	}
+
+	bool pop(T& value) {
+		for (int spins = 0; !tryPop(value); ++spins) {
+			if (stopped()) {
+				return false;
+			}
+			if (closed.load(std::memory_order_acquire)) {
+				return tryPop(value);
+			}
+			backOff(spins);
+		}
+		return true;
+	}
+
+	void close() {
+		closed.store(true, std::memory_order_release);
+	}
+
+	size_t size() const {
+		return tailIndex.load(std::memory_order_acquire) - headIndex.load(std::memory_order_acquire);
+	}
+
+private:
+	bool stopped() const {
+		return stop && stop->load(std::memory_order_acquire);
+	}
+
+	// Frames take milliseconds, so after a short spin a waiting stage sleeps
+	// rather than burning a core the other stages could use.
+	static void backOff(int spins) {
+		if (spins < 64) {
+			std::this_thread::yield();
+		} else {
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	}
+
+	std::vector<T> slots;
+	size_t mask;
+	const std::atomic<bool> *stop;
+	alignas(64) std::atomic<size_t> headIndex{ 0 };
+	alignas(64) std::atomic<size_t> tailIndex{ 0 };
+	std::atomic<bool> closed{ false };
+};
\ No newline at end of file
@@ -0,0 +1,237 @@
+#include "Trace.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+namespace {
+
+const int RING_SIZE = 1 << 14;
+// Buffers of exited threads kept for the next dump; older ones are dropped.
+const size_t MAX_DEAD_BUFFERS = 64;
+
+// Only the owning thread writes events and head. Readers start at base,
+// which clear() moves up instead of touching what the writer owns.
+struct ThreadBuffer {
+	array<Trace::Event, RING_SIZE> events;
+	atomic<uint64_t> head{ 0 }, base{ 0 };
+	atomic<bool> alive{ true };
+	int tid;
+};
+
+mutex registryMutex;
+vector<shared_ptr<ThreadBuffer>> registry;
+int nextTid = 1;
+map<string, string> metadata;
+string exitFileName;
+
+const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+// Drops the buffers of exited threads that have nothing left to read, and
+// the oldest dead ones beyond MAX_DEAD_BUFFERS. Needs registryMutex.
+void pruneDeadBuffers() {
+	size_t dead = count_if(registry.begin(), registry.end(), [](const shared_ptr<ThreadBuffer>& buffer) { return !buffer->alive.load(memory_order_acquire); });
+	registry.erase(remove_if(registry.begin(), registry.end(), [&](const shared_ptr<ThreadBuffer>& buffer) {
+		if (buffer->alive.load(memory_order_acquire)) {
+			return false;
+		}
+		bool drop = dead > MAX_DEAD_BUFFERS || buffer->base.load(memory_order_relaxed) == buffer->head.load(memory_order_relaxed);
+		dead -= drop;
+		return drop;
+	}), registry.end());
+}
+
+// Marks the buffer dead when its thread exits; the registry keeps it alive
+// until it is read or pruned.
+struct BufferOwner {
+	shared_ptr<ThreadBuffer> buffer;
+	~BufferOwner() {
+		if (buffer) {
+			buffer->alive.store(false, memory_order_release);
+		}
+	}
+};
+
+ThreadBuffer* threadBuffer() {
+	thread_local BufferOwner owner;
+	if (!owner.buffer) {
+		auto created = make_shared<ThreadBuffer>();
+		lock_guard<mutex> lock(registryMutex);
+		pruneDeadBuffers();
+		created->tid = nextTid++;
+		registry.push_back(created);
+		owner.buffer = created;
+	}
+	return owner.buffer.get();
+}
+
+// Copies the events that are still intact. A writer may lap the reader while
+// copying, and the one filling slot newHead is already overwriting the event
+// RING_SIZE before it, so everything below newHead - RING_SIZE + 1 is dropped.
+vector<Trace::Event> snapshot(const ThreadBuffer& buffer) {
+	uint64_t head = buffer.head.load(memory_order_acquire);
+	uint64_t first = max(buffer.base.load(memory_order_acquire), head > RING_SIZE ? head - RING_SIZE : 0);
+
+	vector<Trace::Event> res;
+	res.reserve(head - first);
+	for (uint64_t i = first; i < head; ++i) {
+		res.push_back(buffer.events[i % RING_SIZE]);
+	}
+
+	uint64_t newHead = buffer.head.load(memory_order_acquire);
+	if (newHead >= RING_SIZE && newHead - RING_SIZE + 1 > first) {
+		uint64_t stale = min<uint64_t>(newHead - RING_SIZE + 1 - first, res.size());
+		res.erase(res.begin(), res.begin() + stale);
+	}
+	return res;
+}
+
+vector<shared_ptr<ThreadBuffer>> buffers() {
+	lock_guard<mutex> lock(registryMutex);
+	return registry;
+}
+
+string escapeJSON(const char *str) {
+	string res;
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\') {
+			res.push_back('\\');
+		}
+		res.push_back(*str);
+	}
+	return res;
+}
+
+void dumpAtExit() {
+	if (Trace::dumpChromeTrace(exitFileName)) {
+		Utils::c_fprintf(COLOR_GREEN, stderr, "trace written to %s\n", exitFileName.c_str());
+	}
+}
+
+}
+
+atomic<bool> Trace::enabled{ false };
+
+void Trace::setEnabled(bool value) {
+	enabled.store(value, memory_order_relaxed);
+}
+
+void Trace::initFromEnvironment() {
+	const char *fileName = getenv("DIP_TRACE");
+	if (!fileName || !*fileName) {
+		return;
+	}
+	exitFileName = fileName;
+	setEnabled(true);
+	atexit(dumpAtExit);
+}
+
+int64_t Trace::now() {
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+}
+
+void Trace::record(const char *name, int64_t begin, int64_t end) {
+	ThreadBuffer *buffer = threadBuffer();
+	uint64_t head = buffer->head.load(memory_order_relaxed);
+	buffer->events[head % RING_SIZE] = { name, begin, end };
+	buffer->head.store(head + 1, memory_order_release);
+}
+
+// Safe while other threads record: only the read position moves.
+void Trace::clear() {
+	lock_guard<mutex> lock(registryMutex);
+	for (const auto& buffer : registry) {
+		buffer->base.store(buffer->head.load(memory_order_acquire), memory_order_release);
+	}
+	pruneDeadBuffers();
+}
+
+// Run-wide facts (e.g. the selected CPU tier), written as "otherData" in
+// the Chrome trace and as a header of the summary.
+void Trace::setMetadata(const string& key, const string& value) {
+	lock_guard<mutex> lock(registryMutex);
+	metadata[key] = value;
+}
+
+vector<Trace::Summary> Trace::summarize() {
+	map<string, Summary> table;
+	for (const auto& buffer : buffers()) {
+		for (const auto& event : snapshot(*buffer)) {
+			auto& entry = table[event.name];
+			double ms = (event.end - event.begin) * 1e-6;
+			entry.name = event.name;
+			++entry.count;
+			entry.totalMs += ms;
+			updateMax(entry.maxMs, ms);
+		}
+	}
+
+	vector<Summary> res;
+	for (const auto& entry : table) {
+		res.push_back(entry.second);
+	}
+	sort(res.begin(), res.end(), [](const Summary& a, const Summary& b) { return a.totalMs > b.totalMs; });
+	return res;
+}
+
+bool Trace::dumpChromeTrace(const string &fileName) {
+	FILE *fp = fopen(fileName.c_str(), "w");
+	if (!fp) {
+		return false;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"otherData\":{");
+	{
+		lock_guard<mutex> lock(registryMutex);
+		bool firstKey = true;
+		for (const auto& entry : metadata) {
+			fprintf(fp, "%s\"%s\":\"%s\"", firstKey ? "" : ",", escapeJSON(entry.first.c_str()).c_str(), escapeJSON(entry.second.c_str()).c_str());
+			firstKey = false;
+		}
+	}
+	fprintf(fp, "},\"traceEvents\":[\n");
+	bool first = true;
+	for (const auto& buffer : buffers()) {
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+			first ? "" : ",\n", buffer->tid, buffer->tid);
+		first = false;
+		for (const auto& event : snapshot(*buffer)) {
+			fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				escapeJSON(event.name).c_str(), buffer->tid, event.begin * 1e-3, (event.end - event.begin) * 1e-3);
+		}
+	}
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp)) {
+		return false;
+	}
+	// Exited threads have nothing more to add once written.
+	lock_guard<mutex> lock(registryMutex);
+	for (const auto& buffer : registry) {
+		if (!buffer->alive.load(memory_order_acquire)) {
+			buffer->base.store(buffer->head.load(memory_order_acquire), memory_order_release);
+		}
+	}
+	pruneDeadBuffers();
+	return true;
+}
+
+void Trace::printSummary(FILE *fp) {
+	{
+		lock_guard<mutex> lock(registryMutex);
+		for (const auto& entry : metadata) {
+			fprintf(fp, "%s: %s\n", entry.first.c_str(), entry.second.c_str());
+		}
+	}
+	fprintf(fp, "%-40s %8s %12s %12s\n", "span", "count", "total(ms)", "max(ms)");
+	for (const auto& entry : summarize()) {
+		fprintf(fp, "%-40s %8d %12.3f %12.3f\n", entry.name.c_str(), entry.count, entry.totalMs, entry.maxMs);
+	}
+}
\ No newline at end of file
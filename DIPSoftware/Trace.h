@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Scoped trace spans recorded per thread into lock-free ring buffers.
+// Disabled by default; a disabled span costs one relaxed atomic load.
+// Set DIP_TRACE=<file.json> to record from startup and dump on exit.
+class Trace {
+public:
+	struct Event {
+		const char *name;
+		int64_t begin, end;
+	};
+
+	struct Summary {
+		std::string name;
+		int count;
+		double totalMs, maxMs;
+	};
+
+	static inline bool isEnabled() {
+		return enabled.load(std::memory_order_relaxed);
+	}
+	static void setEnabled(bool value);
+	static void initFromEnvironment();
+
+	static int64_t now();
+	static void record(const char *name, int64_t begin, int64_t end);
+	static void clear();
+
+	static void setMetadata(const std::string& key, const std::string& value);
+
+	static std::vector<Summary> summarize();
+	static bool dumpChromeTrace(const std::string &fileName);
+	static void printSummary(FILE *fp);
+
+private:
+	static std::atomic<bool> enabled;
+};
+
+class TraceSpan {
+public:
+	explicit TraceSpan(const char *_name) : name(Trace::isEnabled() ? _name : nullptr), begin(name ? Trace::now() : 0) {}
+	~TraceSpan() {
+		if (name) {
+			Trace::record(name, begin, Trace::now());
+		}
+	}
+
+	TraceSpan(const TraceSpan &) = delete;
+	TraceSpan& operator=(const TraceSpan &) = delete;
+
+private:
+	const char *name;
+	int64_t begin;
+};
+
+#define __TRACE_CONCAT__(x, y) x ## y
+#define __TRACE_NAME__(x, y) __TRACE_CONCAT__(x, y)
+
+#ifdef DIP_NO_TRACE
+
+#define TRACE_SCOPE(name)
+
+#else
+
+#define TRACE_SCOPE(name) TraceSpan __TRACE_NAME__(__trace_span__, __LINE__)(name)
+
+#endif
\ No newline at end of file
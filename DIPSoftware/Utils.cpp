@@ -1,17 +1,325 @@
 #include "Utils.h"
+#include "AutoTune.h"
+#include "CpuDispatch.h"
 #include "DebugUtils.h"
+#include "ImageWriter.h"
+#include "MemoryTracker.h"
+#include "RawImage.h"
+#include "Trace.h"
 
+#include <algorithm>
 #include <future>
+#include <list>
+#include <mutex>
 #include <numeric>
 
-#include <QDebug>
-
 #define PI 3.141592653589793
 #define EPSILON 1e-3
 
 using namespace cv;
 using namespace std;
 
+namespace {
+
+using lutType = array<uchar, 256>;
+
+// Formats whose alpha or 16-bit data is kept. IMREAD_UNCHANGED also skips the
+// EXIF orientation, which only cameras write and they write JPEG.
+bool decodesUnchanged(const String& fileName) {
+	string extension = ImageWriter::extensionOf(fileName);
+	return extension == "png" || extension == "tif" || extension == "tiff";
+}
+
+// Copies the alpha plane of a BGRA source into a BGRA result. offset is the
+// position of res's top-left pixel in mat, for kernels that crop the border.
+void copyAlpha(const Mat& mat, Mat& res, Point offset = Point()) {
+	if (mat.channels() != 4 || res.channels() != 4) {
+		return;
+	}
+	const int fromTo[] = { 3, 3 };
+	Mat src = mat(Rect(offset.x, offset.y, res.cols, res.rows));
+	mixChannels(&src, 1, &res, 1, fromTo, 1);
+}
+
+// Maps every colour channel k through maps[k]; alpha is left as is.
+void applyLUT(const Mat& mat, Mat& res, const array<lutType, 3>& maps) {
+	CpuDispatch::kernels().applyLUT(mat.data, mat.step, res.data, res.step, mat.cols, mat.rows, mat.channels(), reinterpret_cast<const uchar (*)[256]>(maps.data()));
+}
+
+void applyLUT(const Mat& mat, Mat& res, const lutType& map) {
+	applyLUT(mat, res, { map, map, map });
+}
+
+// Runs f(firstRow, rows) on bands of params.bandRows rows, params.threads at
+// a time. Bands write disjoint rows, so the tuning never changes the result.
+template<typename F>
+void forEachBand(const AutoTune::Params& params, int rows, F f) {
+	int bands = (rows + params.bandRows - 1) / params.bandRows;
+	#pragma omp parallel for num_threads(params.threads) schedule(dynamic) if(bands > 1)
+	for (int b = 0; b < bands; ++b) {
+		int first = b * params.bandRows;
+		f(first, min(params.bandRows, rows - first));
+	}
+}
+
+// Adds the histogram of one channel to hist, or of the grey value when
+// channel is negative; every band fills a private partial.
+void accumulateHistogram(const Mat& mat, int channel, int *hist) {
+	AutoTune::Params params = AutoTune::params(AutoTune::KERNEL_HISTOGRAM);
+	vector<array<int, 256>> partial((mat.rows + params.bandRows - 1) / params.bandRows);
+	const CpuKernels& kernels = CpuDispatch::kernels();
+	forEachBand(params, mat.rows, [&](int first, int rows) {
+		int *bandHist = partial[first / params.bandRows].data();
+		fill(bandHist, bandHist + 256, 0);
+		if (channel < 0) {
+			kernels.greyHistogram(mat.ptr<uchar>(first), mat.step, mat.cols, rows, mat.channels(), bandHist);
+		} else {
+			kernels.histogram(mat.ptr<uchar>(first), mat.step, mat.cols, rows, mat.channels(), channel, bandHist);
+		}
+	});
+	for (const auto& band : partial) {
+		rep(v, 256) {
+			hist[v] += band[v];
+		}
+	}
+}
+
+// Source for a kernel that reads neighbouring pixels: a private copy when the
+// result is requested in place, since res.create() may also reallocate mat.
+Mat stencilSource(const Mat& mat, const Mat& res) {
+	return mat.data && mat.data == res.data ? mat.clone() : mat;
+}
+
+// Runs f on the BGR triple of every pixel, passing alpha through. A grey
+// pixel is expanded to an equal triple; with only 256 distinct inputs, f is
+// evaluated once per value into a lookup table instead of once per pixel.
+template<typename F>
+void mapPixels(const Mat& mat, Mat& res, F f) {
+	int cn = mat.channels();
+	if (cn == 1) {
+		lutType map;
+		rep(v, 256) {
+			map[v] = f(Vec3b((uchar) v, (uchar) v, (uchar) v))[0];
+		}
+		applyLUT(mat, res, map);
+		return;
+	}
+	#pragma omp parallel for
+	for (int i = 0; i < mat.rows; ++i) {
+		const uchar *src = mat.ptr<uchar>(i);
+		uchar *dst = res.ptr<uchar>(i);
+		for (int j = 0; j < mat.cols; ++j, src += cn, dst += cn) {
+			Vec3b bgr = f(Vec3b(src[0], src[1], src[2]));
+			dst[0] = bgr[0];
+			dst[1] = bgr[1];
+			dst[2] = bgr[2];
+			if (cn == 4) {
+				dst[3] = src[3];
+			}
+		}
+	}
+}
+
+// For point operations that treat every channel alike: f(v) is evaluated
+// once per value and the image goes through the applyLUT kernel.
+template<typename F>
+lutType tableOf(F f) {
+	lutType map;
+	rep(v, 256) {
+		map[v] = f(v);
+	}
+	return map;
+}
+
+// Transfer functions only depend on their kind, size and parameters, while a
+// sequence or a long running process asks for the same few over and over.
+struct TransferEntry {
+	string key;
+	Mat filter;
+};
+
+struct TransferCache {
+	mutex mtx;
+	list<TransferEntry> entries;
+	size_t bytes = 0, limit = 256 << 20;
+};
+
+// Never destroyed: the filters come from the BufferPool, which is built in
+// main after the statics here and so would be gone before they were freed.
+TransferCache& transferCache() {
+	static TransferCache *cache = new TransferCache;
+	return *cache;
+}
+
+void trimTransferCache(TransferCache& cache) {
+	while (cache.bytes > cache.limit && !cache.entries.empty()) {
+		const Mat& filter = cache.entries.back().filter;
+		cache.bytes -= filter.total() * filter.elemSize();
+		cache.entries.pop_back();
+	}
+}
+
+// Builds the two-channel (real, imaginary) filter with value(D2) at squared
+// distance D2 from the centre, or returns the cached one.
+template<typename F>
+Mat transferFunction(const char *kind, int rows, int cols, initializer_list<float> params, F value) {
+	char buffer[32];
+	string key = kind;
+	key += " " + to_string(rows) + " " + to_string(cols);
+	for (float param : params) {
+		snprintf(buffer, sizeof(buffer), " %.9g", param);
+		key += buffer;
+	}
+	TransferCache& cache = transferCache();
+	{
+		lock_guard<mutex> lock(cache.mtx);
+		auto it = find_if(cache.entries.begin(), cache.entries.end(), [&](const TransferEntry& entry) { return entry.key == key; });
+		if (it != cache.entries.end()) {
+			cache.entries.splice(cache.entries.begin(), cache.entries, it);
+			return it->filter;
+		}
+	}
+
+	Mat tmp(rows, cols, CV_32F);
+	rep(i, tmp.rows) rep(j, tmp.cols) {
+		float D2 = sqr(i - tmp.rows / 2) + sqr(j - tmp.cols / 2);
+		tmp.at<float>(i, j) = value(D2);
+	}
+
+	Mat toMerge[2] = { tmp, tmp };
+	Mat filter;
+	merge(toMerge, 2, filter);
+	MemoryTracker::retag(filter, "transfer cache");
+
+	lock_guard<mutex> lock(cache.mtx);
+	cache.entries.push_front({ key, filter });
+	cache.bytes += filter.total() * filter.elemSize();
+	trimTransferCache(cache);
+	return filter;
+}
+
+// Exact specification orders the pixels of a channel by a key, the value
+// above the sum of its 3x3 neighbourhood (edges replicated, at most 2295),
+// and hands out target levels by rank.
+const int EXACT_LOCAL_BITS = 12;
+const int EXACT_KEYS = 256 << EXACT_LOCAL_BITS;
+// Every block keeps a full key histogram, so their number bounds the memory.
+const int EXACT_MAX_BLOCKS = 8;
+
+template<typename F>
+void forEachExactKey(const Mat& mat, int channel, int firstRow, int lastRow, F f) {
+	int cn = mat.channels(), last = (mat.cols - 1) * cn;
+	for (int i = firstRow; i < lastRow; ++i) {
+		const uchar *up = mat.ptr<uchar>(max(i - 1, 0)) + channel;
+		const uchar *mid = mat.ptr<uchar>(i) + channel;
+		const uchar *down = mat.ptr<uchar>(min(i + 1, mat.rows - 1)) + channel;
+		// Column sums of the window, slid one column at a time.
+		int left = up[0] + mid[0] + down[0], centre = left;
+		rep(j, mat.cols) {
+			int c = j * cn, r = min(c + cn, last);
+			int right = up[r] + mid[r] + down[r];
+			f(i, j, (mid[c] << EXACT_LOCAL_BITS) | (left + centre + right));
+			left = centre;
+			centre = right;
+		}
+	}
+}
+
+// How many pixels get each level: the target scaled to the pixel count, the
+// rounding remainders going to the largest fractions.
+array<int, 256> exactLevelCounts(const array<double, 256>& target, int pixels) {
+	double total = accumulate(target.begin(), target.end(), 0.0);
+	array<int, 256> res;
+	array<pair<double, int>, 256> fractions;
+	int assigned = 0;
+	rep(v, 256) {
+		double share = total > 0 ? target[v] / total * pixels : pixels / 256.0;
+		res[v] = (int) share;
+		fractions[v] = { share - res[v], v };
+		assigned += res[v];
+	}
+	stable_sort(fractions.begin(), fractions.end(), [](const pair<double, int>& a, const pair<double, int>& b) { return a.first > b.first; });
+	for (int k = 0; assigned < pixels; ++k, ++assigned) {
+		++res[fractions[k % 256].second];
+	}
+	return res;
+}
+
+// The rank cursors of a block of rows, with the level each cursor is at.
+struct ExactBlock {
+	vector<int> next;
+	vector<uchar> level;
+};
+
+// A counting sort on the 20-bit key, which is a single-digit radix sort: the
+// rows are split into blocks that count their keys in parallel, the prefix
+// sums over (key, block) give every block the first rank of each key, and a
+// second parallel pass hands out ranks in raster order, so ties stay stable
+// without materializing (key, index) pairs. The ranks of a cursor only grow,
+// so its level is advanced rather than searched for.
+void specifyExact(const Mat& mat, Mat& res, int channel, const array<double, 256>& target, vector<ExactBlock>& blocks) {
+	int blockCount = (int) blocks.size();
+	auto blockRows = [&](int b) { return mat.rows * b / blockCount; };
+
+	#pragma omp parallel for
+	for (int b = 0; b < blockCount; ++b) {
+		int *count = blocks[b].next.data();
+		fill(count, count + EXACT_KEYS, 0);
+		forEachExactKey(mat, channel, blockRows(b), blockRows(b + 1), [&](int, int, int key) { ++count[key]; });
+	}
+
+	array<int, 256> counts = exactLevelCounts(target, mat.rows * mat.cols);
+	array<int, 256> last;
+	partial_sum(counts.begin(), counts.end(), last.begin());
+
+	int rank = 0, level = 0;
+	for (int key = 0; key < EXACT_KEYS; ++key) {
+		for (auto& block : blocks) {
+			while (level < 255 && rank >= last[level]) {
+				++level;
+			}
+			int count = block.next[key];
+			block.next[key] = rank;
+			block.level[key] = (uchar) level;
+			rank += count;
+		}
+	}
+
+	int cn = res.channels();
+	#pragma omp parallel for
+	for (int b = 0; b < blockCount; ++b) {
+		int *next = blocks[b].next.data();
+		uchar *levels = blocks[b].level.data();
+		forEachExactKey(mat, channel, blockRows(b), blockRows(b + 1), [&](int i, int j, int key) {
+			int r = next[key]++;
+			uchar& level = levels[key];
+			while (r >= last[level]) {
+				++level;
+			}
+			res.ptr<uchar>(i)[j * cn + channel] = level;
+		});
+	}
+}
+
+void specifyExact(const Mat& input, Mat& res, const array<array<double, 256>, 3>& targets) {
+	Mat mat = stencilSource(input, res);
+	res.create(mat.rows, mat.cols, mat.type());
+	if (mat.empty()) {
+		return;
+	}
+	vector<ExactBlock> blocks(min(EXACT_MAX_BLOCKS, mat.rows));
+	for (auto& block : blocks) {
+		block.next.resize(EXACT_KEYS);
+		block.level.resize(EXACT_KEYS);
+	}
+	rep(k, Utils::colorChannels(mat)) {
+		specifyExact(mat, res, k, targets[k], blocks);
+	}
+	copyAlpha(mat, res);
+}
+
+}
+
 string Utils::int2ANSIColor(int k) {
 	ostringstream oss;
 	oss << "\x1B[3" << (k + 2) << "m";
@@ -36,62 +344,79 @@ void Utils::c_fprintf(const char *color, FILE *fp, const char *format, ...) {
 	va_end(ap);
 }
 
-QString Utils::getExtension(const String& str) {
-	auto pos = str.find_last_of('.');
-	QString res;
-	repa(i, pos + 1, str.size()) {
-		res.append(str[i]);
+Mat Utils::readImageMat(const String& fileName) {
+	TRACE_SCOPE("Utils::readImageMat");
+	if (RawImage::isRawImage(fileName)) {
+		return RawImage::map(fileName);
+	}
+	MEMORY_TAG("image decode");
+	if (!decodesUnchanged(fileName)) {
+		// Grey stays single channel and EXIF orientation is applied.
+		return imread(fileName, IMREAD_ANYCOLOR);
+	}
+	Mat res = imread(fileName, IMREAD_UNCHANGED);
+	if (res.depth() == CV_16U) {
+		res.convertTo(res, CV_8U, 1.0 / 257);
+	} else if (res.depth() != CV_8U) {
+		res = imread(fileName, IMREAD_COLOR);
+	}
+	if (res.channels() == 2) {
+		res = imread(fileName, IMREAD_COLOR);
 	}
 	return res;
 }
 
-QImage Utils::mat2QImage(const Mat& mat) {
-	if (mat.type() == CV_8UC3) {
-		const uchar *pSrc = (const uchar*) mat.data;
-		QImage image(pSrc, mat.cols, mat.rows, mat.step, QImage::Format_RGB888);
-		return image.rgbSwapped();
-	} else {
-		return QImage();
+// A 1/2, 1/4 or 1/8 scale colour decode. JPEG scales in the DCT, which makes
+// this several times faster than a full decode; other formats are decoded
+// in full and resized. The orientation is handled as readImageMat does, so
+// the proxy has the shape of the full image.
+Mat Utils::readImageMatReduced(const String& fileName, int scale) {
+	TRACE_SCOPE("Utils::readImageMatReduced");
+	MEMORY_TAG("image decode");
+	int flags = scale >= 8 ? IMREAD_REDUCED_COLOR_8 : scale >= 4 ? IMREAD_REDUCED_COLOR_4 : scale >= 2 ? IMREAD_REDUCED_COLOR_2 : IMREAD_COLOR;
+	if (decodesUnchanged(fileName)) {
+		flags |= IMREAD_IGNORE_ORIENTATION;
 	}
+	return imread(fileName, flags);
+}
+
+int Utils::colorChannels(const Mat& mat) {
+	return mat.channels() == 4 ? 3 : mat.channels();
 }
 
-Vec3b Utils::biLinearInterpolation(const Mat& mat, float x, float y) {
+bool Utils::writeImageMat(const String& fileName, const Mat& mat) {
+	TRACE_SCOPE("Utils::writeImageMat");
+	return ImageWriter::write(fileName, mat);
+}
+
+void Utils::biLinearInterpolation(const Mat& mat, float x, float y, uchar *dst) {
 	int x1, x2, y1, y2;
 	x1 = (int) x;
 	y1 = (int) y;
 	x2 = x1 + 1;
 	y2 = y1 + 1;
 
-	float r, g, b;
-
-	if (x < mat.rows - 1 && y < mat.cols - 1) {
-		r = mat.at<Vec3b>(x1, y1)[0] * (x2 - x) * (y2 - y) +
-			mat.at<Vec3b>(x2, y1)[0] * (x - x1) * (y2 - y) +
-			mat.at<Vec3b>(x1, y2)[0] * (x2 - x) * (y - y1) +
-			mat.at<Vec3b>(x2, y2)[0] * (x - x1) * (y - y1);
-		g = mat.at<Vec3b>(x1, y1)[1] * (x2 - x) * (y2 - y) +
-			mat.at<Vec3b>(x2, y1)[1] * (x - x1) * (y2 - y) +
-			mat.at<Vec3b>(x1, y2)[1] * (x2 - x) * (y - y1) +
-			mat.at<Vec3b>(x2, y2)[1] * (x - x1) * (y - y1);
-		b = mat.at<Vec3b>(x1, y1)[2] * (x2 - x) * (y2 - y) +
-			mat.at<Vec3b>(x2, y1)[2] * (x - x1) * (y2 - y) +
-			mat.at<Vec3b>(x1, y2)[2] * (x2 - x) * (y - y1) +
-			mat.at<Vec3b>(x2, y2)[2] * (x - x1) * (y - y1);
-	} else if (x == mat.rows - 1 && y < mat.cols - 1) {
-		r = mat.at<Vec3b>(x1, y1)[0] * (y2 - y) + mat.at<Vec3b>(x1, y2)[0] * (y - y1);
-		g = mat.at<Vec3b>(x1, y1)[1] * (y2 - y) + mat.at<Vec3b>(x1, y2)[1] * (y - y1);
-		b = mat.at<Vec3b>(x1, y1)[2] * (y2 - y) + mat.at<Vec3b>(x1, y2)[2] * (y - y1);
-	} else if (x < mat.rows - 1 && y == mat.cols - 1) {
-		r = mat.at<Vec3b>(x1, y1)[0] * (x2 - x) + mat.at<Vec3b>(x2, y1)[0] * (x - x1);
-		g = mat.at<Vec3b>(x1, y1)[1] * (x2 - x) + mat.at<Vec3b>(x2, y1)[1] * (x - x1);
-		b = mat.at<Vec3b>(x1, y1)[2] * (x2 - x) + mat.at<Vec3b>(x2, y1)[2] * (x - x1);
-	} else {
-		r = mat.at<Vec3b>(x1, y1)[0];
-		g = mat.at<Vec3b>(x1, y1)[1];
-		b = mat.at<Vec3b>(x1, y1)[2];
+	int cn = mat.channels();
+	const uchar *p11 = mat.ptr<uchar>(x1) + y1 * cn;
+	const uchar *p21 = x2 < mat.rows ? mat.ptr<uchar>(x2) + y1 * cn : p11;
+	const uchar *p12 = p11 + cn, *p22 = p21 + cn;
+
+	rep(k, cn) {
+		float v;
+		if (x < mat.rows - 1 && y < mat.cols - 1) {
+			v = p11[k] * (x2 - x) * (y2 - y) +
+				p21[k] * (x - x1) * (y2 - y) +
+				p12[k] * (x2 - x) * (y - y1) +
+				p22[k] * (x - x1) * (y - y1);
+		} else if (x == mat.rows - 1 && y < mat.cols - 1) {
+			v = p11[k] * (y2 - y) + p12[k] * (y - y1);
+		} else if (x < mat.rows - 1 && y == mat.cols - 1) {
+			v = p11[k] * (x2 - x) + p21[k] * (x - x1);
+		} else {
+			v = p11[k];
+		}
+		dst[k] = touc(v);
 	}
-
-	return { touc(r), touc(g), touc(b) };
 }
 
 Vec3f Utils::RGB2HSL(Vec3b rgb) {
@@ -178,6 +503,21 @@ Vec3b Utils::HSL2RGB(Vec3f hsl) {
 }
 
 Mat Utils::rotateImageMat(const Mat& mat, float theta) {
+	Mat res;
+	rotateImageMat(mat, res, theta);
+	return res;
+}
+
+void Utils::getRotatedSize(int rows, int cols, float theta, int& newRows, int& newCols) {
+	float cosTheta = cos(theta), sinTheta = sin(theta);
+	newRows = ceil(rows * abs(cosTheta) + cols * abs(sinTheta) - EPSILON);
+	newCols = ceil(rows * abs(sinTheta) + cols * abs(cosTheta) - EPSILON);
+}
+
+void Utils::rotateImageMat(const Mat& input, Mat& res, float theta) {
+	TRACE_SCOPE("Utils::rotateImageMat");
+	MEMORY_TAG("rotateImageMat");
+	Mat mat = stencilSource(input, res);
 	int newW, newH;
 	int w, h;
 	float cx, cy, dx, dy;
@@ -185,62 +525,174 @@ Mat Utils::rotateImageMat(const Mat& mat, float theta) {
 
 	w = mat.rows;
 	h = mat.cols;
-	newW = ceil(w * abs(cosTheta) + h * abs(sinTheta) - EPSILON);
-	newH = ceil(w * abs(sinTheta) + h * abs(cosTheta) - EPSILON);
+	getRotatedSize(w, h, theta, newW, newH);
 	cx = (w - 1) * 1.0 / 2;
 	cy = (h - 1) * 1.0 / 2;
 	dx = (newW - w) * 1.0 / 2;
 	dy = (newH - h) * 1.0 / 2;
 
-	Mat res(newW, newH, CV_8UC3);
-	rep(i, res.rows) rep(j, res.cols) {
-		float x, y;
-		x = cosTheta * (i - cx - dx) - sinTheta * (j - cy - dy) + cx;
-		y = sinTheta * (i - cx - dx) + cosTheta * (j - cy - dy) + cy;
-		if (betw(x, -EPSILON, w + EPSILON) && betw(y, -EPSILON, h + EPSILON)) {
-			res.at<Vec3b>(i, j) = biLinearInterpolation(mat, x, y);
-		} else {
-			res.at<Vec3b>(i, j) = { 255, 255, 255 };
-		}
-	}
+	// Uncovered corners are white, and transparent when there is alpha.
+	res.create(newW, newH, mat.type());
+	const CpuKernels& kernels = CpuDispatch::kernels();
+	forEachBand(AutoTune::params(AutoTune::KERNEL_ROTATE), res.rows, [&](int first, int rows) {
+		kernels.rotate(mat.data, mat.step, mat.rows, mat.cols, res.data, res.step, first, first + rows, res.cols, mat.channels(), cosTheta, sinTheta, cx, cy, dx, dy);
+	});
+}
 
+Mat Utils::flipImageMat(const Mat& mat, int flipCode) {
+	Mat res;
+	flipImageMat(mat, res, flipCode);
 	return res;
 }
 
-Mat Utils::changeImageMat(const Mat& mat, vector<float> deltas, changeFuncType changeFunc) {
-	Mat res(mat.rows, mat.cols, CV_8UC3);
-	changeFunc(mat, res, deltas);
+// cv::flip swaps mirrored pairs, so it is safe in place.
+void Utils::flipImageMat(const Mat& mat, Mat& res, int flipCode) {
+	TRACE_SCOPE("Utils::flipImageMat");
+	MEMORY_TAG("flipImageMat");
+	flip(mat, res, flipCode);
+}
+
+Mat Utils::changeImageMat(const Mat& mat, const vector<float>& deltas, const changeFuncType& changeFunc) {
+	Mat res;
+	changeImageMat(mat, res, deltas, changeFunc);
 	return res;
 }
 
+void Utils::changeImageMat(const Mat& mat, Mat& res, const vector<float>& deltas, const changeFuncType& changeFunc) {
+	TRACE_SCOPE("Utils::changeImageMat");
+	MEMORY_TAG("changeImageMat");
+	changeFunc(mat, res, deltas);
+}
+
 array<int, 256> Utils::getHistogram(const Mat& mat) {
+	TRACE_SCOPE("Utils::getHistogram");
+	if (mat.channels() == 1) {
+		return getHistogram1Channel(mat, 0);
+	}
 	array<int, 256> res;
 	fill(res.begin(), res.end(), 0);
-	rep(i, mat.rows) rep(j, mat.cols) {
-		Vec3b rgb = mat.at<Vec3b>(i, j);
-		uchar grey = touc((rgb[0] + rgb[1] + rgb[2]) * 1.0 / 3);
-		++res[grey];
-	}
+	accumulateHistogram(mat, -1, res.data());
 	return res;
 }
 
+// Every channel of a grey image is its only plane.
 array<int, 256> Utils::getHistogram1Channel(const Mat& mat, int channel) {
+	TRACE_SCOPE("Utils::getHistogram1Channel");
 	array<int, 256> res;
 	fill(res.begin(), res.end(), 0);
-	rep(i, mat.rows) rep(j, mat.cols) {
-		++res[mat.at<Vec3b>(i, j)[channel]];
+	if (mat.channels() == 1) {
+		channel = 0;
 	}
+	accumulateHistogram(mat, channel, res.data());
 	return res;
 }
 
+// Pooled over the colour channels, so a grey image counts each pixel once.
 array<int, 256> Utils::getHistogram3Channel(const Mat& mat) {
+	TRACE_SCOPE("Utils::getHistogram3Channel");
+	array<int, 256> res;
+	fill(res.begin(), res.end(), 0);
+	rep(k, colorChannels(mat)) {
+		accumulateHistogram(mat, k, res.data());
+	}
+	return res;
+}
+
+// One pass for all the histograms HistogramWidget draws.
+Utils::ColorHistograms Utils::getColorHistograms(const Mat& mat) {
+	TRACE_SCOPE("Utils::getColorHistograms");
+	ColorHistograms res = {};
+	if (mat.channels() == 1) {
+		res.grey = getHistogram1Channel(mat, 0);
+		return res;
+	}
+	res.channelCount = 3;
+	AutoTune::Params params = AutoTune::params(AutoTune::KERNEL_HISTOGRAM);
+	vector<ColorHistograms> partial((mat.rows + params.bandRows - 1) / params.bandRows);
+	const CpuKernels& kernels = CpuDispatch::kernels();
+	forEachBand(params, mat.rows, [&](int first, int rows) {
+		ColorHistograms& band = partial[first / params.bandRows];
+		band = {};
+		kernels.colorHistograms(mat.ptr<uchar>(first), mat.step, mat.cols, rows, mat.channels(), band.grey.data(), band.channels[0].data());
+	});
+	for (const auto& band : partial) {
+		rep(v, 256) {
+			res.grey[v] += band.grey[v];
+			rep(k, 3) {
+				res.channels[k][v] += band.channels[k][v];
+			}
+		}
+	}
+	return res;
+}
+
+// An estimate of getColorHistograms() for display, scaled to the pixel
+// count. By the Dvoretzky-Kiefer-Wolfowitz inequality, n samples keep each
+// estimated CDF within maxError of the exact one everywhere, with 95%
+// confidence, once n >= ln(2 / 0.05) / (2 maxError^2). The samples lie on a
+// grid whose rows are shifted by the golden ratio, so regular patterns do not
+// alias. Images too small to save anything are counted exactly; equalization
+// and specification always use exact counts.
+Utils::ColorHistograms Utils::getSampledHistograms(const Mat& mat, float maxError) {
+	TRACE_SCOPE("Utils::getSampledHistograms");
+	int64_t pixels = (int64_t) mat.rows * mat.cols;
+	double needed = log(2 / 0.05) / (2.0 * maxError * maxError);
+	int stride = (int) sqrt(pixels / needed);
+	if (stride < 2) {
+		return getColorHistograms(mat);
+	}
+
+	int cn = mat.channels();
+	array<array<int64_t, 256>, 4> counts = {};
+	int64_t samples = 0;
+	for (int i = stride / 2, k = 0; i < mat.rows; i += stride, ++k) {
+		const uchar *p = mat.ptr<uchar>(i);
+		int offset = (int) (fmod(k * 0.6180339887, 1.0) * stride);
+		for (int j = offset; j < mat.cols; j += stride) {
+			const uchar *q = p + j * cn;
+			if (cn == 1) {
+				++counts[3][q[0]];
+			} else {
+				++counts[0][q[0]];
+				++counts[1][q[1]];
+				++counts[2][q[2]];
+				++counts[3][(q[0] + q[1] + q[2] + 1) / 3];
+			}
+			++samples;
+		}
+	}
+
+	ColorHistograms res = {};
+	res.channelCount = cn == 1 ? 0 : 3;
+	auto scale = [&](int64_t count) { return (int) ((count * pixels + samples / 2) / samples); };
+	rep(v, 256) {
+		res.grey[v] = scale(counts[3][v]);
+		rep(k, res.channelCount) {
+			res.channels[k][v] = scale(counts[k][v]);
+		}
+	}
+	return res;
+}
+
+// A point operation moves whole bins: the histogram of the result is that of
+// the source pushed through the table, with no pass over the pixels. This is
+// exact for every channel and for grey images; the grey value of a colour
+// pixel averages three mapped channels, so for colour images the grey
+// histogram is an estimate, exact only where the table is affine.
+array<int, 256> Utils::mapHistogram(const array<int, 256>& hist, const array<uchar, 256>& table) {
 	array<int, 256> res;
 	fill(res.begin(), res.end(), 0);
-	rep(i, mat.rows) rep(j, mat.cols) {
-		Vec3b rgb = mat.at<Vec3b>(i, j);
-		++res[rgb[0]];
-		++res[rgb[1]];
-		++res[rgb[2]];
+	rep(v, 256) {
+		res[table[v]] += hist[v];
+	}
+	return res;
+}
+
+Utils::ColorHistograms Utils::mapHistograms(const ColorHistograms& hist, const array<uchar, 256>& table) {
+	ColorHistograms res = hist;
+	res.grey = mapHistogram(hist.grey, table);
+	rep(k, hist.channelCount) {
+		res.channels[k] = mapHistogram(hist.channels[k], table);
 	}
 	return res;
 }
@@ -257,8 +709,19 @@ array<float, 256> Utils::getCDF(const array<int, 256>& hist, int pixels) {
 }
 
 Mat Utils::linearConvert(const Mat& mat, const list<pair<float, float>>& vertices) {
-	auto cvt = [=](float d){ return (int) (d * 255 + 0.5); };
+	Mat res;
+	linearConvert(mat, res, vertices);
+	return res;
+}
 
+void Utils::linearConvert(const Mat& mat, Mat& res, const list<pair<float, float>>& vertices) {
+	TRACE_SCOPE("Utils::linearConvert");
+	MEMORY_TAG("linearConvert");
+	res.create(mat.rows, mat.cols, mat.type());
+	applyLUT(mat, res, linearConvertTable(vertices));
+}
+
+array<uchar, 256> Utils::linearConvertTable(const list<pair<float, float>>& vertices) {
 	array<uchar, 256> map;
 	auto it = vertices.begin();
 	auto nextIt = vertices.begin();
@@ -270,42 +733,59 @@ Mat Utils::linearConvert(const Mat& mat, const list<pair<float, float>>& vertice
 		}
 		map[i] = touc(((nextIt->second - it->second) * i + (it->second * nextIt->first - it->first * nextIt->second)) * 1.0 / (nextIt->first - it->first));
 	}
+	return map;
+}
 
-	Mat res(mat.rows, mat.cols, CV_8UC3);
-	rep(i, mat.rows) rep(j, mat.cols) {
-		Vec3b rgb = mat.at<Vec3b>(i, j);
-		res.at<Vec3b>(i, j) = { map[rgb[0]], map[rgb[1]], map[rgb[2]] };
-	}
-
+Mat Utils::histogramEqualization(const Mat& mat) {
+	Mat res;
+	histogramEqualization(mat, res);
 	return res;
 }
 
-Mat Utils::histogramEqualization(const Mat& mat) {
+void Utils::histogramEqualization(const Mat& mat, Mat& res) {
+	TRACE_SCOPE("Utils::histogramEqualization");
+	MEMORY_TAG("histogramEqualization");
 	array<int, 256> hist = getHistogram3Channel(mat);
-	array<float, 256> cdf = getCDF(hist, mat.rows * mat.cols * 3);
+	res.create(mat.rows, mat.cols, mat.type());
+	applyLUT(mat, res, equalizationTable(hist, mat.rows * mat.cols * colorChannels(mat)));
+}
 
-	Mat res(mat.rows, mat.cols, CV_8UC3);
-	rep(i, mat.rows) rep(j, mat.cols) {
-		Vec3b rgb = mat.at<Vec3b>(i, j);
-		res.at<Vec3b>(i, j) = { touc(cdf[rgb[0]] * 255), touc(cdf[rgb[1]] * 255), touc(cdf[rgb[2]] * 255) };
+array<uchar, 256> Utils::equalizationTable(const array<int, 256>& hist, int pixels) {
+	array<float, 256> cdf = getCDF(hist, pixels);
+	array<uchar, 256> map;
+	rep(i, 256) {
+		map[i] = touc(cdf[i] * 255);
 	}
+	return map;
+}
 
+Mat Utils::histogramSpecificationSML(const Mat& orig, const Mat& pattern) {
+	Mat res;
+	histogramSpecificationSML(orig, res, pattern);
 	return res;
 }
 
-Mat Utils::histogramSpecificationSML(const Mat& orig, const Mat& pattern) {
+void Utils::histogramSpecificationSML(const Mat& orig, Mat& res, const Mat& pattern) {
+	histogramSpecificationSML(orig, res, getHistogramReference(pattern));
+}
+
+void Utils::histogramSpecificationSML(const Mat& orig, Mat& res, const HistogramReference& pattern) {
+	TRACE_SCOPE("Utils::histogramSpecificationSML");
+	MEMORY_TAG("histogramSpecificationSML");
 	array<array<int, 256>, 3> origHist, patternHist;
 	array<array<float, 256>, 3> origCDF, patternCDF;
 
-	rep(i, 3) {
+	// A grey image is matched against the grey histogram of a colour pattern.
+	int ccn = colorChannels(orig);
+	rep(i, ccn) {
 		origHist[i] = getHistogram1Channel(orig, i);
-		patternHist[i] = getHistogram1Channel(pattern, i);
+		patternHist[i] = ccn == 1 ? pattern.greyHist : pattern.hist[i];
 		origCDF[i] = getCDF(origHist[i], orig.rows * orig.cols);
-		patternCDF[i] = getCDF(patternHist[i], pattern.rows * pattern.cols);
+		patternCDF[i] = ccn == 1 ? pattern.greyCDF : pattern.cdf[i];
 	}
 
 	array<array<uchar, 256>, 3> map;
-	rep(k, 3) {
+	rep(k, ccn) {
 		int tmpMin = 0, tmpMax = 0;
 		rep(i, 256) {
 			if (origCDF[k][i] <= patternCDF[k][tmpMin]) {
@@ -325,29 +805,51 @@ Mat Utils::histogramSpecificationSML(const Mat& orig, const Mat& pattern) {
 		}
 	}
 
-	Mat res(orig.rows, orig.cols, CV_8UC3);
-	rep(i, orig.rows) rep(j, orig.cols) {
-		Vec3b rgb = orig.at<Vec3b>(i, j);
-		res.at<Vec3b>(i, j) = { map[0][rgb[0]], map[1][rgb[1]], map[2][rgb[2]] };
-	}
+	res.create(orig.rows, orig.cols, orig.type());
+	applyLUT(orig, res, map);
+}
 
+Utils::HistogramReference Utils::getHistogramReference(const Mat& pattern) {
+	TRACE_SCOPE("Utils::getHistogramReference");
+	HistogramReference res;
+	int pixels = pattern.rows * pattern.cols;
+	res.greyHist = getHistogram(pattern);
+	res.greyCDF = getCDF(res.greyHist, pixels);
+	rep(i, 3) {
+		res.hist[i] = pattern.channels() == 1 ? res.greyHist : getHistogram1Channel(pattern, i);
+		res.cdf[i] = pattern.channels() == 1 ? res.greyCDF : getCDF(res.hist[i], pixels);
+	}
 	return res;
 }
 
 Mat Utils::histogramSpecificationGML(const Mat& orig, const Mat& pattern) {
+	Mat res;
+	histogramSpecificationGML(orig, res, pattern);
+	return res;
+}
+
+void Utils::histogramSpecificationGML(const Mat& orig, Mat& res, const Mat& pattern) {
+	histogramSpecificationGML(orig, res, getHistogramReference(pattern));
+}
+
+void Utils::histogramSpecificationGML(const Mat& orig, Mat& res, const HistogramReference& pattern) {
+	TRACE_SCOPE("Utils::histogramSpecificationGML");
+	MEMORY_TAG("histogramSpecificationGML");
 	array<array<int, 256>, 3> origHist, patternHist;
 	array<array<float, 256>, 3> origCDF, patternCDF;
 
-	rep(i, 3) {
+	// A grey image is matched against the grey histogram of a colour pattern.
+	int ccn = colorChannels(orig);
+	rep(i, ccn) {
 		origHist[i] = getHistogram1Channel(orig, i);
-		patternHist[i] = getHistogram1Channel(pattern, i);
+		patternHist[i] = ccn == 1 ? pattern.greyHist : pattern.hist[i];
 		origCDF[i] = getCDF(origHist[i], orig.rows * orig.cols);
-		patternCDF[i] = getCDF(patternHist[i], pattern.rows * pattern.cols);
+		patternCDF[i] = ccn == 1 ? pattern.greyCDF : pattern.cdf[i];
 	}
 
 	array<array<uchar, 256>, 3> map;
 	array<array<uchar, 256>, 3> invMap;
-	rep(k, 3) {
+	rep(k, ccn) {
 		int tmpMin = 0, tmpMax = 0;
 		rep(i, 256) {
 			if (patternCDF[k][i] <= origCDF[k][tmpMin]) {
@@ -377,61 +879,113 @@ Mat Utils::histogramSpecificationGML(const Mat& orig, const Mat& pattern) {
 		}
 	}
 
-	Mat res(orig.rows, orig.cols, CV_8UC3);
-	rep(i, orig.rows) rep(j, orig.cols) {
-		Vec3b rgb = orig.at<Vec3b>(i, j);
-		res.at<Vec3b>(i, j) = { map[0][rgb[0]], map[1][rgb[1]], map[2][rgb[2]] };
+	res.create(orig.rows, orig.cols, orig.type());
+	applyLUT(orig, res, map);
+}
+
+Mat Utils::histogramSpecificationExact(const Mat& orig, const Mat& pattern) {
+	Mat res;
+	histogramSpecificationExact(orig, res, getHistogramReference(pattern));
+	return res;
+}
+
+// A grey image is matched against the grey histogram of a colour pattern.
+void Utils::histogramSpecificationExact(const Mat& orig, Mat& res, const HistogramReference& pattern) {
+	TRACE_SCOPE("Utils::histogramSpecificationExact");
+	MEMORY_TAG("histogramSpecificationExact");
+	array<array<double, 256>, 3> targets;
+	rep(k, 3) {
+		const array<int, 256>& hist = colorChannels(orig) == 1 ? pattern.greyHist : pattern.hist[k];
+		copy(hist.begin(), hist.end(), targets[k].begin());
 	}
+	specifyExact(orig, res, targets);
+}
+
+void Utils::histogramSpecificationExact(const Mat& orig, Mat& res, const array<double, 256>& distribution) {
+	TRACE_SCOPE("Utils::histogramSpecificationExact");
+	MEMORY_TAG("histogramSpecificationExact");
+	specifyExact(orig, res, { distribution, distribution, distribution });
+}
+
+array<double, 256> Utils::uniformDistribution() {
+	array<double, 256> res;
+	fill(res.begin(), res.end(), 1.0);
+	return res;
+}
 
+array<double, 256> Utils::gaussianDistribution(double mean, double sigma) {
+	array<double, 256> res;
+	rep(v, 256) {
+		res[v] = exp(-sqr(v - mean) / (2 * sqr(sigma)));
+	}
 	return res;
 }
 
 Mat Utils::medianFilterImageMat(const Mat& mat, int size) {
+	Mat res;
+	medianFilterImageMat(mat, res, size);
+	return res;
+}
+
+void Utils::medianFilterImageMat(const Mat& input, Mat& res, int size) {
+	TRACE_SCOPE("Utils::medianFilterImageMat");
+	MEMORY_TAG("medianFilterImageMat");
 	if (size < 3) {
-		return mat;
+		input.copyTo(res);
+		return;
 	} else if (!(size % 2)) {
 		--size;
 	}
 
 	int t = (size * size - 1) / 2;
 
-	Mat res(mat.rows - size, mat.cols - size, CV_8UC3);
-	rep(k, 3) {
-		rep(i, mat.rows - size) {
-			array<int, 256> hist = getHistogram1Channel(mat(Rect(0, i, size, size)), k);
-			int med = 0, mNum = hist[0];
-
-			while (mNum < t) mNum += hist[++med];
-			res.at<Vec3b>(i, 0)[k] = med;
-
-			repa(j, 1, mat.cols - size) {
-				repa(m, i, i + size) {
-					int tmp;
-					tmp = mat.at<Vec3b>(m, j - 1)[k];
-					--hist[tmp];
-					if (tmp <= med) {
-						--mNum;
+	Mat mat = stencilSource(input, res);
+	int cn = mat.channels();
+	res.create(mat.rows - size, mat.cols - size, mat.type());
+	const CpuKernels& kernels = CpuDispatch::kernels();
+	// Every output row restarts its sliding histogram, so bands of rows are
+	// independent.
+	forEachBand(AutoTune::params(AutoTune::KERNEL_MEDIAN), res.rows, [&](int first, int rows) {
+		rep(k, colorChannels(mat)) {
+			repa(i, first, first + rows) {
+				array<int, 256> hist;
+				fill(hist.begin(), hist.end(), 0);
+				kernels.histogram(mat.ptr<uchar>(i), mat.step, size, size, cn, k, hist.data());
+				int med = 0, mNum = hist[0];
+
+				while (mNum < t) mNum += hist[++med];
+				uchar *dst = res.ptr<uchar>(i) + k;
+				dst[0] = med;
+
+				repa(j, 1, mat.cols - size) {
+					repa(m, i, i + size) {
+						const uchar *src = mat.ptr<uchar>(m) + k;
+						int tmp;
+						tmp = src[(j - 1) * cn];
+						--hist[tmp];
+						if (tmp <= med) {
+							--mNum;
+						}
+
+						tmp = src[(j + size - 1) * cn];
+						++hist[tmp];
+						if (tmp <= med) {
+							++mNum;
+						}
 					}
 
-					tmp = mat.at<Vec3b>(m, j + size - 1)[k];
-					++hist[tmp];
-					if (tmp <= med) {
-						++mNum;
+					if (mNum <= t) {
+						while (mNum < t) mNum += hist[++med];
+						dst[j * cn] = med;
+					} else {
+						while (mNum > t) mNum -= hist[med--];
+						dst[j * cn] = med;
 					}
 				}
-
-				if (mNum <= t) {
-					while (mNum < t) mNum += hist[++med];
-					res.at<Vec3b>(i, j)[k] = med;
-				} else {
-					while (mNum > t) mNum -= hist[med--];
-					res.at<Vec3b>(i, j)[k] = med;
-				}
 			}
 		}
-	}
-
-	return res;
+	});
+	copyAlpha(mat, res, Point(size / 2, size / 2));
 }
 
 vector<float> Utils::getGaussianKernel1D(int size, float sigma) {
@@ -452,258 +1006,217 @@ vector<float> Utils::getGaussianKernel1D(int size, float sigma) {
 }
 
 Mat Utils::gaussianFilterImageMat(const Mat& mat, int size, float sigma) {
-	vector<float> kernel1D = getGaussianKernel1D(size, sigma);
-
-	Mat tmpMat(mat.rows - size, mat.cols, CV_32FC3);
-	Mat res(mat.rows - size, mat.cols - size, CV_8UC3);
-	rep(i, mat.rows - size) rep(j, mat.cols) {
-		Vec3f tmp{ 0.0, 0.0, 0.0 };
-		rep(k, size) {
-			Vec3b rgb = mat.at<Vec3b>(i + k, j);
-			tmp[0] += kernel1D[k] * rgb[0];
-			tmp[1] += kernel1D[k] * rgb[1];
-			tmp[2] += kernel1D[k] * rgb[2];
-		}
-		tmpMat.at<Vec3f>(i, j) = tmp;
-	}
-
-	rep(i, mat.rows - size) rep(j, mat.cols - size) {
-		Vec3f tmp{ 0.0, 0.0, 0.0 };
-		rep(k, size) {
-			Vec3f rgb = tmpMat.at<Vec3f>(i, j + k);
-			tmp[0] += kernel1D[k] * rgb[0];
-			tmp[1] += kernel1D[k] * rgb[1];
-			tmp[2] += kernel1D[k] * rgb[2];
-		}
-		res.at<Vec3b>(i, j) = { touc(tmp[0]), touc(tmp[1]), touc(tmp[2]) };
-	}
-
+	Mat res;
+	gaussianFilterImageMat(mat, res, size, sigma);
 	return res;
 }
 
-Mat Utils::getRobertFilterImageMat(const Mat& mat) {
-	Mat res = Mat::zeros(mat.rows, mat.cols, CV_8UC3);
-
-	repa(i, 1, mat.rows - 1) repa(j, 1, mat.cols - 1) {
-		Mat crop = mat(Rect(j, i, 2, 2));
-		Vec3i tmp;
-		rep(k, 3) {
-			tmp[k] = abs(crop.at<Vec3b>(0, 0)[k] - crop.at<Vec3b>(1, 1)[k]) +
-				abs(crop.at<Vec3b>(0, 1)[k] - crop.at<Vec3b>(1, 0)[k]);
-			updateMinMax(tmp[k], 255, 0);
-		}
-		res.at<Vec3b>(i, j) = { (uchar) tmp[0], (uchar) tmp[1], (uchar) tmp[2] };
-	}
+void Utils::gaussianFilterImageMat(const Mat& input, Mat& res, int size, float sigma) {
+	TRACE_SCOPE("Utils::gaussianFilterImageMat");
+	MEMORY_TAG("gaussianFilterImageMat");
+	vector<float> kernel1D = getGaussianKernel1D(size, sigma);
 
-	return res;
+	Mat mat = stencilSource(input, res);
+	int cn = mat.channels();
+	Mat tmpMat(mat.rows - size, mat.cols, CV_32FC(colorChannels(mat)));
+	res.create(mat.rows - size, mat.cols - size, mat.type());
+	const CpuKernels& kernels = CpuDispatch::kernels();
+	// Both passes run per band, so the band of tmpMat is still in cache for
+	// the horizontal one.
+	forEachBand(AutoTune::params(AutoTune::KERNEL_GAUSSIAN), res.rows, [&](int first, int rows) {
+		kernels.gaussianVertical(mat.ptr<uchar>(first), mat.step, tmpMat.ptr<float>(first), tmpMat.step, tmpMat.cols, rows, cn, kernel1D.data(), size);
+		kernels.gaussianHorizontal(tmpMat.ptr<float>(first), tmpMat.step, res.ptr<uchar>(first), res.step, res.cols, rows, cn, kernel1D.data(), size);
+	});
+	copyAlpha(mat, res, Point((size - 1) / 2, (size - 1) / 2));
 }
 
-Mat Utils::getPrewittFilterImageMat(const Mat& mat) {
-	Mat res = Mat::zeros(mat.rows, mat.cols, CV_8UC3);
-
-	repa(i, 1, mat.rows - 1) repa(j, 1, mat.cols - 1) {
-		Mat crop = mat(Rect(j - 1, i - 1, 3, 3));
-		Vec3i tmp;
-		rep(k, 3) {
-			tmp[k] = abs(crop.at<Vec3b>(0, 2)[k] + crop.at<Vec3b>(1, 2)[k] + crop.at<Vec3b>(2, 2)[k] - crop.at<Vec3b>(0, 0)[k] - crop.at<Vec3b>(1, 0)[k] - crop.at<Vec3b>(2, 0)[k]) +
-				abs(crop.at<Vec3b>(2, 0)[k] + crop.at<Vec3b>(2, 1)[k] + crop.at<Vec3b>(2, 2)[k] - crop.at<Vec3b>(0, 0)[k] - crop.at<Vec3b>(0, 1)[k] - crop.at<Vec3b>(0, 2)[k]);
-			updateMinMax(tmp[k], 255, 0);
-		}
-		res.at<Vec3b>(i, j) = { (uchar) tmp[0], (uchar) tmp[1], (uchar) tmp[2] };
-	}
-
-	return res;
+void Utils::getRobertFilterImageMat(const Mat& mat, Mat& res) {
+	TRACE_SCOPE("Utils::getRobertFilterImageMat");
+	MEMORY_TAG("getRobertFilterImageMat");
+	res.create(mat.rows, mat.cols, mat.type());
+	CpuDispatch::kernels().gradient(mat.data, mat.step, res.data, res.step, mat.cols, mat.rows, mat.channels(), 0);
 }
 
-Mat Utils::getSobelFilterImageMat(const Mat& mat) {
-	Mat res = Mat::zeros(mat.rows, mat.cols, CV_8UC3);
-
-	repa(i, 1, mat.rows - 1) repa(j, 1, mat.cols - 1) {
-		Mat crop = mat(Rect(j - 1, i - 1, 3, 3));
-		Vec3i tmp;
-		rep(k, 3) {
-			tmp[k] = abs(crop.at<Vec3b>(0, 2)[k] + 2 * crop.at<Vec3b>(1, 2)[k] + crop.at<Vec3b>(2, 2)[k] - crop.at<Vec3b>(0, 0)[k] - 2 * crop.at<Vec3b>(1, 0)[k] - crop.at<Vec3b>(2, 0)[k]) +
-				abs(crop.at<Vec3b>(2, 0)[k] + 2 * crop.at<Vec3b>(2, 1)[k] + crop.at<Vec3b>(2, 2)[k] - crop.at<Vec3b>(0, 0)[k] - 2 * crop.at<Vec3b>(0, 1)[k] - crop.at<Vec3b>(0, 2)[k]);
-			updateMinMax(tmp[k], 255, 0);
-		}
-		res.at<Vec3b>(i, j) = { (uchar) tmp[0], (uchar) tmp[1], (uchar) tmp[2] };
-	}
-
-	return res;
+void Utils::getPrewittFilterImageMat(const Mat& mat, Mat& res) {
+	TRACE_SCOPE("Utils::getPrewittFilterImageMat");
+	MEMORY_TAG("getPrewittFilterImageMat");
+	res.create(mat.rows, mat.cols, mat.type());
+	CpuDispatch::kernels().gradient(mat.data, mat.step, res.data, res.step, mat.cols, mat.rows, mat.channels(), 1);
 }
 
-Mat Utils::getLaplaceFilterImageMat(const Mat& mat) {
-	Mat res = Mat::zeros(mat.rows, mat.cols, CV_8UC3);
+void Utils::getSobelFilterImageMat(const Mat& mat, Mat& res) {
+	TRACE_SCOPE("Utils::getSobelFilterImageMat");
+	MEMORY_TAG("getSobelFilterImageMat");
+	res.create(mat.rows, mat.cols, mat.type());
+	CpuDispatch::kernels().gradient(mat.data, mat.step, res.data, res.step, mat.cols, mat.rows, mat.channels(), 2);
+}
 
-	repa(i, 1, mat.rows - 1) repa(j, 1, mat.cols - 1) {
-		Mat crop = mat(Rect(j - 1, i - 1, 3, 3));
-		Vec3i tmp;
-		rep(k, 3) {
-			tmp[k] = abs(crop.at<Vec3b>(1, 1)[k] * 8 - crop.at<Vec3b>(0, 0)[k] - crop.at<Vec3b>(0, 1)[k] - crop.at<Vec3b>(0, 2)[k] - crop.at<Vec3b>(1, 0)[k] - crop.at<Vec3b>(1, 2)[k] - crop.at<Vec3b>(2, 0)[k] - crop.at<Vec3b>(2, 1)[k] - crop.at<Vec3b>(2, 2)[k]);
-			updateMinMax(tmp[k], 255, 0);
-		}
-		res.at<Vec3b>(i, j) = { (uchar) tmp[0], (uchar) tmp[1], (uchar) tmp[2] };
-	}
+void Utils::getLaplaceFilterImageMat(const Mat& mat, Mat& res) {
+	TRACE_SCOPE("Utils::getLaplaceFilterImageMat");
+	MEMORY_TAG("getLaplaceFilterImageMat");
+	res.create(mat.rows, mat.cols, mat.type());
+	CpuDispatch::kernels().gradient(mat.data, mat.step, res.data, res.step, mat.cols, mat.rows, mat.channels(), 3);
+}
 
+Mat Utils::sharpenImageMat(const Mat& mat, int type) {
+	Mat res;
+	sharpenImageMat(mat, res, type);
 	return res;
 }
 
-Mat Utils::sharpenImageMat(const Mat& mat, int type) {
-	Mat res(mat.rows, mat.cols, CV_8UC3);
+void Utils::sharpenImageMat(const Mat& mat, Mat& res, int type) {
+	TRACE_SCOPE("Utils::sharpenImageMat");
+	MEMORY_TAG("sharpenImageMat");
 	Mat grad;
 
 	float t = 0.1;
 
 	if (type == 0) {
 		t = 0.2;
-		grad = getRobertFilterImageMat(mat);
+		getRobertFilterImageMat(mat, grad);
 	} else if (type == 1) {
-		grad = getPrewittFilterImageMat(mat);
+		getPrewittFilterImageMat(mat, grad);
 	} else if (type == 2) {
-		grad = getSobelFilterImageMat(mat);
+		getSobelFilterImageMat(mat, grad);
 	} else if (type == 3) {
 		t = 0.2;
-		grad = getLaplaceFilterImageMat(mat);
+		getLaplaceFilterImageMat(mat, grad);
 	} else {
-		return res;
+		mat.copyTo(res);
+		return;
 	}
 
-	rep(i, res.rows) rep(j, res.cols) {
-		Vec3i tmp;
-		rep(k, 3) {
-			tmp[k] = round(mat.at<Vec3b>(i, j)[k] + t * grad.at<Vec3b>(i, j)[k]);
-			updateMinMax(tmp[k], 255, 0);
-		}
-		res.at<Vec3b>(i, j) = { (uchar) tmp[0], (uchar) tmp[1], (uchar) tmp[2] };
-	}
+	// The gradient is complete before res is written, so this is safe in place.
+	res.create(mat.rows, mat.cols, mat.type());
+	CpuDispatch::kernels().sharpenBlend(mat.data, mat.step, grad.data, grad.step, res.data, res.step, mat.cols, mat.rows, mat.channels(), t);
+}
 
-	return res;
+void Utils::changePartialImageMatLightness(const Mat& mat, Mat& res, const vector<float>& deltas) {
+	TRACE_SCOPE("Utils::changePartialImageMatLightness");
+	MEMORY_TAG("changePartialImageMatLightness");
+	res.create(mat.rows, mat.cols, mat.type());
+	CpuDispatch::kernels().lightness(mat.data, mat.step, res.data, res.step, mat.cols, mat.rows, mat.channels(), deltas[0]);
 }
 
-void Utils::changePartialImageMatLightness(const Mat& mat, Mat& res, vector<float> deltas) {
-	float delta = deltas[0];
-	#pragma omp parallel for
-	for (int i = 0; i < mat.rows; ++i) {
-		for (int j = 0; j < mat.cols; ++j) {
-			Vec3b rgb = mat.at<Vec3b>(i, j);
-			float maxValue, minValue;
-			maxValue = max(rgb[0], max(rgb[1], rgb[2]));
-			minValue = min(rgb[0], min(rgb[1], rgb[2]));
-			float L = (maxValue + minValue) * 1.0 / 510;
-			if (delta < 1) {
-				float alpha = L * (1 - delta) / (L * (1 - delta) + delta);
-				res.at<Vec3b>(i, j) = { touc((1 - alpha) * rgb[0] + alpha * 255), touc((1 - alpha) * rgb[1] + alpha * 255), touc((1 - alpha) * rgb[2] + alpha * 255) };
-			} else {
-				res.at<Vec3b>(i, j) = { touc(rgb[0] / (L * (1 - delta) + delta)), touc(rgb[1] / (L * (1 - delta) + delta)), touc(rgb[2] / (L * (1 - delta) + delta)) };
-			}
-		}
-	}
+void Utils::changePartialImageMatSaturation(const Mat& mat, Mat& res, const vector<float>& deltas) {
+	TRACE_SCOPE("Utils::changePartialImageMatSaturation");
+	MEMORY_TAG("changePartialImageMatSaturation");
+	res.create(mat.rows, mat.cols, mat.type());
+	CpuDispatch::kernels().saturation(mat.data, mat.step, res.data, res.step, mat.cols, mat.rows, mat.channels(), deltas[0]);
 }
 
-void Utils::changePartialImageMatSaturation(const Mat& mat, Mat& res, vector<float> deltas) {
-	float delta = deltas[0];
-	#pragma omp parallel for
-	for (int i = 0; i < mat.rows; ++i) {
-		for (int j = 0; j < mat.cols; ++j) {
-			Vec3b rgb = mat.at<Vec3b>(i, j);
-			float maxValue, minValue;
-			maxValue = max(rgb[0], max(rgb[1], rgb[2]));
-			minValue = min(rgb[0], min(rgb[1], rgb[2]));
-			float L, S;
-			L = (maxValue + minValue) * 1.0 / 510;
-			if (maxValue + minValue < 255) {
-				S = (maxValue - minValue) * 1.0 / (maxValue + minValue);
-			} else {
-				S = (maxValue - minValue) * 1.0 / (510 - maxValue - minValue);
-			}
+void Utils::changePartialImageMatHue(const Mat& mat, Mat& res, const vector<float>& deltas) {
+	TRACE_SCOPE("Utils::changePartialImageMatHue");
+	MEMORY_TAG("changePartialImageMatHue");
+	HSLPlanes planes;
+	getHSLPlanes(mat, planes);
+	changeHSLPlanesHue(planes, res, deltas[0]);
+}
 
-			float alpha;
-			if (delta > 0) {
-				alpha = 1.0f / max(S, 1 - delta) - 1;
-				res.at<Vec3b>(i, j) = { touc(rgb[0] + (rgb[0] - L * 255) * alpha), touc(rgb[1] + (rgb[1] - L * 255) * alpha), touc(rgb[2] + (rgb[2] - L * 255) * alpha) };
-			} else {
-				alpha = delta;
-				res.at<Vec3b>(i, j) = { touc(L * 255 + (rgb[0] - L * 255) * (1 + alpha)), touc(L * 255 + (rgb[1] - L * 255) * (1 + alpha)), touc(L * 255 + (rgb[2] - L * 255) * (1 + alpha)) };
-			}
+// Only the shift and HSL2RGB run per call; alpha comes from the source.
+void Utils::changeHSLPlanesHue(const HSLPlanes& planes, Mat& res, float delta) {
+	TRACE_SCOPE("Utils::changeHSLPlanesHue");
+	MEMORY_TAG("changeHSLPlanesHue");
+	const Mat& mat = planes.source;
+	res.create(mat.rows, mat.cols, mat.type());
+	auto shift = [=](Vec3f hsl) {
+		hsl[0] += delta;
+		if (hsl[0] < 0) {
+			hsl[0] += 360.0;
+		} else if (hsl[0] > 360.0) {
+			hsl[0] -= 360.0;
 		}
+		return HSL2RGB(hsl);
+	};
+	int cn = mat.channels();
+	if (cn == 1) {
+		mapPixels(mat, res, [&](Vec3b rgb) { return shift(RGB2HSL(rgb)); });
+		return;
 	}
+	CpuDispatch::kernels().hue(planes.h.ptr<float>(), planes.s.ptr<float>(), planes.l.ptr<float>(), planes.h.step, mat.data, mat.step, res.data, res.step, mat.cols, mat.rows, cn, delta);
 }
 
-void Utils::changePartialImageMatHue(const Mat& mat, Mat& res, vector<float> deltas) {
-	float delta = deltas[0];
+// Keeps planes that were computed from this very Mat. A grey image needs
+// none, its hue change goes through a table.
+void Utils::getHSLPlanes(const Mat& mat, HSLPlanes& planes) {
+	if (planes.source.data == mat.data && planes.source.size() == mat.size() && planes.source.step == mat.step && planes.source.type() == mat.type()) {
+		return;
+	}
+	TRACE_SCOPE("Utils::getHSLPlanes");
+	MEMORY_TAG("hsl planes");
+	planes.source = mat;
+	int cn = mat.channels();
+	if (cn == 1) {
+		planes.h = planes.s = planes.l = Mat();
+		return;
+	}
+	planes.h.create(mat.rows, mat.cols, CV_32F);
+	planes.s.create(mat.rows, mat.cols, CV_32F);
+	planes.l.create(mat.rows, mat.cols, CV_32F);
 	#pragma omp parallel for
 	for (int i = 0; i < mat.rows; ++i) {
-		for (int j = 0; j < mat.cols; ++j) {
-			Vec3b rgb = mat.at<Vec3b>(i, j);
-			Vec3f hsl = RGB2HSL(rgb);
-			hsl[0] += delta;
-			if (hsl[0] < 0) {
-				hsl[0] += 360.0;
-			} else if (hsl[0] > 360.0) {
-				hsl[0] -= 360.0;
-			}
-			res.at<Vec3b>(i, j) = HSL2RGB(hsl);
+		const uchar *src = mat.ptr<uchar>(i);
+		float *h = planes.h.ptr<float>(i), *s = planes.s.ptr<float>(i), *l = planes.l.ptr<float>(i);
+		for (int j = 0; j < mat.cols; ++j, src += cn) {
+			Vec3f hsl = RGB2HSL(Vec3b(src[0], src[1], src[2]));
+			h[j] = hsl[0];
+			s[j] = hsl[1];
+			l[j] = hsl[2];
 		}
 	}
 }
 
-void Utils::changePartialImageMatGamma(const Mat& mat, Mat& res, vector<float> deltas) {
+array<uchar, 256> Utils::gammaTable(const vector<float>& deltas) {
 	float gamma = deltas[0];
 	float c = deltas[1];
-	#pragma omp parallel for
-	for (int i = 0; i < mat.rows; ++i) {
-		for (int j = 0; j < mat.cols; ++j) {
-			Vec3b rgb = mat.at<Vec3b>(i, j);
-			int tmpB, tmpG, tmpR;
-			tmpB = round(pow(rgb[0] * 1.0 / 255, gamma) * c * 255);
-			tmpG = round(pow(rgb[1] * 1.0 / 255, gamma) * c * 255);
-			tmpR = round(pow(rgb[2] * 1.0 / 255, gamma) * c * 255);
-			updateMinMax(tmpB, 255, 0);
-			updateMinMax(tmpG, 255, 0);
-			updateMinMax(tmpR, 255, 0);
-			res.at<Vec3b>(i, j) = { (uchar) tmpB, (uchar) tmpG, (uchar) tmpR };
-		}
-	}
+	return tableOf([=](int v) -> uchar {
+		int tmp = round(pow(v * 1.0 / 255, gamma) * c * 255);
+		updateMinMax(tmp, 255, 0);
+		return (uchar) tmp;
+	});
 }
 
-void Utils::changePartialImageMatLog(const Mat& mat, Mat& res, vector<float> deltas) {
+array<uchar, 256> Utils::logTable(const vector<float>& deltas) {
 	float a = deltas[0];
 	float b = deltas[1];
 	float c = deltas[2];
-	#pragma omp parallel for
-	for (int i = 0; i < mat.rows; ++i) {
-		for (int j = 0; j < mat.cols; ++j) {
-			Vec3b rgb = mat.at<Vec3b>(i, j);
-			int tmpB, tmpG, tmpR;
-			tmpB = round((a + log(rgb[0] * 1.0 / 255 + 1) / (b * log(c))) * 255);
-			tmpG = round((a + log(rgb[1] * 1.0 / 255 + 1) / (b * log(c))) * 255);
-			tmpR = round((a + log(rgb[2] * 1.0 / 255 + 1) / (b * log(c))) * 255);
-			updateMinMax(tmpB, 255, 0);
-			updateMinMax(tmpG, 255, 0);
-			updateMinMax(tmpR, 255, 0);
-			res.at<Vec3b>(i, j) = { (uchar) tmpB, (uchar) tmpG, (uchar) tmpR };
-		}
-	}
+	return tableOf([=](int v) -> uchar {
+		int tmp = round((a + log(v * 1.0 / 255 + 1) / (b * log(c))) * 255);
+		updateMinMax(tmp, 255, 0);
+		return (uchar) tmp;
+	});
 }
 
-void Utils::changePartialImageMatPow(const Mat& mat, Mat& res, vector<float> deltas) {
+array<uchar, 256> Utils::powTable(const vector<float>& deltas) {
 	float a = deltas[0];
 	float b = deltas[1];
 	float c = deltas[2];
-	#pragma omp parallel for
-	for (int i = 0; i < mat.rows; ++i) {
-		for (int j = 0; j < mat.cols; ++j) {
-			Vec3b rgb = mat.at<Vec3b>(i, j);
-			int tmpB, tmpG, tmpR;
-			tmpB = round((pow(b, c * (rgb[0] * 1.0 / 255 - a)) - 1) * 255);
-			tmpG = round((pow(b, c * (rgb[1] * 1.0 / 255 - a)) - 1) * 255);
-			tmpR = round((pow(b, c * (rgb[2] * 1.0 / 255 - a)) - 1) * 255);
-			updateMinMax(tmpB, 255, 0);
-			updateMinMax(tmpG, 255, 0);
-			updateMinMax(tmpR, 255, 0);
-			res.at<Vec3b>(i, j) = { (uchar) tmpB, (uchar) tmpG, (uchar) tmpR };
-		}
-	}
+	return tableOf([=](int v) -> uchar {
+		int tmp = round((pow(b, c * (v * 1.0 / 255 - a)) - 1) * 255);
+		updateMinMax(tmp, 255, 0);
+		return (uchar) tmp;
+	});
+}
+
+void Utils::changePartialImageMatGamma(const Mat& mat, Mat& res, const vector<float>& deltas) {
+	TRACE_SCOPE("Utils::changePartialImageMatGamma");
+	MEMORY_TAG("changePartialImageMatGamma");
+	res.create(mat.rows, mat.cols, mat.type());
+	applyLUT(mat, res, gammaTable(deltas));
+}
+
+void Utils::changePartialImageMatLog(const Mat& mat, Mat& res, const vector<float>& deltas) {
+	TRACE_SCOPE("Utils::changePartialImageMatLog");
+	MEMORY_TAG("changePartialImageMatLog");
+	res.create(mat.rows, mat.cols, mat.type());
+	applyLUT(mat, res, logTable(deltas));
+}
+
+void Utils::changePartialImageMatPow(const Mat& mat, Mat& res, const vector<float>& deltas) {
+	TRACE_SCOPE("Utils::changePartialImageMatPow");
+	MEMORY_TAG("changePartialImageMatPow");
+	res.create(mat.rows, mat.cols, mat.type());
+	applyLUT(mat, res, powTable(deltas));
 }
 
 void Utils::shiftDFT(Mat &fImg) {
@@ -727,12 +1240,20 @@ void Utils::shiftDFT(Mat &fImg) {
 }
 
 Mat Utils::freqFiltering(const Mat &mat, const Mat &filter) {
+	Mat res;
+	freqFiltering(mat, res, filter);
+	return res;
+}
+
+void Utils::freqFiltering(const Mat &mat, Mat &res, const Mat &filter) {
+	TRACE_SCOPE("Utils::freqFiltering");
+	MEMORY_TAG("freqFiltering");
 	//int M = getOptimalDFTSize(mat.rows);
 	//int N = getOptimalDFTSize(mat.cols);
 
 	vector<cv::Mat> img_channels;
 	split(mat, img_channels);
-	rep(i, 3) {
+	rep(i, colorChannels(mat)) {
 		Mat &img = img_channels[i];
 
 		//Mat padded;
@@ -751,141 +1272,95 @@ Mat Utils::freqFiltering(const Mat &mat, const Mat &filter) {
 		split(complexImg, planes);
 
 		normalize(planes[0], img, 0, 1, CV_MINMAX);
-		img.convertTo(img, CV_8UC3, 255.0);
+		img.convertTo(img, CV_8U, 255.0);
 	}
 
-	Mat res;
-	merge(img_channels, res);
-	res = histogramSpecificationSML(res, mat);
-
-	return res;
+	Mat merged;
+	merge(img_channels, merged);
+	histogramSpecificationSML(merged, res, mat);
 }
 
 Mat Utils::lowPassFiltering(const Mat &mat, const Mat &filter) { return freqFiltering(mat, filter); }
 
+void Utils::lowPassFiltering(const Mat &mat, Mat &res, const Mat &filter) { freqFiltering(mat, res, filter); }
+
 Mat Utils::highPassFiltering(const Mat &mat, const Mat &filter) {
 	return freqFiltering(mat, filter + 2.5);
 }
 
-Mat Utils::idealLowPassFilter(int rows, int cols, float D0) {
-	Mat tmp(rows, cols, CV_32F);
-	rep(i, tmp.rows) rep(j, tmp.cols) {
-		float D2 = sqr(i - tmp.rows / 2) + sqr(j - tmp.cols / 2);
-		if (D2 < sqr(D0)) tmp.at<float>(i, j) = 1.0f;
-		else tmp.at<float>(i, j) = 0.0f;
-	}
+void Utils::highPassFiltering(const Mat &mat, Mat &res, const Mat &filter) {
+	freqFiltering(mat, res, filter + 2.5);
+}
 
-	Mat toMerge[2] = { tmp, tmp };
-	Mat filter;
-	merge(toMerge, 2, filter);
-	return filter;
+void Utils::setTransferCacheLimit(size_t bytes) {
+	TransferCache& cache = transferCache();
+	lock_guard<mutex> lock(cache.mtx);
+	cache.limit = bytes;
+	trimTransferCache(cache);
 }
 
-Mat Utils::idealHighPassFilter(int rows, int cols, float D0) {
-	Mat tmp(rows, cols, CV_32F);
-	rep(i, tmp.rows) rep(j, tmp.cols) {
-		float D2 = sqr(i - tmp.rows / 2) + sqr(j - tmp.cols / 2);
-		if (D2 < sqr(D0)) tmp.at<float>(i, j) = 0.0f;
-		else tmp.at<float>(i, j) = 1.0f;
-	}
+Mat Utils::idealLowPassFilter(int rows, int cols, float D0) {
+	TRACE_SCOPE("Utils::idealLowPassFilter");
+	MEMORY_TAG("idealLowPassFilter");
+	return transferFunction("idealLowPass", rows, cols, { D0 }, [=](float D2) -> float {
+		if (D2 < sqr(D0)) return 1.0f;
+		else return 0.0f;
+	});
+}
 
-	Mat toMerge[2] = { tmp, tmp };
-	Mat filter;
-	merge(toMerge, 2, filter);
-	return filter;
+Mat Utils::idealHighPassFilter(int rows, int cols, float D0) {
+	TRACE_SCOPE("Utils::idealHighPassFilter");
+	MEMORY_TAG("idealHighPassFilter");
+	return transferFunction("idealHighPass", rows, cols, { D0 }, [=](float D2) -> float {
+		if (D2 < sqr(D0)) return 0.0f;
+		else return 1.0f;
+	});
 }
 
 Mat Utils::butterWorthLowPassFilter(int rows, int cols, float D0, int n) {
-	Mat tmp(rows, cols, CV_32F);
-	rep(i, tmp.rows) rep(j, tmp.cols) {
-		float D2 = sqr(i - tmp.rows / 2) + sqr(j - tmp.cols / 2);
-		tmp.at<float>(i, j) = 1.0 / (1 + pow(D2 / sqr(D0), n));
-	}
-
-	Mat toMerge[2] = { tmp, tmp };
-	Mat filter;
-	merge(toMerge, 2, filter);
-	return filter;
+	TRACE_SCOPE("Utils::butterWorthLowPassFilter");
+	MEMORY_TAG("butterWorthLowPassFilter");
+	return transferFunction("butterWorthLowPass", rows, cols, { D0, (float) n }, [=](float D2) -> float { return 1.0 / (1 + pow(D2 / sqr(D0), n)); });
 }
 
 Mat Utils::butterWorthHighPassFilter(int rows, int cols, float D0, int n) {
-	Mat tmp(rows, cols, CV_32F);
-	rep(i, tmp.rows) rep(j, tmp.cols) {
-		float D2 = sqr(i - tmp.rows / 2) + sqr(j - tmp.cols / 2);
-		tmp.at<float>(i, j) = 1.0 / (1 + pow(sqr(D0) / D2, n));
-	}
-
-	Mat toMerge[2] = { tmp, tmp };
-	Mat filter;
-	merge(toMerge, 2, filter);
-	return filter;
+	TRACE_SCOPE("Utils::butterWorthHighPassFilter");
+	MEMORY_TAG("butterWorthHighPassFilter");
+	return transferFunction("butterWorthHighPass", rows, cols, { D0, (float) n }, [=](float D2) -> float { return 1.0 / (1 + pow(sqr(D0) / D2, n)); });
 }
 
 Mat Utils::gaussLowPassFilter(int rows, int cols, float D0) {
-	Mat tmp(rows, cols, CV_32F);
-	rep(i, tmp.rows) rep(j, tmp.cols) {
-		float D2 = sqr(i - tmp.rows / 2) + sqr(j - tmp.cols / 2);
-		tmp.at<float>(i, j) = exp(-D2 / (2 * sqr(D0)));
-	}
-
-	Mat toMerge[2] = { tmp, tmp };
-	Mat filter;
-	merge(toMerge, 2, filter);
-	return filter;
+	TRACE_SCOPE("Utils::gaussLowPassFilter");
+	MEMORY_TAG("gaussLowPassFilter");
+	return transferFunction("gaussLowPass", rows, cols, { D0 }, [=](float D2) -> float { return exp(-D2 / (2 * sqr(D0))); });
 }
 
 Mat Utils::gaussHighPassFilter(int rows, int cols, float D0) {
-	Mat tmp(rows, cols, CV_32F);
-	rep(i, tmp.rows) rep(j, tmp.cols) {
-		float D2 = sqr(i - tmp.rows / 2) + sqr(j - tmp.cols / 2);
-		tmp.at<float>(i, j) = 1 - exp(-D2 / (2 * sqr(D0)));
-	}
-
-	Mat toMerge[2] = { tmp, tmp };
-	Mat filter;
-	merge(toMerge, 2, filter);
-	return filter;
+	TRACE_SCOPE("Utils::gaussHighPassFilter");
+	MEMORY_TAG("gaussHighPassFilter");
+	return transferFunction("gaussHighPass", rows, cols, { D0 }, [=](float D2) -> float { return 1 - exp(-D2 / (2 * sqr(D0))); });
 }
 
 Mat Utils::trapezoidLowPassFilter(int rows, int cols, float D0, float D_) {
+	TRACE_SCOPE("Utils::trapezoidLowPassFilter");
+	MEMORY_TAG("trapezoidLowPassFilter");
 	if (D_ > D0) swap(D0, D_);
 
-	Mat tmp(rows, cols, CV_32F);
-	rep(i, tmp.rows) rep(j, tmp.cols) {
-		float D2 = sqr(i - tmp.rows / 2) + sqr(j - tmp.cols / 2);
-		if (D2 <= sqr(D_)) tmp.at<float>(i, j) = 1.0f;
-		else if (D2 <= sqr(D0)) tmp.at<float>(i, j) = (sqrt(D2) - D0) / (D_ - D0);
-		else tmp.at<float>(i, j) = 0.0f;
-	}
-
-	Mat toMerge[2] = { tmp, tmp };
-	Mat filter;
-	merge(toMerge, 2, filter);
-	return filter;
+	return transferFunction("trapezoidLowPass", rows, cols, { D0, D_ }, [=](float D2) -> float {
+		if (D2 <= sqr(D_)) return 1.0f;
+		else if (D2 <= sqr(D0)) return (sqrt(D2) - D0) / (D_ - D0);
+		else return 0.0f;
+	});
 }
 
 Mat Utils::expLowPassFilter(int rows, int cols, float D0, int n) {
-	Mat tmp(rows, cols, CV_32F);
-	rep(i, tmp.rows) rep(j, tmp.cols) {
-		float D2 = sqr(i - tmp.rows / 2) + sqr(j - tmp.cols / 2);
-		tmp.at<float>(i, j) = exp(-pow(sqrt(D2) / D0, n));
-	}
-
-	Mat toMerge[2] = { tmp, tmp };
-	Mat filter;
-	merge(toMerge, 2, filter);
-	return filter;
+	TRACE_SCOPE("Utils::expLowPassFilter");
+	MEMORY_TAG("expLowPassFilter");
+	return transferFunction("expLowPass", rows, cols, { D0, (float) n }, [=](float D2) -> float { return exp(-pow(sqrt(D2) / D0, n)); });
 }
 
 Mat Utils::laplaceHighPassFilter(int rows, int cols) {
-	Mat tmp(rows, cols, CV_32F);
-	rep(i, tmp.rows) rep(j, tmp.cols) {
-		float D2 = sqr(i - tmp.rows / 2) + sqr(j - tmp.cols / 2);
-		tmp.at<float>(i, j) = D2 * 25 / (rows * cols);
-	}
-
-	Mat toMerge[2] = { tmp, tmp };
-	Mat filter;
-	merge(toMerge, 2, filter);
-	return filter;
+	TRACE_SCOPE("Utils::laplaceHighPassFilter");
+	MEMORY_TAG("laplaceHighPassFilter");
+	return transferFunction("laplaceHighPass", rows, cols, {}, [=](float D2) -> float { return D2 * 25 / (rows * cols); });
 }
\ No newline at end of file
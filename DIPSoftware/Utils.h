@@ -1,7 +1,5 @@
 #pragma once
 
-#include <QImage>
-
 #include <opencv2/opencv.hpp>
 
 #include <array>
@@ -25,8 +23,6 @@
 
 #define touc(x) (uchar) round(x)
 
-#define QSL(x) QStringLiteral(x)
-
 template<typename T>
 inline void updateMax(T& value, const T& max) {
 	if (value < max) {
@@ -66,47 +62,119 @@ cv::Vec<T, cn> abs(const cv::Vec<T, cn> &v) {
 
 class Utils {
 public:
-	using changeFuncType = std::function<void(const cv::Mat &, cv::Mat &, std::vector<float>)>;
+	using changeFuncType = std::function<void(const cv::Mat &, cv::Mat &, const std::vector<float>&)>;
+
+	// The histograms of a specification pattern, computed once when many
+	// images are matched to the same pattern.
+	struct HistogramReference {
+		std::array<std::array<int, 256>, 3> hist;
+		std::array<std::array<float, 256>, 3> cdf;
+		std::array<int, 256> greyHist;
+		std::array<float, 256> greyCDF;
+	};
+
+	// The grey histogram of getHistogram() and, for colour images, the
+	// histogram of every colour channel in memory order (B, G, R).
+	struct ColorHistograms {
+		std::array<int, 256> grey;
+		std::array<std::array<int, 256>, 3> channels;
+		int channelCount;
+	};
+
+	// RGB2HSL of every pixel as CV_32F planes, computed once while a dialog
+	// previews hue changes of the same image. source holds a reference, so
+	// the same data pointer means the same pixels as long as no result is
+	// written over the source.
+	struct HSLPlanes {
+		cv::Mat source;
+		cv::Mat h, s, l;
+	};
 
 	static std::string int2ANSIColor(int k);
 	static void c_printf(const char *color, const char *format, ...);
 	static void c_fprintf(const char *color, FILE *fp, const char *format, ...);
 
-	static QString getExtension(const cv::String& str);
+	static cv::Mat readImageMat(const cv::String& fileName);
+	static cv::Mat readImageMatReduced(const cv::String& fileName, int scale);
+	static bool writeImageMat(const cv::String& fileName, const cv::Mat& mat);
+	static int colorChannels(const cv::Mat& mat);
 
-	static QImage mat2QImage(const cv::Mat& mat);
-	static cv::Vec3b biLinearInterpolation(const cv::Mat& mat, float x, float y);
+	static void biLinearInterpolation(const cv::Mat& mat, float x, float y, uchar *dst);
 	static cv::Vec3f RGB2HSL(cv::Vec3b rgb);
 	static cv::Vec3b HSL2RGB(cv::Vec3f hsl);
 
+	// Every operation also has a destination-passing overload. res is only
+	// reallocated when its size or type differs, and it may be mat itself.
+	static void getRotatedSize(int rows, int cols, float theta, int& newRows, int& newCols);
 	static cv::Mat rotateImageMat(const cv::Mat& mat, float theta);
-	static cv::Mat changeImageMat(const cv::Mat& mat, std::vector<float> delta, changeFuncType changeFunc);
+	static void rotateImageMat(const cv::Mat& mat, cv::Mat& res, float theta);
+	static cv::Mat flipImageMat(const cv::Mat& mat, int flipCode);
+	static void flipImageMat(const cv::Mat& mat, cv::Mat& res, int flipCode);
+	static cv::Mat changeImageMat(const cv::Mat& mat, const std::vector<float>& deltas, const changeFuncType& changeFunc);
+	static void changeImageMat(const cv::Mat& mat, cv::Mat& res, const std::vector<float>& deltas, const changeFuncType& changeFunc);
 
 	static std::array<int, 256> getHistogram(const cv::Mat& mat);
 	static std::array<int, 256> getHistogram1Channel(const cv::Mat& mat, int channel);
 	static std::array<int, 256> getHistogram3Channel(const cv::Mat& mat);
+	static ColorHistograms getColorHistograms(const cv::Mat& mat);
+	static ColorHistograms getSampledHistograms(const cv::Mat& mat, float maxError);
 	static std::array<float, 256> getCDF(const std::array<int, 256>& hist, int pixels);
+	static std::array<int, 256> mapHistogram(const std::array<int, 256>& hist, const std::array<uchar, 256>& table);
+	static ColorHistograms mapHistograms(const ColorHistograms& hist, const std::array<uchar, 256>& table);
 
 	static cv::Mat linearConvert(const cv::Mat& mat, const std::list<std::pair<float, float>> &vertices);
+	static void linearConvert(const cv::Mat& mat, cv::Mat& res, const std::list<std::pair<float, float>> &vertices);
+	static std::array<uchar, 256> linearConvertTable(const std::list<std::pair<float, float>> &vertices);
 	static cv::Mat histogramEqualization(const cv::Mat& mat);
+	static void histogramEqualization(const cv::Mat& mat, cv::Mat& res);
+	static std::array<uchar, 256> equalizationTable(const std::array<int, 256>& hist, int pixels);
 	static cv::Mat histogramSpecificationSML(const cv::Mat& orig, const cv::Mat& pattern);
+	static void histogramSpecificationSML(const cv::Mat& orig, cv::Mat& res, const cv::Mat& pattern);
+	static void histogramSpecificationSML(const cv::Mat& orig, cv::Mat& res, const HistogramReference& pattern);
 	static cv::Mat histogramSpecificationGML(const cv::Mat& orig, const cv::Mat& pattern);
+	static void histogramSpecificationGML(const cv::Mat& orig, cv::Mat& res, const cv::Mat& pattern);
+	static void histogramSpecificationGML(const cv::Mat& orig, cv::Mat& res, const HistogramReference& pattern);
+	static HistogramReference getHistogramReference(const cv::Mat& pattern);
+	// Exact specification: every channel gets exactly the target histogram
+	// (scaled to the pixel count), pixels of equal value being ordered by the
+	// mean of their 3x3 neighbourhood before levels are handed out by rank.
+	static cv::Mat histogramSpecificationExact(const cv::Mat& orig, const cv::Mat& pattern);
+	static void histogramSpecificationExact(const cv::Mat& orig, cv::Mat& res, const HistogramReference& pattern);
+	static void histogramSpecificationExact(const cv::Mat& orig, cv::Mat& res, const std::array<double, 256>& distribution);
+	static std::array<double, 256> uniformDistribution();
+	static std::array<double, 256> gaussianDistribution(double mean, double sigma);
 
 	static cv::Mat medianFilterImageMat(const cv::Mat& mat, int size);
+	static void medianFilterImageMat(const cv::Mat& mat, cv::Mat& res, int size);
 	static cv::Mat gaussianFilterImageMat(const cv::Mat& mat, int size, float sigma);
+	static void gaussianFilterImageMat(const cv::Mat& mat, cv::Mat& res, int size, float sigma);
 	static cv::Mat sharpenImageMat(const cv::Mat& mat, int type);
-
-	static void changePartialImageMatLightness(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
-	static void changePartialImageMatSaturation(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
-	static void changePartialImageMatHue(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
-	static void changePartialImageMatGamma(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
-	static void changePartialImageMatLog(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
-	static void changePartialImageMatPow(const cv::Mat& mat, cv::Mat& res, std::vector<float> deltas);
+	static void sharpenImageMat(const cv::Mat& mat, cv::Mat& res, int type);
+
+	static void changePartialImageMatLightness(const cv::Mat& mat, cv::Mat& res, const std::vector<float>& deltas);
+	static void changePartialImageMatSaturation(const cv::Mat& mat, cv::Mat& res, const std::vector<float>& deltas);
+	static void changePartialImageMatHue(const cv::Mat& mat, cv::Mat& res, const std::vector<float>& deltas);
+	static void changeHSLPlanesHue(const HSLPlanes& planes, cv::Mat& res, float delta);
+	static void getHSLPlanes(const cv::Mat& mat, HSLPlanes& planes);
+	static void changePartialImageMatGamma(const cv::Mat& mat, cv::Mat& res, const std::vector<float>& deltas);
+	static void changePartialImageMatLog(const cv::Mat& mat, cv::Mat& res, const std::vector<float>& deltas);
+	static void changePartialImageMatPow(const cv::Mat& mat, cv::Mat& res, const std::vector<float>& deltas);
+	// The tables behind the three transforms above, for predicting histograms.
+	static std::array<uchar, 256> gammaTable(const std::vector<float>& deltas);
+	static std::array<uchar, 256> logTable(const std::vector<float>& deltas);
+	static std::array<uchar, 256> powTable(const std::vector<float>& deltas);
 
 	static cv::Mat freqFiltering(const cv::Mat &mat, const cv::Mat &filter);
-	static cv::Mat lowPassFiltering(const cv::Mat &res, const cv::Mat &filter);
-	static cv::Mat highPassFiltering(const cv::Mat &res, const cv::Mat &filter);
-
+	static void freqFiltering(const cv::Mat &mat, cv::Mat &res, const cv::Mat &filter);
+	static cv::Mat lowPassFiltering(const cv::Mat &mat, const cv::Mat &filter);
+	static void lowPassFiltering(const cv::Mat &mat, cv::Mat &res, const cv::Mat &filter);
+	static cv::Mat highPassFiltering(const cv::Mat &mat, const cv::Mat &filter);
+	static void highPassFiltering(const cv::Mat &mat, cv::Mat &res, const cv::Mat &filter);
+
+	// Transfer functions are cached by kind, size and parameters (see
+	// setTransferCacheLimit); the returned Mat is shared and must not be
+	// written to.
+	static void setTransferCacheLimit(size_t bytes);
 	static cv::Mat idealLowPassFilter(int rows, int cols, float D0);
 	static cv::Mat butterWorthLowPassFilter(int rows, int cols, float D0, int n);
 	static cv::Mat gaussLowPassFilter(int rows, int cols, float D0);
@@ -121,10 +189,10 @@ public:
 private:
 	static std::vector<float> getGaussianKernel1D(int size, float sigma);
 
-	static cv::Mat getRobertFilterImageMat(const cv::Mat& mat);
-	static cv::Mat getPrewittFilterImageMat(const cv::Mat& mat);
-	static cv::Mat getSobelFilterImageMat(const cv::Mat& mat);
-	static cv::Mat getLaplaceFilterImageMat(const cv::Mat& mat);
+	static void getRobertFilterImageMat(const cv::Mat& mat, cv::Mat& res);
+	static void getPrewittFilterImageMat(const cv::Mat& mat, cv::Mat& res);
+	static void getSobelFilterImageMat(const cv::Mat& mat, cv::Mat& res);
+	static void getLaplaceFilterImageMat(const cv::Mat& mat, cv::Mat& res);
 
 	static void shiftDFT(cv::Mat &fImg);
 };
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include "dipcore.h"
+#include "AutoTune.h"
+#include "CpuDispatch.h"
+#include "Utils.h"
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+namespace {
+
+using opType = function<void(const Mat&, Mat&)>;
+
+thread_local string lastError;
+once_flag initFlag;
+
+void init() {
+	CpuDispatch::initFromEnvironment();
+	AutoTune::initFromEnvironment();
+}
+
+dip_status fail(dip_status status, const string& message) {
+	lastError = message;
+	return status;
+}
+
+dip_status checkImage(const dip_image *image, const char *name) {
+	if (!image || !image->data) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, string(name) + " is null");
+	}
+	if (image->width <= 0 || image->height <= 0) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, string(name) + " is empty");
+	}
+	if (image->channels != 1 && image->channels != 3 && image->channels != 4) {
+		return fail(DIP_ERROR_UNSUPPORTED_FORMAT, string(name) + " must have 1, 3 or 4 channels");
+	}
+	if (image->stride < (size_t) image->width * image->channels) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, string(name) + " stride is shorter than a row");
+	}
+	return DIP_OK;
+}
+
+// A Mat header over the caller's pixels; no data is copied or owned.
+Mat wrap(const dip_image *image) {
+	return Mat(image->height, image->width, CV_8UC(image->channels), image->data, image->stride);
+}
+
+// Runs a Utils kernel straight into the caller's dst buffer. The
+// destination-passing overloads only reallocate res on a shape or type
+// mismatch, so a kernel that did is given the wrong dst size here, which is
+// a bug rather than something to copy around.
+dip_status run(const dip_image *src, const dip_image *dst, int width, int height, const opType& op) {
+	dip_status status;
+	if ((status = checkImage(src, "src")) != DIP_OK || (status = checkImage(dst, "dst")) != DIP_OK) {
+		return status;
+	}
+	if (dst->width != width || dst->height != height || dst->channels != src->channels) {
+		return fail(DIP_ERROR_SIZE_MISMATCH, "dst must be " + to_string(width) + "x" + to_string(height) + " with " + to_string(src->channels) + " channels");
+	}
+	call_once(initFlag, init);
+	try {
+		Mat out = wrap(dst), res = out;
+		op(wrap(src), res);
+		if (res.data != out.data || res.size() != out.size() || res.type() != out.type()) {
+			return fail(DIP_ERROR_INTERNAL, "kernel did not write into dst");
+		}
+	} catch (const bad_alloc&) {
+		return fail(DIP_ERROR_OUT_OF_MEMORY, "out of memory");
+	} catch (const cv::Exception& e) {
+		return fail(DIP_ERROR_INTERNAL, e.what());
+	} catch (const exception& e) {
+		return fail(DIP_ERROR_INTERNAL, e.what());
+	} catch (...) {
+		return fail(DIP_ERROR_INTERNAL, "unknown exception");
+	}
+	return DIP_OK;
+}
+
+dip_status runSameSize(const dip_image *src, const dip_image *dst, const opType& op) {
+	if (!src) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "src is null");
+	}
+	return run(src, dst, src->width, src->height, op);
+}
+
+}
+
+int dip_api_version(void) {
+	return DIP_API_VERSION;
+}
+
+const char* dip_status_string(dip_status status) {
+	switch (status) {
+	case DIP_OK:
+		return "ok";
+	case DIP_ERROR_INVALID_ARGUMENT:
+		return "invalid argument";
+	case DIP_ERROR_UNSUPPORTED_FORMAT:
+		return "unsupported format";
+	case DIP_ERROR_SIZE_MISMATCH:
+		return "size mismatch";
+	case DIP_ERROR_OUT_OF_MEMORY:
+		return "out of memory";
+	case DIP_ERROR_INTERNAL:
+		return "internal error";
+	default:
+		return "unknown status";
+	}
+}
+
+const char* dip_last_error(void) {
+	return lastError.c_str();
+}
+
+const char* dip_cpu_tier(void) {
+	call_once(initFlag, init);
+	return CpuDispatch::tierName(CpuDispatch::tier());
+}
+
+dip_status dip_set_cpu_tier(const char *name) {
+	CpuDispatch::Tier tier;
+	if (!name || !CpuDispatch::parseTier(name, tier)) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "unknown cpu tier");
+	}
+	call_once(initFlag, init);
+	CpuDispatch::setTier(tier);
+	return DIP_OK;
+}
+
+dip_status dip_histogram(const dip_image *src, int channel, int hist[256]) {
+	dip_status status = checkImage(src, "src");
+	if (status != DIP_OK) {
+		return status;
+	}
+	if (!hist || channel >= Utils::colorChannels(wrap(src))) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "bad histogram channel or output");
+	}
+	call_once(initFlag, init);
+	Mat mat = wrap(src);
+	array<int, 256> res = channel < 0 ? Utils::getHistogram(mat) : Utils::getHistogram1Channel(mat, channel);
+	copy(res.begin(), res.end(), hist);
+	return DIP_OK;
+}
+
+dip_status dip_equalize(const dip_image *src, const dip_image *dst) {
+	return runSameSize(src, dst, [](const Mat& mat, Mat& res) { Utils::histogramEqualization(mat, res); });
+}
+
+dip_status dip_linear_convert(const dip_image *src, const dip_image *dst, const float *xs, const float *ys, int count) {
+	if (!xs || !ys || count < 2 || xs[0] != 0 || xs[count - 1] != 255) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "vertices must run from x = 0 to x = 255");
+	}
+	list<pair<float, float>> vertices;
+	rep(i, count) {
+		if (i && xs[i] <= xs[i - 1]) {
+			return fail(DIP_ERROR_INVALID_ARGUMENT, "vertices must be sorted by x");
+		}
+		vertices.push_back({ xs[i], ys[i] });
+	}
+	return runSameSize(src, dst, [&](const Mat& mat, Mat& res) { Utils::linearConvert(mat, res, vertices); });
+}
+
+dip_status dip_specify_histogram(const dip_image *src, const dip_image *dst, const dip_image *pattern, int mode) {
+	dip_status status = checkImage(pattern, "pattern");
+	if (status != DIP_OK) {
+		return status;
+	}
+	if (mode != DIP_SPECIFY_SML && mode != DIP_SPECIFY_GML && mode != DIP_SPECIFY_EXACT) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "unknown specification mode " + to_string(mode));
+	}
+	Mat pat = wrap(pattern);
+	return runSameSize(src, dst, [&](const Mat& mat, Mat& res) {
+		if (mode == DIP_SPECIFY_GML) {
+			Utils::histogramSpecificationGML(mat, res, pat);
+		} else if (mode == DIP_SPECIFY_EXACT) {
+			Utils::histogramSpecificationExact(mat, res, Utils::getHistogramReference(pat));
+		} else {
+			Utils::histogramSpecificationSML(mat, res, pat);
+		}
+	});
+}
+
+dip_status dip_adjust(const dip_image *src, const dip_image *dst, dip_adjustment adjustment, const float *deltas, int count) {
+	static const struct {
+		Utils::changeFuncType func;
+		int deltas;
+	} adjustments[] = {
+		{ &Utils::changePartialImageMatLightness, 1 },
+		{ &Utils::changePartialImageMatSaturation, 1 },
+		{ &Utils::changePartialImageMatHue, 1 },
+		{ &Utils::changePartialImageMatGamma, 2 },
+		{ &Utils::changePartialImageMatLog, 3 },
+		{ &Utils::changePartialImageMatPow, 3 }
+	};
+	if (adjustment < DIP_ADJUST_LIGHTNESS || adjustment > DIP_ADJUST_POW) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "unknown adjustment");
+	}
+	const auto& entry = adjustments[adjustment];
+	if (!deltas || count != entry.deltas) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "adjustment takes " + to_string(entry.deltas) + " parameters");
+	}
+	vector<float> values(deltas, deltas + count);
+	return runSameSize(src, dst, [&](const Mat& mat, Mat& res) { Utils::changeImageMat(mat, res, values, entry.func); });
+}
+
+dip_status dip_median(const dip_image *src, const dip_image *dst, int size) {
+	if (!src) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "src is null");
+	}
+	// Even sizes are rounded down to odd, and sizes below 3 copy.
+	int border = size < 3 ? 0 : size - 1 + size % 2;
+	if (size < 1 || border >= src->width || border >= src->height) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "median size must be positive and smaller than the image");
+	}
+	return run(src, dst, src->width - border, src->height - border, [=](const Mat& mat, Mat& res) { Utils::medianFilterImageMat(mat, res, size); });
+}
+
+dip_status dip_gaussian(const dip_image *src, const dip_image *dst, int size, float sigma) {
+	if (!src) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "src is null");
+	}
+	if (size < 1 || size >= src->width || size >= src->height || sigma <= 0) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "gaussian size must be positive and smaller than the image, sigma positive");
+	}
+	return run(src, dst, src->width - size, src->height - size, [=](const Mat& mat, Mat& res) { Utils::gaussianFilterImageMat(mat, res, size, sigma); });
+}
+
+dip_status dip_sharpen(const dip_image *src, const dip_image *dst, dip_sharpen_operator op) {
+	if (op < DIP_SHARPEN_ROBERT || op > DIP_SHARPEN_LAPLACE) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "unknown sharpen operator");
+	}
+	return runSameSize(src, dst, [=](const Mat& mat, Mat& res) { Utils::sharpenImageMat(mat, res, op); });
+}
+
+dip_status dip_flip(const dip_image *src, const dip_image *dst, dip_flip_mode mode) {
+	if (mode != DIP_FLIP_VERTICAL && mode != DIP_FLIP_HORIZONTAL && mode != DIP_FLIP_BOTH) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "unknown flip mode");
+	}
+	return runSameSize(src, dst, [=](const Mat& mat, Mat& res) { Utils::flipImageMat(mat, res, mode); });
+}
+
+dip_status dip_rotated_size(int width, int height, float theta, int *rotatedWidth, int *rotatedHeight) {
+	if (width <= 0 || height <= 0 || !rotatedWidth || !rotatedHeight) {
+		return fail(DIP_ERROR_INVALID_ARGUMENT, "bad rotation size arguments");
+	}
+	Utils::getRotatedSize(height, width, theta, *rotatedHeight, *rotatedWidth);
+	return DIP_OK;
+}
+
+dip_status dip_rotate(const dip_image *src, const dip_image *dst, float theta) {
+	int width, height;
+	dip_status status = checkImage(src, "src");
+	if (status != DIP_OK || (status = dip_rotated_size(src->width, src->height, theta, &width, &height)) != DIP_OK) {
+		return status;
+	}
+	return run(src, dst, width, height, [=](const Mat& mat, Mat& res) { Utils::rotateImageMat(mat, res, theta); });
+}
\ No newline at end of file
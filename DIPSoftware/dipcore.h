@@ -0,0 +1,118 @@
+#pragma once
+
+// C interface to the processing core. Every call works in place on buffers
+// owned by the caller: an image is a pointer to 8-bit interleaved pixels
+// (grey, BGR or BGRA) plus its size and row stride in bytes. Nothing is
+// copied on the way in or out, except a temporary copy of the source when
+// src and dst are the same buffer for a neighbourhood filter. src and dst
+// must either be the same buffer or not overlap at all.
+//
+// Calls return DIP_OK or an error code; dip_last_error() describes the last
+// failure on the calling thread. The library never keeps a pointer to a
+// caller buffer after a call returns.
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#if defined(DIPCORE_EXPORTS)
+#define DIP_API __declspec(dllexport)
+#elif defined(DIPCORE_SHARED)
+#define DIP_API __declspec(dllimport)
+#else
+#define DIP_API
+#endif
+#elif defined(__GNUC__)
+#define DIP_API __attribute__((visibility("default")))
+#else
+#define DIP_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped whenever a declaration below changes incompatibly.
+#define DIP_API_VERSION 1
+
+typedef enum dip_status {
+	DIP_OK = 0,
+	DIP_ERROR_INVALID_ARGUMENT = 1,
+	DIP_ERROR_UNSUPPORTED_FORMAT = 2,
+	DIP_ERROR_SIZE_MISMATCH = 3,
+	DIP_ERROR_OUT_OF_MEMORY = 4,
+	DIP_ERROR_INTERNAL = 5
+} dip_status;
+
+typedef struct dip_image {
+	unsigned char *data;
+	int width, height;
+	size_t stride;
+	int channels;
+} dip_image;
+
+typedef enum dip_adjustment {
+	DIP_ADJUST_LIGHTNESS = 0,	// delta
+	DIP_ADJUST_SATURATION = 1,	// delta
+	DIP_ADJUST_HUE = 2,			// degrees
+	DIP_ADJUST_GAMMA = 3,		// gamma, c
+	DIP_ADJUST_LOG = 4,			// a, b, c
+	DIP_ADJUST_POW = 5			// a, b, c
+} dip_adjustment;
+
+typedef enum dip_specification {
+	DIP_SPECIFY_SML = 0,
+	DIP_SPECIFY_GML = 1,
+	DIP_SPECIFY_EXACT = 2
+} dip_specification;
+
+typedef enum dip_sharpen_operator {
+	DIP_SHARPEN_ROBERT = 0,
+	DIP_SHARPEN_PREWITT = 1,
+	DIP_SHARPEN_SOBEL = 2,
+	DIP_SHARPEN_LAPLACE = 3
+} dip_sharpen_operator;
+
+typedef enum dip_flip_mode {
+	DIP_FLIP_VERTICAL = 0,
+	DIP_FLIP_HORIZONTAL = 1,
+	DIP_FLIP_BOTH = -1
+} dip_flip_mode;
+
+DIP_API int dip_api_version(void);
+DIP_API const char* dip_status_string(dip_status status);
+DIP_API const char* dip_last_error(void);
+
+// "scalar", "sse2", "avx2" or "avx512". DIP_CPU_TIER and the DIP_TUNE
+// settings are honoured as in the application, so a tuning file written by
+// --tune, the GUI or the daemon is used, but the library never calibrates
+// itself; dip_set_cpu_tier() clamps to what the CPU supports.
+DIP_API const char* dip_cpu_tier(void);
+DIP_API dip_status dip_set_cpu_tier(const char *name);
+
+// channel < 0 gives the grey histogram of a colour image.
+DIP_API dip_status dip_histogram(const dip_image *src, int channel, int hist[256]);
+
+DIP_API dip_status dip_equalize(const dip_image *src, const dip_image *dst);
+// Piecewise linear curve through count >= 2 (x, y) vertices in [0, 255],
+// sorted by x, starting at x = 0 and ending at x = 255.
+DIP_API dip_status dip_linear_convert(const dip_image *src, const dip_image *dst, const float *xs, const float *ys, int count);
+// mode is a dip_specification; it is an int so that callers of the older
+// groupMapping flag (0 SML, 1 GML) keep compiling.
+DIP_API dip_status dip_specify_histogram(const dip_image *src, const dip_image *dst, const dip_image *pattern, int mode);
+DIP_API dip_status dip_adjust(const dip_image *src, const dip_image *dst, dip_adjustment adjustment, const float *deltas, int count);
+
+// dst is size pixels narrower and shorter than src, an even size counting as
+// the odd size below it; sizes 1 and 2 copy.
+DIP_API dip_status dip_median(const dip_image *src, const dip_image *dst, int size);
+// dst is size pixels narrower and shorter than src.
+DIP_API dip_status dip_gaussian(const dip_image *src, const dip_image *dst, int size, float sigma);
+DIP_API dip_status dip_sharpen(const dip_image *src, const dip_image *dst, dip_sharpen_operator op);
+
+DIP_API dip_status dip_flip(const dip_image *src, const dip_image *dst, dip_flip_mode mode);
+// The rotated image is larger than src; ask for its size before allocating dst.
+DIP_API dip_status dip_rotated_size(int width, int height, float theta, int *rotatedWidth, int *rotatedHeight);
+DIP_API dip_status dip_rotate(const dip_image *src, const dip_image *dst, float theta);
+
+#ifdef __cplusplus
+}
+#endif
\ No newline at end of file
@@ -1,11 +1,19 @@
 #include "EditImageCommand.h"
+#include "BufferPool.h"
+#include "ColorMatrix.h"
 #include "DiagramPreviewDialog.h"
 #include "dipsoftware.h"
+#include "ImageWriter.h"
+#include "MemoryTracker.h"
 #include "MultiInputDialog.h"
+#include "ResultCache.h"
+#include "Trace.h"
 
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QInputDialog>
 #include <QMenu>
+#include <QTimer>
 #include <QDebug>
 
 #include <cmath>
@@ -14,6 +22,14 @@
 
 #define PI 3.1415926
 
+namespace {
+
+// Large JPEGs open as a 1/8 scale DCT decode while the full decode runs.
+const int PROXY_SCALE = 8;
+const qint64 PROXY_MIN_FILE_SIZE = 4 << 20;
+
+}
+
 using namespace cv;
 using namespace std;
 
@@ -25,6 +41,9 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	imgWidget = new ImgWidget(this);
 	histogramWidget = new HistogramWidget(this);
 	diagramWidget = new DiagramWidget(this);
+	memoryPanel = nullptr;
+	activeSaves = 0;
+	openGeneration = 0;
 	originMat = nullptr;
 	mainLayout = new QHBoxLayout;
 	centerWidget = new QWidget(this);
@@ -36,6 +55,7 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	saveFileAction->setShortcut(QKeySequence::Save);
 	saveAsFileAction = new QAction(QSL("&Ϊ..."), this);
 	saveAsFileAction->setShortcut(QKeySequence::SaveAs);
+	saveSessionAction = new QAction(QSL("Ự..."), this);
 
 	undoAction = undoStack->createUndoAction(this, QSL("&"));
 	undoAction->setShortcut(QKeySequence::Undo);
@@ -53,6 +73,7 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	changeLightnessAction = new QAction(QSL("&..."), this);
 	changeSaturationAction = new QAction(QSL("&Ͷ..."), this);
 	changeHueAction = new QAction(QSL("&ɫ..."), this);
+	quickHueSaturationAction = new QAction(QSL("&ɫ/Ͷ..."), this);
 	linearConvertAction = new QAction(QSL("&ֶԱ任"), this);
 	changeGammaAction = new QAction(QSL("&GammaУ"), this);
 	changeLogAction = new QAction(QSL("&任"), this);
@@ -60,6 +81,8 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	histEquAction = new QAction(QSL("&ֱͼ⻯"), this);
 	histSpecSMLAction = new QAction(QSL("&ӳ"), this);
 	histSpecGMLAction = new QAction(QSL("&ӳ"), this);
+	histSpecExactAction = new QAction(QSL("&ȷ涨"), this);
+	histSpecUniformAction = new QAction(QSL("&ȷ⻯"), this);
 	medianFilterAction = new QAction(QSL("&ֵ˲"), this);
 	gaussianFilterAction = new QAction(QSL("&˹˲"), this);
 	sharpenRobertFilterAction = new QAction(QSL("&Robert"), this);
@@ -75,14 +98,19 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	butterWorthHighPassAction = new QAction(QSL("&ButterWorthͨ˲"), this);
 	gaussHighPassAction = new QAction(QSL("&˹ͨ˲"), this);
 	laplaceHighPassAction = new QAction(QSL("&˹ͨ˲"), this);
+	recordTraceAction = new QAction(QSL("&¼ܸ"), this);
+	recordTraceAction->setCheckable(true);
+	recordTraceAction->setChecked(Trace::isEnabled());
+	exportTraceAction = new QAction(QSL("&ܸ..."), this);
+	memoryPanelAction = new QAction(QSL("&ڴͳ..."), this);
 
 	actionObservers = make_shared<vector<QAction*>>(initializer_list<QAction*>{
-		saveFileAction, saveAsFileAction, rotate90Action,
+		saveFileAction, saveAsFileAction, saveSessionAction, rotate90Action,
 		rotate180Action, rotate270Action, rotateAction,
 		horizontalFlipAction, verticalFlipAction, changeLightnessAction,
-		changeSaturationAction, changeHueAction, linearConvertAction,
+		changeSaturationAction, changeHueAction, quickHueSaturationAction, linearConvertAction,
 		changeGammaAction, changeLogAction, changePowAction,
-		histEquAction, histSpecSMLAction, histSpecGMLAction,
+		histEquAction, histSpecSMLAction, histSpecGMLAction, histSpecExactAction, histSpecUniformAction,
 		medianFilterAction, gaussianFilterAction, sharpenRobertFilterAction,
 		sharpenPrewittFilterAction, sharpenSobelFilterAction, sharpenLaplaceFilterAction,
 		idealLowPassAction, butterWorthLowPassAction, gaussLowPassAction,
@@ -94,6 +122,8 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	fileMenu->addAction(openFileAction);
 	fileMenu->addAction(saveFileAction);
 	fileMenu->addAction(saveAsFileAction);
+	fileMenu->addSeparator();
+	fileMenu->addAction(saveSessionAction);
 	QMenu *editMenu = menuBar()->addMenu(QSL("&"));
 	editMenu->addAction(undoAction);
 	editMenu->addAction(redoAction);
@@ -112,6 +142,7 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	changeMenu->addAction(changeLightnessAction);
 	changeMenu->addAction(changeSaturationAction);
 	changeMenu->addAction(changeHueAction);
+	changeMenu->addAction(quickHueSaturationAction);
 	imageMenu->addSeparator();
 	imageMenu->addAction(linearConvertAction);
 	QMenu *nonLinearMenu = imageMenu->addMenu(QSL("&Ա任"));
@@ -122,6 +153,9 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	QMenu *histSpecMenu = imageMenu->addMenu(QSL("&ֱͼ涨"));
 	histSpecMenu->addAction(histSpecSMLAction);
 	histSpecMenu->addAction(histSpecGMLAction);
+	histSpecMenu->addSeparator();
+	histSpecMenu->addAction(histSpecExactAction);
+	histSpecMenu->addAction(histSpecUniformAction);
 	imageMenu->addSeparator();
 	QMenu *spaceFilterMenu = imageMenu->addMenu(QSL("&˲"));
 	spaceFilterMenu->addAction(medianFilterAction);
@@ -143,11 +177,29 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	highPassFilterMenu->addAction(butterWorthHighPassAction);
 	highPassFilterMenu->addAction(gaussHighPassAction);
 	highPassFilterMenu->addAction(laplaceHighPassAction);
+	QMenu *toolMenu = menuBar()->addMenu(QSL("&"));
+	toolMenu->addAction(recordTraceAction);
+	toolMenu->addAction(exportTraceAction);
+	toolMenu->addSeparator();
+	toolMenu->addAction(memoryPanelAction);
 
+	// Connected first so that every action sees the full image, not the proxy.
+	for (const auto& action : *actionObservers) {
+		connect(action, &QAction::triggered, this, &DIPSoftware::finishOpen);
+	}
+	connect(this, &DIPSoftware::imageDecoded, this, [this](int generation) {
+		if (generation == openGeneration) {
+			finishOpen();
+		}
+	});
 	connect(imgWidget, &ImgWidget::setCropActionEnabled, this, bind(&QAction::setEnabled, cropAction, placeholders::_1));
+	connect(imgWidget, &ImgWidget::cropRectChanged, histogramWidget, &HistogramWidget::setRegion);
+	connect(imgWidget, &ImgWidget::previewChanged, histogramWidget, &HistogramWidget::setPreviewMat);
 	connect(openFileAction, &QAction::triggered, this, &DIPSoftware::openFile);
 	connect(saveFileAction, &QAction::triggered, this, &DIPSoftware::saveFile);
 	connect(saveAsFileAction, &QAction::triggered, this, &DIPSoftware::saveAsFile);
+	connect(saveSessionAction, &QAction::triggered, this, &DIPSoftware::saveSession);
+	connect(undoStack, &QUndoStack::indexChanged, this, &DIPSoftware::recordSession);
 	connect(cropAction, &QAction::triggered, this, &DIPSoftware::cropImage);
 	connect(rotate90Action, &QAction::triggered, this, bind(&DIPSoftware::rotateImage, this, PI / 2));
 	connect(rotate180Action, &QAction::triggered, this, bind(&DIPSoftware::rotateImage, this, PI));
@@ -161,19 +213,30 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	connect(changeSaturationAction, &QAction::triggered, this, bind(&DIPSoftware::uiChangeImage, this, &Utils::changePartialImageMatSaturation, QSL("Ͷ"), vector<InputPreviewDialog::ParameterInfo>{
 		InputPreviewDialog::ParameterInfo([](float d){ return d / 100; }, [](float d){ return 100 * d; }, QSL("Ͷȣ"), 0, -100, 100)
 	}));
-	connect(changeHueAction, &QAction::triggered, this, bind(&DIPSoftware::uiChangeImage, this, &Utils::changePartialImageMatHue, QSL("ɫ"), vector<InputPreviewDialog::ParameterInfo>{
+	auto changeHue = [this](const Mat& mat, Mat& res, const vector<float>& deltas) {
+		Utils::getHSLPlanes(mat, hslPlanes);
+		Utils::changeHSLPlanesHue(hslPlanes, res, deltas[0]);
+	};
+	connect(changeHueAction, &QAction::triggered, this, bind(&DIPSoftware::uiChangeImage, this, changeHue, QSL("ɫ"), vector<InputPreviewDialog::ParameterInfo>{
 		InputPreviewDialog::ParameterInfo([](float d){ return d; }, [](float d){ return d; }, QSL("ɫ"), 0, -180, 180)
 	}));
-	connect(changeGammaAction, &QAction::triggered, this, bind(&DIPSoftware::uiChangeImage, this, &Utils::changePartialImageMatGamma, QSL("GammaУ"), vector<InputPreviewDialog::ParameterInfo>{
+	auto quickHueSaturation = [](const Mat& mat, Mat& res, const vector<float>& deltas) {
+		(ColorMatrix::saturation(1 + deltas[1]) * ColorMatrix::hueRotation(deltas[0])).apply(mat, res);
+	};
+	connect(quickHueSaturationAction, &QAction::triggered, this, bind(&DIPSoftware::uiChangeImage, this, quickHueSaturation, QSL("ɫ/Ͷ"), vector<InputPreviewDialog::ParameterInfo>{
+		InputPreviewDialog::ParameterInfo([](float d){ return d; }, [](float d){ return d; }, QSL("ɫ"), 0, -180, 180),
+		InputPreviewDialog::ParameterInfo([](float d){ return d / 100; }, [](float d){ return 100 * d; }, QSL("Ͷȣ"), 0, -100, 100)
+	}));
+	connect(changeGammaAction, &QAction::triggered, this, bind(&DIPSoftware::uiPointOperation, this, &Utils::changePartialImageMatGamma, &Utils::gammaTable, QSL("GammaУ"), vector<InputPreviewDialog::ParameterInfo>{
 		InputPreviewDialog::ParameterInfo([](float d){ return pow(10, d / 1000); }, [](float d){ return 1000 * log10(d); }, QSL("ã"), 0, -1400, 1400),
 			InputPreviewDialog::ParameterInfo([](float d){ return pow(10, d / 100); }, [](float d){ return 100 * log10(d); }, QSL("c"), 0, -100, 100)
 	}));
-	connect(changeLogAction, &QAction::triggered, this, bind(&DIPSoftware::uiChangeImage, this, &Utils::changePartialImageMatLog, QSL("任"), vector<InputPreviewDialog::ParameterInfo>{
+	connect(changeLogAction, &QAction::triggered, this, bind(&DIPSoftware::uiPointOperation, this, &Utils::changePartialImageMatLog, &Utils::logTable, QSL("任"), vector<InputPreviewDialog::ParameterInfo>{
 		InputPreviewDialog::ParameterInfo([](float d){ return d / 100; }, [](float d){ return d * 100; }, QSL("a"), 0, -100, 100),
 		InputPreviewDialog::ParameterInfo([](float d){ return pow(10, d / 100); }, [](float d){ return 100 * log10(d); }, QSL("b"), 0, -100, 100),
 		InputPreviewDialog::ParameterInfo([](float d){ return d / 100; }, [](float d){ return 100 * d; }, QSL("c"), 200, 105, 1000)
 	}));
-	connect(changePowAction, &QAction::triggered, this, bind(&DIPSoftware::uiChangeImage, this, &Utils::changePartialImageMatPow, QSL("ָ任"), vector<InputPreviewDialog::ParameterInfo>{
+	connect(changePowAction, &QAction::triggered, this, bind(&DIPSoftware::uiPointOperation, this, &Utils::changePartialImageMatPow, &Utils::powTable, QSL("ָ任"), vector<InputPreviewDialog::ParameterInfo>{
 		InputPreviewDialog::ParameterInfo([](float d){ return d / 100; }, [](float d){ return d * 100; }, QSL("a"), 0, -100, 100),
 		InputPreviewDialog::ParameterInfo([](float d){ return d / 100; }, [](float d){ return 100 * d; }, QSL("b"), 230, 101, 1000),
 		InputPreviewDialog::ParameterInfo([](float d){ return pow(10, d / 100); }, [](float d){ return 100 * log10(d); }, QSL("c"), 0, -100, 100)
@@ -182,6 +245,8 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	connect(histEquAction, &QAction::triggered, this, &DIPSoftware::histEquImage);
 	connect(histSpecSMLAction, &QAction::triggered, this, &DIPSoftware::histSpecSMLImage);
 	connect(histSpecGMLAction, &QAction::triggered, this, &DIPSoftware::histSpecGMLImage);
+	connect(histSpecExactAction, &QAction::triggered, this, &DIPSoftware::histSpecExactImage);
+	connect(histSpecUniformAction, &QAction::triggered, this, &DIPSoftware::histSpecUniformImage);
 	connect(medianFilterAction, &QAction::triggered, this, &DIPSoftware::medianFilterImage);
 	connect(gaussianFilterAction, &QAction::triggered, this, &DIPSoftware::gaussianFilterImage);
 	connect(sharpenRobertFilterAction, &QAction::triggered, this, bind(&DIPSoftware::sharpenImage, this, 0));
@@ -197,6 +262,9 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	connect(butterWorthHighPassAction, &QAction::triggered, this, bind(&DIPSoftware::highPassFilteringImage, this, 1));
 	connect(gaussHighPassAction, &QAction::triggered, this, bind(&DIPSoftware::highPassFilteringImage, this, 2));
 	connect(laplaceHighPassAction, &QAction::triggered, this, bind(&DIPSoftware::highPassFilteringImage, this, 3));
+	connect(recordTraceAction, &QAction::toggled, this, &Trace::setEnabled);
+	connect(exportTraceAction, &QAction::triggered, this, &DIPSoftware::exportTrace);
+	connect(memoryPanelAction, &QAction::triggered, this, &DIPSoftware::showMemoryPanel);
 
 	//diagramWidget->setFixedSize(400, 300);
 	histogramWidget->setFixedSize(400, 300);
@@ -204,39 +272,218 @@ DIPSoftware::DIPSoftware(QWidget *parent) : QMainWindow(parent) {
 	//mainLayout->addWidget(diagramWidget, 0, Qt::AlignTop);
 	mainLayout->addWidget(histogramWidget, 0, Qt::AlignTop);
 
+	saveProgressBar = new QProgressBar(this);
+	saveProgressBar->setRange(0, 100);
+	saveProgressBar->setMaximumWidth(200);
+	saveProgressBar->hide();
+	ui.statusBar->addPermanentWidget(saveProgressBar);
+	// Emitted from the encoder threads, so both arrive queued.
+	connect(this, &DIPSoftware::saveProgress, saveProgressBar, &QProgressBar::setValue);
+	connect(this, &DIPSoftware::saveFinished, this, [this](const QString &fileName, bool ok) {
+		if (!--activeSaves) {
+			saveProgressBar->hide();
+		}
+		ui.statusBar->showMessage(ok ? QSL("ѱ %1").arg(fileName) : QSL("ʧܣ%1").arg(fileName), 5000);
+	});
+
+	QTimer *poolTrimTimer = new QTimer(this);
+	connect(poolTrimTimer, &QTimer::timeout, this, []() { BufferPool::instance().trim(30.0); });
+	poolTrimTimer->start(10000);
+
 	setActionsEnabled(false);
 	centerWidget->setLayout(mainLayout);
 	setCentralWidget(centerWidget);
 }
 
 DIPSoftware::~DIPSoftware() {
-
+	closeSession();
+	if (pendingImage.valid()) {
+		pendingImage.wait();
+	}
+	for (auto &save : pendingSaves) {
+		save.wait();
+	}
 }
 
 void DIPSoftware::setOriginMat() {
 	originMat = imgWidget->imgMat;
 }
 
+// Repeating an edit on an image seen before, e.g. redoing it by hand after an
+// undo, is answered from the ResultCache.
+Mat DIPSoftware::cachedEdit(const string& op, const function<Mat(const Mat&)>& compute) {
+	return ResultCache::instance().apply(*imgWidget->imgMat, op, compute);
+}
+
 void DIPSoftware::openFile() {
-	QString inputFileName = QFileDialog::getOpenFileName(this, QSL("ļ"), " ", QSL("ͼļ(*.bmp;*.png;*.jpg;*.jpeg)"));
+	QString inputFileName = QFileDialog::getOpenFileName(this, QSL("ļ"), " ", QSL("ͼļ(*.bmp;*.png;*.jpg;*.jpeg;*.dipraw;*.dipsession)"));
 	if (!inputFileName.size()) {
 		return;
 	}
-	currentFileName = String((const char *) inputFileName.toLocal8Bit());
-	Mat imageMat = imread(currentFileName);
+	finishOpen();
+	String fileName = String((const char *) inputFileName.toLocal8Bit());
+	if (SessionFile::isSessionFile(fileName)) {
+		openSession(fileName);
+		return;
+	}
+	closeSession();
+	currentFileName = fileName;
+
+	QString extension = QtUtils::getExtension(currentFileName).toLower();
+	if ((extension == QSL("jpg") || extension == QSL("jpeg")) && QFileInfo(inputFileName).size() >= PROXY_MIN_FILE_SIZE) {
+		Mat proxy = Utils::readImageMatReduced(currentFileName, PROXY_SCALE);
+		if (!proxy.empty()) {
+			imgWidget->setProxyMat(proxy, PROXY_SCALE);
+			histogramWidget->setImageMat(proxy);
+			setActionsEnabled(true);
+
+			int generation = ++openGeneration;
+			String fileName = currentFileName;
+			pendingImage = async(launch::async, [this, fileName, generation]() {
+				Mat res = Utils::readImageMat(fileName);
+				emit imageDecoded(generation);
+				return res;
+			}).share();
+			return;
+		}
+	}
+
+	Mat imageMat = Utils::readImageMat(currentFileName);
 	imgWidget->setImageMat(imageMat);
 	histogramWidget->setImageMat(imageMat);
 	setActionsEnabled(true);
 }
 
+// Swaps the full decode in for the proxy, waiting for it if it is still
+// running.
+void DIPSoftware::finishOpen() {
+	if (!pendingImage.valid()) {
+		return;
+	}
+	Mat imageMat = pendingImage.get();
+	pendingImage = shared_future<Mat>();
+	if (imageMat.empty()) {
+		ui.statusBar->showMessage(QSL("޷ %1").arg(QString::fromLocal8Bit(currentFileName.c_str())), 5000);
+		setActionsEnabled(false);
+		return;
+	}
+	imgWidget->setImageMat(imageMat);
+	histogramWidget->setImageMat(imageMat);
+}
+
 void DIPSoftware::saveFile() {
-	imwrite(currentFileName, *(imgWidget->imgMat));
+	saveImage(currentFileName);
 }
 
 void DIPSoftware::saveAsFile() {
-	QString inputFileName = QFileDialog::getSaveFileName(this, QSL("Ϊ"), "", QSL("λͼļ(*.bmp);;PNGļ(*.png);;JPEGļ(*.jpg;*.jpeg)"));
+	QString inputFileName = QFileDialog::getSaveFileName(this, QSL("Ϊ"), "", QSL("λͼļ(*.bmp);;PNGļ(*.png);;JPEGļ(*.jpg;*.jpeg);;DIPԭʼļ(*.dipraw)"));
+	if (!inputFileName.size()) {
+		return;
+	}
 	currentFileName = String((const char *) inputFileName.toLocal8Bit());
-	imwrite(currentFileName, *(imgWidget->imgMat));
+	saveImage(currentFileName);
+}
+
+// Encodes a snapshot on a worker thread, so editing can go on meanwhile
+// without changing what is written.
+void DIPSoftware::saveImage(const String &fileName) {
+	pendingSaves.remove_if([](const future<void> &save) { return save.wait_for(chrono::seconds(0)) == future_status::ready; });
+
+	Mat snapshot;
+	{
+		MEMORY_TAG("save snapshot");
+		snapshot = imgWidget->imgMat->clone();
+	}
+	QString displayName = QString::fromLocal8Bit(fileName.c_str());
+	++activeSaves;
+	saveProgressBar->setValue(0);
+	saveProgressBar->show();
+	pendingSaves.push_back(async(launch::async, [this, fileName, snapshot, displayName]() {
+		bool ok = ImageWriter::write(fileName, snapshot, [this](double fraction) { emit saveProgress((int) (fraction * 100)); });
+		emit saveFinished(displayName, ok);
+	}));
+}
+
+// Writes the history so far and keeps appending to the file as edits, undo
+// and redo happen, until another file is opened.
+void DIPSoftware::saveSession() {
+	QString outputFileName = QFileDialog::getSaveFileName(this, QSL("Ự"), "", QSL("DIPỰļ(*.dipsession)"));
+	if (!outputFileName.size()) {
+		return;
+	}
+	finishOpen();
+	closeSession();
+	sessionWriter.reset(new SessionWriter(String((const char *) outputFileName.toLocal8Bit())));
+	if (!sessionWriter->isOpen()) {
+		sessionWriter.reset();
+		ui.statusBar->showMessage(QSL("ʧܣ%1").arg(outputFileName), 5000);
+		return;
+	}
+	sessionWriter->setSource(currentFileName);
+	sessionWriter->append(0, Mat(), undoStack->count() ? static_cast<const EditImageCommand*>(undoStack->command(0))->origin() : *imgWidget->imgMat);
+	for (int i = 0; i < undoStack->count(); ++i) {
+		auto command = static_cast<const EditImageCommand*>(undoStack->command(i));
+		sessionWriter->append(i + 1, command->origin(), command->result());
+		sessionCommands.push_back(command);
+	}
+	sessionWriter->setCurrent(undoStack->index());
+}
+
+// Rebuilds the undo stack over the mapped session without touching any image
+// but the current one; the other states load when undo or redo reaches them.
+void DIPSoftware::openSession(const String &fileName) {
+	auto reader = SessionReader::open(fileName);
+	if (!reader) {
+		ui.statusBar->showMessage(QSL("޷ %1").arg(QString::fromLocal8Bit(fileName.c_str())), 5000);
+		return;
+	}
+	closeSession();
+	undoStack->clear();
+	for (int i = 1; i < reader->count(); ++i) {
+		undoStack->push(new EditImageCommand(imgWidget, histogramWidget, [reader, i]() { return reader->state(i - 1); }, [reader, i]() { return reader->state(i); }));
+		sessionCommands.push_back(undoStack->command(i - 1));
+	}
+	if (undoStack->index() != reader->current()) {
+		undoStack->setIndex(reader->current());
+	} else {
+		Mat imageMat = reader->state(reader->current());
+		imgWidget->setImageMat(imageMat);
+		histogramWidget->setImageMat(imageMat);
+	}
+	currentFileName = reader->source();
+	if (reader->isRepaired()) {
+		sessionWriter.reset(new SessionWriter(fileName, reader->end()));
+	}
+	if (!sessionWriter || !sessionWriter->isOpen()) {
+		sessionWriter.reset();
+		sessionCommands.clear();
+		ui.statusBar->showMessage(QSL("Ựֻ޷д %1").arg(QString::fromLocal8Bit(fileName.c_str())), 5000);
+	}
+	setActionsEnabled(true);
+}
+
+void DIPSoftware::closeSession() {
+	if (sessionWriter && !sessionWriter->flush()) {
+		ui.statusBar->showMessage(QSL("ʧܣ%1").arg(QString::fromLocal8Bit(sessionWriter->fileName().c_str())), 5000);
+	}
+	sessionWriter.reset();
+	sessionCommands.clear();
+}
+
+// A new command at index - 1 is a new edit, anything else is undo or redo.
+void DIPSoftware::recordSession(int index) {
+	if (!sessionWriter) {
+		return;
+	}
+	const QUndoCommand *command = index ? undoStack->command(index - 1) : nullptr;
+	if (command && ((int) sessionCommands.size() < index || sessionCommands[index - 1] != command)) {
+		sessionCommands.resize(index - 1);
+		sessionCommands.push_back(command);
+		auto editCommand = static_cast<const EditImageCommand*>(command);
+		sessionWriter->append(index, editCommand->origin(), editCommand->result());
+	} else {
+		sessionWriter->setCurrent(index);
+	}
 }
 
 void DIPSoftware::cropImage() {
@@ -247,7 +494,8 @@ void DIPSoftware::cropImage() {
 }
 
 void DIPSoftware::rotateImage(float theta) {
-	undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, Utils::rotateImageMat(*(imgWidget->imgMat), theta)));
+	Mat image = cachedEdit(ResultCache::opKey("rotate", { theta }), [=](const Mat& mat) { return Utils::rotateImageMat(mat, theta); });
+	undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
 }
 
 void DIPSoftware::rotateImageAnyAngle() {
@@ -259,49 +507,56 @@ void DIPSoftware::rotateImageAnyAngle() {
 }
 
 void DIPSoftware::horizontalFlipImage() {
-	Mat image = Mat(imgWidget->imgMat->rows, imgWidget->imgMat->cols, CV_8UC3);
-	rep(j, image.cols) {
-		imgWidget->imgMat->col(image.cols - j - 1).copyTo(image.col(j));
-	}
+	Mat image = cachedEdit("flip:1", [](const Mat& mat) { return Utils::flipImageMat(mat, 1); });
 
 	undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
 }
 
 void DIPSoftware::verticalFlipImage() {
-	Mat image = Mat(imgWidget->imgMat->rows, imgWidget->imgMat->cols, CV_8UC3);
-	rep(i, image.rows) {
-		imgWidget->imgMat->row(image.rows - i - 1).copyTo(image.row(i));
-	}
+	Mat image = cachedEdit("flip:0", [](const Mat& mat) { return Utils::flipImageMat(mat, 0); });
 
 	undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
 }
 
-void DIPSoftware::changeImage(function<Mat(vector<float>)> lambdaFunc, function<vector<float>(function<Mat(vector<float>)>, bool&)> changeFunc) {
+void DIPSoftware::changeImage(function<Mat(const vector<float>&)> lambdaFunc, function<vector<float>(function<Mat(const vector<float>&)>, bool&)> changeFunc) {
 	setOriginMat();
 
 	bool ok;
 	vector<float> deltas = changeFunc(lambdaFunc, ok);
 	if (!ok) {
 		imgWidget->setImageMat(*originMat);
+		histogramWidget->setImageMat(*originMat);
 	} else if (deltas.size()) {
 		undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *originMat, lambdaFunc(deltas)));
 	} else {
 		undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *originMat, *imgWidget->imgMat));
 	}
+	hslPlanes = Utils::HSLPlanes();
 }
 
 void DIPSoftware::uiChangeImage(Utils::changeFuncType changeFunc, const QString &title, const vector<InputPreviewDialog::ParameterInfo>& infos) {
-	auto lambdaFunc = [=](vector<float> d){ return Utils::changeImageMat(*originMat, d, changeFunc); };
-	changeImage(lambdaFunc, [=](function<Mat(vector<float>)> lambdaFunc, bool& ok){ return InputPreviewDialog::changeFloat(this, imgWidget, lambdaFunc, title, infos, &ok); });
+	auto lambdaFunc = [=](const vector<float>& d){ return Utils::changeImageMat(*originMat, d, changeFunc); };
+	changeImage(lambdaFunc, [=](function<Mat(const vector<float>&)> lambdaFunc, bool& ok){ return InputPreviewDialog::changeFloat(this, imgWidget, lambdaFunc, title, infos, &ok); });
+}
+
+// Point operations also pass their table, so the histogram of every preview
+// is predicted from the one on display instead of counted.
+void DIPSoftware::uiPointOperation(Utils::changeFuncType changeFunc, function<array<uchar, 256>(const vector<float>&)> tableFunc, const QString &title, const vector<InputPreviewDialog::ParameterInfo>& infos) {
+	auto lambdaFunc = [=](const vector<float>& d){
+		histogramWidget->setPreviewTable(tableFunc(d));
+		return Utils::changeImageMat(*originMat, d, changeFunc);
+	};
+	changeImage(lambdaFunc, [=](function<Mat(const vector<float>&)> lambdaFunc, bool& ok){ return InputPreviewDialog::changeFloat(this, imgWidget, lambdaFunc, title, infos, &ok); });
 }
 
 void DIPSoftware::linearConvertImage() {
 	setOriginMat();
 
 	bool ok;
-	list<pair<float, float>> vertices = DiagramPreviewDialog::changeDiagram(this, imgWidget, bind(&Utils::linearConvert, *originMat, placeholders::_1), QSL("ֶԱ任"), &ok);
+	list<pair<float, float>> vertices = DiagramPreviewDialog::changeDiagram(this, imgWidget, [=](const list<pair<float, float>>& v){ histogramWidget->setPreviewTable(Utils::linearConvertTable(v)); return Utils::linearConvert(*originMat, v); }, QSL("ֶԱ任"), &ok);
 	if (!ok) {
 		imgWidget->setImageMat(*originMat);
+		histogramWidget->setImageMat(*originMat);
 	} else if (vertices.size()) {
 		undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *originMat, Utils::linearConvert(*originMat, vertices)));
 	} else {
@@ -310,27 +565,42 @@ void DIPSoftware::linearConvertImage() {
 }
 
 void DIPSoftware::histEquImage() {
-	Mat image = Utils::histogramEqualization(*imgWidget->imgMat);
+	Mat image = cachedEdit("histEqu", [](const Mat& mat) { return Utils::histogramEqualization(mat); });
 	undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
 }
 
 void DIPSoftware::histSpecSMLImage() {
-	QString inputFileName = QFileDialog::getOpenFileName(this, QSL("ļ"), " ", QSL("ͼļ(*.bmp;*.png;*.jpg;*.jpeg)"));
+	QString inputFileName = QFileDialog::getOpenFileName(this, QSL("ļ"), " ", QSL("ͼļ(*.bmp;*.png;*.jpg;*.jpeg;*.dipraw)"));
 	if (!inputFileName.size()) {
 		return;
 	}
-	Mat patternMat = imread(String((const char *) inputFileName.toLocal8Bit()));
-	Mat image = Utils::histogramSpecificationSML(*imgWidget->imgMat, patternMat);
+	Mat patternMat = Utils::readImageMat(String((const char *) inputFileName.toLocal8Bit()));
+	Mat image = cachedEdit(format("histSpecSML:%016llx", (unsigned long long) ResultCache::hashOf(patternMat)), [&](const Mat& mat) { return Utils::histogramSpecificationSML(mat, patternMat); });
 	undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
 }
 
 void DIPSoftware::histSpecGMLImage() {
-	QString inputFileName = QFileDialog::getOpenFileName(this, QSL("ļ"), " ", QSL("ͼļ(*.bmp;*.png;*.jpg;*.jpeg)"));
+	QString inputFileName = QFileDialog::getOpenFileName(this, QSL("ļ"), " ", QSL("ͼļ(*.bmp;*.png;*.jpg;*.jpeg;*.dipraw)"));
+	if (!inputFileName.size()) {
+		return;
+	}
+	Mat patternMat = Utils::readImageMat(String((const char *) inputFileName.toLocal8Bit()));
+	Mat image = cachedEdit(format("histSpecGML:%016llx", (unsigned long long) ResultCache::hashOf(patternMat)), [&](const Mat& mat) { return Utils::histogramSpecificationGML(mat, patternMat); });
+	undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
+}
+
+void DIPSoftware::histSpecExactImage() {
+	QString inputFileName = QFileDialog::getOpenFileName(this, QSL("ļ"), " ", QSL("ͼļ(*.bmp;*.png;*.jpg;*.jpeg;*.dipraw)"));
 	if (!inputFileName.size()) {
 		return;
 	}
-	Mat patternMat = imread(String((const char *) inputFileName.toLocal8Bit()));
-	Mat image = Utils::histogramSpecificationGML(*imgWidget->imgMat, patternMat);
+	Mat patternMat = Utils::readImageMat(String((const char *) inputFileName.toLocal8Bit()));
+	Mat image = cachedEdit(format("histSpecExact:%016llx", (unsigned long long) ResultCache::hashOf(patternMat)), [&](const Mat& mat) { return Utils::histogramSpecificationExact(mat, patternMat); });
+	undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
+}
+
+void DIPSoftware::histSpecUniformImage() {
+	Mat image = cachedEdit("histSpecUniform", [](const Mat& mat) { Mat res; Utils::histogramSpecificationExact(mat, res, Utils::uniformDistribution()); return res; });
 	undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
 }
 
@@ -340,7 +610,7 @@ void DIPSoftware::medianFilterImage() {
 	maxKernel = (maxKernel / 2) * 2 - 1;
 	int size = QInputDialog::getInt(this, QSL("ֵ˲"), QSL("˴С"), 3, 3, maxKernel, 2, &ok);
 	if (ok) {
-		Mat image = Utils::medianFilterImageMat(*imgWidget->imgMat, size);
+		Mat image = cachedEdit(ResultCache::opKey("median", { (float) size }), [=](const Mat& mat) { return Utils::medianFilterImageMat(mat, size); });
 		undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
 	}
 }
@@ -351,13 +621,13 @@ void DIPSoftware::gaussianFilterImage() {
 	maxKernel = (maxKernel / 2) * 2 - 1;
 	int size = QInputDialog::getInt(this, QSL("˹˲"), QSL("˴С"), 3, 3, maxKernel, 2, &ok);
 	if (ok) {
-		Mat image = Utils::gaussianFilterImageMat(*imgWidget->imgMat, size, 1.0);
+		Mat image = cachedEdit(ResultCache::opKey("gaussian", { (float) size, 1.0f }), [=](const Mat& mat) { return Utils::gaussianFilterImageMat(mat, size, 1.0); });
 		undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
 	}
 }
 
 void DIPSoftware::sharpenImage(int type) {
-	Mat image = Utils::sharpenImageMat(*imgWidget->imgMat, type);
+	Mat image = cachedEdit(ResultCache::opKey("sharpen", { (float) type }), [=](const Mat& mat) { return Utils::sharpenImageMat(mat, type); });
 	undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
 }
 
@@ -369,28 +639,28 @@ void DIPSoftware::lowPassFilteringImage(int type) {
 	int a = 64;
 	if (type == 0) {
 		float D0 = QInputDialog::getDouble(this, QSL("ͨ˲"), QSL("ضƵ"), a, 0, a, 1, &ok);
-		if (ok) image = Utils::lowPassFiltering(*imgWidget->imgMat, Utils::idealLowPassFilter(rows, cols, D0));
+		if (ok) image = cachedEdit(ResultCache::opKey("idealLowPassFilter", { D0 }), [&](const Mat& mat) { return Utils::lowPassFiltering(mat, Utils::idealLowPassFilter(rows, cols, D0)); });
 	} else if (type == 1) {
 		vector<float> pars = MultiInputDialog::getFloats(this, QSL("ButterWorthͨ˲"), vector<MultiInputDialog::ParameterInfo>{
 			MultiInputDialog::ParameterInfo{ QSL("ضƵ"), float(a), 0, float(a) },
 			MultiInputDialog::ParameterInfo{ QSL(""), 1.0, 1.0, 100.0 }
 		}, &ok);
-		if (ok) image = Utils::lowPassFiltering(*imgWidget->imgMat, Utils::butterWorthLowPassFilter(rows, cols, pars[0], int(pars[1])));
+		if (ok) image = cachedEdit(ResultCache::opKey("butterWorthLowPassFilter", { pars[0], (float) int(pars[1]) }), [&](const Mat& mat) { return Utils::lowPassFiltering(mat, Utils::butterWorthLowPassFilter(rows, cols, pars[0], int(pars[1]))); });
 	} else if (type == 2) {
 		float D0 = QInputDialog::getDouble(this, QSL("˹ͨ˲"), QSL("ضƵ"), a, 0, a, 1, &ok);
-		if (ok) image = Utils::lowPassFiltering(*imgWidget->imgMat, Utils::gaussLowPassFilter(rows, cols, D0));
+		if (ok) image = cachedEdit(ResultCache::opKey("gaussLowPassFilter", { D0 }), [&](const Mat& mat) { return Utils::lowPassFiltering(mat, Utils::gaussLowPassFilter(rows, cols, D0)); });
 	} else if (type == 3) {
 		vector<float> pars = MultiInputDialog::getFloats(this, QSL("εͨ˲"), vector<MultiInputDialog::ParameterInfo>{
 			MultiInputDialog::ParameterInfo{ QSL("ٽƵ"), float(a) * 0.5f, 0, float(a)},
 			MultiInputDialog::ParameterInfo{ QSL("ضƵ"), float(a), 0, float(a)}
 		}, &ok);
-		if (ok) image = Utils::lowPassFiltering(*imgWidget->imgMat, Utils::trapezoidLowPassFilter(rows, cols, pars[1], pars[0]));
+		if (ok) image = cachedEdit(ResultCache::opKey("trapezoidLowPassFilter", { pars[1], pars[0] }), [&](const Mat& mat) { return Utils::lowPassFiltering(mat, Utils::trapezoidLowPassFilter(rows, cols, pars[1], pars[0])); });
 	} else if (type == 4) {
 		vector<float> pars = MultiInputDialog::getFloats(this, QSL("ָͨ˲"), vector<MultiInputDialog::ParameterInfo>{
 			MultiInputDialog::ParameterInfo{ QSL("ضƵ"), float(a), 0, float(a) },
 			MultiInputDialog::ParameterInfo{ QSL(""), 1.0, 1.0, 100.0 }
 		}, &ok);
-		if (ok) image = Utils::lowPassFiltering(*imgWidget->imgMat, Utils::expLowPassFilter(rows, cols, pars[0], int(pars[1])));
+		if (ok) image = cachedEdit(ResultCache::opKey("expLowPassFilter", { pars[0], (float) int(pars[1]) }), [&](const Mat& mat) { return Utils::lowPassFiltering(mat, Utils::expLowPassFilter(rows, cols, pars[0], int(pars[1]))); });
 	}
 
 	if (ok) undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
@@ -404,23 +674,40 @@ void DIPSoftware::highPassFilteringImage(int type) {
 	int a = 32;
 	if (type == 0) {
 		float D0 = QInputDialog::getDouble(this, QSL("ͨ˲"), QSL("ضƵ"), a, 0, a, 1, &ok);
-		if (ok) image = Utils::highPassFiltering(*imgWidget->imgMat, Utils::idealHighPassFilter(rows, cols, D0));
+		if (ok) image = cachedEdit(ResultCache::opKey("idealHighPassFilter", { D0 }), [&](const Mat& mat) { return Utils::highPassFiltering(mat, Utils::idealHighPassFilter(rows, cols, D0)); });
 	} else if (type == 1) {
 		vector<float> pars = MultiInputDialog::getFloats(this, QSL("ButterWorthͨ˲"), vector<MultiInputDialog::ParameterInfo>{
 			MultiInputDialog::ParameterInfo{ QSL("ضƵ"), float(a), 0, float(a) },
 			MultiInputDialog::ParameterInfo{ QSL(""), 1.0, 1.0, 100.0 }
 		}, &ok);
-		if (ok) image = Utils::highPassFiltering(*imgWidget->imgMat, Utils::butterWorthHighPassFilter(rows, cols, pars[0], int(pars[1])));
+		if (ok) image = cachedEdit(ResultCache::opKey("butterWorthHighPassFilter", { pars[0], (float) int(pars[1]) }), [&](const Mat& mat) { return Utils::highPassFiltering(mat, Utils::butterWorthHighPassFilter(rows, cols, pars[0], int(pars[1]))); });
 	} else if (type == 2) {
 		float D0 = QInputDialog::getDouble(this, QSL("˹ͨ˲"), QSL("ضƵ"), a, 0, a, 1, &ok);
-		if (ok) image = Utils::highPassFiltering(*imgWidget->imgMat, Utils::gaussHighPassFilter(rows, cols, D0));
+		if (ok) image = cachedEdit(ResultCache::opKey("gaussHighPassFilter", { D0 }), [&](const Mat& mat) { return Utils::highPassFiltering(mat, Utils::gaussHighPassFilter(rows, cols, D0)); });
 	} else if (type == 3) {
-		image = Utils::highPassFiltering(*imgWidget->imgMat, Utils::laplaceHighPassFilter(rows, cols));
+		image = cachedEdit("laplaceHighPassFilter", [&](const Mat& mat) { return Utils::highPassFiltering(mat, Utils::laplaceHighPassFilter(rows, cols)); });
 	}
 
 	if (ok) undoStack->push(new EditImageCommand(imgWidget, histogramWidget, *imgWidget->imgMat, image));
 }
 
+void DIPSoftware::exportTrace() {
+	QString outputFileName = QFileDialog::getSaveFileName(this, QSL("ܸ"), "", QSL("Chrome Traceļ(*.json)"));
+	if (!outputFileName.size()) {
+		return;
+	}
+	bool ok = Trace::dumpChromeTrace(String((const char *) outputFileName.toLocal8Bit()));
+	ui.statusBar->showMessage(ok ? QSL("ѱ %1").arg(outputFileName) : QSL("ʧܣ%1").arg(outputFileName), 5000);
+}
+
+void DIPSoftware::showMemoryPanel() {
+	if (!memoryPanel) {
+		memoryPanel = new MemoryPanelDialog(this);
+	}
+	memoryPanel->show();
+	memoryPanel->raise();
+}
+
 void DIPSoftware::setActionsEnabled(bool enabled) {
 	for (const auto& action : *actionObservers) {
 		action->setEnabled(enabled);
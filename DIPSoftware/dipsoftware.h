@@ -7,14 +7,19 @@
 #include "HistogramWidget.h"
 #include "ImgWidget.h"
 #include "InputPreviewDialog.h"
-#include "Utils.h"
+#include "MemoryPanelDialog.h"
+#include "QtUtils.h"
+#include "SessionFile.h"
 
 #include <QAction>
 #include <QHBoxLayout>
+#include <QProgressBar>
 #include <QScrollArea>
 #include <QUndoStack>
 
 #include <functional>
+#include <future>
+#include <list>
 #include <memory>
 #include <vector>
 
@@ -25,29 +30,47 @@ public:
 	DIPSoftware(QWidget *parent = 0);
 	~DIPSoftware();
 
+signals:
+	void saveProgress(int percent);
+	void saveFinished(const QString &fileName, bool ok);
+	void imageDecoded(int generation);
+
 private:
 	void setOriginMat();
+	cv::Mat cachedEdit(const std::string& op, const std::function<cv::Mat(const cv::Mat&)>& compute);
 
 	void openFile();
+	void finishOpen();
 	void saveFile();
 	void saveAsFile();
+	void saveImage(const cv::String &fileName);
+	void saveSession();
+	void openSession(const cv::String &fileName);
+	void closeSession();
+	void recordSession(int index);
 	void cropImage();
 	void rotateImage(float theta);
 	void rotateImageAnyAngle();
 	void horizontalFlipImage();
 	void verticalFlipImage();
-	void changeImage(std::function<cv::Mat(std::vector<float>)> lambdaFunc, std::function<std::vector<float>(std::function<cv::Mat(std::vector<float>)>, bool&)> changeFunc);
+	void changeImage(std::function<cv::Mat(const std::vector<float>&)> lambdaFunc, std::function<std::vector<float>(std::function<cv::Mat(const std::vector<float>&)>, bool&)> changeFunc);
 	void uiChangeImage(Utils::changeFuncType changeFunc, const QString &title, const std::vector<InputPreviewDialog::ParameterInfo> &infos);
+	void uiPointOperation(Utils::changeFuncType changeFunc, std::function<std::array<uchar, 256>(const std::vector<float>&)> tableFunc, const QString &title, const std::vector<InputPreviewDialog::ParameterInfo> &infos);
 	void linearConvertImage();
 	void histEquImage();
 	void histSpecSMLImage();
 	void histSpecGMLImage();
+	void histSpecExactImage();
+	void histSpecUniformImage();
 	void medianFilterImage();
 	void gaussianFilterImage();
 	void sharpenImage(int type);
 	void lowPassFilteringImage(int type);
 	void highPassFilteringImage(int type);
 
+	void exportTrace();
+	void showMemoryPanel();
+
 	void setActionsEnabled(bool enabled);
 
 private:
@@ -58,6 +81,7 @@ private:
 	QAction *openFileAction;
 	QAction *saveFileAction;
 	QAction *saveAsFileAction;
+	QAction *saveSessionAction;
 
 	QAction *undoAction;
 	QAction *redoAction;
@@ -73,6 +97,7 @@ private:
 	QAction *changeLightnessAction;
 	QAction *changeSaturationAction;
 	QAction *changeHueAction;
+	QAction *quickHueSaturationAction;
 
 	QAction *linearConvertAction;
 	QAction *changeGammaAction;
@@ -82,6 +107,8 @@ private:
 	QAction *histEquAction;
 	QAction *histSpecSMLAction;
 	QAction *histSpecGMLAction;
+	QAction *histSpecExactAction;
+	QAction *histSpecUniformAction;
 
 	QAction *medianFilterAction;
 	QAction *gaussianFilterAction;
@@ -101,6 +128,10 @@ private:
 	QAction *gaussHighPassAction;
 	QAction *laplaceHighPassAction;
 
+	QAction *recordTraceAction;
+	QAction *exportTraceAction;
+	QAction *memoryPanelAction;
+
 	std::shared_ptr<std::vector<QAction*>> actionObservers;
 
 	QUndoStack *undoStack;
@@ -111,7 +142,17 @@ private:
 	DiagramWidget *diagramWidget;
 	HistogramWidget *histogramWidget;
 	ImgWidget *imgWidget;
+	MemoryPanelDialog *memoryPanel;
+	QProgressBar *saveProgressBar;
+	std::list<std::future<void>> pendingSaves;
+	int activeSaves;
+	std::shared_future<cv::Mat> pendingImage;
+	int openGeneration;
 	std::shared_ptr<cv::Mat> originMat;
+	// Kept while a hue dialog previews originMat.
+	Utils::HSLPlanes hslPlanes;
+	std::unique_ptr<SessionWriter> sessionWriter;
+	std::vector<const QUndoCommand*> sessionCommands;
 };
 
 // DIPSOFTWARE_H
\ No newline at end of file
@@ -1,7 +1,24 @@
+#include "AutoTune.h"
+#include "BufferPool.h"
+#include "CommandLine.h"
+#include "CpuDispatch.h"
 #include "dipsoftware.h"
+#include "MemoryTracker.h"
+#include "ResultCache.h"
+#include "Trace.h"
 #include <QtWidgets/QApplication>
 
 int main(int argc, char *argv[]) {
+	Trace::initFromEnvironment();
+	BufferPool::install();
+	MemoryTracker::initFromEnvironment();
+	CpuDispatch::initFromEnvironment();
+	AutoTune::initFromEnvironment();
+	ResultCache::initFromEnvironment();
+	if (CommandLine::isCommandLine(argc, argv)) {
+		return CommandLine::run(argc, argv);
+	}
+	AutoTune::calibrateIfUntuned();
 	QApplication a(argc, argv);
 	DIPSoftware w;
 	w.show();